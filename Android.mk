@@ -12,6 +12,8 @@ LOCAL_SRC_FILES := \
     gpkg/gpkg_db.c \
     gpkg/gpkg_geom.c \
     gpkg/i18n.c \
+    gpkg/knn.c \
+    gpkg/rtree.c \
     gpkg/spatialdb.c \
     gpkg/spl_db.c \
     gpkg/spl_geom.c \
@@ -19,6 +19,10 @@ static inline long atomic_dec_long(volatile long *value) {
   return InterlockedDecrement(value);
 }
 
+static inline long atomic_get_long(volatile long *value) {
+  return InterlockedCompareExchange(value, 0, 0);
+}
+
 #elif defined(__MACH__) || defined(__APPLE__)
 
 #include <libkern/OSAtomic.h>
@@ -32,6 +36,10 @@ static inline long atomic_inc_long(volatile long *value) {
 static inline long atomic_dec_long(volatile long *value) {
   return OSAtomicDecrement32((volatile int32_t *)value);
 }
+
+static inline long atomic_get_long(volatile long *value) {
+  return OSAtomicAdd32(0, (volatile int32_t *)value);
+}
 #elif ULONG_MAX == 0xffffffffffffffff
 static inline long atomic_inc_long(volatile long *value) {
   return OSAtomicIncrement64((volatile int64_t *)value);
@@ -40,6 +48,10 @@ static inline long atomic_inc_long(volatile long *value) {
 static inline long atomic_dec_long(volatile long *value) {
   return OSAtomicDecrement64((volatile int64_t *)value);
 }
+
+static inline long atomic_get_long(volatile long *value) {
+  return OSAtomicAdd64(0, (volatile int64_t *)value);
+}
 #else
 
 #error "Unsupported long size"
@@ -56,6 +68,14 @@ static inline long atomic_dec_long(volatile long *value) {
   return __sync_sub_and_fetch(value, 1);
 }
 
+static inline long atomic_get_long(volatile long *value) {
+#ifdef __ATOMIC_RELAXED
+  return __atomic_load_n(value, __ATOMIC_RELAXED);
+#else
+  return __sync_add_and_fetch(value, 0);
+#endif
+}
+
 #elif defined(__sun)
 
 #include <atomic.h>
@@ -68,6 +88,10 @@ static inline long atomic_dec_long(volatile long *value) {
   return (long)atomic_dec_ulong_nv((volatile ulong_t *)value);
 }
 
+static inline long atomic_get_long(volatile long *value) {
+  return (long)atomic_add_long_nv((volatile ulong_t *)value, 0);
+}
+
 #else
 
 #error "Atomic operations not supported"
@@ -82,6 +106,10 @@ static inline long atomic_dec_long(volatile long *value) {
   return *value;
 }
 
+static inline long atomic_get_long(volatile long *value) {
+  return *value;
+}
+
 #endif
 
 #endif
@@ -19,6 +19,16 @@
 #include "fp.h"
 #include "sqlite.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BINSTREAM_BSWAP_SSE2 1
+#include <emmintrin.h>
+#endif
+
+static binstream_endianness binstream_host_endianness() {
+  const uint16_t probe = 1;
+  return *((const uint8_t *) &probe) == 1 ? LITTLE : BIG;
+}
+
 int binstream_init(binstream_t *stream, uint8_t *data, size_t length) {
   stream->data = data;
   stream->limit = length;
@@ -183,7 +193,7 @@ int binstream_write_nu8(binstream_t *stream, const uint8_t *val, size_t count) {
   return SQLITE_OK;
 }
 
-int binstream_read_u32(binstream_t *stream, uint32_t *out) {
+int binstream_read_u32_generic(binstream_t *stream, uint32_t *out) {
   int result = binstream_ensureavailable(stream, stream->position + 4);
   if (result != SQLITE_OK) {
     return result;
@@ -226,7 +236,7 @@ int binstream_write_u32(binstream_t *stream, uint32_t val) {
   return SQLITE_OK;
 }
 
-int binstream_read_i32(binstream_t *stream, int32_t *out) {
+int binstream_read_i32_generic(binstream_t *stream, int32_t *out) {
   int result = binstream_ensureavailable(stream, stream->position + 4);
   if (result != SQLITE_OK) {
     return result;
@@ -269,12 +279,7 @@ int binstream_write_i32(binstream_t *stream, int32_t val) {
   return SQLITE_OK;
 }
 
-int binstream_read_u64(binstream_t *stream, uint64_t *out) {
-  int result = binstream_ensureavailable(stream, stream->position + 8);
-  if (result != SQLITE_OK) {
-    return result;
-  }
-
+static uint64_t binstream_read_u64_unchecked(binstream_t *stream) {
   uint64_t v1 = stream->data[stream->position++];
   uint64_t v2 = stream->data[stream->position++];
   uint64_t v3 = stream->data[stream->position++];
@@ -284,10 +289,19 @@ int binstream_read_u64(binstream_t *stream, uint64_t *out) {
   uint64_t v7 = stream->data[stream->position++];
   uint64_t v8 = stream->data[stream->position++];
   if (stream->end == LITTLE) {
-    *out = (v1 << 0) | (v2 << 8) | (v3 << 16) | (v4 << 24) | (v5 << 32) | (v6 << 40) | (v7 << 48) | (v8 << 56);
+    return (v1 << 0) | (v2 << 8) | (v3 << 16) | (v4 << 24) | (v5 << 32) | (v6 << 40) | (v7 << 48) | (v8 << 56);
   } else {
-    *out = (v8 << 0) | (v7 << 8) | (v6 << 16) | (v5 << 24) | (v4 << 32) | (v3 << 40) | (v2 << 48) | (v1 << 56);
+    return (v8 << 0) | (v7 << 8) | (v6 << 16) | (v5 << 24) | (v4 << 32) | (v3 << 40) | (v2 << 48) | (v1 << 56);
+  }
+}
+
+int binstream_read_u64(binstream_t *stream, uint64_t *out) {
+  int result = binstream_ensureavailable(stream, stream->position + 8);
+  if (result != SQLITE_OK) {
+    return result;
   }
+
+  *out = binstream_read_u64_unchecked(stream);
   return SQLITE_OK;
 }
 
@@ -331,7 +345,7 @@ int binstream_write_u64(binstream_t *stream, uint64_t val) {
   return SQLITE_OK;
 }
 
-int binstream_read_double(binstream_t *stream, double *out) {
+int binstream_read_double_generic(binstream_t *stream, double *out) {
   union {
     uint64_t L;
     double D;
@@ -345,6 +359,67 @@ int binstream_read_double(binstream_t *stream, double *out) {
   return SQLITE_OK;
 }
 
+/*
+ * Copies count 64-bit values from src to dst, reversing the byte order of each value. With SSE2 two values are
+ * swapped per iteration: first the bytes within each 16-bit word, then the order of the words within each value.
+ */
+static void binstream_bswap64_copy(uint8_t *dst, const uint8_t *src, size_t count) {
+  size_t i = 0;
+#if BINSTREAM_BSWAP_SSE2
+  for (; i + 2 <= count; i += 2) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (src + i * 8));
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    _mm_storeu_si128((__m128i *) (dst + i * 8), v);
+  }
+#endif
+  for (; i < count; i++) {
+    const uint8_t *s = src + i * 8;
+    uint8_t *d = dst + i * 8;
+    d[0] = s[7];
+    d[1] = s[6];
+    d[2] = s[5];
+    d[3] = s[4];
+    d[4] = s[3];
+    d[5] = s[2];
+    d[6] = s[1];
+    d[7] = s[0];
+  }
+}
+
+int binstream_nread_double_generic(binstream_t *stream, double *out, size_t count) {
+  if (count > binstream_available(stream) / sizeof(double)) {
+    return SQLITE_IOERR;
+  }
+
+  if (stream->end == binstream_host_endianness()) {
+    memcpy(out, stream->data + stream->position, count * sizeof(double));
+  } else {
+    binstream_bswap64_copy((uint8_t *) out, stream->data + stream->position, count);
+  }
+  stream->position += count * sizeof(double);
+
+  return SQLITE_OK;
+}
+
+int binstream_map_ndouble(binstream_t *stream, const double **out, size_t count) {
+  if (count > binstream_available(stream) / sizeof(double)) {
+    *out = NULL;
+    return SQLITE_IOERR;
+  }
+
+  uint8_t *data = stream->data + stream->position;
+  if (stream->end != binstream_host_endianness() || ((uintptr_t) data) % sizeof(double) != 0) {
+    *out = NULL;
+    return SQLITE_OK;
+  }
+
+  *out = (const double *) data;
+  stream->position += count * sizeof(double);
+  return SQLITE_OK;
+}
+
 int binstream_write_double(binstream_t *stream, double val) {
   return binstream_write_u64(stream, fp_double_to_uint64(val));
 }
@@ -18,6 +18,8 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+#include "sqlite.h"
 
 /**
  * @addtogroup binstream Binary I/O
@@ -223,7 +225,7 @@ int binstream_write_nu8(binstream_t *stream, const uint8_t *val, size_t count);
  * @return SQLITE_OK if the value was read successfully
  *         SQLITE_IOERR if insufficient data is available in the stream
  */
-int binstream_read_u32(binstream_t *stream, uint32_t *out);
+static inline int binstream_read_u32(binstream_t *stream, uint32_t *out);
 
 /**
  * Writes a single unsigned 32-bit value to the stream. The position of the stream is advanced by 4.
@@ -243,7 +245,7 @@ int binstream_write_u32(binstream_t *stream, uint32_t val);
  * @return SQLITE_OK if the value was read successfully
  *         SQLITE_IOERR if insufficient data is available in the stream
  */
-int binstream_read_i32(binstream_t *stream, int32_t *out);
+static inline int binstream_read_i32(binstream_t *stream, int32_t *out);
 
 /**
  * Writes a single signed 32-bit value to the stream. The position of the stream is advanced by 4.
@@ -283,7 +285,41 @@ int binstream_write_u64(binstream_t *stream, uint64_t val);
  * @return SQLITE_OK if the value was read successfully
  *         SQLITE_IOERR if insufficient data is available in the stream
  */
-int binstream_read_double(binstream_t *stream, double *out);
+static inline int binstream_read_double(binstream_t *stream, double *out);
+
+/**
+ * Reads count double-precision floating point values from the stream. The position of the stream is advanced by
+ * (8 * count). The availability of the data is checked once for the entire sequence. If the endianness of the stream
+ * matches that of the host the values are copied in bulk; otherwise the values are copied and byte swapped in bulk.
+ *
+ * @param stream a stream
+ * @param[out] out a memory area of at least count doubles to write the read values to.
+ * @param count the number of values to read
+ * @return SQLITE_OK if the values were read successfully
+ *         SQLITE_IOERR if insufficient data is available in the stream
+ */
+static inline int binstream_nread_double(binstream_t *stream, double *out, size_t count);
+
+/**
+ * Obtains a pointer to count double-precision floating point values directly in the data buffer of the stream,
+ * without copying them. This is only possible if the endianness of the stream matches that of the host and the
+ * data at the current position is suitably aligned for double access. If that is the case the position of the
+ * stream is advanced by (8 * count) and out is set to point into the stream's buffer. Otherwise out is set to NULL,
+ * the position of the stream is left unchanged and binstream_nread_double() should be used instead.
+ *
+ * The returned pointer is only valid for as long as the data buffer of the stream is.
+ *
+ * Note that mapping will rarely succeed for coordinates inside geometry blobs. WKB puts a 1 byte byte order marker
+ * in front of each type code and count, so point sequences are normally not 8-byte aligned, neither inside the
+ * blob nor relative to the start of the SQLite value. In that case the values have to be copied anyway.
+ *
+ * @param stream a stream
+ * @param[out] out the location to store the pointer to the values in, or NULL if the values cannot be mapped
+ * @param count the number of values to map
+ * @return SQLITE_OK if the values were mapped or if mapping is not possible
+ *         SQLITE_IOERR if insufficient data is available in the stream
+ */
+int binstream_map_ndouble(binstream_t *stream, const double **out, size_t count);
 
 /**
  * Writes a single double-precision floating point value to the stream. The position of the stream is advanced by 8.
@@ -306,6 +342,63 @@ int binstream_write_double(binstream_t *stream, double val);
  */
 int binstream_write_ndouble(binstream_t *stream, const double *val, size_t count);
 
+/*
+ * The functions below are implementation details of the inline read functions. They handle every combination of
+ * stream and host endianness and report insufficient data; the inline versions only handle the common case of a
+ * little endian stream on a little endian host directly.
+ */
+int binstream_read_u32_generic(binstream_t *stream, uint32_t *out);
+int binstream_read_i32_generic(binstream_t *stream, int32_t *out);
+int binstream_read_double_generic(binstream_t *stream, double *out);
+int binstream_nread_double_generic(binstream_t *stream, double *out, size_t count);
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BINSTREAM_HOST_LITTLE 1
+#endif
+#elif defined(_WIN32)
+#define BINSTREAM_HOST_LITTLE 1
+#endif
+
+#ifdef BINSTREAM_HOST_LITTLE
+#define BINSTREAM_FAST_READ(stream, out, size)                                                                         \
+  if ((stream)->end == LITTLE && (stream)->position + (size) <= (stream)->limit) {                                     \
+    memcpy((out), (stream)->data + (stream)->position, (size));                                                        \
+    (stream)->position += (size);                                                                                      \
+    return SQLITE_OK;                                                                                                  \
+  }
+#else
+#define BINSTREAM_FAST_READ(stream, out, size)
+#endif
+
+static inline int binstream_read_u32(binstream_t *stream, uint32_t *out) {
+  BINSTREAM_FAST_READ(stream, out, sizeof(uint32_t))
+  return binstream_read_u32_generic(stream, out);
+}
+
+static inline int binstream_read_i32(binstream_t *stream, int32_t *out) {
+  BINSTREAM_FAST_READ(stream, out, sizeof(int32_t))
+  return binstream_read_i32_generic(stream, out);
+}
+
+static inline int binstream_read_double(binstream_t *stream, double *out) {
+  BINSTREAM_FAST_READ(stream, out, sizeof(double))
+  return binstream_read_double_generic(stream, out);
+}
+
+static inline int binstream_nread_double(binstream_t *stream, double *out, size_t count) {
+#ifdef BINSTREAM_HOST_LITTLE
+  if (stream->end == LITTLE && count <= (stream->limit - stream->position) / sizeof(double)) {
+    memcpy(out, stream->data + stream->position, count * sizeof(double));
+    stream->position += count * sizeof(double);
+    return SQLITE_OK;
+  }
+#endif
+  return binstream_nread_double_generic(stream, out, count);
+}
+
+#undef BINSTREAM_FAST_READ
+
 /** @} */
 
 #endif
@@ -43,6 +43,13 @@ typedef struct {
   geom_envelope_t envelope;
 } geom_blob_header_t;
 
+/**
+ * An upper bound for the number of bytes that a geometry blob adds to the Well-Known Binary encoding of its geometry.
+ * This is the size of a GeoPackage Binary header with an XYZM envelope; the Spatialite Binary header and end marker
+ * take up less space.
+ */
+#define GEOM_BLOB_MAX_OVERHEAD (8 + 8 * 8)
+
 /**
  * A geometry blob writer. geom_blob_writer_t instances can be used to generate a spatial database specific blobs based
  * on any geometry source. Use geom_blob_writer_geom_consumer() to obtain a geom_consumer_t pointer that can be passed to
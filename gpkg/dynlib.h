@@ -16,10 +16,24 @@
 
 #define dynlib void*
 #define dynlib_open(path) dlopen(path, RTLD_LAZY | RTLD_LOCAL)
-#define dynlib_sym(handle,symbol) dlsym(handle,symbol)
 #define dynlib_close(handle) dlclose(handle)
 #define dynlib_error(handle) dlerror()
 
+typedef void (*dynlib_function)(void);
+
+/*
+ * ISO C does not allow converting the object pointer returned by dlsym to a function pointer, so the conversion goes
+ * through a union. The result can be cast to the actual function pointer type.
+ */
+static inline dynlib_function dynlib_sym(void *handle, const char *symbol) {
+  union {
+    void *object;
+    dynlib_function function;
+  } sym;
+  sym.object = dlsym(handle, symbol);
+  return sym.function;
+}
+
 #endif
 
 #endif
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <float.h>
 #include <string.h>
 #include "fp.h"
 
@@ -50,3 +51,376 @@ double fp_uint64_to_double(uint64_t x) {
   memcpy(&dbl, &x, sizeof(uint64_t));
   return dbl;
 }
+
+/*
+ * Powers of ten that can be represented exactly as a double.
+ */
+static const double fp_exact_powers_of_ten[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define FP_MAX_EXACT_POWER 22
+#define FP_MAX_EXACT_MANTISSA (1ULL << 53)
+#define FP_MAX_DIGITS 19
+
+int fp_parse_double(const char *str, const char *end, const char **endptr, double *value) {
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+  /* Intermediate results with extended precision would be rounded twice */
+  return 0;
+#else
+  const char *p = str;
+  int negative = 0;
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int has_digits = 0;
+  int exponent = 0;
+
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+
+  for (; p < end && '0' <= *p && *p <= '9'; p++) {
+    has_digits = 1;
+    if (mantissa == 0 && *p == '0') {
+      continue;
+    }
+    if (++digits > FP_MAX_DIGITS) {
+      return 0;
+    }
+    mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+  }
+
+  if (p < end && *p == '.') {
+    p++;
+    for (; p < end && '0' <= *p && *p <= '9'; p++) {
+      has_digits = 1;
+      exponent--;
+      if (mantissa == 0 && *p == '0') {
+        continue;
+      }
+      if (++digits > FP_MAX_DIGITS) {
+        return 0;
+      }
+      mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+    }
+  }
+
+  if (!has_digits) {
+    return 0;
+  }
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    int exp_negative = 0;
+    int exp_value = 0;
+    p++;
+    if (p < end && (*p == '-' || *p == '+')) {
+      exp_negative = *p == '-';
+      p++;
+    }
+    if (p == end || *p < '0' || '9' < *p) {
+      return 0;
+    }
+    for (; p < end && '0' <= *p && *p <= '9'; p++) {
+      if (exp_value > 1000) {
+        return 0;
+      }
+      exp_value = exp_value * 10 + (*p - '0');
+    }
+    exponent += exp_negative ? -exp_value : exp_value;
+  }
+
+  /* Leave anything strtod might interpret differently, such as hexadecimal numbers, to strtod */
+  if (p < end && (*p == '.' || ('a' <= *p && *p <= 'z') || ('A' <= *p && *p <= 'Z'))) {
+    return 0;
+  }
+
+  double result;
+  if (mantissa == 0) {
+    result = 0.0;
+  } else if (mantissa > FP_MAX_EXACT_MANTISSA || exponent < -FP_MAX_EXACT_POWER || exponent > FP_MAX_EXACT_POWER) {
+    return 0;
+  } else if (exponent < 0) {
+    result = (double) mantissa / fp_exact_powers_of_ten[-exponent];
+  } else {
+    result = (double) mantissa * fp_exact_powers_of_ten[exponent];
+  }
+
+  *value = negative ? -result : result;
+  *endptr = p;
+  return 1;
+#endif
+}
+
+/*
+ * Shortest round-trip formatting of doubles using the Grisu2 algorithm by Florian Loitsch, "Printing Floating-Point
+ * Numbers Quickly and Accurately with Integers" (PLDI 2010). The generated digits always parse back to the original
+ * value and are the shortest such representation for all but a very small fraction of inputs.
+ */
+typedef struct {
+  uint64_t f;
+  int e;
+} fp_diy_t;
+
+#define FP_SIGNIFICAND_SIZE 52
+#define FP_EXPONENT_BIAS (0x3FF + FP_SIGNIFICAND_SIZE)
+#define FP_HIDDEN_BIT 0x0010000000000000ULL
+#define FP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define FP_EXPONENT_MASK 0x7FF0000000000000ULL
+
+/*
+ * Normalized 64-bit approximations f * 2^e of the powers of ten 10^-348, 10^-340, ..., 10^340.
+ */
+static const fp_diy_t fp_cached_powers[] = {
+  {0xfa8fd5a0081c0288ULL, -1220}, {0xbaaee17fa23ebf76ULL, -1193},
+  {0x8b16fb203055ac76ULL, -1166}, {0xcf42894a5dce35eaULL, -1140},
+  {0x9a6bb0aa55653b2dULL, -1113}, {0xe61acf033d1a45dfULL, -1087},
+  {0xab70fe17c79ac6caULL, -1060}, {0xff77b1fcbebcdc4fULL, -1034},
+  {0xbe5691ef416bd60cULL, -1007}, {0x8dd01fad907ffc3cULL, -980},
+  {0xd3515c2831559a83ULL, -954}, {0x9d71ac8fada6c9b5ULL, -927},
+  {0xea9c227723ee8bcbULL, -901}, {0xaecc49914078536dULL, -874},
+  {0x823c12795db6ce57ULL, -847}, {0xc21094364dfb5637ULL, -821},
+  {0x9096ea6f3848984fULL, -794}, {0xd77485cb25823ac7ULL, -768},
+  {0xa086cfcd97bf97f4ULL, -741}, {0xef340a98172aace5ULL, -715},
+  {0xb23867fb2a35b28eULL, -688}, {0x84c8d4dfd2c63f3bULL, -661},
+  {0xc5dd44271ad3cdbaULL, -635}, {0x936b9fcebb25c996ULL, -608},
+  {0xdbac6c247d62a584ULL, -582}, {0xa3ab66580d5fdaf6ULL, -555},
+  {0xf3e2f893dec3f126ULL, -529}, {0xb5b5ada8aaff80b8ULL, -502},
+  {0x87625f056c7c4a8bULL, -475}, {0xc9bcff6034c13053ULL, -449},
+  {0x964e858c91ba2655ULL, -422}, {0xdff9772470297ebdULL, -396},
+  {0xa6dfbd9fb8e5b88fULL, -369}, {0xf8a95fcf88747d94ULL, -343},
+  {0xb94470938fa89bcfULL, -316}, {0x8a08f0f8bf0f156bULL, -289},
+  {0xcdb02555653131b6ULL, -263}, {0x993fe2c6d07b7facULL, -236},
+  {0xe45c10c42a2b3b06ULL, -210}, {0xaa242499697392d3ULL, -183},
+  {0xfd87b5f28300ca0eULL, -157}, {0xbce5086492111aebULL, -130},
+  {0x8cbccc096f5088ccULL, -103}, {0xd1b71758e219652cULL, -77},
+  {0x9c40000000000000ULL, -50}, {0xe8d4a51000000000ULL, -24},
+  {0xad78ebc5ac620000ULL, 3}, {0x813f3978f8940984ULL, 30},
+  {0xc097ce7bc90715b3ULL, 56}, {0x8f7e32ce7bea5c70ULL, 83},
+  {0xd5d238a4abe98068ULL, 109}, {0x9f4f2726179a2245ULL, 136},
+  {0xed63a231d4c4fb27ULL, 162}, {0xb0de65388cc8ada8ULL, 189},
+  {0x83c7088e1aab65dbULL, 216}, {0xc45d1df942711d9aULL, 242},
+  {0x924d692ca61be758ULL, 269}, {0xda01ee641a708deaULL, 295},
+  {0xa26da3999aef774aULL, 322}, {0xf209787bb47d6b85ULL, 348},
+  {0xb454e4a179dd1877ULL, 375}, {0x865b86925b9bc5c2ULL, 402},
+  {0xc83553c5c8965d3dULL, 428}, {0x952ab45cfa97a0b3ULL, 455},
+  {0xde469fbd99a05fe3ULL, 481}, {0xa59bc234db398c25ULL, 508},
+  {0xf6c69a72a3989f5cULL, 534}, {0xb7dcbf5354e9beceULL, 561},
+  {0x88fcf317f22241e2ULL, 588}, {0xcc20ce9bd35c78a5ULL, 614},
+  {0x98165af37b2153dfULL, 641}, {0xe2a0b5dc971f303aULL, 667},
+  {0xa8d9d1535ce3b396ULL, 694}, {0xfb9b7cd9a4a7443cULL, 720},
+  {0xbb764c4ca7a44410ULL, 747}, {0x8bab8eefb6409c1aULL, 774},
+  {0xd01fef10a657842cULL, 800}, {0x9b10a4e5e9913129ULL, 827},
+  {0xe7109bfba19c0c9dULL, 853}, {0xac2820d9623bf429ULL, 880},
+  {0x80444b5e7aa7cf85ULL, 907}, {0xbf21e44003acdd2dULL, 933},
+  {0x8e679c2f5e44ff8fULL, 960}, {0xd433179d9c8cb841ULL, 986},
+  {0x9e19db92b4e31ba9ULL, 1013}, {0xeb96bf6ebadf77d9ULL, 1039},
+  {0xaf87023b9bf0ee6bULL, 1066}
+};
+
+static const uint64_t fp_powers_of_ten[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+  10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL, 1000000000000000ULL,
+  10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static fp_diy_t fp_diy_normalize(fp_diy_t x) {
+  while ((x.f & 0x8000000000000000ULL) == 0) {
+    x.f <<= 1;
+    x.e--;
+  }
+  return x;
+}
+
+static fp_diy_t fp_diy_multiply(fp_diy_t x, fp_diy_t y) {
+  const uint64_t mask = 0xFFFFFFFFULL;
+  uint64_t a = x.f >> 32, b = x.f & mask, c = y.f >> 32, d = y.f & mask;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t tmp = (bd >> 32) + (ad & mask) + (bc & mask);
+  /* Round the discarded lower half */
+  tmp += 1ULL << 31;
+  fp_diy_t result = {ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64};
+  return result;
+}
+
+static void fp_grisu_round(char *buffer, int length, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+  while (rest < wp_w && delta - rest >= ten_kappa && (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+    buffer[length - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+static int fp_decimal_digits(uint32_t n) {
+  int digits = 1;
+  while (digits < 10 && n >= fp_powers_of_ten[digits]) {
+    digits++;
+  }
+  return digits;
+}
+
+static int fp_grisu_digits(fp_diy_t w, fp_diy_t mp, uint64_t delta, char *buffer, int *k) {
+  fp_diy_t one = {1ULL << -mp.e, mp.e};
+  uint64_t wp_w = mp.f - w.f;
+  uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+  uint64_t p2 = mp.f & (one.f - 1);
+  int kappa = fp_decimal_digits(p1);
+  int length = 0;
+
+  while (kappa > 0) {
+    uint32_t divisor = (uint32_t) fp_powers_of_ten[kappa - 1];
+    uint32_t d = p1 / divisor;
+    p1 %= divisor;
+    if (d || length) {
+      buffer[length++] = (char)('0' + d);
+    }
+    kappa--;
+    uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+    if (rest <= delta) {
+      *k += kappa;
+      fp_grisu_round(buffer, length, delta, rest, fp_powers_of_ten[kappa] << -one.e, wp_w);
+      return length;
+    }
+  }
+
+  for (;;) {
+    p2 *= 10;
+    delta *= 10;
+    char d = (char)(p2 >> -one.e);
+    if (d || length) {
+      buffer[length++] = (char)('0' + d);
+    }
+    p2 &= one.f - 1;
+    kappa--;
+    if (p2 < delta) {
+      *k += kappa;
+      fp_grisu_round(buffer, length, delta, p2, one.f, -kappa < 20 ? wp_w * fp_powers_of_ten[-kappa] : 0);
+      return length;
+    }
+  }
+}
+
+/*
+ * Generates the shortest digits d such that d * 10^k rounds to x. x must be finite and positive.
+ */
+static int fp_grisu2(double x, char *buffer, int *k) {
+  uint64_t bits = fp_double_to_uint64(x);
+  int biased_e = (int)((bits & FP_EXPONENT_MASK) >> FP_SIGNIFICAND_SIZE);
+  fp_diy_t v;
+  if (biased_e != 0) {
+    v.f = (bits & FP_SIGNIFICAND_MASK) + FP_HIDDEN_BIT;
+    v.e = biased_e - FP_EXPONENT_BIAS;
+  } else {
+    v.f = bits & FP_SIGNIFICAND_MASK;
+    v.e = 1 - FP_EXPONENT_BIAS;
+  }
+
+  /* Boundaries halfway between x and its neighbours */
+  fp_diy_t plus = {(v.f << 1) + 1, v.e - 1};
+  while ((plus.f & (FP_HIDDEN_BIT << 1)) == 0) {
+    plus.f <<= 1;
+    plus.e--;
+  }
+  plus.f <<= 64 - FP_SIGNIFICAND_SIZE - 2;
+  plus.e -= 64 - FP_SIGNIFICAND_SIZE - 2;
+
+  fp_diy_t minus;
+  if (v.f == FP_HIDDEN_BIT) {
+    minus.f = (v.f << 2) - 1;
+    minus.e = v.e - 2;
+  } else {
+    minus.f = (v.f << 1) - 1;
+    minus.e = v.e - 1;
+  }
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  /* Select a cached power of ten that brings the scaled boundaries in the range [2^-60, 2^-32] */
+  double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+  int cached_k = (int) dk;
+  if (dk - cached_k > 0.0) {
+    cached_k++;
+  }
+  int index = (cached_k >> 3) + 1;
+  *k = -(-348 + index * 8);
+  fp_diy_t c_mk = fp_cached_powers[index];
+
+  fp_diy_t w = fp_diy_multiply(fp_diy_normalize(v), c_mk);
+  fp_diy_t wp = fp_diy_multiply(plus, c_mk);
+  fp_diy_t wm = fp_diy_multiply(minus, c_mk);
+  wm.f++;
+  wp.f--;
+  return fp_grisu_digits(w, wp, wp.f - wm.f, buffer, k);
+}
+
+static int fp_write_exponent(int exponent, char *buffer) {
+  int length = 0;
+  buffer[length++] = 'e';
+  if (exponent < 0) {
+    buffer[length++] = '-';
+    exponent = -exponent;
+  } else {
+    buffer[length++] = '+';
+  }
+  if (exponent >= 100) {
+    buffer[length++] = (char)('0' + exponent / 100);
+    exponent %= 100;
+  }
+  buffer[length++] = (char)('0' + exponent / 10);
+  buffer[length++] = (char)('0' + exponent % 10);
+  return length;
+}
+
+int fp_format_double(double x, char *buffer) {
+  int length = 0;
+
+  if (fp_isnan(x)) {
+    memcpy(buffer, "NaN", 3);
+    return 3;
+  }
+
+  if (x < 0) {
+    buffer[length++] = '-';
+    x = -x;
+  }
+
+  if (x == 0.0) {
+    /* Negative zero is written as 0 */
+    buffer[0] = '0';
+    return 1;
+  } else if (x > 1.7976931348623157e308) {
+    memcpy(buffer + length, "Inf", 3);
+    return length + 3;
+  }
+
+  char *digits = buffer + length;
+  int k;
+  int digit_count = fp_grisu2(x, digits, &k);
+
+  /* The decimal point goes after the first point digits */
+  int point = digit_count + k;
+  if (point > 0 && point <= 17) {
+    if (digit_count <= point) {
+      memset(digits + digit_count, '0', (size_t)(point - digit_count));
+      return length + point;
+    } else {
+      memmove(digits + point + 1, digits + point, (size_t)(digit_count - point));
+      digits[point] = '.';
+      return length + digit_count + 1;
+    }
+  } else if (point > -4 && point <= 0) {
+    int offset = 2 - point;
+    memmove(digits + offset, digits, (size_t) digit_count);
+    digits[0] = '0';
+    digits[1] = '.';
+    memset(digits + 2, '0', (size_t) -point);
+    return length + offset + digit_count;
+  } else {
+    if (digit_count > 1) {
+      memmove(digits + 2, digits + 1, (size_t)(digit_count - 1));
+      digits[1] = '.';
+      digit_count++;
+    }
+    return length + digit_count + fp_write_exponent(point - 1, digits + digit_count);
+  }
+}
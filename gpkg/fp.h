@@ -46,4 +46,34 @@ uint64_t fp_double_to_uint64(double x);
  */
 double fp_uint64_to_double(uint64_t x);
 
+/**
+ * Parses a decimal floating point number of the form [+-]digits[.digits][(e|E)[+-]digits] without depending on the
+ * current locale. Only numbers that can be converted exactly using a single double precision multiplication or
+ * division are parsed; for all other input 0 is returned and the caller should fall back to a complete strtod
+ * implementation.
+ * @param str the start of the number
+ * @param end the end of the input
+ * @param[out] endptr receives a pointer to the first character after the number
+ * @param[out] value receives the parsed value
+ * @return 1 if the number was parsed; 0 otherwise
+ */
+int fp_parse_double(const char *str, const char *end, const char **endptr, double *value);
+
+/**
+ * The size of the buffer that must be passed to fp_format_double.
+ */
+#define FP_FORMAT_BUFFER_SIZE 32
+
+/**
+ * Formats a double using the shortest sequence of decimal digits that parses back to the same value. The choice
+ * between fixed and exponential notation follows the printf %.17g conversion: numbers with a decimal exponent from -4
+ * up to and including 16 are written in fixed notation and all other numbers in exponential notation, so 1e16 is
+ * written as 10000000000000000 and 1e17 as 1e+17. Like the printf implementation of SQLite, negative zero is written as
+ * 0 and infinities as Inf and -Inf. The result is not null terminated.
+ * @param x the double value to format
+ * @param buffer the output buffer of at least FP_FORMAT_BUFFER_SIZE characters
+ * @return the number of characters that were written
+ */
+int fp_format_double(double x, char *buffer);
+
 #endif
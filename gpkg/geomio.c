@@ -321,43 +321,244 @@ static void geom_envelope_fill_arc(geom_envelope_t *envelope, const geom_header_
 #undef MIN_MAX
 }
 
-static void geom_envelope_fill_simple(geom_envelope_t *envelope, const geom_header_t *header, size_t point_count, const double *coords) {
-#define MIN_MAX(coord) double coord = coords[offset++]; \
-        if (coord < envelope->min_##coord) envelope->min_##coord = coord; \
-        if (coord > envelope->max_##coord) envelope->max_##coord = coord;
-
-  int offset = 0;
-  switch (header->coord_type) {
-    case GEOM_XY:
-      for (size_t i = 0; i < point_count; i++) {
-        MIN_MAX(x)
-        MIN_MAX(y)
-      }
-      break;
-    case GEOM_XYZ:
-      for (size_t i = 0; i < point_count; i++) {
-        MIN_MAX(x)
-        MIN_MAX(y)
-        MIN_MAX(z)
+/*
+ * Min/max reduction kernels for interleaved coordinate arrays. Each kernel updates min[0..coord_size) and
+ * max[0..coord_size) with the ordinates of point_count points of coord_size ordinates each. NaN ordinates are
+ * ignored, like they are by the scalar comparisons.
+ *
+ * The SSE2 kernel is used whenever the compiler targets SSE2 (always the case on x86-64). The AVX kernel is compiled
+ * in for GCC and Clang on x86 and is selected at runtime if the CPU supports it.
+ */
+typedef void (*geom_minmax_func)(const double *coords, size_t point_count, uint32_t coord_size, double *min, double *max);
+
+#define MIN_MAX_ORDINATE(d) do { double v = coords[d]; \
+        if (v < min[d]) min[d] = v; \
+        if (v > max[d]) max[d] = v; \
+      } while(0)
+
+static void geom_minmax_scalar(const double *coords, size_t point_count, uint32_t coord_size, double *min, double *max) {
+  switch (coord_size) {
+    case 2:
+      for (size_t i = 0; i < point_count; i++, coords += 2) {
+        MIN_MAX_ORDINATE(0);
+        MIN_MAX_ORDINATE(1);
       }
       break;
-    case GEOM_XYM:
-      for (size_t i = 0; i < point_count; i++) {
-        MIN_MAX(x)
-        MIN_MAX(y)
-        MIN_MAX(m)
+    case 3:
+      for (size_t i = 0; i < point_count; i++, coords += 3) {
+        MIN_MAX_ORDINATE(0);
+        MIN_MAX_ORDINATE(1);
+        MIN_MAX_ORDINATE(2);
       }
       break;
     default:
-      for (size_t i = 0; i < point_count; i++) {
-        MIN_MAX(x)
-        MIN_MAX(y)
-        MIN_MAX(z)
-        MIN_MAX(m)
+      for (size_t i = 0; i < point_count; i++, coords += 4) {
+        MIN_MAX_ORDINATE(0);
+        MIN_MAX_ORDINATE(1);
+        MIN_MAX_ORDINATE(2);
+        MIN_MAX_ORDINATE(3);
       }
   }
+}
 
-#undef MIN_MAX
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GEOM_MINMAX_SSE2 1
+#include <emmintrin.h>
+
+static void geom_minmax_sse2(const double *coords, size_t point_count, uint32_t coord_size, double *min, double *max) {
+  size_t i = 0;
+
+  if (coord_size == 3) {
+    /*
+     * Two XYZ points span three registers: (x0 y0) (z0 x1) (y1 z1). The accumulators therefore hold
+     * (x y), (z x) and (y z) respectively.
+     */
+    __m128d min_a = _mm_set_pd(min[1], min[0]), max_a = _mm_set_pd(max[1], max[0]);
+    __m128d min_b = _mm_set_pd(min[0], min[2]), max_b = _mm_set_pd(max[0], max[2]);
+    __m128d min_c = _mm_set_pd(min[2], min[1]), max_c = _mm_set_pd(max[2], max[1]);
+    for (; i + 2 <= point_count; i += 2, coords += 6) {
+      __m128d a = _mm_loadu_pd(coords);
+      __m128d b = _mm_loadu_pd(coords + 2);
+      __m128d c = _mm_loadu_pd(coords + 4);
+      min_a = _mm_min_pd(a, min_a);
+      max_a = _mm_max_pd(a, max_a);
+      min_b = _mm_min_pd(b, min_b);
+      max_b = _mm_max_pd(b, max_b);
+      min_c = _mm_min_pd(c, min_c);
+      max_c = _mm_max_pd(c, max_c);
+    }
+
+    double lo[6], hi[6];
+    _mm_storeu_pd(lo, min_a);
+    _mm_storeu_pd(lo + 2, min_b);
+    _mm_storeu_pd(lo + 4, min_c);
+    _mm_storeu_pd(hi, max_a);
+    _mm_storeu_pd(hi + 2, max_b);
+    _mm_storeu_pd(hi + 4, max_c);
+    min[0] = lo[0] < lo[3] ? lo[0] : lo[3];
+    min[1] = lo[1] < lo[4] ? lo[1] : lo[4];
+    min[2] = lo[2] < lo[5] ? lo[2] : lo[5];
+    max[0] = hi[0] > hi[3] ? hi[0] : hi[3];
+    max[1] = hi[1] > hi[4] ? hi[1] : hi[4];
+    max[2] = hi[2] > hi[5] ? hi[2] : hi[5];
+  } else {
+    /*
+     * XY and XYZM points consist of one or two whole registers.
+     */
+    __m128d min_xy = _mm_loadu_pd(min), max_xy = _mm_loadu_pd(max);
+    if (coord_size == 2) {
+      for (; i < point_count; i++, coords += 2) {
+        __m128d xy = _mm_loadu_pd(coords);
+        min_xy = _mm_min_pd(xy, min_xy);
+        max_xy = _mm_max_pd(xy, max_xy);
+      }
+    } else {
+      __m128d min_zm = _mm_loadu_pd(min + 2), max_zm = _mm_loadu_pd(max + 2);
+      for (; i < point_count; i++, coords += 4) {
+        __m128d xy = _mm_loadu_pd(coords);
+        __m128d zm = _mm_loadu_pd(coords + 2);
+        min_xy = _mm_min_pd(xy, min_xy);
+        max_xy = _mm_max_pd(xy, max_xy);
+        min_zm = _mm_min_pd(zm, min_zm);
+        max_zm = _mm_max_pd(zm, max_zm);
+      }
+      _mm_storeu_pd(min + 2, min_zm);
+      _mm_storeu_pd(max + 2, max_zm);
+    }
+    _mm_storeu_pd(min, min_xy);
+    _mm_storeu_pd(max, max_xy);
+  }
+
+  geom_minmax_scalar(coords, point_count - i, coord_size, min, max);
+}
+#endif
+
+#if GEOM_MINMAX_SSE2 && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define GEOM_MINMAX_AVX 1
+#include <immintrin.h>
+
+__attribute__((target("avx")))
+static void geom_minmax_avx(const double *coords, size_t point_count, uint32_t coord_size, double *min, double *max) {
+  size_t i = 0;
+  double lo[12], hi[12];
+
+  if (coord_size == 2) {
+    /* Two XY points per register */
+    __m256d min_v = _mm256_set_pd(min[1], min[0], min[1], min[0]);
+    __m256d max_v = _mm256_set_pd(max[1], max[0], max[1], max[0]);
+    for (; i + 2 <= point_count; i += 2, coords += 4) {
+      __m256d v = _mm256_loadu_pd(coords);
+      min_v = _mm256_min_pd(v, min_v);
+      max_v = _mm256_max_pd(v, max_v);
+    }
+    _mm_storeu_pd(min, _mm_min_pd(_mm256_castpd256_pd128(min_v), _mm256_extractf128_pd(min_v, 1)));
+    _mm_storeu_pd(max, _mm_max_pd(_mm256_castpd256_pd128(max_v), _mm256_extractf128_pd(max_v, 1)));
+  } else if (coord_size == 3) {
+    /*
+     * Four XYZ points span three registers: (x0 y0 z0 x1) (y1 z1 x2 y2) (z2 x3 y3 z3).
+     */
+    __m256d min_a = _mm256_set_pd(min[0], min[2], min[1], min[0]), max_a = _mm256_set_pd(max[0], max[2], max[1], max[0]);
+    __m256d min_b = _mm256_set_pd(min[1], min[0], min[2], min[1]), max_b = _mm256_set_pd(max[1], max[0], max[2], max[1]);
+    __m256d min_c = _mm256_set_pd(min[2], min[1], min[0], min[2]), max_c = _mm256_set_pd(max[2], max[1], max[0], max[2]);
+    for (; i + 4 <= point_count; i += 4, coords += 12) {
+      __m256d a = _mm256_loadu_pd(coords);
+      __m256d b = _mm256_loadu_pd(coords + 4);
+      __m256d c = _mm256_loadu_pd(coords + 8);
+      min_a = _mm256_min_pd(a, min_a);
+      max_a = _mm256_max_pd(a, max_a);
+      min_b = _mm256_min_pd(b, min_b);
+      max_b = _mm256_max_pd(b, max_b);
+      min_c = _mm256_min_pd(c, min_c);
+      max_c = _mm256_max_pd(c, max_c);
+    }
+    _mm256_storeu_pd(lo, min_a);
+    _mm256_storeu_pd(lo + 4, min_b);
+    _mm256_storeu_pd(lo + 8, min_c);
+    _mm256_storeu_pd(hi, max_a);
+    _mm256_storeu_pd(hi + 4, max_b);
+    _mm256_storeu_pd(hi + 8, max_c);
+    /* Fold the twelve lanes back onto x, y and z; lane k holds ordinate k % 3 */
+    for (int k = 3; k < 12; k++) {
+      if (lo[k] < lo[k % 3]) lo[k % 3] = lo[k];
+      if (hi[k] > hi[k % 3]) hi[k % 3] = hi[k];
+    }
+    memcpy(min, lo, 3 * sizeof(double));
+    memcpy(max, hi, 3 * sizeof(double));
+  } else {
+    /* One XYZM point per register */
+    __m256d min_v = _mm256_loadu_pd(min);
+    __m256d max_v = _mm256_loadu_pd(max);
+    for (; i < point_count; i++, coords += 4) {
+      __m256d v = _mm256_loadu_pd(coords);
+      min_v = _mm256_min_pd(v, min_v);
+      max_v = _mm256_max_pd(v, max_v);
+    }
+    _mm256_storeu_pd(min, min_v);
+    _mm256_storeu_pd(max, max_v);
+  }
+
+  geom_minmax_scalar(coords, point_count - i, coord_size, min, max);
+}
+#endif
+
+#undef MIN_MAX_ORDINATE
+
+static geom_minmax_func geom_minmax_select() {
+#if GEOM_MINMAX_AVX
+  if (__builtin_cpu_supports("avx")) {
+    return geom_minmax_avx;
+  }
+#endif
+#if GEOM_MINMAX_SSE2
+  return geom_minmax_sse2;
+#else
+  return geom_minmax_scalar;
+#endif
+}
+
+static void geom_envelope_fill_simple(geom_envelope_t *envelope, const geom_header_t *header, size_t point_count, const double *coords) {
+  static geom_minmax_func minmax = NULL;
+  double min[GEOM_MAX_COORD_SIZE];
+  double max[GEOM_MAX_COORD_SIZE];
+
+  /* Ordinates are laid out as x, y, then z and/or m; gather the matching envelope bounds in the same order. */
+  int has_z = header->coord_type == GEOM_XYZ || header->coord_type == GEOM_XYZM;
+  int has_m = header->coord_type == GEOM_XYM || header->coord_type == GEOM_XYZM;
+  uint32_t coord_size = 2 + has_z + has_m;
+  min[0] = envelope->min_x;
+  max[0] = envelope->max_x;
+  min[1] = envelope->min_y;
+  max[1] = envelope->max_y;
+  if (has_z) {
+    min[2] = envelope->min_z;
+    max[2] = envelope->max_z;
+  }
+  if (has_m) {
+    min[coord_size - 1] = envelope->min_m;
+    max[coord_size - 1] = envelope->max_m;
+  }
+
+  if (point_count < 4) {
+    geom_minmax_scalar(coords, point_count, coord_size, min, max);
+  } else {
+    if (minmax == NULL) {
+      minmax = geom_minmax_select();
+    }
+    minmax(coords, point_count, coord_size, min, max);
+  }
+
+  envelope->min_x = min[0];
+  envelope->max_x = max[0];
+  envelope->min_y = min[1];
+  envelope->max_y = max[1];
+  if (has_z) {
+    envelope->min_z = min[2];
+    envelope->max_z = max[2];
+  }
+  if (has_m) {
+    envelope->min_m = min[coord_size - 1];
+    envelope->max_m = max[coord_size - 1];
+  }
 }
 
 void geom_consumer_init(
@@ -14,6 +14,16 @@ typedef struct GEOSContextHandle_HS geos_handle_t;
 
 #define GEOSversion(handle) GEOSversion()
 
+#define GEOS_API_AVAILABLE(handle, name) 1
+
+#if GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 10)
+#define GEOS_HAVE_COORDSEQ_BUFFER 1
+#endif
+
+#if GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 12)
+#define GEOS_HAVE_M 1
+#endif
+
 #else
 
 enum GEOSGeomTypes {
@@ -73,11 +83,14 @@ typedef struct {
     GEOSGeometry* (*GEOSSymDifference_r)(GEOSContextHandle_t,const GEOSGeometry*,const GEOSGeometry*);
     GEOSGeometry* (*GEOSIntersection_r)(GEOSContextHandle_t,const GEOSGeometry*,const GEOSGeometry*);
     GEOSGeometry* (*GEOSUnion_r)(GEOSContextHandle_t,const GEOSGeometry*,const GEOSGeometry*);
+    GEOSGeometry* (*GEOSUnaryUnion_r)(GEOSContextHandle_t,const GEOSGeometry*);
     GEOSGeometry* (*GEOSBuffer_r)(GEOSContextHandle_t,const GEOSGeometry*,double,int);
     char (*GEOSRelatePattern_r)(GEOSContextHandle_t,const GEOSGeometry*,const GEOSGeometry*,const char *);
     int (*GEOSGeomTypeId_r)(GEOSContextHandle_t,const GEOSGeometry*);
     int (*GEOSGetSRID_r)(GEOSContextHandle_t,const GEOSGeometry*);
     void (*GEOSSetSRID_r)(GEOSContextHandle_t,const GEOSGeometry*,int);
+    char (*GEOSHasZ_r)(GEOSContextHandle_t,const GEOSGeometry*);
+    char (*GEOSHasM_r)(GEOSContextHandle_t,const GEOSGeometry*);
 
     GEOSGeometry* (*GEOSGeom_createPoint_r)(GEOSContextHandle_t,GEOSCoordSequence*);
     GEOSGeometry* (*GEOSGeom_createEmptyPoint_r)(GEOSContextHandle_t);
@@ -96,6 +109,10 @@ typedef struct {
     int (*GEOSCoordSeq_getY_r)(GEOSContextHandle_t,const GEOSCoordSequence*,unsigned int,double*);
     int (*GEOSCoordSeq_setX_r)(GEOSContextHandle_t,GEOSCoordSequence*,unsigned int,double);
     int (*GEOSCoordSeq_setY_r)(GEOSContextHandle_t,GEOSCoordSequence*,unsigned int,double);
+    int (*GEOSCoordSeq_getZ_r)(GEOSContextHandle_t,const GEOSCoordSequence*,unsigned int,double*);
+    int (*GEOSCoordSeq_setZ_r)(GEOSContextHandle_t,GEOSCoordSequence*,unsigned int,double);
+    GEOSCoordSequence* (*GEOSCoordSeq_copyFromBuffer_r)(GEOSContextHandle_t,const double*,unsigned int,int,int);
+    int (*GEOSCoordSeq_copyToBuffer_r)(GEOSContextHandle_t,const GEOSCoordSequence*,double*,int,int);
 
     GEOSPreparedGeometry const *(*GEOSPrepare_r)(GEOSContextHandle_t,const GEOSGeometry*);
     void (*GEOSPreparedGeom_destroy_r)(GEOSContextHandle_t,const GEOSPreparedGeometry*);
@@ -144,11 +161,14 @@ typedef struct {
 #define GEOSSymDifference_r(ctx,g1,g2) ctx->api.GEOSSymDifference_r(ctx->context,g1,g2)
 #define GEOSIntersection_r(ctx,g1,g2) ctx->api.GEOSIntersection_r(ctx->context,g1,g2)
 #define GEOSUnion_r(ctx,g1,g2) ctx->api.GEOSUnion_r(ctx->context,g1,g2)
+#define GEOSUnaryUnion_r(ctx,g) ctx->api.GEOSUnaryUnion_r(ctx->context,g)
 #define GEOSBuffer_r(ctx,g,d,i) ctx->api.GEOSBuffer_r(ctx->context,g,d,i)
 #define GEOSRelatePattern_r(ctx,g1,g2,c) ctx->api.GEOSRelatePattern_r(ctx->context,g1,g2,c)
 #define GEOSGeomTypeId_r(ctx,g) ctx->api.GEOSGeomTypeId_r(ctx->context,g)
 #define GEOSGetSRID_r(ctx,g) ctx->api.GEOSGetSRID_r(ctx->context,g)
 #define GEOSSetSRID_r(ctx,g,i) ctx->api.GEOSSetSRID_r(ctx->context,g,i)
+#define GEOSHasZ_r(ctx,g) ctx->api.GEOSHasZ_r(ctx->context,g)
+#define GEOSHasM_r(ctx,g) ctx->api.GEOSHasM_r(ctx->context,g)
 #define GEOSGeom_createPoint_r(ctx,cs) ctx->api.GEOSGeom_createPoint_r(ctx->context,cs)
 #define GEOSGeom_createEmptyPoint_r(ctx) ctx->api.GEOSGeom_createEmptyPoint_r(ctx->context)
 #define GEOSGeom_createLinearRing_r(ctx,cs) ctx->api.GEOSGeom_createLinearRing_r(ctx->context,cs)
@@ -165,11 +185,24 @@ typedef struct {
 #define GEOSCoordSeq_getY_r(ctx,cs,i,d) ctx->api.GEOSCoordSeq_getY_r(ctx->context,cs,i,d)
 #define GEOSCoordSeq_setX_r(ctx,cs,i,d) ctx->api.GEOSCoordSeq_setX_r(ctx->context,cs,i,d)
 #define GEOSCoordSeq_setY_r(ctx,cs,i,d) ctx->api.GEOSCoordSeq_setY_r(ctx->context,cs,i,d)
+#define GEOSCoordSeq_getZ_r(ctx,cs,i,d) ctx->api.GEOSCoordSeq_getZ_r(ctx->context,cs,i,d)
+#define GEOSCoordSeq_setZ_r(ctx,cs,i,d) ctx->api.GEOSCoordSeq_setZ_r(ctx->context,cs,i,d)
+#define GEOSCoordSeq_copyFromBuffer_r(ctx,b,i,z,m) ctx->api.GEOSCoordSeq_copyFromBuffer_r(ctx->context,b,i,z,m)
+#define GEOSCoordSeq_copyToBuffer_r(ctx,cs,b,z,m) ctx->api.GEOSCoordSeq_copyToBuffer_r(ctx->context,cs,b,z,m)
 #define GEOSPrepare_r(ctx,g) ctx->api.GEOSPrepare_r(ctx->context,g)
 #define GEOSPreparedGeom_destroy_r(ctx,pg) ctx->api.GEOSPreparedGeom_destroy_r(ctx->context,pg)
 #define GEOSGeom_destroy_r(ctx,g) ctx->api.GEOSGeom_destroy_r(ctx->context,g)
 #define GEOSversion(ctx) ctx->api.GEOSversion()
 
+/*
+ * Functions that were added in later GEOS versions may be missing from the loaded library. Code that calls them
+ * should check GEOS_API_AVAILABLE first.
+ */
+#define GEOS_API_AVAILABLE(handle, name) (handle->api.name != NULL)
+
+#define GEOS_HAVE_COORDSEQ_BUFFER 1
+#define GEOS_HAVE_M 1
+
 #endif
 
 #endif
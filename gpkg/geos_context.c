@@ -1,8 +1,12 @@
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include "atomic_ops.h"
 #include "geos.h"
 #include "geos_context.h"
 #include "sqlite.h"
+#include "thread.h"
 #include "tls.h"
 
 #if GPKG_GEOM_FUNC == GPKG_GEOS_DL
@@ -10,6 +14,9 @@
 #endif
 
 GPKG_TLS_KEY(last_geos_error)
+GPKG_TLS_KEY(geos_thread_id)
+GPKG_TLS_KEY(geos_pool_id)
+GPKG_TLS_KEY(geos_pool_handle)
 
 void geom_geos_clear_error() {
   char *err = GPKG_TLS_GET(last_geos_error);
@@ -115,11 +122,14 @@ geos_handle_t *geom_geos_init(char const *geos_lib, errorstream_t *error) {
   handle->api.GEOSSymDifference_r = (GEOSGeometry* (*)(GEOSContextHandle_t,const GEOSGeometry*,const GEOSGeometry*)) dynlib_sym(lib, "GEOSSymDifference_r");
   handle->api.GEOSIntersection_r = (GEOSGeometry* (*)(GEOSContextHandle_t,const GEOSGeometry*,const GEOSGeometry*)) dynlib_sym(lib, "GEOSIntersection_r");
   handle->api.GEOSUnion_r = (GEOSGeometry* (*)(GEOSContextHandle_t,const GEOSGeometry*,const GEOSGeometry*)) dynlib_sym(lib, "GEOSUnion_r");
+  handle->api.GEOSUnaryUnion_r = (GEOSGeometry* (*)(GEOSContextHandle_t,const GEOSGeometry*)) dynlib_sym(lib, "GEOSUnaryUnion_r");
   handle->api.GEOSBuffer_r = (GEOSGeometry* (*)(GEOSContextHandle_t,const GEOSGeometry*,double,int)) dynlib_sym(lib, "GEOSBuffer_r");
   handle->api.GEOSRelatePattern_r = (char (*)(GEOSContextHandle_t,const GEOSGeometry*,const GEOSGeometry*,const char *)) dynlib_sym(lib, "GEOSRelatePattern_r");
   handle->api.GEOSGeomTypeId_r = (int (*)(GEOSContextHandle_t,const GEOSGeometry*)) dynlib_sym(lib, "GEOSGeomTypeId_r");
   handle->api.GEOSGetSRID_r = (int (*)(GEOSContextHandle_t,const GEOSGeometry*)) dynlib_sym(lib, "GEOSGetSRID_r");
   handle->api.GEOSSetSRID_r = (void (*)(GEOSContextHandle_t,const GEOSGeometry*,int)) dynlib_sym(lib, "GEOSSetSRID_r");
+  handle->api.GEOSHasZ_r = (char (*)(GEOSContextHandle_t,const GEOSGeometry*)) dynlib_sym(lib, "GEOSHasZ_r");
+  handle->api.GEOSHasM_r = (char (*)(GEOSContextHandle_t,const GEOSGeometry*)) dynlib_sym(lib, "GEOSHasM_r");
   handle->api.GEOSGeom_createPoint_r = (GEOSGeometry* (*)(GEOSContextHandle_t,GEOSCoordSequence*)) dynlib_sym(lib, "GEOSGeom_createPoint_r");
   handle->api.GEOSGeom_createEmptyPoint_r = (GEOSGeometry* (*)(GEOSContextHandle_t)) dynlib_sym(lib, "GEOSGeom_createEmptyPoint_r");
   handle->api.GEOSGeom_createLinearRing_r = (GEOSGeometry* (*)(GEOSContextHandle_t,GEOSCoordSequence*)) dynlib_sym(lib, "GEOSGeom_createLinearRing_r");
@@ -136,6 +146,10 @@ geos_handle_t *geom_geos_init(char const *geos_lib, errorstream_t *error) {
   handle->api.GEOSCoordSeq_getY_r = (int (*)(GEOSContextHandle_t,const GEOSCoordSequence*,unsigned int,double*)) dynlib_sym(lib, "GEOSCoordSeq_getY_r");
   handle->api.GEOSCoordSeq_setX_r = (int (*)(GEOSContextHandle_t,GEOSCoordSequence*,unsigned int,double)) dynlib_sym(lib, "GEOSCoordSeq_setX_r");
   handle->api.GEOSCoordSeq_setY_r = (int (*)(GEOSContextHandle_t,GEOSCoordSequence*,unsigned int,double)) dynlib_sym(lib, "GEOSCoordSeq_setY_r");
+  handle->api.GEOSCoordSeq_getZ_r = (int (*)(GEOSContextHandle_t,const GEOSCoordSequence*,unsigned int,double*)) dynlib_sym(lib, "GEOSCoordSeq_getZ_r");
+  handle->api.GEOSCoordSeq_setZ_r = (int (*)(GEOSContextHandle_t,GEOSCoordSequence*,unsigned int,double)) dynlib_sym(lib, "GEOSCoordSeq_setZ_r");
+  handle->api.GEOSCoordSeq_copyFromBuffer_r = (GEOSCoordSequence* (*)(GEOSContextHandle_t,const double*,unsigned int,int,int)) dynlib_sym(lib, "GEOSCoordSeq_copyFromBuffer_r");
+  handle->api.GEOSCoordSeq_copyToBuffer_r = (int (*)(GEOSContextHandle_t,const GEOSCoordSequence*,double*,int,int)) dynlib_sym(lib, "GEOSCoordSeq_copyToBuffer_r");
   handle->api.GEOSPrepare_r = (GEOSPreparedGeometry const *(*)(GEOSContextHandle_t,const GEOSGeometry*)) dynlib_sym(lib, "GEOSPrepare_r");
   handle->api.GEOSPreparedGeom_destroy_r = (void (*)(GEOSContextHandle_t,const GEOSPreparedGeometry*)) dynlib_sym(lib, "GEOSPreparedGeom_destroy_r");
   handle->api.GEOSGeom_destroy_r = (void (*)(GEOSContextHandle_t,const GEOSGeometry*)) dynlib_sym(lib, "GEOSGeom_destroy_r");
@@ -185,3 +199,286 @@ void geom_geos_destroy(geos_handle_t *geos) {
 
 #endif
 }
+
+/*
+ * Creates an additional handle for the GEOS library that was loaded for the given handle.
+ */
+static geos_handle_t *geom_geos_clone(geos_handle_t *geos) {
+#if GPKG_GEOM_FUNC == GPKG_GEOS
+  return initGEOS_r(geom_null_msg_handler, geom_tls_msg_handler);
+#else
+  geos_handle_t *handle = (geos_handle_t*)sqlite3_malloc(sizeof(geos_handle_t));
+  if (handle == NULL) {
+    return NULL;
+  }
+
+  *handle = *geos;
+  handle->context = handle->api.initGEOS_r(geom_null_msg_handler, geom_tls_msg_handler);
+  if (handle->context == NULL) {
+    sqlite3_free(handle);
+    return NULL;
+  }
+
+  return handle;
+#endif
+}
+
+static void geom_geos_destroy_clone(geos_handle_t *geos) {
+#if GPKG_GEOM_FUNC == GPKG_GEOS
+  finishGEOS_r(geos);
+#else
+  geos->api.finishGEOS_r(geos->context);
+  sqlite3_free(geos);
+#endif
+}
+
+typedef struct {
+  long thread_id;
+  geos_handle_t *handle;
+} geos_thread_handle_t;
+
+/*
+ * The first handle of a pool is the one returned by geom_geos_init; it owns the GEOS library. The other handles are
+ * clones of it. Handles are assigned to thread ids rather than threads: when a thread exits its id is handed out again
+ * to the next thread that needs one, which takes over the handles of the exited thread. A pool therefore never holds
+ * more handles than the number of threads that used it at the same time.
+ */
+struct geos_handle_pool {
+  volatile long ref_count;
+  long id;
+  sqlite3_mutex *mutex;
+  geos_thread_handle_t *threads;
+  int thread_count;
+  int thread_capacity;
+};
+
+static volatile long geos_next_pool_id = 0;
+
+/*
+ * Thread id bookkeeping, protected by the static master mutex. The thread exit key only exists while there are pools,
+ * so that no callback into this library remains registered once it may be unloaded.
+ */
+static long geos_next_thread_id = 0;
+static long *geos_free_thread_ids = NULL;
+static int geos_free_thread_count = 0;
+static int geos_free_thread_capacity = 0;
+static int geos_pool_count = 0;
+static int geos_thread_exit_key_valid = 0;
+static thread_exit_key_t geos_thread_exit_key;
+
+static THREAD_EXIT_CALLBACK geom_geos_thread_exit(void *value) {
+  long thread_id = (long)(intptr_t)value;
+  sqlite3_mutex *master = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+
+  sqlite3_mutex_enter(master);
+  if (geos_thread_exit_key_valid && thread_id != 0) {
+    if (geos_free_thread_count == geos_free_thread_capacity) {
+      int new_capacity = geos_free_thread_capacity == 0 ? 16 : geos_free_thread_capacity * 2;
+      long *ids = (long*)sqlite3_realloc(geos_free_thread_ids, new_capacity * (int)sizeof(long));
+      if (ids != NULL) {
+        geos_free_thread_ids = ids;
+        geos_free_thread_capacity = new_capacity;
+      }
+    }
+    // If the list could not grow the id is simply not reused
+    if (geos_free_thread_count < geos_free_thread_capacity) {
+      geos_free_thread_ids[geos_free_thread_count++] = thread_id;
+    }
+  }
+  sqlite3_mutex_leave(master);
+}
+
+static long geom_geos_thread_id() {
+  long thread_id = (long)(intptr_t)GPKG_TLS_GET(geos_thread_id);
+  if (thread_id == 0) {
+    sqlite3_mutex *master = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+    sqlite3_mutex_enter(master);
+    if (geos_free_thread_count > 0) {
+      thread_id = geos_free_thread_ids[--geos_free_thread_count];
+    } else {
+      thread_id = ++geos_next_thread_id;
+    }
+    if (geos_thread_exit_key_valid) {
+      thread_exit_key_set(geos_thread_exit_key, (void*)(intptr_t)thread_id);
+    }
+    sqlite3_mutex_leave(master);
+    GPKG_TLS_SET(geos_thread_id, (void*)(intptr_t)thread_id);
+  }
+  return thread_id;
+}
+
+/*
+ * Makes sure the id of the calling thread is released when it exits. geom_geos_thread_id does this when it hands out
+ * an id, but the registration is lost when the last pool is destroyed, so it is repeated each time a thread is given a
+ * handle in a pool.
+ */
+static void geom_geos_thread_register(long thread_id) {
+  sqlite3_mutex *master = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+  sqlite3_mutex_enter(master);
+  if (geos_thread_exit_key_valid) {
+    thread_exit_key_set(geos_thread_exit_key, (void*)(intptr_t)thread_id);
+  }
+  sqlite3_mutex_leave(master);
+}
+
+static void geom_geos_pool_count_inc() {
+  sqlite3_mutex *master = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+  sqlite3_mutex_enter(master);
+  if (geos_pool_count++ == 0) {
+    geos_thread_exit_key_valid = thread_exit_key_create(&geos_thread_exit_key, geom_geos_thread_exit) == 0;
+  }
+  sqlite3_mutex_leave(master);
+}
+
+static void geom_geos_pool_count_dec() {
+  sqlite3_mutex *master = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+  sqlite3_mutex_enter(master);
+  if (--geos_pool_count == 0 && geos_thread_exit_key_valid) {
+    // Thread ids mean nothing without pools; release the list so nothing is left behind if the library is unloaded
+    geos_thread_exit_key_valid = 0;
+    thread_exit_key_delete(geos_thread_exit_key);
+    sqlite3_free(geos_free_thread_ids);
+    geos_free_thread_ids = NULL;
+    geos_free_thread_count = 0;
+    geos_free_thread_capacity = 0;
+  }
+  sqlite3_mutex_leave(master);
+}
+
+#if GPKG_GEOM_FUNC == GPKG_GEOS
+geos_handle_pool_t *geom_geos_pool_init(errorstream_t *error) {
+#else
+geos_handle_pool_t *geom_geos_pool_init(char const *geos_lib, errorstream_t *error) {
+#endif
+  GPKG_TLS_KEY_CREATE(geos_thread_id);
+  GPKG_TLS_KEY_CREATE(geos_pool_id);
+  GPKG_TLS_KEY_CREATE(geos_pool_handle);
+
+  geos_handle_pool_t *pool = (geos_handle_pool_t*)sqlite3_malloc(sizeof(geos_handle_pool_t));
+  if (pool == NULL) {
+    error_append(error, "Could not allocate memory for GEOS handle pool");
+    return NULL;
+  }
+  memset(pool, 0, sizeof(geos_handle_pool_t));
+
+  pool->threads = (geos_thread_handle_t*)sqlite3_malloc(4 * sizeof(geos_thread_handle_t));
+  if (pool->threads == NULL) {
+    error_append(error, "Could not allocate memory for GEOS handle pool");
+    goto error;
+  }
+  pool->thread_capacity = 4;
+
+#if GPKG_GEOM_FUNC == GPKG_GEOS
+  geos_handle_t *geos = geom_geos_init(error);
+#else
+  geos_handle_t *geos = geom_geos_init(geos_lib, error);
+#endif
+  if (geos == NULL) {
+    goto error;
+  }
+
+  geom_geos_pool_count_inc();
+
+  // The mutex is NULL if SQLite was built without thread support; the mutex functions accept that.
+  pool->mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+  pool->ref_count = 1;
+  pool->id = atomic_inc_long(&geos_next_pool_id);
+  pool->threads[0].thread_id = geom_geos_thread_id();
+  pool->threads[0].handle = geos;
+  pool->thread_count = 1;
+  geom_geos_thread_register(pool->threads[0].thread_id);
+
+  return pool;
+
+  error:
+  sqlite3_free(pool->threads);
+  sqlite3_free(pool);
+  return NULL;
+}
+
+geos_handle_t *geom_geos_pool_handle(geos_handle_pool_t *pool) {
+  // Fast path: the pool this thread used last
+  if ((long)(intptr_t)GPKG_TLS_GET(geos_pool_id) == pool->id) {
+    return (geos_handle_t*)GPKG_TLS_GET(geos_pool_handle);
+  }
+
+  long thread_id = geom_geos_thread_id();
+  geos_handle_t *handle = NULL;
+  int added = 0;
+
+  sqlite3_mutex_enter(pool->mutex);
+
+  for (int i = 0; i < pool->thread_count; i++) {
+    if (pool->threads[i].thread_id == thread_id) {
+      handle = pool->threads[i].handle;
+      break;
+    }
+  }
+
+  if (handle == NULL) {
+    if (pool->thread_count == pool->thread_capacity) {
+      int new_capacity = pool->thread_capacity * 2;
+      geos_thread_handle_t *threads = (geos_thread_handle_t*)sqlite3_realloc(pool->threads, new_capacity * (int)sizeof(geos_thread_handle_t));
+      if (threads == NULL) {
+        goto exit;
+      }
+      pool->threads = threads;
+      pool->thread_capacity = new_capacity;
+    }
+
+    handle = geom_geos_clone(pool->threads[0].handle);
+    if (handle == NULL) {
+      goto exit;
+    }
+
+    pool->threads[pool->thread_count].thread_id = thread_id;
+    pool->threads[pool->thread_count].handle = handle;
+    pool->thread_count++;
+    added = 1;
+  }
+
+  exit:
+  sqlite3_mutex_leave(pool->mutex);
+
+  if (added) {
+    geom_geos_thread_register(thread_id);
+  }
+
+  if (handle != NULL) {
+    GPKG_TLS_SET(geos_pool_id, (void*)(intptr_t)pool->id);
+    GPKG_TLS_SET(geos_pool_handle, handle);
+  }
+
+  return handle;
+}
+
+void geom_geos_pool_acquire(geos_handle_pool_t *pool) {
+  if (pool != NULL) {
+    atomic_inc_long(&pool->ref_count);
+  }
+}
+
+void geom_geos_pool_release(geos_handle_pool_t *pool) {
+  if (pool == NULL || atomic_dec_long(&pool->ref_count) > 0) {
+    return;
+  }
+
+  // Pool ids are never reused, so threads that still refer to this pool in their fast path will not find it again
+  for (int i = pool->thread_count - 1; i > 0; i--) {
+    geom_geos_destroy_clone(pool->threads[i].handle);
+  }
+  geom_geos_destroy(pool->threads[0].handle);
+
+  sqlite3_mutex_free(pool->mutex);
+  sqlite3_free(pool->threads);
+  sqlite3_free(pool);
+
+  geom_geos_pool_count_dec();
+}
+
+int geom_geos_pool_size(geos_handle_pool_t *pool) {
+  sqlite3_mutex_enter(pool->mutex);
+  int size = pool->thread_count;
+  sqlite3_mutex_leave(pool->mutex);
+  return size;
+}
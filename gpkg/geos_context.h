@@ -16,4 +16,39 @@ geos_handle_t *geom_geos_init(char const *geos_lib, errorstream_t *error);
 
 void geom_geos_destroy(geos_handle_t * geos);
 
+/**
+ * A pool of GEOS handles that hands out one handle per thread. GEOS handles must not be used by several threads at
+ * the same time, so code that may run on more than one thread should obtain its handle from a pool.
+ */
+typedef struct geos_handle_pool geos_handle_pool_t;
+
+#if GPKG_GEOM_FUNC == GPKG_GEOS
+geos_handle_pool_t *geom_geos_pool_init(errorstream_t *error);
+#else
+geos_handle_pool_t *geom_geos_pool_init(char const *geos_lib, errorstream_t *error);
+#endif
+
+/**
+ * Returns the GEOS handle of the calling thread, creating it if this thread has not used the pool before. Returns
+ * NULL if a new handle could not be created.
+ */
+geos_handle_t *geom_geos_pool_handle(geos_handle_pool_t *pool);
+
+/**
+ * Pools are reference counted. GEOS objects created with a handle from a pool may need the GEOS library after the code
+ * that created the pool is done with it; holding a reference to the pool keeps the library loaded.
+ */
+void geom_geos_pool_acquire(geos_handle_pool_t *pool);
+
+/**
+ * Releases a reference to a pool. The pool, its handles and the GEOS library are destroyed when the last reference is
+ * released. A pool returned by geom_geos_pool_init has a single reference.
+ */
+void geom_geos_pool_release(geos_handle_pool_t *pool);
+
+/**
+ * Returns the number of GEOS handles in a pool.
+ */
+int geom_geos_pool_size(geos_handle_pool_t *pool);
+
 #endif
@@ -13,21 +13,78 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include "atomic_ops.h"
 #include "geos_context.h"
 #include "geos_geom_io.h"
 #include "geom_func.h"
+#include "i18n.h"
+#include "rtree.h"
 #include "spatialdb_internal.h"
 #include "sql.h"
 #include "geos.h"
+#include "wkt.h"
+
+/*
+ * Small per-connection cache of decoded geometries. Analytic queries typically apply several functions to the same
+ * column value; sqlite3_get_auxdata only helps for constant arguments, so without this cache every function call
+ * decodes the blob again. Entries are looked up by a hash of the blob and verified by comparing the full blob.
+ */
+#define GEOS_GEOM_CACHE_SIZE 32
+#define GEOS_GEOM_CACHE_MAX_BYTES (4 * 1024 * 1024)
+
+struct geos_geometry;
+
+typedef struct {
+  struct geos_geometry *geometry;
+  uint8_t *blob;
+  size_t length;
+  uint32_t hash;
+  size_t cost;
+  unsigned long last_used;
+} geos_geom_cache_entry_t;
+
+#define GEOS_PREPARED_CACHE_CANDIDATES 64
+
+typedef struct {
+  geos_geom_cache_entry_t entries[GEOS_GEOM_CACHE_SIZE];
+  size_t cost;
+  unsigned long clock;
+  sqlite3_int64 hits;
+  sqlite3_int64 misses;
+  /*
+   * Hashes of the geometries that recently missed the prepared geometry cache on this connection.
+   */
+  uint32_t prepared_candidates[GEOS_PREPARED_CACHE_CANDIDATES];
+  int next_prepared_candidate;
+} geos_geom_cache_t;
 
 typedef struct {
   volatile long ref_count;
-  geos_handle_t *geos_handle;
+  /*
+   * GEOS handles, one per thread that uses this context.
+   */
+  geos_handle_pool_t *geos_pool;
+  /*
+   * The handle of the thread that loaded GEOS. It is only used to look up the GEOS version and the available GEOS
+   * functions; GEOS functions are always called using the handle of the calling thread.
+   */
+  geos_handle_t *geos_library;
   const spatialdb_t *spatialdb;
+  geos_geom_cache_t *geom_cache;
 } geos_context_t;
 
+static void geos_geom_cache_destroy(geos_geom_cache_t *cache);
+static void geos_prepared_cache_destroy();
+
+/*
+ * Number of live GEOS contexts in the process. The prepared geometry cache is emptied when it drops to zero, so that
+ * it does not keep GEOS libraries loaded or leak when the extension is unloaded.
+ */
+static volatile long geos_context_count = 0;
+
 #if GPKG_GEOM_FUNC == GPKG_GEOS
 static geos_context_t *geos_context_init(const spatialdb_t *spatialdb, errorstream_t *error) {
 #else
@@ -40,22 +97,40 @@ static geos_context_t *geos_context_init(spatialdb_t *spatialdb, char const *geo
   }
 
 #if GPKG_GEOM_FUNC == GPKG_GEOS
-  geos_handle_t *geos_handle = geom_geos_init(error);
+  geos_handle_pool_t *geos_pool = geom_geos_pool_init(error);
 #else
-  geos_handle_t *geos_handle = geom_geos_init(geos_lib, error);
+  geos_handle_pool_t *geos_pool = geom_geos_pool_init(geos_lib, error);
 #endif
 
-  if (geos_handle == NULL) {
+  if (geos_pool == NULL) {
     sqlite3_free(ctx);
     return NULL;
   }
 
   ctx->ref_count = 1;
-  ctx->geos_handle = geos_handle;
+  ctx->geos_pool = geos_pool;
+  ctx->geos_library = geom_geos_pool_handle(geos_pool);
   ctx->spatialdb = spatialdb;
+  // Running without a geometry cache is not an error
+  ctx->geom_cache = sqlite3_malloc(sizeof(geos_geom_cache_t));
+  if (ctx->geom_cache != NULL) {
+    memset(ctx->geom_cache, 0, sizeof(geos_geom_cache_t));
+  }
+  atomic_inc_long(&geos_context_count);
   return ctx;
 }
 
+/*
+ * Returns the GEOS handle that the calling thread should use for this context.
+ */
+static geos_handle_t *geos_context_handle(const geos_context_t *ctx, errorstream_t *error) {
+  geos_handle_t *geos = geom_geos_pool_handle(ctx->geos_pool);
+  if (geos == NULL) {
+    error_append(error, "Could not create GEOS handle");
+  }
+  return geos;
+}
+
 static void geos_context_acquire(geos_context_t *ctx) {
   if (ctx) {
     atomic_inc_long(&ctx->ref_count);
@@ -66,17 +141,29 @@ static void geos_context_release(geos_context_t *ctx) {
   if (ctx) {
     long newval = atomic_dec_long(&ctx->ref_count);
     if (newval == 0) {
-      geom_geos_destroy(ctx->geos_handle);
-      ctx->geos_handle = NULL;
+      geos_geom_cache_destroy(ctx->geom_cache);
+      ctx->geom_cache = NULL;
+      geom_geos_pool_release(ctx->geos_pool);
+      ctx->geos_pool = NULL;
+      ctx->geos_library = NULL;
       sqlite3_free(ctx);
+      if (atomic_dec_long(&geos_context_count) == 0) {
+        geos_prepared_cache_destroy();
+      }
     }
   }
 }
 
-typedef struct {
+typedef struct geos_geometry {
   GEOSGeometry* geometry;
   geos_handle_t *context;
   int srid;
+  /*
+   * Number of owners of this geometry: the caller that decoded or looked it up, the geometry cache and SQLite's
+   * auxiliary data. The geometry cache belongs to the connection the functions were registered on and geometries are
+   * only passed around while SQLite holds that connection's mutex, so the count does not need atomic updates.
+   */
+  int ref_count;
 } geos_geometry_t;
 
 static geos_geometry_t *get_geos_geom(sqlite3_context *context, const geos_context_t *geos_context, sqlite3_value *value, errorstream_t *error) {
@@ -89,11 +176,16 @@ static geos_geometry_t *get_geos_geom(sqlite3_context *context, const geos_conte
     return NULL;
   }
 
+  geos_handle_t *geos = geos_context_handle(geos_context, error);
+  if (geos == NULL) {
+    return NULL;
+  }
+
   binstream_t stream;
   binstream_init(&stream, blob, blob_length);
 
   geos_writer_t writer;
-  geos_writer_init_srid(&writer, geos_context->geos_handle, header.srid);
+  geos_writer_init_srid(&writer, geos, header.srid);
 
   geos_context->spatialdb->read_blob_header(&stream, &header, error);
   geos_context->spatialdb->read_geometry(&stream, geos_writer_geom_consumer(&writer), error);
@@ -110,9 +202,10 @@ static geos_geometry_t *get_geos_geom(sqlite3_context *context, const geos_conte
     return NULL;
   }
 
-  result->context = geos_context->geos_handle;
+  result->context = geos;
   result->geometry = g;
   result->srid = header.srid;
+  result->ref_count = 1;
 
   return result;
 }
@@ -123,6 +216,10 @@ static void free_geos_geom(void* data) {
   }
 
   geos_geometry_t* geom = (geos_geometry_t*)data;
+  if (--geom->ref_count > 0) {
+    return;
+  }
+
   GEOSGeom_destroy_r(geom->context, geom->geometry);
 
   geom->context = NULL;
@@ -131,29 +228,152 @@ static void free_geos_geom(void* data) {
   sqlite3_free(data);
 }
 
+/*
+ * Hashes the length and the first and last bytes of a blob. This is enough to tell geometries apart in practice; a
+ * hash match is always verified against the full blob.
+ */
+static uint32_t geos_geom_cache_hash(const uint8_t *blob, size_t length) {
+  uint32_t hash = 2166136261u ^ (uint32_t)length;
+  size_t head = length < 64 ? length : 64;
+  size_t tail = length - head < 64 ? length - head : 64;
+
+  for (size_t i = 0; i < head; i++) {
+    hash = (hash ^ blob[i]) * 16777619u;
+  }
+  for (size_t i = length - tail; i < length; i++) {
+    hash = (hash ^ blob[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static void geos_geom_cache_evict(geos_geom_cache_t *cache, geos_geom_cache_entry_t *entry) {
+  free_geos_geom(entry->geometry);
+  sqlite3_free(entry->blob);
+  cache->cost -= entry->cost;
+  memset(entry, 0, sizeof(geos_geom_cache_entry_t));
+}
+
+static void geos_geom_cache_destroy(geos_geom_cache_t *cache) {
+  if (cache == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < GEOS_GEOM_CACHE_SIZE; i++) {
+    if (cache->entries[i].geometry != NULL) {
+      geos_geom_cache_evict(cache, &cache->entries[i]);
+    }
+  }
+  sqlite3_free(cache);
+}
+
+static void geos_geom_cache_put(geos_geom_cache_t *cache, const uint8_t *blob, size_t length, uint32_t hash, geos_geometry_t *geometry) {
+  // The decoded geometry is assumed to take about twice the size of its blob
+  size_t cost = 2 * length + sizeof(geos_geometry_t);
+  if (cost > GEOS_GEOM_CACHE_MAX_BYTES / 4) {
+    return;
+  }
+
+  geos_geom_cache_entry_t *entry = NULL;
+  for (;;) {
+    geos_geom_cache_entry_t *lru = NULL;
+    entry = NULL;
+    for (int i = 0; i < GEOS_GEOM_CACHE_SIZE; i++) {
+      geos_geom_cache_entry_t *e = &cache->entries[i];
+      if (e->geometry == NULL) {
+        entry = e;
+      } else if (lru == NULL || e->last_used < lru->last_used) {
+        lru = e;
+      }
+    }
+
+    if (entry != NULL && cache->cost + cost <= GEOS_GEOM_CACHE_MAX_BYTES) {
+      break;
+    }
+    geos_geom_cache_evict(cache, lru);
+  }
+
+  entry->blob = sqlite3_malloc((int)length);
+  if (entry->blob == NULL) {
+    return;
+  }
+  memcpy(entry->blob, blob, length);
+  entry->length = length;
+  entry->hash = hash;
+  entry->cost = cost;
+  entry->last_used = ++cache->clock;
+  entry->geometry = geometry;
+  geometry->ref_count++;
+  cache->cost += cost;
+}
+
+/*
+ * Returns the decoded geometry for a blob value, either from the geometry cache or by decoding it. The caller owns one
+ * reference to the returned geometry.
+ */
+static geos_geometry_t *get_cached_geos_geom(sqlite3_context *context, const geos_context_t *geos_context, sqlite3_value *value, errorstream_t *error) {
+  geos_geom_cache_t *cache = geos_context->geom_cache;
+  const uint8_t *blob = (const uint8_t *)sqlite3_value_blob(value);
+  size_t blob_length = (size_t) sqlite3_value_bytes(value);
+
+  if (blob == NULL || cache == NULL) {
+    return get_geos_geom(context, geos_context, value, error);
+  }
+
+  uint32_t hash = geos_geom_cache_hash(blob, blob_length);
+  for (int i = 0; i < GEOS_GEOM_CACHE_SIZE; i++) {
+    geos_geom_cache_entry_t *entry = &cache->entries[i];
+    if (entry->geometry != NULL && entry->hash == hash && entry->length == blob_length && memcmp(entry->blob, blob, blob_length) == 0) {
+      cache->hits++;
+      entry->last_used = ++cache->clock;
+      entry->geometry->ref_count++;
+      return entry->geometry;
+    }
+  }
+
+  cache->misses++;
+  geos_geometry_t *geometry = get_geos_geom(context, geos_context, value, error);
+  if (geometry != NULL) {
+    geos_geom_cache_put(cache, blob, blob_length, hash, geometry);
+  }
+  return geometry;
+}
+
 typedef struct {
   const GEOSPreparedGeometry* geometry;
-  geos_handle_t *context;
+  GEOSGeometry *source;
+  /*
+   * The pool of the context that created the geometry. Prepared geometries can outlive that context through the
+   * prepared geometry cache; the reference to the pool keeps the GEOS library loaded until they are destroyed.
+   */
+  geos_handle_pool_t *geos_pool;
   int srid;
+  /*
+   * Number of owners of this geometry: its user and the prepared geometry cache.
+   */
+  volatile long ref_count;
+  /*
+   * GEOS builds the indexes of a prepared geometry lazily, so it must not be evaluated by several threads at the same
+   * time. A prepared geometry has at most one user, which has incremented this counter from 0 to 1.
+   */
+  volatile long in_use;
 } geos_prepared_geometry_t;
 
-static geos_prepared_geometry_t *get_geos_prepared_geom(sqlite3_context *context, const geos_context_t *geos_context, sqlite3_value *value, errorstream_t *error) {
-  geom_blob_header_t header;
-
-  uint8_t *blob = (uint8_t *)sqlite3_value_blob(value);
-  size_t blob_length = (size_t) sqlite3_value_bytes(value);
-
-  if (blob == NULL) {
+static geos_prepared_geometry_t *read_geos_prepared_geom(const geos_context_t *geos_context, uint8_t *blob, size_t blob_length, geom_blob_header_t *header, errorstream_t *error) {
+  geos_handle_t *geos = geos_context_handle(geos_context, error);
+  if (geos == NULL) {
     return NULL;
   }
 
   binstream_t stream;
   binstream_init(&stream, blob, blob_length);
 
+  if (geos_context->spatialdb->read_blob_header(&stream, header, error) != SQLITE_OK) {
+    return NULL;
+  }
+
   geos_writer_t writer;
-  geos_writer_init_srid(&writer, geos_context->geos_handle, header.srid);
+  geos_writer_init_srid(&writer, geos, header->srid);
 
-  geos_context->spatialdb->read_blob_header(&stream, &header, error);
   geos_context->spatialdb->read_geometry(&stream, geos_writer_geom_consumer(&writer), error);
 
   GEOSGeometry *g = geos_writer_getgeometry(&writer);
@@ -163,36 +383,350 @@ static geos_prepared_geometry_t *get_geos_prepared_geom(sqlite3_context *context
     return NULL;
   }
 
-  struct GEOSPrepGeom_t const *prepared_g = GEOSPrepare_r(geos_context->geos_handle, g);
+  struct GEOSPrepGeom_t const *prepared_g = GEOSPrepare_r(geos, g);
   if (prepared_g == NULL) {
+    GEOSGeom_destroy_r(geos, g);
     return NULL;
   }
 
   geos_prepared_geometry_t *result = sqlite3_malloc(sizeof(geos_prepared_geometry_t));
   if (result == NULL) {
-    GEOSPreparedGeom_destroy_r(geos_context->geos_handle, prepared_g);
+    GEOSPreparedGeom_destroy_r(geos, prepared_g);
+    GEOSGeom_destroy_r(geos, g);
     return NULL;
   }
 
-  result->context = geos_context->geos_handle;
+  geom_geos_pool_acquire(geos_context->geos_pool);
+  result->geos_pool = geos_context->geos_pool;
   result->geometry = prepared_g;
-  result->srid = header.srid;
+  result->source = g;
+  result->srid = header->srid;
+  result->ref_count = 1;
+  result->in_use = 1;
 
   return result;
 }
 
+static void release_geos_prepared_geom(geos_prepared_geometry_t *geom) {
+  if (atomic_dec_long(&geom->ref_count) > 0) {
+    return;
+  }
+
+  // The last owner may be on any thread, and its GEOS handle on any connection
+  geos_handle_t *geos = geom_geos_pool_handle(geom->geos_pool);
+  if (geos != NULL) {
+    GEOSPreparedGeom_destroy_r(geos, geom->geometry);
+    GEOSGeom_destroy_r(geos, geom->source);
+  }
+  geom_geos_pool_release(geom->geos_pool);
+
+  geom->geos_pool = NULL;
+  geom->geometry = NULL;
+  geom->source = NULL;
+
+  sqlite3_free(geom);
+}
+
+/*
+ * Releases a prepared geometry obtained from get_geos_prepared_geom or read_geos_prepared_geom.
+ */
 static void free_geos_prepared_geom(void* data) {
   if (data == NULL) {
     return;
   }
 
   geos_prepared_geometry_t* geom = (geos_prepared_geometry_t*)data;
-  GEOSPreparedGeom_destroy_r(geom->context, geom->geometry);
+  atomic_dec_long(&geom->in_use);
+  release_geos_prepared_geom(geom);
+}
 
-  geom->context = NULL;
-  geom->geometry = NULL;
+/*
+ * Process wide cache of prepared geometries. sqlite3_get_auxdata only keeps a prepared geometry for the duration of
+ * a single statement; applications that run many short statements against the same query geometries would prepare
+ * those again and again.
+ * Entries are shared by all connections that use the same GEOS library. A geometry is only added to the cache the
+ * second time it misses on the same connection, so that scans over a non-constant argument do not flush the cache.
+ * Such scans miss on every row; the resident counts let them find out without taking the cache mutex.
+ */
+#define GEOS_PREPARED_CACHE_SIZE 64
+#define GEOS_PREPARED_CACHE_MAX_BYTES (16 * 1024 * 1024)
+#define GEOS_PREPARED_CACHE_RESIDENT 256
 
-  sqlite3_free(data);
+typedef struct {
+  geos_prepared_geometry_t *geometry;
+  const void *library;
+  const spatialdb_t *spatialdb;
+  uint8_t *blob;
+  size_t length;
+  uint32_t hash;
+  size_t cost;
+  unsigned long last_used;
+} geos_prepared_cache_entry_t;
+
+static struct {
+  sqlite3_mutex *mutex;
+  int initialized;
+  geos_prepared_cache_entry_t entries[GEOS_PREPARED_CACHE_SIZE];
+  /*
+   * Number of entries per hash bucket. These are updated while holding the mutex, but read without it; a stale count
+   * only costs a needless lookup or a missed hit.
+   */
+  volatile long resident[GEOS_PREPARED_CACHE_RESIDENT];
+  size_t cost;
+  unsigned long clock;
+  volatile long hits;
+  volatile long misses;
+} geos_prepared_cache;
+
+#if GPKG_GEOM_FUNC == GPKG_GEOS
+#define GEOS_LIBRARY(ctx) NULL
+#else
+#define GEOS_LIBRARY(ctx) ((const void *)(ctx)->geos_library->geos_lib)
+#endif
+
+static void geos_prepared_cache_init() {
+  // The mutex is NULL if SQLite was built without thread support; the mutex functions accept that.
+  sqlite3_mutex *mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+  sqlite3_mutex *master = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+  sqlite3_mutex_enter(master);
+  if (!geos_prepared_cache.initialized) {
+    geos_prepared_cache.mutex = mutex;
+    geos_prepared_cache.initialized = 1;
+    mutex = NULL;
+  }
+  sqlite3_mutex_leave(master);
+  sqlite3_mutex_free(mutex);
+}
+
+static void geos_prepared_cache_evict(geos_prepared_cache_entry_t *entry) {
+  atomic_dec_long(&geos_prepared_cache.resident[entry->hash % GEOS_PREPARED_CACHE_RESIDENT]);
+  release_geos_prepared_geom(entry->geometry);
+  sqlite3_free(entry->blob);
+  geos_prepared_cache.cost -= entry->cost;
+  memset(entry, 0, sizeof(geos_prepared_cache_entry_t));
+}
+
+static void geos_prepared_cache_destroy() {
+  geos_prepared_geometry_t *evicted[GEOS_PREPARED_CACHE_SIZE];
+  int evicted_count = 0;
+
+  sqlite3_mutex *master = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+  sqlite3_mutex_enter(master);
+  // A new context may have been created in the meantime
+  if (geos_context_count == 0 && geos_prepared_cache.initialized) {
+    for (int i = 0; i < GEOS_PREPARED_CACHE_SIZE; i++) {
+      geos_prepared_geometry_t *geometry = geos_prepared_cache.entries[i].geometry;
+      if (geometry != NULL) {
+        atomic_inc_long(&geometry->ref_count);
+        evicted[evicted_count++] = geometry;
+        geos_prepared_cache_evict(&geos_prepared_cache.entries[i]);
+      }
+    }
+    sqlite3_mutex_free(geos_prepared_cache.mutex);
+    geos_prepared_cache.mutex = NULL;
+    geos_prepared_cache.initialized = 0;
+  }
+  sqlite3_mutex_leave(master);
+
+  // Releasing the last geometry of a GEOS handle pool destroys the pool, which needs the master mutex itself
+  for (int i = 0; i < evicted_count; i++) {
+    release_geos_prepared_geom(evicted[i]);
+  }
+}
+
+/*
+ * Returns 1 if a geometry with the given hash missed recently on the connection that owns the geometry cache and
+ * records it as a candidate otherwise.
+ */
+static int geos_prepared_cache_admit(geos_geom_cache_t *cache, uint32_t hash) {
+  if (cache == NULL) {
+    return 0;
+  }
+
+  for (int i = 0; i < GEOS_PREPARED_CACHE_CANDIDATES; i++) {
+    if (cache->prepared_candidates[i] == hash) {
+      return 1;
+    }
+  }
+  cache->prepared_candidates[cache->next_prepared_candidate] = hash;
+  cache->next_prepared_candidate = (cache->next_prepared_candidate + 1) % GEOS_PREPARED_CACHE_CANDIDATES;
+  return 0;
+}
+
+static void geos_prepared_cache_put(const geos_context_t *geos_context, const uint8_t *blob, size_t length, uint32_t hash, geos_prepared_geometry_t *geometry) {
+  // The prepared geometry and its indexes are assumed to take about four times the size of its blob
+  size_t cost = 4 * length + sizeof(geos_prepared_geometry_t);
+  if (cost > GEOS_PREPARED_CACHE_MAX_BYTES / 4) {
+    return;
+  }
+
+  geos_prepared_cache_entry_t *entry = NULL;
+  for (;;) {
+    geos_prepared_cache_entry_t *lru = NULL;
+    entry = NULL;
+    for (int i = 0; i < GEOS_PREPARED_CACHE_SIZE; i++) {
+      geos_prepared_cache_entry_t *e = &geos_prepared_cache.entries[i];
+      if (e->geometry == NULL) {
+        entry = e;
+      } else if (lru == NULL || e->last_used < lru->last_used) {
+        lru = e;
+      }
+    }
+
+    if (entry != NULL && geos_prepared_cache.cost + cost <= GEOS_PREPARED_CACHE_MAX_BYTES) {
+      break;
+    }
+    geos_prepared_cache_evict(lru);
+  }
+
+  entry->blob = sqlite3_malloc((int)length);
+  if (entry->blob == NULL) {
+    return;
+  }
+  memcpy(entry->blob, blob, length);
+  entry->library = GEOS_LIBRARY(geos_context);
+  entry->spatialdb = geos_context->spatialdb;
+  entry->length = length;
+  entry->hash = hash;
+  entry->cost = cost;
+  entry->last_used = ++geos_prepared_cache.clock;
+  entry->geometry = geometry;
+  atomic_inc_long(&geometry->ref_count);
+  atomic_inc_long(&geos_prepared_cache.resident[hash % GEOS_PREPARED_CACHE_RESIDENT]);
+  geos_prepared_cache.cost += cost;
+}
+
+/*
+ * Returns a prepared geometry for a blob, either from the prepared geometry cache or by decoding and preparing it. The
+ * caller is the only user of the returned geometry until it calls free_geos_prepared_geom. If the cached geometry is
+ * being used by another statement, a private copy is prepared instead.
+ */
+static geos_prepared_geometry_t *get_cached_geos_prepared_geom(const geos_context_t *geos_context, uint8_t *blob, size_t blob_length, geom_blob_header_t *header, errorstream_t *error) {
+  geos_prepared_geometry_t *geometry = NULL;
+  uint32_t hash = geos_geom_cache_hash(blob, blob_length);
+  const void *library = GEOS_LIBRARY(geos_context);
+  int admit = 0;
+
+  if (atomic_get_long(&geos_prepared_cache.resident[hash % GEOS_PREPARED_CACHE_RESIDENT]) > 0) {
+    sqlite3_mutex_enter(geos_prepared_cache.mutex);
+    for (int i = 0; i < GEOS_PREPARED_CACHE_SIZE; i++) {
+      geos_prepared_cache_entry_t *entry = &geos_prepared_cache.entries[i];
+      if (entry->geometry != NULL && entry->hash == hash && entry->length == blob_length
+          && entry->library == library && entry->spatialdb == geos_context->spatialdb
+          && memcmp(entry->blob, blob, blob_length) == 0) {
+        if (atomic_inc_long(&entry->geometry->in_use) == 1) {
+          geometry = entry->geometry;
+          atomic_inc_long(&geometry->ref_count);
+          entry->last_used = ++geos_prepared_cache.clock;
+        } else {
+          atomic_dec_long(&entry->geometry->in_use);
+        }
+        break;
+      }
+    }
+    sqlite3_mutex_leave(geos_prepared_cache.mutex);
+  }
+
+  if (geometry != NULL) {
+    atomic_inc_long(&geos_prepared_cache.hits);
+  } else {
+    atomic_inc_long(&geos_prepared_cache.misses);
+    admit = geos_prepared_cache_admit(geos_context->geom_cache, hash);
+  }
+
+  if (geometry != NULL) {
+    binstream_t stream;
+    binstream_init(&stream, blob, blob_length);
+    if (geos_context->spatialdb->read_blob_header(&stream, header, error) != SQLITE_OK) {
+      free_geos_prepared_geom(geometry);
+      return NULL;
+    }
+    return geometry;
+  }
+
+  geometry = read_geos_prepared_geom(geos_context, blob, blob_length, header, error);
+  if (geometry != NULL && admit) {
+    sqlite3_mutex_enter(geos_prepared_cache.mutex);
+    geos_prepared_cache_put(geos_context, blob, blob_length, hash, geometry);
+    sqlite3_mutex_leave(geos_prepared_cache.mutex);
+  }
+  return geometry;
+}
+
+static geos_prepared_geometry_t *get_geos_prepared_geom(sqlite3_context *context, const geos_context_t *geos_context, sqlite3_value *value, errorstream_t *error) {
+  geom_blob_header_t header;
+
+  uint8_t *blob = (uint8_t *)sqlite3_value_blob(value);
+  size_t blob_length = (size_t) sqlite3_value_bytes(value);
+
+  if (blob == NULL) {
+    return NULL;
+  }
+
+  return get_cached_geos_prepared_geom(geos_context, blob, blob_length, &header, error);
+}
+
+typedef enum {
+  ENVELOPE_INTERSECTS,
+  ENVELOPE_WITHIN,
+  ENVELOPE_CONTAINS
+} envelope_relation_t;
+
+static int envelope_matches(envelope_relation_t relation, const geom_envelope_t *candidate, const geom_envelope_t *query) {
+  switch (relation) {
+    case ENVELOPE_WITHIN:
+      return candidate->min_x >= query->min_x && candidate->max_x <= query->max_x
+             && candidate->min_y >= query->min_y && candidate->max_y <= query->max_y;
+    case ENVELOPE_CONTAINS:
+      return candidate->min_x <= query->min_x && candidate->max_x >= query->max_x
+             && candidate->min_y <= query->min_y && candidate->max_y >= query->max_y;
+    default:
+      return candidate->min_x <= query->max_x && candidate->max_x >= query->min_x
+             && candidate->min_y <= query->max_y && candidate->max_y >= query->min_y;
+  }
+}
+
+/*
+ * Reads the blob header of a geometry argument. Returns 1 if the value is a geometry blob with a non-empty envelope in
+ * its header and 0 otherwise.
+ */
+static int read_header_envelope(const geos_context_t *geos_context, sqlite3_value *value, geom_blob_header_t *header) {
+  uint8_t *blob = (uint8_t *)sqlite3_value_blob(value);
+  size_t blob_length = (size_t) sqlite3_value_bytes(value);
+
+  if (blob == NULL) {
+    return 0;
+  }
+
+  binstream_t stream;
+  binstream_init(&stream, blob, blob_length);
+
+  if (geos_context->spatialdb->read_blob_header(&stream, header, NULL) != SQLITE_OK) {
+    return 0;
+  }
+
+  return !header->empty && header->envelope.has_env_x && header->envelope.has_env_y;
+}
+
+/*
+ * Evaluates a binary predicate using only the envelopes in the blob headers of its arguments. The predicate can only
+ * hold if envelope_matches(relation, a, b) does; when it does not, the result of the predicate is mismatch_result.
+ * Returns -1 if the envelopes do not settle the result and the geometries themselves need to be compared. That
+ * includes arguments without an envelope in their header, empty geometries and arguments with different SRIDs.
+ */
+static int envelope_predicate(const geos_context_t *geos_context, envelope_relation_t relation, int mismatch_result, sqlite3_value *a, sqlite3_value *b) {
+  geom_blob_header_t header_a;
+  geom_blob_header_t header_b;
+
+  if (!read_header_envelope(geos_context, a, &header_a) || !read_header_envelope(geos_context, b, &header_b)) {
+    return -1;
+  }
+
+  if (header_a.srid != header_b.srid) {
+    return -1;
+  }
+
+  return envelope_matches(relation, &header_a.envelope, &header_b.envelope) ? -1 : mismatch_result;
 }
 
 static int set_geos_geom_result(sqlite3_context *context, const geos_context_t *geos_context, const GEOSGeometry *geom, errorstream_t *error) {
@@ -202,10 +736,16 @@ static int set_geos_geom_result(sqlite3_context *context, const geos_context_t *
     sqlite3_result_null(context);
     return result;
   } else {
+    geos_handle_t *geos = geos_context_handle(geos_context, error);
+    if (geos == NULL) {
+      sqlite3_result_error(context, error_message(error), -1);
+      return SQLITE_NOMEM;
+    }
+
     geom_blob_writer_t writer;
-    geos_context->spatialdb->writer_init_srid(&writer, GEOSGetSRID_r(geos_context->geos_handle, geom));
+    geos_context->spatialdb->writer_init_srid(&writer, GEOSGetSRID_r(geos, geom));
 
-    result = geos_read_geometry(geos_context->geos_handle, geom, geom_blob_writer_geom_consumer(&writer), error);
+    result = geos_read_geometry(geos, geom, geom_blob_writer_geom_consumer(&writer), error);
 
     if (result == SQLITE_OK) {
       sqlite3_result_blob(context, geom_blob_writer_getdata(&writer), geom_blob_writer_length(&writer), sqlite3_free);
@@ -223,15 +763,20 @@ static int set_geos_geom_result(sqlite3_context *context, const geos_context_t *
   const geos_context_t *geos_context = (const geos_context_t *)sqlite3_user_data(context); \
   char error_buffer[256];\
   errorstream_t error;\
-  error_init_fixed(&error, error_buffer, 256)
+  error_init_fixed(&error, error_buffer, 256);\
+  geos_handle_t *geos_handle = geos_context_handle(geos_context, &error);\
+  if (geos_handle == NULL) {\
+    sqlite3_result_error(context, error_message(&error), -1);\
+    return;\
+  }
 #define GEOS_CONTEXT geos_context
-#define GEOS_HANDLE geos_context->geos_handle
+#define GEOS_HANDLE geos_handle
 
 #define GEOS_GET_GEOM(name, args, i) \
   const geos_geometry_t *name = sqlite3_get_auxdata(context, i); \
   int name##_set_auxdata = 0; \
   if (name == NULL) { \
-    name = get_geos_geom( context, geos_context, args[i], &error ); \
+    name = get_cached_geos_geom( context, geos_context, args[i], &error ); \
     name##_set_auxdata = 1;\
   }
 #define GEOS_FREE_GEOM(name, i) \
@@ -306,6 +851,8 @@ static int set_geos_geom_result(sqlite3_context *context, const geos_context_t *
     } else {\
       sqlite3_result_null(context);\
     }\
+    GEOS_FREE_GEOM( g1, 0 );\
+    GEOS_FREE_GEOM( g2, 1 );\
     return;\
   }\
   int srid1 = g1->srid;\
@@ -313,6 +860,8 @@ static int set_geos_geom_result(sqlite3_context *context, const geos_context_t *
   if (srid1 != srid2 ) {\
     error_append(&error, "Cannot apply %s when SRIDs differ: %d != %d", #name, srid1, srid2);\
     sqlite3_result_error(context, error_message(&error), -1);\
+    GEOS_FREE_GEOM( g1, 0 );\
+    GEOS_FREE_GEOM( g2, 1 );\
     return;\
   }\
   char result = GEOS##name##_r(GEOS_HANDLE, g1->geometry, g2->geometry);\
@@ -326,8 +875,13 @@ static int set_geos_geom_result(sqlite3_context *context, const geos_context_t *
   GEOS_FREE_GEOM( g2, 1 );\
 }
 
-#define GEOS_FUNC_PREPGEOM_GEOM__INTEGER(name) static void ST_##name(sqlite3_context *context, int nbArgs, sqlite3_value **args) {\
+#define GEOS_FUNC_PREPGEOM_GEOM__INTEGER(name, relation, mismatch_result) static void ST_##name(sqlite3_context *context, int nbArgs, sqlite3_value **args) {\
   GEOS_START(context);\
+  int envelope_result = envelope_predicate(GEOS_CONTEXT, relation, mismatch_result, args[0], args[1]);\
+  if (envelope_result >= 0) {\
+    sqlite3_result_int(context, envelope_result);\
+    return;\
+  }\
   GEOS_GET_PREPARED_GEOM( g1, args, 0 );\
   GEOS_GET_GEOM( g2, args, 1 );\
   if (g1 == NULL || g2 == NULL) {\
@@ -336,6 +890,8 @@ static int set_geos_geom_result(sqlite3_context *context, const geos_context_t *
     } else {\
       sqlite3_result_null(context);\
     }\
+    GEOS_FREE_PREPARED_GEOM( g1, 0 );\
+    GEOS_FREE_GEOM( g2, 1 );\
     return;\
   }\
   int srid1 = g1->srid;\
@@ -343,6 +899,8 @@ static int set_geos_geom_result(sqlite3_context *context, const geos_context_t *
   if (srid1 != srid2 ) {\
     error_append(&error, "Cannot apply %s when SRIDs differ: %d != %d", #name, srid1, srid2);\
     sqlite3_result_error(context, error_message(&error), -1);\
+    GEOS_FREE_PREPARED_GEOM( g1, 0 );\
+    GEOS_FREE_GEOM( g2, 1 );\
     return;\
   }\
   char result = GEOSPrepared##name##_r(GEOS_HANDLE, g1->geometry, g2->geometry);\
@@ -353,7 +911,7 @@ static int set_geos_geom_result(sqlite3_context *context, const geos_context_t *
     sqlite3_result_int(context, result);\
   }\
   GEOS_FREE_PREPARED_GEOM( g1, 0 );\
-  GEOS_FREE_GEOM( g2, 0 );\
+  GEOS_FREE_GEOM( g2, 1 );\
 }
 
 #define GEOS_FUNC_GEOM__DOUBLE(name) static void ST_##name(sqlite3_context *context, int nbArgs, sqlite3_value **args) {\
@@ -388,6 +946,8 @@ static int set_geos_geom_result(sqlite3_context *context, const geos_context_t *
     } else {\
       sqlite3_result_null(context);\
     }\
+    GEOS_FREE_GEOM( g1, 0 );\
+    GEOS_FREE_GEOM( g2, 1 );\
     return;\
   }\
   int srid1 = g1->srid;\
@@ -395,6 +955,8 @@ static int set_geos_geom_result(sqlite3_context *context, const geos_context_t *
   if (srid1 != srid2 ) {\
     error_append(&error, "Cannot apply %s when SRIDs differ: %d != %d", #name, srid1, srid2);\
     sqlite3_result_error(context, error_message(&error), -1);\
+    GEOS_FREE_GEOM( g1, 0 );\
+    GEOS_FREE_GEOM( g2, 1 );\
     return;\
   }\
   double val;\
@@ -464,6 +1026,8 @@ static int set_geos_geom_result(sqlite3_context *context, const geos_context_t *
     } else {\
       sqlite3_result_null(context);\
     }\
+    GEOS_FREE_GEOM( g1, 0 );\
+    GEOS_FREE_GEOM( g2, 1 );\
     return;\
   }\
   int srid1 = g1->srid;\
@@ -471,6 +1035,8 @@ static int set_geos_geom_result(sqlite3_context *context, const geos_context_t *
   if (srid1 != srid2 ) {\
     error_append(&error, "Cannot apply %s when SRIDs differ: %d != %d", #name, srid1, srid2);\
     sqlite3_result_error(context, error_message(&error), -1);\
+    GEOS_FREE_GEOM( g1, 0 );\
+    GEOS_FREE_GEOM( g2, 1 );\
     return;\
   }\
   GEOSGeometry *result = GEOS##name##_r(GEOS_HANDLE, g1->geometry, g2->geometry);\
@@ -496,6 +1062,8 @@ static void ST_Relate(sqlite3_context *context, int nbArgs, sqlite3_value **args
     } else {
       sqlite3_result_null(context);
     }
+    GEOS_FREE_GEOM(g1, 0);
+    GEOS_FREE_GEOM(g2, 1);
     return;
   }
 
@@ -542,13 +1110,13 @@ GEOS_FUNC_GEOM__INTEGER_(IsRing, isRing)
 
 GEOS_FUNC_GEOM__INTEGER_(IsValid, isValid)
 
-GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Disjoint)
-GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Intersects)
-GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Touches)
-GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Crosses)
-GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Within)
-GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Contains)
-GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Overlaps)
+GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Disjoint, ENVELOPE_INTERSECTS, 1)
+GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Intersects, ENVELOPE_INTERSECTS, 0)
+GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Touches, ENVELOPE_INTERSECTS, 0)
+GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Crosses, ENVELOPE_INTERSECTS, 0)
+GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Within, ENVELOPE_WITHIN, 0)
+GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Contains, ENVELOPE_CONTAINS, 0)
+GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Overlaps, ENVELOPE_INTERSECTS, 0)
 
 GEOS_FUNC_GEOM_GEOM__INTEGER(Equals)
 
@@ -583,59 +1151,1391 @@ GEOS_FUNC_GEOM_GEOM__GEOM(Union)
 
 #if GPKG_GEOM_FUNC == GPKG_GEOS_DL || (GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 3))
 GEOS_FUNC_GEOM__INTEGER_(IsClosed, isClosed)
-GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Covers)
-GEOS_FUNC_PREPGEOM_GEOM__INTEGER(CoveredBy)
-#endif
+GEOS_FUNC_PREPGEOM_GEOM__INTEGER(Covers, ENVELOPE_CONTAINS, 0)
+GEOS_FUNC_PREPGEOM_GEOM__INTEGER(CoveredBy, ENVELOPE_WITHIN, 0)
 
-static void GPKG_GEOSVersion(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
-  const geos_context_t *geos_context = (const geos_context_t *)sqlite3_user_data(context);
-  sqlite3_result_text(context, GEOSversion(geos_context->geos_handle), -1, SQLITE_TRANSIENT);
-}
+/*
+ * ST_Union(geom) aggregate. The step function only decodes its argument; the final function merges all geometries at
+ * once using GEOSUnaryUnion, which is much faster than a sequence of pairwise unions.
+ */
+typedef struct {
+  GEOSGeometry **geometries;
+  unsigned int count;
+  unsigned int capacity;
+  int srid;
+} geos_union_t;
 
-#define STR(x) #x
+static void ST_Union_step(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  GEOS_START(context);
 
-#if GPKG_GEOM_FUNC == GPKG_GEOS_DL
-#define GEOS_FUNC_AVAILABLE(ctx, name) (ctx->geos_handle->api.name != NULL)
-#else
-#define GEOS_FUNC_AVAILABLE(ctx, name) 1
-#endif
+  geos_union_t *geos_union = (geos_union_t *)sqlite3_aggregate_context(context, sizeof(geos_union_t));
+  if (geos_union == NULL) {
+    sqlite3_result_error_nomem(context);
+    return;
+  }
 
-#define GEOS_FUNCTION4(db, name, funcName, geosName, nbArgs, ctx, error)                                               \
-  do {                                                                                                                 \
-    if (GEOS_FUNC_AVAILABLE(ctx,geosName)) {                                                                           \
-      geos_context_acquire(ctx);                                                                                       \
-      sql_create_function(db, name, funcName, nbArgs, SQL_DETERMINISTIC, ctx, (void(*)(void*))geos_context_release, error);     \
-    }                                                                                                                  \
-} while (0)
+  geos_geometry_t *g = get_geos_geom(context, GEOS_CONTEXT, args[0], &error);
+  if (g == NULL) {
+    if (error_count(&error) > 0) {
+      sqlite3_result_error(context, error_message(&error), -1);
+    }
+    return;
+  }
 
-#define GEOS_FUNCTION3(db, prefix, name, geosName, nbArgs, ctx, error)                                                 \
-  GEOS_FUNCTION4(db, STR(name), prefix##_##name, geosName, nbArgs, ctx, error);                                        \
-  GEOS_FUNCTION4(db, STR(prefix##_##name), prefix##_##name, geosName, nbArgs, ctx, error);
+  if (geos_union->count > 0 && geos_union->srid != g->srid) {
+    error_append(&error, "Cannot apply Union when SRIDs differ: %d != %d", geos_union->srid, g->srid);
+    sqlite3_result_error(context, error_message(&error), -1);
+    free_geos_geom(g);
+    return;
+  }
 
-#define GEOS_FUNCTION(db, prefix, name, nbArgs, ctx, error) GEOS_FUNCTION2(db, prefix, name, name, nbArgs, ctx, error)
-#define GEOS_FUNCTION2(db, prefix, name, geosname, nbArgs, ctx, error) GEOS_FUNCTION3(db, prefix, name, GEOS##geosname##_r, nbArgs, ctx, error)
-#define GEOS_FUNCTION_PREP(db, prefix, name, nbArgs, ctx, error) GEOS_FUNCTION2(db, prefix, name, Prepared##name, nbArgs, ctx, error)
+  if (geos_union->count == geos_union->capacity) {
+    unsigned int capacity = geos_union->capacity == 0 ? 64 : geos_union->capacity * 2;
+    GEOSGeometry **geometries = (GEOSGeometry **)sqlite3_realloc64(geos_union->geometries, capacity * sizeof(GEOSGeometry *));
+    if (geometries == NULL) {
+      sqlite3_result_error_nomem(context);
+      free_geos_geom(g);
+      return;
+    }
+    geos_union->geometries = geometries;
+    geos_union->capacity = capacity;
+  }
 
-static void geom_func_register(sqlite3 *db, errorstream_t *error, geos_context_t *ctx) {
-  char const *geos_version = GEOSversion(ctx->geos_handle);
-  int geos_major;
-  int geos_minor;
-  int geos_version_result = sscanf(geos_version, "%d.%d", &geos_major, &geos_minor);
-  if (geos_version_result != 2) {
-    error_append(error, "Could not parse GEOS version number (%s)", geos_version);
+  // Take over the decoded geometry
+  geos_union->geometries[geos_union->count++] = g->geometry;
+  geos_union->srid = g->srid;
+  sqlite3_free(g);
+}
+
+static void ST_Union_final(sqlite3_context *context) {
+  geos_union_t *geos_union = (geos_union_t *)sqlite3_aggregate_context(context, 0);
+  if (geos_union == NULL || geos_union->count == 0) {
+    sqlite3_result_null(context);
+    return;
   }
 
-  GEOS_FUNCTION(db, ST, Area, 1, ctx, error);
-  GEOS_FUNCTION4(db, "ST_Length", ST_Length, GEOSLength_r, 1, ctx, error);
-  GEOS_FUNCTION4(db, "GLength", ST_Length, GEOSLength_r, 1, ctx, error);
+  GEOS_START(context);
 
-  GEOS_FUNCTION2(db, ST, IsSimple, isSimple, 1, ctx, error);
-  GEOS_FUNCTION2(db, ST, IsRing, isRing, 1, ctx, error);
-  GEOS_FUNCTION2(db, ST, IsValid, isValid, 1, ctx, error);
+  // The collection takes ownership of the geometries
+  GEOSGeometry *collection = GEOSGeom_createCollection_r(GEOS_HANDLE, GEOS_GEOMETRYCOLLECTION, geos_union->geometries, geos_union->count);
+  if (collection == NULL) {
+    for (unsigned int i = 0; i < geos_union->count; i++) {
+      GEOSGeom_destroy_r(GEOS_HANDLE, geos_union->geometries[i]);
+    }
+  }
+  sqlite3_free(geos_union->geometries);
+  geos_union->geometries = NULL;
+  geos_union->count = 0;
 
-  GEOS_FUNCTION_PREP(db, ST, Disjoint, 2, ctx, error);
-  GEOS_FUNCTION_PREP(db, ST, Intersects, 2, ctx, error);
-  GEOS_FUNCTION_PREP(db, ST, Touches, 2, ctx, error);
+  GEOSGeometry *result = collection != NULL ? GEOSUnaryUnion_r(GEOS_HANDLE, collection) : NULL;
+  if (result == NULL) {
+    geom_geos_get_error(&error);
+    sqlite3_result_error(context, error_message(&error), -1);
+  } else {
+    GEOSSetSRID_r(GEOS_HANDLE, result, geos_union->srid);
+    set_geos_geom_result(context, GEOS_CONTEXT, result, &error);
+    GEOSGeom_destroy_r(GEOS_HANDLE, result);
+  }
+
+  if (collection != NULL) {
+    GEOSGeom_destroy_r(GEOS_HANDLE, collection);
+  }
+}
+#endif
+
+static void GPKG_GEOSVersion(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  const geos_context_t *geos_context = (const geos_context_t *)sqlite3_user_data(context);
+  sqlite3_result_text(context, GEOSversion(geos_context->geos_library), -1, SQLITE_TRANSIENT);
+}
+
+#define STR(x) #x
+
+#define GEOS_FUNC_AVAILABLE(ctx, name) GEOS_API_AVAILABLE(ctx->geos_library, name)
+
+/*
+ * gpkg_spatial_query(table_name, column_name, geometry [, predicate])
+ *
+ * Table valued function that returns the rows of a table whose geometry satisfies a spatial predicate with respect to
+ * a query geometry. The predicate is evaluated as ST_<predicate>(column, geometry) and defaults to 'intersects'. The
+ * 'envelope' predicate selects the rows whose envelope intersects the envelope of the query geometry.
+ * Candidate rows are obtained from the spatial index of the column and are checked against the envelope in their blob
+ * header before the exact predicate is evaluated using a prepared version of the query geometry. The query geometry
+ * can be passed as a geometry blob or as well-known text.
+ */
+#define SPATIAL_QUERY_COLUMN_ID 0
+#define SPATIAL_QUERY_COLUMN_GEOMETRY 1
+#define SPATIAL_QUERY_COLUMN_TABLE_NAME 2
+#define SPATIAL_QUERY_ARG_COUNT 4
+#define SPATIAL_QUERY_REQUIRED_ARGS 0x7
+
+typedef enum {
+  PREDICATE_INTERSECTS,
+  PREDICATE_TOUCHES,
+  PREDICATE_CROSSES,
+  PREDICATE_OVERLAPS,
+  PREDICATE_WITHIN,
+  PREDICATE_CONTAINS,
+  PREDICATE_COVERS,
+  PREDICATE_COVEREDBY,
+  /*
+   * Only compares the envelopes of the geometries; GEOS is not used.
+   */
+  PREDICATE_ENVELOPE
+} spatial_predicate_t;
+
+typedef struct {
+  const char *name;
+  spatial_predicate_t predicate;
+  envelope_relation_t envelope_relation;
+} spatial_predicate_info_t;
+
+static const spatial_predicate_info_t spatial_predicates[] = {
+  {"intersects", PREDICATE_INTERSECTS, ENVELOPE_INTERSECTS},
+  {"touches", PREDICATE_TOUCHES, ENVELOPE_INTERSECTS},
+  {"crosses", PREDICATE_CROSSES, ENVELOPE_INTERSECTS},
+  {"overlaps", PREDICATE_OVERLAPS, ENVELOPE_INTERSECTS},
+  {"within", PREDICATE_WITHIN, ENVELOPE_WITHIN},
+  {"contains", PREDICATE_CONTAINS, ENVELOPE_CONTAINS},
+#if GPKG_GEOM_FUNC == GPKG_GEOS_DL || (GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 3))
+  {"covers", PREDICATE_COVERS, ENVELOPE_CONTAINS},
+  {"coveredby", PREDICATE_COVEREDBY, ENVELOPE_WITHIN},
+#endif
+  {"envelope", PREDICATE_ENVELOPE, ENVELOPE_INTERSECTS},
+  {NULL, PREDICATE_INTERSECTS, ENVELOPE_INTERSECTS}
+};
+
+static const spatial_predicate_info_t *spatial_predicate_lookup(const char *name) {
+  const spatial_predicate_info_t *predicate = spatial_predicates;
+  while (predicate->name != NULL) {
+    if (sqlite3_stricmp(predicate->name, name) == 0) {
+      return predicate;
+    }
+    predicate++;
+  }
+  return NULL;
+}
+
+static int spatial_predicate_available(const geos_context_t *ctx, spatial_predicate_t predicate) {
+  switch (predicate) {
+    case PREDICATE_INTERSECTS:
+      return GEOS_FUNC_AVAILABLE(ctx, GEOSPreparedIntersects_r);
+    case PREDICATE_TOUCHES:
+      return GEOS_FUNC_AVAILABLE(ctx, GEOSPreparedTouches_r);
+    case PREDICATE_CROSSES:
+      return GEOS_FUNC_AVAILABLE(ctx, GEOSPreparedCrosses_r);
+    case PREDICATE_OVERLAPS:
+      return GEOS_FUNC_AVAILABLE(ctx, GEOSPreparedOverlaps_r);
+    case PREDICATE_WITHIN:
+      return GEOS_FUNC_AVAILABLE(ctx, GEOSPreparedContains_r);
+    case PREDICATE_CONTAINS:
+      return GEOS_FUNC_AVAILABLE(ctx, GEOSPreparedWithin_r);
+    case PREDICATE_COVERS:
+      return GEOS_FUNC_AVAILABLE(ctx, GEOSPreparedCoveredBy_r);
+    case PREDICATE_COVEREDBY:
+      return GEOS_FUNC_AVAILABLE(ctx, GEOSPreparedCovers_r);
+    case PREDICATE_ENVELOPE:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * The query geometry is the prepared one, so the predicates that are not symmetric are evaluated using their inverse.
+ */
+static char spatial_predicate_evaluate(geos_handle_t *geos, spatial_predicate_t predicate, const GEOSPreparedGeometry *query, const GEOSGeometry *candidate) {
+  switch (predicate) {
+    case PREDICATE_INTERSECTS:
+      return GEOSPreparedIntersects_r(geos, query, candidate);
+    case PREDICATE_TOUCHES:
+      return GEOSPreparedTouches_r(geos, query, candidate);
+    case PREDICATE_CROSSES:
+      return GEOSPreparedCrosses_r(geos, query, candidate);
+    case PREDICATE_OVERLAPS:
+      return GEOSPreparedOverlaps_r(geos, query, candidate);
+    case PREDICATE_WITHIN:
+      return GEOSPreparedContains_r(geos, query, candidate);
+    case PREDICATE_CONTAINS:
+      return GEOSPreparedWithin_r(geos, query, candidate);
+#if GPKG_GEOM_FUNC == GPKG_GEOS_DL || (GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 3))
+    case PREDICATE_COVERS:
+      return GEOSPreparedCoveredBy_r(geos, query, candidate);
+    case PREDICATE_COVEREDBY:
+      return GEOSPreparedCovers_r(geos, query, candidate);
+#endif
+    case PREDICATE_ENVELOPE:
+      return 1;
+    default:
+      return 2;
+  }
+}
+
+typedef struct {
+  sqlite3_vtab base;
+  sqlite3 *db;
+  geos_context_t *geos_context;
+  i18n_locale_t *locale;
+} spatial_query_vtab_t;
+
+typedef struct {
+  sqlite3_vtab_cursor base;
+  /*
+   * Returns the ids of the index entries whose envelope matches the query envelope.
+   */
+  sqlite3_stmt *index_stmt;
+  /*
+   * Returns the geometry of a single row.
+   */
+  sqlite3_stmt *geometry_stmt;
+  const spatial_predicate_info_t *predicate;
+  geos_prepared_geometry_t *query;
+  int check_srid;
+  geom_envelope_t envelope;
+  sqlite3_int64 id;
+  int eof;
+} spatial_query_cursor_t;
+
+static void spatial_query_set_error(sqlite3_vtab *vtab, errorstream_t *error) {
+  sqlite3_free(vtab->zErrMsg);
+  vtab->zErrMsg = sqlite3_mprintf("%s", error_message(error));
+}
+
+static int spatial_query_connect(sqlite3 *db, void *aux, int argc, const char *const *argv, sqlite3_vtab **vtab_out, char **err) {
+  spatial_query_vtab_t *vtab;
+
+  int result = sqlite3_declare_vtab(db, "CREATE TABLE x(fid INTEGER, geometry BLOB, table_name HIDDEN, column_name HIDDEN, query_geometry HIDDEN, predicate HIDDEN)");
+  if (result != SQLITE_OK) {
+    return result;
+  }
+
+  vtab = (spatial_query_vtab_t *)sqlite3_malloc(sizeof(spatial_query_vtab_t));
+  if (vtab == NULL) {
+    return SQLITE_NOMEM;
+  }
+  memset(vtab, 0, sizeof(spatial_query_vtab_t));
+
+  vtab->locale = i18n_locale_init("C");
+  if (vtab->locale == NULL) {
+    sqlite3_free(vtab);
+    return SQLITE_NOMEM;
+  }
+
+  vtab->db = db;
+  vtab->geos_context = (geos_context_t *)aux;
+  geos_context_acquire(vtab->geos_context);
+
+  *vtab_out = &vtab->base;
+  return SQLITE_OK;
+}
+
+static int spatial_query_disconnect(sqlite3_vtab *vtab_base) {
+  spatial_query_vtab_t *vtab = (spatial_query_vtab_t *)vtab_base;
+  i18n_locale_destroy(vtab->locale);
+  geos_context_release(vtab->geos_context);
+  sqlite3_free(vtab);
+  return SQLITE_OK;
+}
+
+static int spatial_query_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+  int constraint[SPATIAL_QUERY_ARG_COUNT];
+  int argv_index = 0;
+  int i;
+
+  for (i = 0; i < SPATIAL_QUERY_ARG_COUNT; i++) {
+    constraint[i] = -1;
+  }
+
+  for (i = 0; i < info->nConstraint; i++) {
+    const struct sqlite3_index_constraint *c = &info->aConstraint[i];
+    if (c->usable && c->op == SQLITE_INDEX_CONSTRAINT_EQ && c->iColumn >= SPATIAL_QUERY_COLUMN_TABLE_NAME) {
+      constraint[c->iColumn - SPATIAL_QUERY_COLUMN_TABLE_NAME] = i;
+    }
+  }
+
+  info->idxNum = 0;
+  for (i = 0; i < SPATIAL_QUERY_ARG_COUNT; i++) {
+    if (constraint[i] >= 0) {
+      info->aConstraintUsage[constraint[i]].argvIndex = ++argv_index;
+      info->aConstraintUsage[constraint[i]].omit = 1;
+      info->idxNum |= 1 << i;
+    }
+  }
+
+  if ((info->idxNum & SPATIAL_QUERY_REQUIRED_ARGS) == SPATIAL_QUERY_REQUIRED_ARGS) {
+    info->estimatedCost = 1000.0;
+  } else {
+    info->estimatedCost = 1e99;
+  }
+
+#if SQLITE_VERSION_NUMBER >= 3008002
+  if (sqlite3_libversion_number() >= 3008002) {
+    info->estimatedRows = (info->idxNum & SPATIAL_QUERY_REQUIRED_ARGS) == SPATIAL_QUERY_REQUIRED_ARGS ? 100 : 2147483647;
+  }
+#endif
+
+  return SQLITE_OK;
+}
+
+static int spatial_query_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor_out) {
+  spatial_query_cursor_t *cursor = (spatial_query_cursor_t *)sqlite3_malloc(sizeof(spatial_query_cursor_t));
+  if (cursor == NULL) {
+    return SQLITE_NOMEM;
+  }
+  memset(cursor, 0, sizeof(spatial_query_cursor_t));
+  cursor->eof = 1;
+
+  *cursor_out = &cursor->base;
+  return SQLITE_OK;
+}
+
+static void spatial_query_cursor_reset(spatial_query_cursor_t *cursor) {
+  sqlite3_finalize(cursor->index_stmt);
+  cursor->index_stmt = NULL;
+  sqlite3_finalize(cursor->geometry_stmt);
+  cursor->geometry_stmt = NULL;
+  free_geos_prepared_geom(cursor->query);
+  cursor->query = NULL;
+  cursor->predicate = NULL;
+  cursor->eof = 1;
+}
+
+static int spatial_query_close(sqlite3_vtab_cursor *cursor_base) {
+  spatial_query_cursor_t *cursor = (spatial_query_cursor_t *)cursor_base;
+  spatial_query_cursor_reset(cursor);
+  sqlite3_free(cursor);
+  return SQLITE_OK;
+}
+
+static int spatial_query_fill_envelope(const spatialdb_t *spatialdb, uint8_t *blob, size_t blob_length, geom_envelope_t *envelope, errorstream_t *error) {
+  geom_blob_header_t header;
+  binstream_t stream;
+  binstream_init(&stream, blob, blob_length);
+
+  int result = spatialdb->read_blob_header(&stream, &header, error);
+  if (result == SQLITE_OK) {
+    result = spatialdb->fill_envelope(&stream, envelope, error);
+  }
+  return result;
+}
+
+/*
+ * Prepares the query on the rtree table. The rtree module stores envelopes as floats that are rounded outwards, so the
+ * query bounds are rounded in the same way to make sure no matching entries are lost.
+ */
+static int spatial_query_prepare_index(sqlite3 *db, const char *index_table_name, envelope_relation_t relation, const geom_envelope_t *envelope, sqlite3_stmt **stmt_out, errorstream_t *error) {
+  int result = SQLITE_OK;
+  sqlite3_stmt *stmt = NULL;
+  char *sql = NULL;
+  const char *min_op = relation == ENVELOPE_WITHIN ? ">=" : "<=";
+  const char *max_op = relation == ENVELOPE_WITHIN ? "<=" : ">=";
+
+  // The column names of the index table depend on the spatial database type
+  sql = sqlite3_mprintf("SELECT * FROM \"main\".\"%w\"", index_table_name);
+  if (sql == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  result = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not read spatial index %s: %s", index_table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (sqlite3_column_count(stmt) != 5) {
+    error_append(error, "%s is not a two dimensional spatial index", index_table_name);
+    result = SQLITE_ERROR;
+    goto exit;
+  }
+
+  sqlite3_free(sql);
+  sql = sqlite3_mprintf(
+          "SELECT \"%w\" FROM \"main\".\"%w\" WHERE \"%w\" %s ?1 AND \"%w\" %s ?2 AND \"%w\" %s ?3 AND \"%w\" %s ?4",
+          sqlite3_column_name(stmt, 0), index_table_name,
+          sqlite3_column_name(stmt, 1), min_op, sqlite3_column_name(stmt, 2), max_op,
+          sqlite3_column_name(stmt, 3), min_op, sqlite3_column_name(stmt, 4), max_op
+        );
+  if (sql == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  sqlite3_finalize(stmt);
+  stmt = NULL;
+
+  result = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not read spatial index %s: %s", index_table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (relation == ENVELOPE_INTERSECTS) {
+    sqlite3_bind_double(stmt, 1, rtree_value_up(envelope->max_x));
+    sqlite3_bind_double(stmt, 2, rtree_value_down(envelope->min_x));
+    sqlite3_bind_double(stmt, 3, rtree_value_up(envelope->max_y));
+    sqlite3_bind_double(stmt, 4, rtree_value_down(envelope->min_y));
+  } else {
+    sqlite3_bind_double(stmt, 1, rtree_value_down(envelope->min_x));
+    sqlite3_bind_double(stmt, 2, rtree_value_up(envelope->max_x));
+    sqlite3_bind_double(stmt, 3, rtree_value_down(envelope->min_y));
+    sqlite3_bind_double(stmt, 4, rtree_value_up(envelope->max_y));
+  }
+
+  *stmt_out = stmt;
+  stmt = NULL;
+
+exit:
+  sqlite3_finalize(stmt);
+  sqlite3_free(sql);
+  return result;
+}
+
+/*
+ * Reads the blob header of a geometry and computes its envelope if the header does not contain one. The stream is
+ * positioned at the start of the geometry body when this function returns.
+ */
+static int read_blob_header_with_envelope(const spatialdb_t *spatialdb, binstream_t *stream, geom_blob_header_t *header, errorstream_t *error) {
+  int result = spatialdb->read_blob_header(stream, header, error);
+  if (result != SQLITE_OK || header->empty || (header->envelope.has_env_x && header->envelope.has_env_y)) {
+    return result;
+  }
+
+  size_t position = binstream_position(stream);
+  result = spatialdb->fill_envelope(stream, &header->envelope, error);
+  if (result == SQLITE_OK) {
+    result = binstream_seek(stream, position);
+  }
+  return result;
+}
+
+static int spatial_query_next(sqlite3_vtab_cursor *cursor_base) {
+  spatial_query_cursor_t *cursor = (spatial_query_cursor_t *)cursor_base;
+  spatial_query_vtab_t *vtab = (spatial_query_vtab_t *)cursor_base->pVtab;
+  const spatialdb_t *spatialdb = vtab->geos_context->spatialdb;
+  char error_buffer[256];
+  errorstream_t error;
+  int result;
+
+  error_init_fixed(&error, error_buffer, 256);
+
+  geos_handle_t *geos = geos_context_handle(vtab->geos_context, &error);
+  if (geos == NULL) {
+    spatial_query_set_error(cursor_base->pVtab, &error);
+    return SQLITE_NOMEM;
+  }
+
+  while (1) {
+    sqlite3_reset(cursor->geometry_stmt);
+
+    result = sqlite3_step(cursor->index_stmt);
+    if (result == SQLITE_DONE) {
+      cursor->eof = 1;
+      return SQLITE_OK;
+    } else if (result != SQLITE_ROW) {
+      error_append(&error, "Could not read spatial index: %s", sqlite3_errmsg(vtab->db));
+      break;
+    }
+
+    cursor->id = sqlite3_column_int64(cursor->index_stmt, 0);
+    sqlite3_bind_int64(cursor->geometry_stmt, 1, cursor->id);
+    result = sqlite3_step(cursor->geometry_stmt);
+    if (result == SQLITE_DONE) {
+      // The index refers to a row that no longer exists
+      continue;
+    } else if (result != SQLITE_ROW) {
+      error_append(&error, "Could not read geometry of row %lld: %s", cursor->id, sqlite3_errmsg(vtab->db));
+      break;
+    }
+
+    uint8_t *blob = (uint8_t *)sqlite3_column_blob(cursor->geometry_stmt, 0);
+    size_t blob_length = (size_t) sqlite3_column_bytes(cursor->geometry_stmt, 0);
+    if (blob == NULL) {
+      continue;
+    }
+
+    binstream_t stream;
+    binstream_init(&stream, blob, blob_length);
+
+    geom_blob_header_t header;
+    result = read_blob_header_with_envelope(spatialdb, &stream, &header, &error);
+    if (result != SQLITE_OK) {
+      break;
+    }
+
+    if (header.empty) {
+      continue;
+    }
+
+    if (cursor->check_srid && header.srid != cursor->query->srid) {
+      error_append(&error, "Cannot apply %s when SRIDs differ: %d != %d", cursor->predicate->name, header.srid, cursor->query->srid);
+      result = SQLITE_ERROR;
+      break;
+    }
+
+    if (!envelope_matches(cursor->predicate->envelope_relation, &header.envelope, &cursor->envelope)) {
+      continue;
+    } else if (cursor->predicate->predicate == PREDICATE_ENVELOPE) {
+      return SQLITE_OK;
+    }
+
+    geos_writer_t writer;
+    geos_writer_init_srid(&writer, geos, header.srid);
+    result = spatialdb->read_geometry(&stream, geos_writer_geom_consumer(&writer), &error);
+    GEOSGeometry *g = geos_writer_getgeometry(&writer);
+    geos_writer_destroy(&writer, g == NULL);
+
+    if (result != SQLITE_OK || g == NULL) {
+      if (g != NULL) {
+        GEOSGeom_destroy_r(geos, g);
+      }
+      if (result == SQLITE_OK) {
+        error_append(&error, "Could not read geometry of row %lld", cursor->id);
+        result = SQLITE_ERROR;
+      }
+      break;
+    }
+
+    char match = spatial_predicate_evaluate(geos, cursor->predicate->predicate, cursor->query->geometry, g);
+    GEOSGeom_destroy_r(geos, g);
+
+    if (match == 2) {
+      geom_geos_get_error(&error);
+      result = SQLITE_ERROR;
+      break;
+    } else if (match) {
+      return SQLITE_OK;
+    }
+  }
+
+  spatial_query_set_error(cursor_base->pVtab, &error);
+  return result;
+}
+
+static int spatial_query_filter(sqlite3_vtab_cursor *cursor_base, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
+  spatial_query_cursor_t *cursor = (spatial_query_cursor_t *)cursor_base;
+  spatial_query_vtab_t *vtab = (spatial_query_vtab_t *)cursor_base->pVtab;
+  const geos_context_t *geos_context = vtab->geos_context;
+  const spatialdb_t *spatialdb = geos_context->spatialdb;
+  const char *table_name;
+  const char *column_name;
+  const char *predicate_name = "intersects";
+  sqlite3_value *geometry;
+  geom_blob_writer_t writer;
+  int writer_initialized = 0;
+  geom_blob_header_t header;
+  uint8_t *blob;
+  size_t blob_length;
+  char *index_table_name = NULL;
+  char *sql = NULL;
+  char error_buffer[256];
+  errorstream_t error;
+  int result = SQLITE_OK;
+
+  error_init_fixed(&error, error_buffer, 256);
+  spatial_query_cursor_reset(cursor);
+
+  if ((idxNum & SPATIAL_QUERY_REQUIRED_ARGS) != SPATIAL_QUERY_REQUIRED_ARGS) {
+    error_append(&error, "gpkg_spatial_query requires a table name, a column name and a geometry");
+    result = SQLITE_ERROR;
+    goto exit;
+  }
+
+  table_name = (const char *)sqlite3_value_text(argv[0]);
+  column_name = (const char *)sqlite3_value_text(argv[1]);
+  geometry = argv[2];
+  if (argc > 3 && sqlite3_value_type(argv[3]) != SQLITE_NULL) {
+    predicate_name = (const char *)sqlite3_value_text(argv[3]);
+  }
+
+  if (table_name == NULL || column_name == NULL) {
+    error_append(&error, "gpkg_spatial_query requires a table name, a column name and a geometry");
+    result = SQLITE_ERROR;
+    goto exit;
+  }
+
+  cursor->predicate = spatial_predicate_lookup(predicate_name);
+  if (cursor->predicate == NULL) {
+    error_append(&error, "Unsupported spatial predicate: %s", predicate_name);
+    result = SQLITE_ERROR;
+    goto exit;
+  }
+
+  if (!spatial_predicate_available(geos_context, cursor->predicate->predicate)) {
+    error_append(&error, "Spatial predicate %s is not supported by GEOS %s", predicate_name, GEOSversion(geos_context->geos_library));
+    result = SQLITE_ERROR;
+    goto exit;
+  }
+
+  switch (sqlite3_value_type(geometry)) {
+    case SQLITE_NULL:
+      goto exit;
+    case SQLITE_TEXT:
+      spatialdb->writer_init(&writer);
+      writer_initialized = 1;
+      result = wkt_read_geometry((const char *)sqlite3_value_text(geometry), (size_t) sqlite3_value_bytes(geometry), geom_blob_writer_geom_consumer(&writer), vtab->locale, &error);
+      if (result != SQLITE_OK) {
+        goto exit;
+      }
+      blob = geom_blob_writer_getdata(&writer);
+      blob_length = geom_blob_writer_length(&writer);
+      cursor->check_srid = 0;
+      break;
+    default:
+      blob = (uint8_t *)sqlite3_value_blob(geometry);
+      blob_length = (size_t) sqlite3_value_bytes(geometry);
+      cursor->check_srid = 1;
+      break;
+  }
+
+  cursor->query = get_cached_geos_prepared_geom(geos_context, blob, blob_length, &header, &error);
+  if (cursor->query == NULL) {
+    if (error_count(&error) == 0) {
+      error_append(&error, "Could not read query geometry");
+    }
+    result = SQLITE_ERROR;
+    goto exit;
+  }
+
+  if (header.empty) {
+    goto exit;
+  }
+
+  cursor->envelope = header.envelope;
+  if (!cursor->envelope.has_env_x || !cursor->envelope.has_env_y) {
+    result = spatial_query_fill_envelope(spatialdb, blob, blob_length, &cursor->envelope, &error);
+    if (result != SQLITE_OK) {
+      goto exit;
+    }
+    if (!cursor->envelope.has_env_x || !cursor->envelope.has_env_y) {
+      goto exit;
+    }
+  }
+
+  index_table_name = spatialdb->spatial_index_name(table_name, column_name);
+  if (index_table_name == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  result = spatial_query_prepare_index(vtab->db, index_table_name, cursor->predicate->envelope_relation, &cursor->envelope, &cursor->index_stmt, &error);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  sql = sqlite3_mprintf("SELECT \"%w\" FROM \"main\".\"%w\" WHERE rowid = ?", column_name, table_name);
+  if (sql == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  result = sqlite3_prepare_v2(vtab->db, sql, -1, &cursor->geometry_stmt, NULL);
+  if (result != SQLITE_OK) {
+    error_append(&error, "Could not read %s.%s: %s", table_name, column_name, sqlite3_errmsg(vtab->db));
+    goto exit;
+  }
+
+  cursor->eof = 0;
+  result = spatial_query_next(cursor_base);
+
+exit:
+  if (writer_initialized) {
+    spatialdb->writer_destroy(&writer, 1);
+  }
+  sqlite3_free(index_table_name);
+  sqlite3_free(sql);
+
+  if (result != SQLITE_OK) {
+    if (error_count(&error) > 0) {
+      spatial_query_set_error(cursor_base->pVtab, &error);
+    }
+    spatial_query_cursor_reset(cursor);
+  }
+
+  return result;
+}
+
+static int spatial_query_eof(sqlite3_vtab_cursor *cursor_base) {
+  return ((spatial_query_cursor_t *)cursor_base)->eof;
+}
+
+static int spatial_query_column(sqlite3_vtab_cursor *cursor_base, sqlite3_context *context, int i) {
+  spatial_query_cursor_t *cursor = (spatial_query_cursor_t *)cursor_base;
+
+  switch (i) {
+    case SPATIAL_QUERY_COLUMN_ID:
+      sqlite3_result_int64(context, cursor->id);
+      break;
+    case SPATIAL_QUERY_COLUMN_GEOMETRY:
+      sqlite3_result_value(context, sqlite3_column_value(cursor->geometry_stmt, 0));
+      break;
+    default:
+      sqlite3_result_null(context);
+      break;
+  }
+
+  return SQLITE_OK;
+}
+
+static int spatial_query_rowid(sqlite3_vtab_cursor *cursor_base, sqlite3_int64 *rowid) {
+  *rowid = ((spatial_query_cursor_t *)cursor_base)->id;
+  return SQLITE_OK;
+}
+
+static sqlite3_module spatial_query_module = {
+  0,
+  spatial_query_connect,
+  spatial_query_connect,
+  spatial_query_best_index,
+  spatial_query_disconnect,
+  spatial_query_disconnect,
+  spatial_query_open,
+  spatial_query_close,
+  spatial_query_filter,
+  spatial_query_next,
+  spatial_query_eof,
+  spatial_query_column,
+  spatial_query_rowid
+};
+
+/*
+ * gpkg_spatial_join(table_a, column_a, table_b, column_b [, predicate])
+ *
+ * Table valued function that returns the pairs of rows of two tables whose geometries satisfy a spatial predicate. The
+ * predicate is evaluated as ST_<predicate>(column_a, column_b) and defaults to 'intersects'; the 'envelope' predicate
+ * returns the pairs whose envelopes intersect without evaluating an exact predicate.
+ * Candidate pairs are found by traversing the spatial indexes of both columns in step: a pair of nodes is only
+ * expanded if their bounding boxes overlap, so the cost depends on the number of overlapping pairs rather than on the
+ * product of the table sizes. Candidates are then checked against the envelopes in their blob headers before the
+ * exact predicate is evaluated using a prepared version of the geometry of the second table.
+ */
+#define SPATIAL_JOIN_COLUMN_ID_A 0
+#define SPATIAL_JOIN_COLUMN_ID_B 1
+#define SPATIAL_JOIN_COLUMN_TABLE_A 2
+#define SPATIAL_JOIN_ARG_COUNT 5
+#define SPATIAL_JOIN_REQUIRED_ARGS 0xF
+
+/*
+ * One side of a pair in the synchronized traversal. This is either a node of the spatial index with the given depth
+ * or, if depth is negative, a leaf entry.
+ */
+typedef struct {
+  rtree_cell_t cell;
+  int depth;
+} spatial_join_item_t;
+
+typedef struct {
+  spatial_join_item_t a;
+  spatial_join_item_t b;
+} spatial_join_pair_t;
+
+typedef struct {
+  sqlite3_vtab base;
+  sqlite3 *db;
+  geos_context_t *geos_context;
+} spatial_join_vtab_t;
+
+typedef struct {
+  sqlite3_vtab_cursor base;
+  rtree_reader_t reader_a;
+  rtree_reader_t reader_b;
+  /*
+   * Pairs that still need to be visited. The pairs are visited depth first to keep the stack small.
+   */
+  spatial_join_pair_t *pairs;
+  size_t pair_count;
+  size_t pair_capacity;
+  /*
+   * Return the geometry of a single row of each table.
+   */
+  sqlite3_stmt *geometry_stmt_a;
+  sqlite3_stmt *geometry_stmt_b;
+  const spatial_predicate_info_t *predicate;
+  /*
+   * The row of the second table that is currently loaded. Consecutive candidate pairs usually share the same row of
+   * the second table, so its header and prepared geometry are reused.
+   */
+  sqlite3_int64 loaded_id_b;
+  int loaded_b;
+  geom_blob_header_t header_b;
+  geos_prepared_geometry_t *prepared_b;
+  sqlite3_int64 id_a;
+  sqlite3_int64 id_b;
+  /*
+   * The number of the current result row, which serves as its rowid.
+   */
+  sqlite3_int64 row;
+  int eof;
+} spatial_join_cursor_t;
+
+static int spatial_join_connect(sqlite3 *db, void *aux, int argc, const char *const *argv, sqlite3_vtab **vtab_out, char **err) {
+  spatial_join_vtab_t *vtab;
+
+  int result = sqlite3_declare_vtab(db, "CREATE TABLE x(fid_a INTEGER, fid_b INTEGER, table_a HIDDEN, column_a HIDDEN, table_b HIDDEN, column_b HIDDEN, predicate HIDDEN)");
+  if (result != SQLITE_OK) {
+    return result;
+  }
+
+  vtab = (spatial_join_vtab_t *)sqlite3_malloc(sizeof(spatial_join_vtab_t));
+  if (vtab == NULL) {
+    return SQLITE_NOMEM;
+  }
+  memset(vtab, 0, sizeof(spatial_join_vtab_t));
+
+  vtab->db = db;
+  vtab->geos_context = (geos_context_t *)aux;
+  geos_context_acquire(vtab->geos_context);
+
+  *vtab_out = &vtab->base;
+  return SQLITE_OK;
+}
+
+static int spatial_join_disconnect(sqlite3_vtab *vtab_base) {
+  spatial_join_vtab_t *vtab = (spatial_join_vtab_t *)vtab_base;
+  geos_context_release(vtab->geos_context);
+  sqlite3_free(vtab);
+  return SQLITE_OK;
+}
+
+static int spatial_join_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+  int constraint[SPATIAL_JOIN_ARG_COUNT];
+  int argv_index = 0;
+  int i;
+
+  for (i = 0; i < SPATIAL_JOIN_ARG_COUNT; i++) {
+    constraint[i] = -1;
+  }
+
+  for (i = 0; i < info->nConstraint; i++) {
+    const struct sqlite3_index_constraint *c = &info->aConstraint[i];
+    if (c->usable && c->op == SQLITE_INDEX_CONSTRAINT_EQ && c->iColumn >= SPATIAL_JOIN_COLUMN_TABLE_A) {
+      constraint[c->iColumn - SPATIAL_JOIN_COLUMN_TABLE_A] = i;
+    }
+  }
+
+  info->idxNum = 0;
+  for (i = 0; i < SPATIAL_JOIN_ARG_COUNT; i++) {
+    if (constraint[i] >= 0) {
+      info->aConstraintUsage[constraint[i]].argvIndex = ++argv_index;
+      info->aConstraintUsage[constraint[i]].omit = 1;
+      info->idxNum |= 1 << i;
+    }
+  }
+
+  if ((info->idxNum & SPATIAL_JOIN_REQUIRED_ARGS) == SPATIAL_JOIN_REQUIRED_ARGS) {
+    info->estimatedCost = 100000.0;
+  } else {
+    info->estimatedCost = 1e99;
+  }
+
+#if SQLITE_VERSION_NUMBER >= 3008002
+  if (sqlite3_libversion_number() >= 3008002) {
+    info->estimatedRows = (info->idxNum & SPATIAL_JOIN_REQUIRED_ARGS) == SPATIAL_JOIN_REQUIRED_ARGS ? 10000 : 2147483647;
+  }
+#endif
+
+  return SQLITE_OK;
+}
+
+static int spatial_join_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor_out) {
+  spatial_join_cursor_t *cursor = (spatial_join_cursor_t *)sqlite3_malloc(sizeof(spatial_join_cursor_t));
+  if (cursor == NULL) {
+    return SQLITE_NOMEM;
+  }
+  memset(cursor, 0, sizeof(spatial_join_cursor_t));
+  cursor->eof = 1;
+
+  *cursor_out = &cursor->base;
+  return SQLITE_OK;
+}
+
+static void spatial_join_cursor_reset(spatial_join_cursor_t *cursor) {
+  rtree_reader_destroy(&cursor->reader_a);
+  rtree_reader_destroy(&cursor->reader_b);
+  sqlite3_free(cursor->pairs);
+  cursor->pairs = NULL;
+  cursor->pair_count = 0;
+  cursor->pair_capacity = 0;
+  sqlite3_finalize(cursor->geometry_stmt_a);
+  cursor->geometry_stmt_a = NULL;
+  sqlite3_finalize(cursor->geometry_stmt_b);
+  cursor->geometry_stmt_b = NULL;
+  free_geos_prepared_geom(cursor->prepared_b);
+  cursor->prepared_b = NULL;
+  cursor->loaded_b = 0;
+  cursor->predicate = NULL;
+  cursor->eof = 1;
+}
+
+static int spatial_join_close(sqlite3_vtab_cursor *cursor_base) {
+  spatial_join_cursor_t *cursor = (spatial_join_cursor_t *)cursor_base;
+  spatial_join_cursor_reset(cursor);
+  sqlite3_free(cursor);
+  return SQLITE_OK;
+}
+
+static int spatial_join_push(spatial_join_cursor_t *cursor, const rtree_cell_t *a, int depth_a, const rtree_cell_t *b, int depth_b) {
+  if (cursor->pair_count == cursor->pair_capacity) {
+    size_t capacity = cursor->pair_capacity == 0 ? 64 : cursor->pair_capacity * 2;
+    spatial_join_pair_t *pairs = (spatial_join_pair_t *)sqlite3_realloc64(cursor->pairs, capacity * sizeof(spatial_join_pair_t));
+    if (pairs == NULL) {
+      return SQLITE_NOMEM;
+    }
+    cursor->pairs = pairs;
+    cursor->pair_capacity = capacity;
+  }
+
+  spatial_join_pair_t *pair = &cursor->pairs[cursor->pair_count++];
+  pair->a.cell = *a;
+  pair->a.depth = depth_a;
+  pair->b.cell = *b;
+  pair->b.depth = depth_b;
+  return SQLITE_OK;
+}
+
+static int spatial_join_cells_overlap(const rtree_cell_t *a, const rtree_cell_t *b) {
+  return a->min_x <= b->max_x && a->max_x >= b->min_x && a->min_y <= b->max_y && a->max_y >= b->min_y;
+}
+
+/*
+ * Replaces a pair of nodes by the pairs of their children whose bounding boxes overlap. If both sides are nodes at the
+ * same depth both are expanded, otherwise only the side that is highest up in its tree is expanded. The children of
+ * the second table are iterated in the outer loop so that the resulting leaf pairs are grouped by their second row.
+ */
+static int spatial_join_expand(spatial_join_cursor_t *cursor, const spatial_join_pair_t *pair) {
+  int expand_a = pair->a.depth >= 0 && (pair->b.depth < 0 || pair->a.depth >= pair->b.depth);
+  int expand_b = pair->b.depth >= 0 && (pair->a.depth < 0 || pair->b.depth >= pair->a.depth);
+  const rtree_cell_t *cells_a = &pair->a.cell;
+  const rtree_cell_t *cells_b = &pair->b.cell;
+  int count_a = 1;
+  int count_b = 1;
+  int depth_a = pair->a.depth;
+  int depth_b = pair->b.depth;
+  int result;
+
+  if (expand_a) {
+    result = rtree_reader_read_node(&cursor->reader_a, pair->a.cell.id, &cells_a, &count_a);
+    if (result != SQLITE_OK) {
+      return result;
+    }
+    depth_a--;
+  }
+
+  if (expand_b) {
+    result = rtree_reader_read_node(&cursor->reader_b, pair->b.cell.id, &cells_b, &count_b);
+    if (result != SQLITE_OK) {
+      return result;
+    }
+    depth_b--;
+  }
+
+  for (int i = 0; i < count_b; i++) {
+    if (!spatial_join_cells_overlap(&cells_b[i], &pair->a.cell)) {
+      continue;
+    }
+    for (int j = 0; j < count_a; j++) {
+      if (spatial_join_cells_overlap(&cells_a[j], &cells_b[i])) {
+        result = spatial_join_push(cursor, &cells_a[j], depth_a, &cells_b[i], depth_b);
+        if (result != SQLITE_OK) {
+          return result;
+        }
+      }
+    }
+  }
+
+  return SQLITE_OK;
+}
+
+/*
+ * Positions a geometry statement on the row with the given id and reads its blob header. Returns SQLITE_ROW if the row
+ * has a non-empty geometry, SQLITE_DONE if it does not and an error code otherwise.
+ */
+static int spatial_join_read_row(spatial_join_vtab_t *vtab, sqlite3_stmt *stmt, sqlite3_int64 id, binstream_t *stream, geom_blob_header_t *header, errorstream_t *error) {
+  sqlite3_reset(stmt);
+  sqlite3_bind_int64(stmt, 1, id);
+
+  int result = sqlite3_step(stmt);
+  if (result == SQLITE_DONE) {
+    // The index refers to a row that no longer exists
+    return SQLITE_DONE;
+  } else if (result != SQLITE_ROW) {
+    error_append(error, "Could not read geometry of row %lld: %s", id, sqlite3_errmsg(vtab->db));
+    return result;
+  }
+
+  uint8_t *blob = (uint8_t *)sqlite3_column_blob(stmt, 0);
+  size_t blob_length = (size_t) sqlite3_column_bytes(stmt, 0);
+  if (blob == NULL) {
+    return SQLITE_DONE;
+  }
+
+  binstream_init(stream, blob, blob_length);
+  result = read_blob_header_with_envelope(vtab->geos_context->spatialdb, stream, header, error);
+  if (result != SQLITE_OK) {
+    return result;
+  }
+
+  return header->empty ? SQLITE_DONE : SQLITE_ROW;
+}
+
+/*
+ * Evaluates the predicate for a candidate pair. Returns SQLITE_ROW if the pair matches, SQLITE_DONE if it does not and
+ * an error code otherwise.
+ */
+static int spatial_join_refine(spatial_join_cursor_t *cursor, sqlite3_int64 id_a, sqlite3_int64 id_b, errorstream_t *error) {
+  spatial_join_vtab_t *vtab = (spatial_join_vtab_t *)cursor->base.pVtab;
+  const geos_context_t *geos_context = vtab->geos_context;
+  geom_blob_header_t header_a;
+  binstream_t stream;
+  int result;
+
+  geos_handle_t *geos = geos_context_handle(geos_context, error);
+  if (geos == NULL) {
+    return SQLITE_NOMEM;
+  }
+
+  if (!cursor->loaded_b || cursor->loaded_id_b != id_b) {
+    free_geos_prepared_geom(cursor->prepared_b);
+    cursor->prepared_b = NULL;
+    cursor->loaded_b = 0;
+
+    result = spatial_join_read_row(vtab, cursor->geometry_stmt_b, id_b, &stream, &cursor->header_b, error);
+    if (result == SQLITE_DONE) {
+      cursor->header_b.empty = 1;
+    } else if (result != SQLITE_ROW) {
+      return result;
+    }
+    cursor->loaded_id_b = id_b;
+    cursor->loaded_b = 1;
+  }
+
+  if (cursor->header_b.empty) {
+    return SQLITE_DONE;
+  }
+
+  result = spatial_join_read_row(vtab, cursor->geometry_stmt_a, id_a, &stream, &header_a, error);
+  if (result != SQLITE_ROW) {
+    return result;
+  }
+
+  if (header_a.srid != cursor->header_b.srid) {
+    error_append(error, "Cannot apply %s when SRIDs differ: %d != %d", cursor->predicate->name, header_a.srid, cursor->header_b.srid);
+    return SQLITE_ERROR;
+  }
+
+  if (!envelope_matches(cursor->predicate->envelope_relation, &header_a.envelope, &cursor->header_b.envelope)) {
+    return SQLITE_DONE;
+  } else if (cursor->predicate->predicate == PREDICATE_ENVELOPE) {
+    return SQLITE_ROW;
+  }
+
+  if (cursor->prepared_b == NULL) {
+    geom_blob_header_t header;
+    uint8_t *blob = (uint8_t *)sqlite3_column_blob(cursor->geometry_stmt_b, 0);
+    size_t blob_length = (size_t) sqlite3_column_bytes(cursor->geometry_stmt_b, 0);
+
+    cursor->prepared_b = read_geos_prepared_geom(geos_context, blob, blob_length, &header, error);
+    if (cursor->prepared_b == NULL) {
+      if (error_count(error) == 0) {
+        error_append(error, "Could not read geometry of row %lld", id_b);
+      }
+      return SQLITE_ERROR;
+    }
+  }
+
+  geos_writer_t writer;
+  geos_writer_init_srid(&writer, geos, header_a.srid);
+  result = geos_context->spatialdb->read_geometry(&stream, geos_writer_geom_consumer(&writer), error);
+  GEOSGeometry *g = geos_writer_getgeometry(&writer);
+  geos_writer_destroy(&writer, g == NULL);
+
+  if (result != SQLITE_OK || g == NULL) {
+    if (g != NULL) {
+      GEOSGeom_destroy_r(geos, g);
+    }
+    if (result == SQLITE_OK) {
+      error_append(error, "Could not read geometry of row %lld", id_a);
+      result = SQLITE_ERROR;
+    }
+    return result;
+  }
+
+  char match = spatial_predicate_evaluate(geos, cursor->predicate->predicate, cursor->prepared_b->geometry, g);
+  GEOSGeom_destroy_r(geos, g);
+
+  if (match == 2) {
+    geom_geos_get_error(error);
+    return SQLITE_ERROR;
+  }
+
+  return match ? SQLITE_ROW : SQLITE_DONE;
+}
+
+static int spatial_join_next(sqlite3_vtab_cursor *cursor_base) {
+  spatial_join_cursor_t *cursor = (spatial_join_cursor_t *)cursor_base;
+  char error_buffer[256];
+  errorstream_t error;
+  int result = SQLITE_OK;
+
+  error_init_fixed(&error, error_buffer, 256);
+
+  while (cursor->pair_count > 0) {
+    spatial_join_pair_t pair = cursor->pairs[--cursor->pair_count];
+
+    if (pair.a.depth >= 0 || pair.b.depth >= 0) {
+      result = spatial_join_expand(cursor, &pair);
+      if (result != SQLITE_OK) {
+        error_append(&error, "Could not read spatial index: %s", sqlite3_errstr(result));
+        goto exit;
+      }
+      continue;
+    }
+
+    result = spatial_join_refine(cursor, pair.a.cell.id, pair.b.cell.id, &error);
+    if (result == SQLITE_ROW) {
+      cursor->id_a = pair.a.cell.id;
+      cursor->id_b = pair.b.cell.id;
+      cursor->row++;
+      return SQLITE_OK;
+    } else if (result != SQLITE_DONE) {
+      goto exit;
+    }
+  }
+
+  cursor->eof = 1;
+  result = SQLITE_OK;
+
+exit:
+  if (result != SQLITE_OK && error_count(&error) > 0) {
+    spatial_query_set_error(cursor_base->pVtab, &error);
+  }
+  return result;
+}
+
+static int spatial_join_prepare_side(spatial_join_vtab_t *vtab, const char *table_name, const char *column_name, rtree_reader_t *reader, sqlite3_stmt **geometry_stmt, errorstream_t *error) {
+  const spatialdb_t *spatialdb = vtab->geos_context->spatialdb;
+  char *index_table_name = NULL;
+  char *sql = NULL;
+  int result = SQLITE_OK;
+
+  index_table_name = spatialdb->spatial_index_name(table_name, column_name);
+  if (index_table_name == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  result = rtree_reader_init(reader, vtab->db, "main", index_table_name);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not read spatial index %s: %s", index_table_name, sqlite3_errmsg(vtab->db));
+    goto exit;
+  }
+
+  sql = sqlite3_mprintf("SELECT \"%w\" FROM \"main\".\"%w\" WHERE rowid = ?", column_name, table_name);
+  if (sql == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  result = sqlite3_prepare_v2(vtab->db, sql, -1, geometry_stmt, NULL);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not read %s.%s: %s", table_name, column_name, sqlite3_errmsg(vtab->db));
+    goto exit;
+  }
+
+exit:
+  sqlite3_free(index_table_name);
+  sqlite3_free(sql);
+  return result;
+}
+
+static int spatial_join_filter(sqlite3_vtab_cursor *cursor_base, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
+  spatial_join_cursor_t *cursor = (spatial_join_cursor_t *)cursor_base;
+  spatial_join_vtab_t *vtab = (spatial_join_vtab_t *)cursor_base->pVtab;
+  const char *table_a;
+  const char *column_a;
+  const char *table_b;
+  const char *column_b;
+  const char *predicate_name = "intersects";
+  rtree_cell_t root;
+  char error_buffer[256];
+  errorstream_t error;
+  int result = SQLITE_OK;
+
+  error_init_fixed(&error, error_buffer, 256);
+  spatial_join_cursor_reset(cursor);
+
+  if ((idxNum & SPATIAL_JOIN_REQUIRED_ARGS) != SPATIAL_JOIN_REQUIRED_ARGS) {
+    error_append(&error, "gpkg_spatial_join requires two table names and two column names");
+    result = SQLITE_ERROR;
+    goto exit;
+  }
+
+  table_a = (const char *)sqlite3_value_text(argv[0]);
+  column_a = (const char *)sqlite3_value_text(argv[1]);
+  table_b = (const char *)sqlite3_value_text(argv[2]);
+  column_b = (const char *)sqlite3_value_text(argv[3]);
+  if (argc > 4 && sqlite3_value_type(argv[4]) != SQLITE_NULL) {
+    predicate_name = (const char *)sqlite3_value_text(argv[4]);
+  }
+
+  if (table_a == NULL || column_a == NULL || table_b == NULL || column_b == NULL) {
+    error_append(&error, "gpkg_spatial_join requires two table names and two column names");
+    result = SQLITE_ERROR;
+    goto exit;
+  }
+
+  cursor->predicate = spatial_predicate_lookup(predicate_name);
+  if (cursor->predicate == NULL) {
+    error_append(&error, "Unsupported spatial predicate: %s", predicate_name);
+    result = SQLITE_ERROR;
+    goto exit;
+  }
+
+  if (!spatial_predicate_available(vtab->geos_context, cursor->predicate->predicate)) {
+    error_append(&error, "Spatial predicate %s is not supported by GEOS %s", predicate_name, GEOSversion(vtab->geos_context->geos_library));
+    result = SQLITE_ERROR;
+    goto exit;
+  }
+
+  result = spatial_join_prepare_side(vtab, table_a, column_a, &cursor->reader_a, &cursor->geometry_stmt_a, &error);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  result = spatial_join_prepare_side(vtab, table_b, column_b, &cursor->reader_b, &cursor->geometry_stmt_b, &error);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  // The bounding box of the root nodes is not stored, so they are treated as unbounded
+  root.id = RTREE_ROOT_NODE;
+  root.min_x = -HUGE_VAL;
+  root.max_x = HUGE_VAL;
+  root.min_y = -HUGE_VAL;
+  root.max_y = HUGE_VAL;
+  result = spatial_join_push(cursor, &root, cursor->reader_a.depth, &root, cursor->reader_b.depth);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  cursor->row = 0;
+  cursor->eof = 0;
+  result = spatial_join_next(cursor_base);
+
+exit:
+  if (result != SQLITE_OK) {
+    if (error_count(&error) > 0) {
+      spatial_query_set_error(cursor_base->pVtab, &error);
+    }
+    spatial_join_cursor_reset(cursor);
+  }
+
+  return result;
+}
+
+static int spatial_join_eof(sqlite3_vtab_cursor *cursor_base) {
+  return ((spatial_join_cursor_t *)cursor_base)->eof;
+}
+
+static int spatial_join_column(sqlite3_vtab_cursor *cursor_base, sqlite3_context *context, int i) {
+  spatial_join_cursor_t *cursor = (spatial_join_cursor_t *)cursor_base;
+
+  switch (i) {
+    case SPATIAL_JOIN_COLUMN_ID_A:
+      sqlite3_result_int64(context, cursor->id_a);
+      break;
+    case SPATIAL_JOIN_COLUMN_ID_B:
+      sqlite3_result_int64(context, cursor->id_b);
+      break;
+    default:
+      sqlite3_result_null(context);
+      break;
+  }
+
+  return SQLITE_OK;
+}
+
+static int spatial_join_rowid(sqlite3_vtab_cursor *cursor_base, sqlite3_int64 *rowid) {
+  *rowid = ((spatial_join_cursor_t *)cursor_base)->row;
+  return SQLITE_OK;
+}
+
+static sqlite3_module spatial_join_module = {
+  0,
+  spatial_join_connect,
+  spatial_join_connect,
+  spatial_join_best_index,
+  spatial_join_disconnect,
+  spatial_join_disconnect,
+  spatial_join_open,
+  spatial_join_close,
+  spatial_join_filter,
+  spatial_join_next,
+  spatial_join_eof,
+  spatial_join_column,
+  spatial_join_rowid
+};
+
+static void GPKG_GeometryCacheHits(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  const geos_context_t *geos_context = (const geos_context_t *)sqlite3_user_data(context);
+  sqlite3_result_int64(context, geos_context->geom_cache != NULL ? geos_context->geom_cache->hits : 0);
+}
+
+static void GPKG_GeometryCacheMisses(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  const geos_context_t *geos_context = (const geos_context_t *)sqlite3_user_data(context);
+  sqlite3_result_int64(context, geos_context->geom_cache != NULL ? geos_context->geom_cache->misses : 0);
+}
+
+static void GPKG_GEOSHandleCount(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  const geos_context_t *geos_context = (const geos_context_t *)sqlite3_user_data(context);
+  sqlite3_result_int(context, geom_geos_pool_size(geos_context->geos_pool));
+}
+
+static void GPKG_PreparedGeometryCacheHits(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  sqlite3_result_int64(context, atomic_get_long(&geos_prepared_cache.hits));
+}
+
+static void GPKG_PreparedGeometryCacheMisses(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  sqlite3_result_int64(context, atomic_get_long(&geos_prepared_cache.misses));
+}
+
+#define GEOS_FUNCTION4(db, name, funcName, geosName, nbArgs, ctx, error)                                               \
+  do {                                                                                                                 \
+    if (GEOS_FUNC_AVAILABLE(ctx,geosName)) {                                                                           \
+      geos_context_acquire(ctx);                                                                                       \
+      sql_create_function(db, name, funcName, nbArgs, SQL_DETERMINISTIC, ctx, (void(*)(void*))geos_context_release, error);     \
+    }                                                                                                                  \
+} while (0)
+
+#define GEOS_FUNCTION3(db, prefix, name, geosName, nbArgs, ctx, error)                                                 \
+  GEOS_FUNCTION4(db, STR(name), prefix##_##name, geosName, nbArgs, ctx, error);                                        \
+  GEOS_FUNCTION4(db, STR(prefix##_##name), prefix##_##name, geosName, nbArgs, ctx, error);
+
+#define GEOS_FUNCTION(db, prefix, name, nbArgs, ctx, error) GEOS_FUNCTION2(db, prefix, name, name, nbArgs, ctx, error)
+#define GEOS_FUNCTION2(db, prefix, name, geosname, nbArgs, ctx, error) GEOS_FUNCTION3(db, prefix, name, GEOS##geosname##_r, nbArgs, ctx, error)
+#define GEOS_FUNCTION_PREP(db, prefix, name, nbArgs, ctx, error) GEOS_FUNCTION2(db, prefix, name, Prepared##name, nbArgs, ctx, error)
+
+static void geom_func_register(sqlite3 *db, errorstream_t *error, geos_context_t *ctx) {
+  char const *geos_version = GEOSversion(ctx->geos_library);
+  int geos_major;
+  int geos_minor;
+  int geos_version_result = sscanf(geos_version, "%d.%d", &geos_major, &geos_minor);
+  if (geos_version_result != 2) {
+    error_append(error, "Could not parse GEOS version number (%s)", geos_version);
+  }
+
+  geos_prepared_cache_init();
+
+  GEOS_FUNCTION(db, ST, Area, 1, ctx, error);
+  GEOS_FUNCTION4(db, "ST_Length", ST_Length, GEOSLength_r, 1, ctx, error);
+  GEOS_FUNCTION4(db, "GLength", ST_Length, GEOSLength_r, 1, ctx, error);
+
+  GEOS_FUNCTION2(db, ST, IsSimple, isSimple, 1, ctx, error);
+  GEOS_FUNCTION2(db, ST, IsRing, isRing, 1, ctx, error);
+  GEOS_FUNCTION2(db, ST, IsValid, isValid, 1, ctx, error);
+
+  GEOS_FUNCTION_PREP(db, ST, Disjoint, 2, ctx, error);
+  GEOS_FUNCTION_PREP(db, ST, Intersects, 2, ctx, error);
+  GEOS_FUNCTION_PREP(db, ST, Touches, 2, ctx, error);
   GEOS_FUNCTION_PREP(db, ST, Crosses, 2, ctx, error);
   GEOS_FUNCTION_PREP(db, ST, Within, 2, ctx, error);
   GEOS_FUNCTION_PREP(db, ST, Contains, 2, ctx, error);
@@ -677,10 +2577,32 @@ static void geom_func_register(sqlite3 *db, errorstream_t *error, geos_context_t
     GEOS_FUNCTION2(db, ST, IsClosed, isClosed, 1, ctx, error);
     GEOS_FUNCTION_PREP(db, ST, Covers, 2, ctx, error);
     GEOS_FUNCTION_PREP(db, ST, CoveredBy, 2, ctx, error);
+
+    if (GEOS_FUNC_AVAILABLE(ctx, GEOSUnaryUnion_r)) {
+      geos_context_acquire(ctx);
+      sql_create_aggregate(db, "ST_Union", ST_Union_step, ST_Union_final, 1, 0, ctx, (void(*)(void*))geos_context_release, error);
+      geos_context_acquire(ctx);
+      sql_create_aggregate(db, "GUnion", ST_Union_step, ST_Union_final, 1, 0, ctx, (void(*)(void*))geos_context_release, error);
+    }
   }
 #endif
 
   GEOS_FUNCTION3(db, GPKG, GEOSVersion, GEOSversion, 0, ctx, error);
+
+  geos_context_acquire(ctx);
+  sql_create_function(db, "GPKG_GeometryCacheHits", GPKG_GeometryCacheHits, 0, 0, ctx, (void(*)(void*))geos_context_release, error);
+  geos_context_acquire(ctx);
+  sql_create_function(db, "GPKG_GeometryCacheMisses", GPKG_GeometryCacheMisses, 0, 0, ctx, (void(*)(void*))geos_context_release, error);
+  geos_context_acquire(ctx);
+  sql_create_function(db, "GPKG_GEOSHandleCount", GPKG_GEOSHandleCount, 0, 0, ctx, (void(*)(void*))geos_context_release, error);
+  sql_create_function(db, "GPKG_PreparedGeometryCacheHits", GPKG_PreparedGeometryCacheHits, 0, 0, NULL, NULL, error);
+  sql_create_function(db, "GPKG_PreparedGeometryCacheMisses", GPKG_PreparedGeometryCacheMisses, 0, 0, NULL, NULL, error);
+
+  geos_context_acquire(ctx);
+  sql_create_module(db, "gpkg_spatial_query", &spatial_query_module, ctx, (void(*)(void*))geos_context_release, error);
+
+  geos_context_acquire(ctx);
+  sql_create_module(db, "gpkg_spatial_join", &spatial_join_module, ctx, (void(*)(void*))geos_context_release, error);
 }
 
 #if GPKG_GEOM_FUNC == GPKG_GEOS_DL
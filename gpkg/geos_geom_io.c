@@ -9,13 +9,15 @@ static int geos_begin_geometry(const struct geom_consumer_t *consumer, const geo
 
   writer->offset++;
   writer->childData[writer->offset].count = 0;
+  writer->childData[writer->offset].coord_type = header->coord_type;
+  writer->childData[writer->offset].coord_size = header->coord_size;
 
   switch (header->geom_type) {
     case GEOM_POINT:
     case GEOM_LINEARRING:
     case GEOM_LINESTRING:
       writer->childData[writer->offset].type = COORDINATES;
-      writer->childData[writer->offset].data = sqlite3_malloc(2 * 20 * sizeof(double));
+      writer->childData[writer->offset].data = sqlite3_malloc(header->coord_size * 20 * sizeof(double));
       writer->childData[writer->offset].capacity = 20;
       break;
     case GEOM_POLYGON:
@@ -60,11 +62,18 @@ static int geos_add_geometry(geos_writer_t *writer, GEOSGeometry *geom) {
   return SQLITE_OK;
 }
 
-static int geos_add_coordinate(geos_writer_t *writer, double x, double y) {
+/*
+ * Appends coordinates to the current coordinate sequence. The coordinates are kept in the layout of the geometry
+ * header so they can be handed to GEOS in one go.
+ */
+static int geos_add_coordinates(geos_writer_t *writer, size_t point_count, const double *coords) {
   geos_data_t *childData = &writer->childData[writer->offset];
-  if (childData->count == childData->capacity) {
-    size_t new_capacity = childData->capacity * 3 / 2;
-    void *new_data = sqlite3_realloc(childData->data, new_capacity * 2 * sizeof(double));
+  if (childData->count + point_count > childData->capacity) {
+    size_t new_capacity = childData->capacity * 2;
+    if (new_capacity < childData->count + point_count) {
+      new_capacity = childData->count + point_count;
+    }
+    void *new_data = sqlite3_realloc64(childData->data, new_capacity * childData->coord_size * sizeof(double));
     if (new_data == NULL) {
       return SQLITE_NOMEM;
     }
@@ -72,27 +81,45 @@ static int geos_add_coordinate(geos_writer_t *writer, double x, double y) {
     childData->capacity = new_capacity;
   }
 
-  double *coords = (double *)childData->data;
-  size_t offset = 2 * childData->count;
-  coords[offset] = x;
-  coords[offset + 1] = y;
-  childData->count++;
+  double *data = (double *)childData->data;
+  memcpy(data + childData->count * childData->coord_size, coords, point_count * childData->coord_size * sizeof(double));
+  childData->count += point_count;
   return SQLITE_OK;
 }
 
+/*
+ * Creates a GEOS coordinate sequence from the current coordinates. The buffer based API copies all coordinates in one
+ * call, including Z and M. Older GEOS versions only get the coordinates one ordinate at a time and drop M values.
+ */
 static GEOSCoordSequence *geos_create_coord_seq(geos_writer_t *writer) {
   geos_data_t *childData = &writer->childData[writer->offset];
   size_t childCount = childData->count;
+  uint32_t coord_size = childData->coord_size;
+  int has_z = childData->coord_type == GEOM_XYZ || childData->coord_type == GEOM_XYZM;
+  int has_m = childData->coord_type == GEOM_XYM || childData->coord_type == GEOM_XYZM;
+  double *coords = (double *)childData->data;
+
+#ifdef GEOS_HAVE_COORDSEQ_BUFFER
+  if (GEOS_API_AVAILABLE(writer->context, GEOSCoordSeq_copyFromBuffer_r)) {
+    return GEOSCoordSeq_copyFromBuffer_r(writer->context, coords, childCount, has_z, has_m);
+  }
+#endif
 
-  GEOSCoordSequence *seq = GEOSCoordSeq_create_r(writer->context, childCount, 2);
+  if (has_z && !GEOS_API_AVAILABLE(writer->context, GEOSCoordSeq_setZ_r)) {
+    has_z = 0;
+  }
+
+  GEOSCoordSequence *seq = GEOSCoordSeq_create_r(writer->context, childCount, has_z ? 3 : 2);
   if (seq == NULL) {
     return NULL;
   }
 
-  double *coords = (double *)childData->data;
-  for (size_t i = 0; i < childCount; i++) {
-    GEOSCoordSeq_setX_r(writer->context, seq, i, *coords++);
-    GEOSCoordSeq_setY_r(writer->context, seq, i, *coords++);
+  for (size_t i = 0; i < childCount; i++, coords += coord_size) {
+    GEOSCoordSeq_setX_r(writer->context, seq, i, coords[0]);
+    GEOSCoordSeq_setY_r(writer->context, seq, i, coords[1]);
+    if (has_z) {
+      GEOSCoordSeq_setZ_r(writer->context, seq, i, coords[2]);
+    }
   }
 
   return seq;
@@ -217,10 +244,9 @@ static int geos_coordinates(const struct geom_consumer_t *consumer, const geom_h
   int result = SQLITE_OK;
   geos_writer_t *writer = (geos_writer_t *) consumer;
 
-  size_t offset = 0;
-  for (int i = 0; result == SQLITE_OK && i < point_count; i++) {
-    result = geos_add_coordinate(writer, coords[offset], coords[offset + 1]);
-    offset += header->coord_size;
+  point_count = (skip_coords == 0) ? point_count : (point_count - (skip_coords / header->coord_size));
+  if (point_count > 0) {
+    result = geos_add_coordinates(writer, point_count, &coords[skip_coords]);
   }
 
   return result;
@@ -271,19 +297,50 @@ GEOSGeometry *geos_writer_getgeometry(geos_writer_t *writer) {
   return writer->geometry;
 }
 
-#define COORD_BATCH_SIZE 10
+#define COORD_BATCH_SIZE 64
 
 static int read_geos_coordseq(geos_handle_t *geos, geom_header_t *header, const GEOSCoordSequence *coordseq, geom_consumer_t const *consumer, errorstream_t *error) {
   int result = SQLITE_OK;
-  double coord[2 * COORD_BATCH_SIZE];
-  uint32_t remaining;
-  GEOSCoordSeq_getSize_r(geos, coordseq, &remaining);
-
-  while (remaining > 0) {
-    uint32_t points_to_read = (remaining > COORD_BATCH_SIZE ? COORD_BATCH_SIZE : remaining);
-    for (int i = 0, ix = 0; i < points_to_read; i++, ix += 2) {
-      GEOSCoordSeq_getX_r(geos, coordseq, i, &coord[ix]);
-      GEOSCoordSeq_getY_r(geos, coordseq, i, &coord[ix + 1]);
+  uint32_t size;
+  GEOSCoordSeq_getSize_r(geos, coordseq, &size);
+
+  if (size == 0) {
+    return result;
+  }
+
+  int has_z = header->coord_type == GEOM_XYZ || header->coord_type == GEOM_XYZM;
+  int has_m = header->coord_type == GEOM_XYM || header->coord_type == GEOM_XYZM;
+
+#ifdef GEOS_HAVE_COORDSEQ_BUFFER
+  if (GEOS_API_AVAILABLE(geos, GEOSCoordSeq_copyToBuffer_r)) {
+    double *coords = (double *)sqlite3_malloc64((sqlite3_uint64)size * header->coord_size * sizeof(double));
+    if (coords == NULL) {
+      return SQLITE_NOMEM;
+    }
+
+    if (GEOSCoordSeq_copyToBuffer_r(geos, coordseq, coords, has_z, has_m)) {
+      result = consumer->coordinates(consumer, header, size, coords, 0, error);
+    } else {
+      geom_geos_get_error(error);
+      result = SQLITE_ERROR;
+    }
+
+    sqlite3_free(coords);
+    return result;
+  }
+#endif
+
+  double coord[4 * COORD_BATCH_SIZE];
+  uint32_t start = 0;
+  while (start < size) {
+    uint32_t points_to_read = (size - start > COORD_BATCH_SIZE ? COORD_BATCH_SIZE : size - start);
+    double *c = coord;
+    for (uint32_t i = start; i < start + points_to_read; i++, c += header->coord_size) {
+      GEOSCoordSeq_getX_r(geos, coordseq, i, &c[0]);
+      GEOSCoordSeq_getY_r(geos, coordseq, i, &c[1]);
+      if (has_z) {
+        GEOSCoordSeq_getZ_r(geos, coordseq, i, &c[2]);
+      }
     }
 
     result = consumer->coordinates(consumer, header, points_to_read, coord, 0, error);
@@ -291,18 +348,18 @@ static int read_geos_coordseq(geos_handle_t *geos, geom_header_t *header, const
       return result;
     }
 
-    remaining -= points_to_read;
+    start += points_to_read;
   }
 
   return result;
 }
 
-static int read_geos_point(geos_handle_t *geos, const GEOSGeometry *geom, geom_consumer_t const *consumer, errorstream_t *error) {
+static int read_geos_point(geos_handle_t *geos, const GEOSGeometry *geom, coord_type_t coord_type, geom_consumer_t const *consumer, errorstream_t *error) {
   int result = SQLITE_OK;
   geom_header_t header = {
     GEOM_POINT,
-    GEOM_XY,
-    2
+    coord_type,
+    (uint32_t) geom_coord_dim(coord_type)
   };
 
   if (result == SQLITE_OK) {
@@ -317,12 +374,12 @@ static int read_geos_point(geos_handle_t *geos, const GEOSGeometry *geom, geom_c
   return result;
 }
 
-static int read_geos_linestring(geos_handle_t *geos, const GEOSGeometry *geom, geom_consumer_t const *consumer, errorstream_t *error) {
+static int read_geos_linestring(geos_handle_t *geos, const GEOSGeometry *geom, coord_type_t coord_type, geom_consumer_t const *consumer, errorstream_t *error) {
   int result = SQLITE_OK;
   geom_header_t header = {
     GEOM_LINESTRING,
-    GEOM_XY,
-    2
+    coord_type,
+    (uint32_t) geom_coord_dim(coord_type)
   };
 
   if (result == SQLITE_OK) {
@@ -337,12 +394,12 @@ static int read_geos_linestring(geos_handle_t *geos, const GEOSGeometry *geom, g
   return result;
 }
 
-static int read_geos_linearring(geos_handle_t *geos, const GEOSGeometry *geom, geom_consumer_t const *consumer, errorstream_t *error) {
+static int read_geos_linearring(geos_handle_t *geos, const GEOSGeometry *geom, coord_type_t coord_type, geom_consumer_t const *consumer, errorstream_t *error) {
   int result = SQLITE_OK;
   geom_header_t header = {
     GEOM_LINEARRING,
-    GEOM_XY,
-    2
+    coord_type,
+    (uint32_t) geom_coord_dim(coord_type)
   };
 
   if (result == SQLITE_OK) {
@@ -357,25 +414,25 @@ static int read_geos_linearring(geos_handle_t *geos, const GEOSGeometry *geom, g
   return result;
 }
 
-static int read_geos_polygon(geos_handle_t *geos, const GEOSGeometry *geom, geom_consumer_t const *consumer, errorstream_t *error) {
+static int read_geos_polygon(geos_handle_t *geos, const GEOSGeometry *geom, coord_type_t coord_type, geom_consumer_t const *consumer, errorstream_t *error) {
   int result = SQLITE_OK;
   geom_header_t header = {
     GEOM_POLYGON,
-    GEOM_XY,
-    2
+    coord_type,
+    (uint32_t) geom_coord_dim(coord_type)
   };
 
   if (result == SQLITE_OK) {
     result = consumer->begin_geometry(consumer, &header, error);
   }
   if (result == SQLITE_OK && !GEOSisEmpty_r(geos, geom)) {
-    result = read_geos_linearring(geos, GEOSGetExteriorRing_r(geos, geom), consumer, error);
+    result = read_geos_linearring(geos, GEOSGetExteriorRing_r(geos, geom), coord_type, consumer, error);
     int ring_count = GEOSGetNumInteriorRings_r(geos, geom);
     for (int i = 0; i < ring_count; i++) {
       if (result != SQLITE_OK) {
         break;
       }
-      result = read_geos_linearring(geos, GEOSGetInteriorRingN_r(geos, geom, i), consumer, error);
+      result = read_geos_linearring(geos, GEOSGetInteriorRingN_r(geos, geom, i), coord_type, consumer, error);
     }
   }
 
@@ -386,12 +443,12 @@ static int read_geos_polygon(geos_handle_t *geos, const GEOSGeometry *geom, geom
   return result;
 }
 
-static int read_geos_multipoint(geos_handle_t *geos, const GEOSGeometry *geom, geom_consumer_t const *consumer, errorstream_t *error) {
+static int read_geos_multipoint(geos_handle_t *geos, const GEOSGeometry *geom, coord_type_t coord_type, geom_consumer_t const *consumer, errorstream_t *error) {
   int result = SQLITE_OK;
   geom_header_t header = {
     GEOM_MULTIPOINT,
-    GEOM_XY,
-    2
+    coord_type,
+    (uint32_t) geom_coord_dim(coord_type)
   };
 
   if (result == SQLITE_OK) {
@@ -402,7 +459,7 @@ static int read_geos_multipoint(geos_handle_t *geos, const GEOSGeometry *geom, g
     if (result != SQLITE_OK) {
       break;
     }
-    result = read_geos_point(geos, GEOSGetGeometryN_r(geos, geom, i), consumer, error);
+    result = read_geos_point(geos, GEOSGetGeometryN_r(geos, geom, i), coord_type, consumer, error);
   }
 
   if (result == SQLITE_OK) {
@@ -412,12 +469,12 @@ static int read_geos_multipoint(geos_handle_t *geos, const GEOSGeometry *geom, g
   return result;
 }
 
-static int read_geos_multilinestring(geos_handle_t *geos, const GEOSGeometry *geom, geom_consumer_t const *consumer, errorstream_t *error) {
+static int read_geos_multilinestring(geos_handle_t *geos, const GEOSGeometry *geom, coord_type_t coord_type, geom_consumer_t const *consumer, errorstream_t *error) {
   int result = SQLITE_OK;
   geom_header_t header = {
     GEOM_MULTILINESTRING,
-    GEOM_XY,
-    2
+    coord_type,
+    (uint32_t) geom_coord_dim(coord_type)
   };
 
   if (result == SQLITE_OK) {
@@ -429,7 +486,7 @@ static int read_geos_multilinestring(geos_handle_t *geos, const GEOSGeometry *ge
     if (result != SQLITE_OK) {
       break;
     }
-    result = read_geos_linestring(geos, GEOSGetGeometryN_r(geos, geom, i), consumer, error);
+    result = read_geos_linestring(geos, GEOSGetGeometryN_r(geos, geom, i), coord_type, consumer, error);
   }
 
   if (result == SQLITE_OK) {
@@ -439,12 +496,12 @@ static int read_geos_multilinestring(geos_handle_t *geos, const GEOSGeometry *ge
   return result;
 }
 
-static int read_geos_multipolygon(geos_handle_t *geos, const GEOSGeometry *geom, geom_consumer_t const *consumer, errorstream_t *error) {
+static int read_geos_multipolygon(geos_handle_t *geos, const GEOSGeometry *geom, coord_type_t coord_type, geom_consumer_t const *consumer, errorstream_t *error) {
   int result = SQLITE_OK;
   geom_header_t header = {
     GEOM_MULTIPOLYGON,
-    GEOM_XY,
-    2
+    coord_type,
+    (uint32_t) geom_coord_dim(coord_type)
   };
 
   if (result == SQLITE_OK) {
@@ -456,7 +513,7 @@ static int read_geos_multipolygon(geos_handle_t *geos, const GEOSGeometry *geom,
     if (result != SQLITE_OK) {
       break;
     }
-    result = read_geos_polygon(geos, GEOSGetGeometryN_r(geos, geom, i), consumer, error);
+    result = read_geos_polygon(geos, GEOSGetGeometryN_r(geos, geom, i), coord_type, consumer, error);
   }
 
   if (result == SQLITE_OK) {
@@ -466,14 +523,14 @@ static int read_geos_multipolygon(geos_handle_t *geos, const GEOSGeometry *geom,
   return result;
 }
 
-static int read_geos_geometry(geos_handle_t *geos, const GEOSGeometry *geom, geom_consumer_t const *consumer, errorstream_t *error);
+static int read_geos_geometry(geos_handle_t *geos, const GEOSGeometry *geom, coord_type_t coord_type, geom_consumer_t const *consumer, errorstream_t *error);
 
-static int read_geos_geometrycollection(geos_handle_t *geos, const GEOSGeometry *geom, geom_consumer_t const *consumer, errorstream_t *error) {
+static int read_geos_geometrycollection(geos_handle_t *geos, const GEOSGeometry *geom, coord_type_t coord_type, geom_consumer_t const *consumer, errorstream_t *error) {
   int result = SQLITE_OK;
   geom_header_t header = {
     GEOM_GEOMETRYCOLLECTION,
-    GEOM_XY,
-    2
+    coord_type,
+    (uint32_t) geom_coord_dim(coord_type)
   };
 
   if (result == SQLITE_OK) {
@@ -485,7 +542,7 @@ static int read_geos_geometrycollection(geos_handle_t *geos, const GEOSGeometry
     if (result != SQLITE_OK) {
       break;
     }
-    result = read_geos_geometry(geos, GEOSGetGeometryN_r(geos, geom, i), consumer, error);
+    result = read_geos_geometry(geos, GEOSGetGeometryN_r(geos, geom, i), coord_type, consumer, error);
   }
 
   if (result == SQLITE_OK) {
@@ -495,38 +552,64 @@ static int read_geos_geometrycollection(geos_handle_t *geos, const GEOSGeometry
   return result;
 }
 
-static int read_geos_geometry(geos_handle_t *geos, const GEOSGeometry *geom, geom_consumer_t const *consumer, errorstream_t *error) {
+static int read_geos_geometry(geos_handle_t *geos, const GEOSGeometry *geom, coord_type_t coord_type, geom_consumer_t const *consumer, errorstream_t *error) {
   int type = GEOSGeomTypeId_r(geos, geom);
   if (type == GEOS_POINT) {
-    return read_geos_point(geos, geom, consumer, error);
+    return read_geos_point(geos, geom, coord_type, consumer, error);
   } else if (type == GEOS_LINESTRING) {
-    return read_geos_linestring(geos, geom, consumer, error);
+    return read_geos_linestring(geos, geom, coord_type, consumer, error);
   } else if (type == GEOS_LINEARRING) {
-    return read_geos_linearring(geos, geom, consumer, error);
+    return read_geos_linearring(geos, geom, coord_type, consumer, error);
   } else if (type == GEOS_POLYGON) {
-    return read_geos_polygon(geos, geom, consumer, error);
+    return read_geos_polygon(geos, geom, coord_type, consumer, error);
   } else if (type == GEOS_MULTIPOINT) {
-    return read_geos_multipoint(geos, geom, consumer, error);
+    return read_geos_multipoint(geos, geom, coord_type, consumer, error);
   } else if (type == GEOS_MULTILINESTRING) {
-    return read_geos_multilinestring(geos, geom, consumer, error);
+    return read_geos_multilinestring(geos, geom, coord_type, consumer, error);
   } else if (type == GEOS_MULTIPOLYGON) {
-    return read_geos_multipolygon(geos, geom, consumer, error);
+    return read_geos_multipolygon(geos, geom, coord_type, consumer, error);
   } else if (type == GEOS_GEOMETRYCOLLECTION) {
-    return read_geos_geometrycollection(geos, geom, consumer, error);
+    return read_geos_geometrycollection(geos, geom, coord_type, consumer, error);
   } else {
     return SQLITE_ERROR;
   }
 }
 
+/*
+ * Determines the coordinate type of a GEOS geometry. M values can only be read using the buffer based API, so they are
+ * ignored when it is not available.
+ */
+static coord_type_t geos_coord_type(geos_handle_t *geos, const GEOSGeometry *geom) {
+  int has_z = 0;
+  int has_m = 0;
+
+  if (GEOS_API_AVAILABLE(geos, GEOSHasZ_r) && GEOS_API_AVAILABLE(geos, GEOSCoordSeq_getZ_r)) {
+    has_z = GEOSHasZ_r(geos, geom) == 1;
+  }
+
+#if defined(GEOS_HAVE_M) && defined(GEOS_HAVE_COORDSEQ_BUFFER)
+  if (GEOS_API_AVAILABLE(geos, GEOSHasM_r) && GEOS_API_AVAILABLE(geos, GEOSCoordSeq_copyToBuffer_r)) {
+    has_m = GEOSHasM_r(geos, geom) == 1;
+  }
+#endif
+
+  if (has_z) {
+    return has_m ? GEOM_XYZM : GEOM_XYZ;
+  } else {
+    return has_m ? GEOM_XYM : GEOM_XY;
+  }
+}
+
 int geos_read_geometry(geos_handle_t *geos, const GEOSGeometry *geom, geom_consumer_t const *consumer, errorstream_t *error) {
   int result;
+  coord_type_t coord_type = geos_coord_type(geos, geom);
 
   result = consumer->begin(consumer, error);
   if (result != SQLITE_OK) {
     goto exit;
   }
 
-  result = read_geos_geometry(geos, geom, consumer, error);
+  result = read_geos_geometry(geos, geom, coord_type, consumer, error);
   if (result != SQLITE_OK) {
     goto exit;
   }
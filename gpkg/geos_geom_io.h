@@ -23,6 +23,10 @@ typedef struct {
   size_t capacity;
   /** @private */
   size_t count;
+  /** @private */
+  coord_type_t coord_type;
+  /** @private */
+  uint32_t coord_size;
 } geos_data_t;
 
 /**
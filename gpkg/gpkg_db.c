@@ -15,6 +15,7 @@
  */
 #include "spatialdb_internal.h"
 #include "gpkg_geom.h"
+#include "rtree.h"
 #include "sql.h"
 #include "sqlite.h"
 
@@ -469,6 +470,10 @@ static int gpkg_writer_init(geom_blob_writer_t *writer) {
   return gpb_writer_init(writer, -1);
 }
 
+static int gpkg_writer_init_size(geom_blob_writer_t *writer, size_t initial_size) {
+  return gpb_writer_init_size(writer, -1, initial_size);
+}
+
 static int add_geometry_column(sqlite3 *db, const char *db_name, const char *table_name, const char *column_name, const char *geom_type, int srs_id, int z, int m, errorstream_t *error) {
   int result;
 
@@ -508,7 +513,8 @@ static int add_geometry_column(sqlite3 *db, const char *db_name, const char *tab
 
   // Check if the SRID is defined
   int count = 0;
-  result = sql_exec_for_int(db, &count, "SELECT count(*) FROM gpkg_spatial_ref_sys WHERE srs_id = %d", srs_id);
+  value_t srs_params[] = { INT_VALUE(srs_id) };
+  result = sql_exec_for_int_params(db, &count, srs_params, 1, "SELECT count(*) FROM gpkg_spatial_ref_sys WHERE srs_id = ?");
   if (result != SQLITE_OK) {
     return result;
   }
@@ -566,60 +572,24 @@ static int create_tiles_table(sqlite3 *db, const char *db_name, const char *tabl
   return SQLITE_OK;
 }
 
-static int create_spatial_index(sqlite3 *db, const char *db_name, const char *table_name, const char *geometry_column_name, const char *id_column_name, errorstream_t *error) {
-  int result = SQLITE_OK;
-  char *index_table_name = NULL;
-  int exists = 0;
-
-  index_table_name = sqlite3_mprintf("rtree_%s_%s", table_name, geometry_column_name);
-  if (index_table_name == NULL) {
-    result = SQLITE_NOMEM;
-    goto exit;
-  }
-
-  // Check if the target table exists
-  exists = 0;
-  result = sql_check_table_exists(db, db_name, index_table_name, &exists);
-  if (result != SQLITE_OK) {
-    error_append(error, "Could not check if index table %s.%s exists: %s", db_name, index_table_name, sqlite3_errmsg(db));
-    goto exit;
-  }
-
-  if (exists) {
-    result = SQLITE_OK;
-    goto exit;
-  }
-
-  // Check if the target table exists
-  exists = 0;
-  result = sql_check_table_exists(db, db_name, table_name, &exists);
-  if (result != SQLITE_OK) {
-    error_append(error, "Could not check if table %s.%s exists: %s", db_name, table_name, sqlite3_errmsg(db));
-    goto exit;
-  }
-
-  if (!exists) {
-    error_append(error, "Table %s.%s does not exist", db_name, table_name);
-    goto exit;
-  }
-
-  int geom_col_count = 0;
-  result = sql_exec_for_int(db, &geom_col_count, "SELECT count(*) FROM \"%w\".gpkg_geometry_columns WHERE table_name LIKE %Q AND column_name LIKE %Q", db_name, table_name, geometry_column_name);
-  if (result != SQLITE_OK) {
-    error_append(error, "Could not check if column %s.%s.%s exists in %s.gpkg_geometry_columns: %s", db_name, table_name, geometry_column_name, db_name, sqlite3_errmsg(db));
-    goto exit;
-  }
+/*
+ * Returns the query that produces the rtree entries (id, minx, maxx, miny, maxy) for a feature table.
+ */
+static char *spatial_index_source_sql(const char *db_name, const char *table_name, const char *geometry_column_name, const char *id_column_name) {
+  return sqlite3_mprintf(
+           "SELECT \"%w\", ST_MinX(\"%w\"), ST_MaxX(\"%w\"), ST_MinY(\"%w\"), ST_MaxY(\"%w\") FROM \"%w\".\"%w\""
+           "  WHERE \"%w\" NOTNULL AND NOT ST_IsEmpty(\"%w\")",
+           id_column_name, geometry_column_name, geometry_column_name, geometry_column_name, geometry_column_name, db_name, table_name,
+           geometry_column_name, geometry_column_name
+         );
+}
 
-  if (geom_col_count == 0) {
-    error_append(error, "Column %s.%s.%s is not registered in %s.gpkg_geometry_columns", db_name, table_name, geometry_column_name, db_name);
-    goto exit;
-  }
+static char *spatial_index_name(const char *table_name, const char *geometry_column_name) {
+  return sqlite3_mprintf("rtree_%s_%s", table_name, geometry_column_name);
+}
 
-  result = sql_exec(db, "CREATE VIRTUAL TABLE \"%w\".\"%w\" USING rtree(id, minx, maxx, miny, maxy)", db_name, index_table_name);
-  if (result != SQLITE_OK) {
-    error_append(error, "Could not create rtree table %s.%s: %s", db_name, index_table_name, sqlite3_errmsg(db));
-    goto exit;
-  }
+static int create_spatial_index_triggers(sqlite3 *db, const char *db_name, const char *table_name, const char *geometry_column_name, const char *id_column_name, const char *index_table_name, errorstream_t *error) {
+  int result = SQLITE_OK;
 
   result = sql_exec(
              db,
@@ -746,17 +716,73 @@ static int create_spatial_index(sqlite3 *db, const char *db_name, const char *ta
     goto exit;
   }
 
-  result = sql_exec(
-             db,
-             "INSERT OR REPLACE INTO \"%w\".\"%w\" (id, minx, maxx, miny, maxy) "
-             "  SELECT \"%w\", ST_MinX(\"%w\"), ST_MaxX(\"%w\"), ST_MinY(\"%w\"), ST_MaxY(\"%w\") FROM \"%w\".\"%w\""
-             "  WHERE \"%w\" NOTNULL AND NOT ST_IsEmpty(\"%w\")",
-             db_name, index_table_name,
-             id_column_name, geometry_column_name, geometry_column_name, geometry_column_name, geometry_column_name, db_name, table_name,
-             geometry_column_name, geometry_column_name
-           );
+exit:
+  return result;
+}
+
+static int create_spatial_index(sqlite3 *db, const spatialdb_t *spatialdb, const char *db_name, const char *table_name, const char *geometry_column_name, const char *id_column_name, errorstream_t *error) {
+  int result = SQLITE_OK;
+  char *index_table_name = NULL;
+  int exists = 0;
+
+  index_table_name = spatial_index_name(table_name, geometry_column_name);
+  if (index_table_name == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  // Check if the target table exists
+  exists = 0;
+  result = sql_check_table_exists(db, db_name, index_table_name, &exists);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not check if index table %s.%s exists: %s", db_name, index_table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (exists) {
+    result = SQLITE_OK;
+    goto exit;
+  }
+
+  // Check if the target table exists
+  exists = 0;
+  result = sql_check_table_exists(db, db_name, table_name, &exists);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not check if table %s.%s exists: %s", db_name, table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (!exists) {
+    error_append(error, "Table %s.%s does not exist", db_name, table_name);
+    goto exit;
+  }
+
+  int geom_col_count = 0;
+  value_t geom_col_params[] = { TEXT_VALUE((char *)table_name), TEXT_VALUE((char *)geometry_column_name) };
+  result = sql_exec_for_int_params(db, &geom_col_count, geom_col_params, 2, "SELECT count(*) FROM \"%w\".gpkg_geometry_columns WHERE table_name LIKE ? AND column_name LIKE ?", db_name);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not check if column %s.%s.%s exists in %s.gpkg_geometry_columns: %s", db_name, table_name, geometry_column_name, db_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (geom_col_count == 0) {
+    error_append(error, "Column %s.%s.%s is not registered in %s.gpkg_geometry_columns", db_name, table_name, geometry_column_name, db_name);
+    goto exit;
+  }
+
+  result = sql_exec(db, "CREATE VIRTUAL TABLE \"%w\".\"%w\" USING rtree(id, minx, maxx, miny, maxy)", db_name, index_table_name);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not create rtree table %s.%s: %s", db_name, index_table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  result = create_spatial_index_triggers(db, db_name, table_name, geometry_column_name, id_column_name, index_table_name, error);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  result = spatialdb_fill_spatial_index(db, spatialdb, db_name, table_name, geometry_column_name, id_column_name, index_table_name, error);
   if (result != SQLITE_OK) {
-    error_append(error, "Could not populate rtree: %s", sqlite3_errmsg(db));
     goto exit;
   }
 
@@ -775,6 +801,334 @@ exit:
   return result;
 }
 
+/*
+ * While a spatial index is suspended the Annex L triggers are replaced by triggers that only record the ids of the
+ * touched rows in a log table. Resuming applies the log to the index, or rebuilds the index from scratch when the log
+ * covers a large part of it, and reinstalls the Annex L triggers. The log table is dropped again after resuming so no
+ * non-standard tables remain in the GeoPackage; the presence of the log triggers indicates whether the index is
+ * suspended.
+ */
+#define SPATIAL_INDEX_REBUILD_RATIO 4
+
+static const char *spatial_index_triggers[] = {
+  "insert", "update1", "update2", "update3", "update4", "delete", NULL
+};
+
+static const char *spatial_index_log_triggers[] = {
+  "insert", "update", "delete", NULL
+};
+
+static int spatial_index_is_suspended(sqlite3 *db, const char *db_name, const char *log_table_name, int *suspended) {
+  char *trigger_name = sqlite3_mprintf("%s_insert", log_table_name);
+  if (trigger_name == NULL) {
+    return SQLITE_NOMEM;
+  }
+
+  value_t params[] = { TEXT_VALUE(trigger_name) };
+  int result = sql_exec_for_int_params(db, suspended, params, 1, "SELECT count(*) FROM \"%w\".sqlite_master WHERE type = 'trigger' AND name = ?", db_name);
+  sqlite3_free(trigger_name);
+  return result;
+}
+
+static int suspend_spatial_index(sqlite3 *db, const char *db_name, const char *table_name, const char *geometry_column_name, errorstream_t *error) {
+  int result = SQLITE_OK;
+  char *index_table_name = NULL;
+  char *log_table_name = NULL;
+  char *id_column_name = NULL;
+  int exists = 0;
+  int suspended = 0;
+
+  index_table_name = spatial_index_name(table_name, geometry_column_name);
+  log_table_name = sqlite3_mprintf("rtree_%s_%s_log", table_name, geometry_column_name);
+  if (index_table_name == NULL || log_table_name == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  result = sql_check_table_exists(db, db_name, index_table_name, &exists);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not check if index table %s.%s exists: %s", db_name, index_table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (!exists) {
+    error_append(error, "Spatial index %s.%s does not exist", db_name, index_table_name);
+    goto exit;
+  }
+
+  // Suspending an already suspended index is a no-op
+  result = spatial_index_is_suspended(db, db_name, log_table_name, &suspended);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not check if spatial index %s.%s is suspended: %s", db_name, index_table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (suspended) {
+    goto exit;
+  }
+
+  result = sql_integer_primary_key(db, db_name, table_name, &id_column_name);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not determine primary key of %s.%s: %s", db_name, table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (id_column_name == NULL) {
+    error_append(error, "Table %s.%s does not have an integer primary key", db_name, table_name);
+    goto exit;
+  }
+
+  for (const char **trigger = spatial_index_triggers; *trigger != NULL; trigger++) {
+    result = sql_exec(db, "DROP TRIGGER IF EXISTS \"%w\".\"rtree_%w_%w_%w\"", db_name, table_name, geometry_column_name, *trigger);
+    if (result != SQLITE_OK) {
+      error_append(error, "Could not drop rtree %s trigger: %s", *trigger, sqlite3_errmsg(db));
+      goto exit;
+    }
+  }
+
+  result = sql_exec(db, "CREATE TABLE IF NOT EXISTS \"%w\".\"%w\" (id INTEGER PRIMARY KEY)", db_name, log_table_name);
+  if (result == SQLITE_OK) {
+    result = sql_exec(db, "DELETE FROM \"%w\".\"%w\"", db_name, log_table_name);
+  }
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not create log table %s.%s: %s", db_name, log_table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  result = sql_exec(
+             db,
+             "CREATE TRIGGER \"%w\".\"%w_insert\" AFTER INSERT ON \"%w\"\n"
+             "BEGIN\n"
+             "  INSERT OR IGNORE INTO \"%w\" (id) VALUES (NEW.\"%w\");\n"
+             "END;",
+             db_name, log_table_name, table_name,
+             log_table_name, id_column_name
+           );
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not create rtree log insert trigger: %s", sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  result = sql_exec(
+             db,
+             "CREATE TRIGGER \"%w\".\"%w_update\" AFTER UPDATE OF \"%w\", \"%w\" ON \"%w\"\n"
+             "BEGIN\n"
+             "  INSERT OR IGNORE INTO \"%w\" (id) VALUES (OLD.\"%w\");\n"
+             "  INSERT OR IGNORE INTO \"%w\" (id) VALUES (NEW.\"%w\");\n"
+             "END;",
+             db_name, log_table_name, id_column_name, geometry_column_name, table_name,
+             log_table_name, id_column_name,
+             log_table_name, id_column_name
+           );
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not create rtree log update trigger: %s", sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  result = sql_exec(
+             db,
+             "CREATE TRIGGER \"%w\".\"%w_delete\" AFTER DELETE ON \"%w\"\n"
+             "BEGIN\n"
+             "  INSERT OR IGNORE INTO \"%w\" (id) VALUES (OLD.\"%w\");\n"
+             "END;",
+             db_name, log_table_name, table_name,
+             log_table_name, id_column_name
+           );
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not create rtree log delete trigger: %s", sqlite3_errmsg(db));
+    goto exit;
+  }
+
+exit:
+  sqlite3_free(index_table_name);
+  sqlite3_free(log_table_name);
+  sqlite3_free(id_column_name);
+  return result;
+}
+
+static int resume_spatial_index(sqlite3 *db, const char *db_name, const char *table_name, const char *geometry_column_name, errorstream_t *error) {
+  int result = SQLITE_OK;
+  char *index_table_name = NULL;
+  char *log_table_name = NULL;
+  char *id_column_name = NULL;
+  char *source_sql = NULL;
+  char *logged_sql = NULL;
+  int suspended = 0;
+  int log_count = 0;
+  int index_count = 0;
+
+  index_table_name = spatial_index_name(table_name, geometry_column_name);
+  log_table_name = sqlite3_mprintf("rtree_%s_%s_log", table_name, geometry_column_name);
+  if (index_table_name == NULL || log_table_name == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  // Resuming an index that is not suspended is a no-op
+  result = spatial_index_is_suspended(db, db_name, log_table_name, &suspended);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not check if spatial index %s.%s is suspended: %s", db_name, index_table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (!suspended) {
+    goto exit;
+  }
+
+  result = sql_integer_primary_key(db, db_name, table_name, &id_column_name);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not determine primary key of %s.%s: %s", db_name, table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (id_column_name == NULL) {
+    error_append(error, "Table %s.%s does not have an integer primary key", db_name, table_name);
+    goto exit;
+  }
+
+  for (const char **trigger = spatial_index_log_triggers; *trigger != NULL; trigger++) {
+    result = sql_exec(db, "DROP TRIGGER IF EXISTS \"%w\".\"%w_%w\"", db_name, log_table_name, *trigger);
+    if (result != SQLITE_OK) {
+      error_append(error, "Could not drop rtree log %s trigger: %s", *trigger, sqlite3_errmsg(db));
+      goto exit;
+    }
+  }
+
+  result = sql_exec_for_int(db, &log_count, "SELECT count(*) FROM \"%w\".\"%w\"", db_name, log_table_name);
+  if (result == SQLITE_OK) {
+    result = sql_exec_for_int(db, &index_count, "SELECT count(*) FROM \"%w\".\"%w_rowid\"", db_name, index_table_name);
+  }
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not determine number of changed rows: %s", sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  source_sql = spatial_index_source_sql(db_name, table_name, geometry_column_name, id_column_name);
+  if (source_sql == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  if (log_count == 0) {
+    // Nothing changed while the index was suspended
+  } else if ((sqlite3_int64)log_count * SPATIAL_INDEX_REBUILD_RATIO >= index_count) {
+    result = rtree_truncate(db, db_name, index_table_name);
+    if (result != SQLITE_OK) {
+      error_append(error, "Could not rebuild rtree: %s", sqlite3_errmsg(db));
+      goto exit;
+    }
+
+    result = spatialdb_fill_spatial_index(db, spatialdb_geopackage_schema(), db_name, table_name, geometry_column_name, id_column_name, index_table_name, error);
+    if (result != SQLITE_OK) {
+      goto exit;
+    }
+  } else {
+    result = sql_exec(db, "DELETE FROM \"%w\".\"%w\" WHERE id IN (SELECT id FROM \"%w\".\"%w\")", db_name, index_table_name, db_name, log_table_name);
+    if (result != SQLITE_OK) {
+      error_append(error, "Could not remove changed rows from rtree: %s", sqlite3_errmsg(db));
+      goto exit;
+    }
+
+    logged_sql = sqlite3_mprintf("%s AND \"%w\" IN (SELECT id FROM \"%w\".\"%w\")", source_sql, id_column_name, db_name, log_table_name);
+    if (logged_sql == NULL) {
+      result = SQLITE_NOMEM;
+      goto exit;
+    }
+
+    result = sql_exec(db, "INSERT OR REPLACE INTO \"%w\".\"%w\" (id, minx, maxx, miny, maxy) %s", db_name, index_table_name, logged_sql);
+    if (result != SQLITE_OK) {
+      error_append(error, "Could not insert changed rows into rtree: %s", sqlite3_errmsg(db));
+      goto exit;
+    }
+  }
+
+  result = sql_exec(db, "DROP TABLE IF EXISTS \"%w\".\"%w\"", db_name, log_table_name);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not drop log table %s.%s: %s", db_name, log_table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  result = create_spatial_index_triggers(db, db_name, table_name, geometry_column_name, id_column_name, index_table_name, error);
+
+exit:
+  sqlite3_free(index_table_name);
+  sqlite3_free(log_table_name);
+  sqlite3_free(id_column_name);
+  sqlite3_free(source_sql);
+  sqlite3_free(logged_sql);
+  return result;
+}
+
+static int check_spatial_index(sqlite3 *db, const char *db_name, const char *table_name, const char *geometry_column_name, errorstream_t *error) {
+  int result = SQLITE_OK;
+  char *index_table_name = NULL;
+  char *log_table_name = NULL;
+  char *id_column_name = NULL;
+  char *source_sql = NULL;
+  char *ordered_sql = NULL;
+  int exists = 0;
+  int suspended = 0;
+
+  index_table_name = spatial_index_name(table_name, geometry_column_name);
+  log_table_name = sqlite3_mprintf("rtree_%s_%s_log", table_name, geometry_column_name);
+  if (index_table_name == NULL || log_table_name == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  result = sql_check_table_exists(db, db_name, index_table_name, &exists);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not check if index table %s.%s exists: %s", db_name, index_table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (!exists) {
+    error_append(error, "Spatial index %s.%s does not exist", db_name, index_table_name);
+    goto exit;
+  }
+
+  result = spatial_index_is_suspended(db, db_name, log_table_name, &suspended);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not check if spatial index %s.%s is suspended: %s", db_name, index_table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (suspended) {
+    error_append(error, "Spatial index %s.%s is suspended", db_name, index_table_name);
+    goto exit;
+  }
+
+  result = sql_integer_primary_key(db, db_name, table_name, &id_column_name);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not determine primary key of %s.%s: %s", db_name, table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  // Ordering by the integer primary key lets SQLite scan the table in order instead of sorting it
+  source_sql = spatial_index_source_sql(db_name, table_name, geometry_column_name, id_column_name != NULL ? id_column_name : "rowid");
+  if (source_sql != NULL) {
+    ordered_sql = sqlite3_mprintf("%s ORDER BY \"%w\"", source_sql, id_column_name != NULL ? id_column_name : "rowid");
+  }
+  if (ordered_sql == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  result = sql_check_rtree(db, db_name, index_table_name, ordered_sql, error);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not check spatial index %s.%s: %s", db_name, index_table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+exit:
+  sqlite3_free(index_table_name);
+  sqlite3_free(log_table_name);
+  sqlite3_free(id_column_name);
+  sqlite3_free(source_sql);
+  sqlite3_free(ordered_sql);
+  return result;
+}
+
 static int fill_envelope(binstream_t *stream, geom_envelope_t *envelope, errorstream_t *error) {
   return wkb_fill_envelope(stream, WKB_ISO, envelope, error);
 }
@@ -796,10 +1150,16 @@ static const spatialdb_t GEOPACKAGE = {
   read_blob_header,
   gpkg_writer_init,
   gpb_writer_init,
+  gpkg_writer_init_size,
+  gpb_writer_init_size,
   gpb_writer_destroy,
   add_geometry_column,
   create_tiles_table,
   create_spatial_index,
+  suspend_spatial_index,
+  resume_spatial_index,
+  check_spatial_index,
+  spatial_index_name,
   fill_envelope,
   read_geometry_header,
   read_geometry
@@ -41,22 +41,20 @@ static size_t gpb_header_size(geom_blob_header_t *gpb) {
 }
 
 int gpb_read_header(binstream_t *stream, geom_blob_header_t *gpb, errorstream_t *error) {
-  uint8_t head[2];
-  if (binstream_nread_u8(stream, head, 2) != SQLITE_OK) {
+  /* Magic number, version and flags */
+  uint8_t head[4];
+  if (binstream_nread_u8(stream, head, 4) != SQLITE_OK) {
     return SQLITE_IOERR;
   }
 
   if (memcmp(head, "GP", 2) != 0) {
     if (error) {
-      error_append(error, "Incorrect GPB magic number [expected: GP, actual:%*s]", 2, head);
+      error_append(error, "Incorrect GPB magic number [expected: GP, actual:%.*s]", 2, head);
     }
     return SQLITE_IOERR;
   }
 
-  if (binstream_read_u8(stream, &gpb->version)) {
-    return SQLITE_IOERR;
-  }
-
+  gpb->version = head[2];
   if (gpb->version != GPB_VERSION) {
     if (error) {
       error_append(error, "Incorrect GPB version [expected: %d, actual:%d]", GPB_VERSION, gpb->version);
@@ -64,11 +62,7 @@ int gpb_read_header(binstream_t *stream, geom_blob_header_t *gpb, errorstream_t
     return SQLITE_IOERR;
   }
 
-  uint8_t flags;
-  if (binstream_read_u8(stream, &flags)) {
-    return SQLITE_IOERR;
-  }
-
+  uint8_t flags = head[3];
   gpb->empty = (flags >> 4) & 0x1;
   uint8_t envelope = (flags >> 1) & 0x7;
   uint8_t endian = flags & 0x1;
@@ -85,21 +79,20 @@ int gpb_read_header(binstream_t *stream, geom_blob_header_t *gpb, errorstream_t
     return SQLITE_IOERR;
   }
 
+  /* The envelope is stored as [minx, maxx, miny, maxy] followed by [minz, maxz] and/or [minm, maxm] */
+  double env[8];
+  size_t env_count = envelope == 0 ? 0 : envelope == 1 ? 4 : envelope == 4 ? 8 : 6;
+  if (binstream_nread_double(stream, env, env_count) != SQLITE_OK) {
+    return SQLITE_IOERR;
+  }
+
   if (envelope > 0) {
     gpb->envelope.has_env_x = 1;
-    if (binstream_read_double(stream, &gpb->envelope.min_x)) {
-      return SQLITE_IOERR;
-    }
-    if (binstream_read_double(stream, &gpb->envelope.max_x)) {
-      return SQLITE_IOERR;
-    }
+    gpb->envelope.min_x = env[0];
+    gpb->envelope.max_x = env[1];
     gpb->envelope.has_env_y = 1;
-    if (binstream_read_double(stream, &gpb->envelope.min_y)) {
-      return SQLITE_IOERR;
-    }
-    if (binstream_read_double(stream, &gpb->envelope.max_y)) {
-      return SQLITE_IOERR;
-    }
+    gpb->envelope.min_y = env[2];
+    gpb->envelope.max_y = env[3];
   } else {
     gpb->envelope.has_env_x = 0;
     gpb->envelope.min_x = 0.0;
@@ -111,12 +104,8 @@ int gpb_read_header(binstream_t *stream, geom_blob_header_t *gpb, errorstream_t
 
   if (envelope == 2 || envelope == 4) {
     gpb->envelope.has_env_z = 1;
-    if (binstream_read_double(stream, &gpb->envelope.min_z)) {
-      return SQLITE_IOERR;
-    }
-    if (binstream_read_double(stream, &gpb->envelope.max_z)) {
-      return SQLITE_IOERR;
-    }
+    gpb->envelope.min_z = env[4];
+    gpb->envelope.max_z = env[5];
   } else {
     gpb->envelope.has_env_z = 0;
     gpb->envelope.min_z = 0.0;
@@ -124,13 +113,10 @@ int gpb_read_header(binstream_t *stream, geom_blob_header_t *gpb, errorstream_t
   }
 
   if (envelope == 3 || envelope == 4) {
+    size_t m = envelope == 4 ? 6 : 4;
     gpb->envelope.has_env_m = 1;
-    if (binstream_read_double(stream, &gpb->envelope.min_m)) {
-      return SQLITE_IOERR;
-    }
-    if (binstream_read_double(stream, &gpb->envelope.max_m)) {
-      return SQLITE_IOERR;
-    }
+    gpb->envelope.min_m = env[m];
+    gpb->envelope.max_m = env[m + 1];
   } else {
     gpb->envelope.has_env_m = 0;
     gpb->envelope.min_m = 0.0;
@@ -319,13 +305,17 @@ exit:
 }
 
 int gpb_writer_init(geom_blob_writer_t *writer, int32_t srid) {
+  return gpb_writer_init_size(writer, srid, 256);
+}
+
+int gpb_writer_init_size(geom_blob_writer_t *writer, int32_t srid, size_t initial_size) {
   geom_consumer_init(&writer->geom_consumer, NULL, gpb_end, gpb_begin_geometry, gpb_end_geometry, gpb_coordinates);
   geom_envelope_init(&writer->header.envelope);
   writer->geom_type = GEOM_GEOMETRY;
   writer->header.version = GPB_VERSION;
   writer->header.srid = srid;
   writer->header.empty = 1;
-  return wkb_writer_init(&writer->wkb_writer, WKB_ISO);
+  return wkb_writer_init_size(&writer->wkb_writer, WKB_ISO, initial_size);
 }
 
 void gpb_writer_destroy(geom_blob_writer_t *writer, int free_data) {
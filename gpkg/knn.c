@@ -0,0 +1,650 @@
+/*
+ * Copyright 2013 Luciad (http://www.luciad.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <math.h>
+#include <string.h>
+#include "sqlite.h"
+#include "binstream.h"
+#include "blobio.h"
+#include "geomio.h"
+#include "knn.h"
+#include "rtree.h"
+#include "sql.h"
+
+/*
+ * gpkg_knn(table_name, column_name, x, y [, k])
+ *
+ * Table valued function that returns the k rows of a table whose geometry is closest to the point (x, y), in order
+ * of increasing distance. If k is omitted all rows are returned. The nodes of the spatial index of the column are
+ * visited best-first using a priority queue that is ordered on the distance from the point to the bounding box of
+ * each node. Index entries are refined by computing the exact distance to their geometry and are only returned once
+ * no node or entry that is still queued can be closer.
+ */
+#define KNN_COLUMN_ID 0
+#define KNN_COLUMN_DISTANCE 1
+#define KNN_COLUMN_GEOMETRY 2
+#define KNN_COLUMN_TABLE_NAME 3
+#define KNN_ARG_COUNT 5
+#define KNN_REQUIRED_ARGS 0xF
+#define KNN_ARG_K 0x10
+
+/*
+ * Computes the planar distance between a point and a geometry. Polygons that contain the point are at distance 0; this
+ * is determined by counting the crossings of the rings of each polygon with a ray starting at the point.
+ */
+typedef struct {
+  geom_consumer_t geom_consumer;
+  double x;
+  double y;
+  /*
+   * The smallest squared distance so far.
+   */
+  double distance;
+  int empty;
+  int has_previous;
+  double previous_x;
+  double previous_y;
+  int in_polygon;
+  int crossings;
+} knn_distance_t;
+
+static void knn_distance_point(knn_distance_t *d, double x, double y) {
+  double dx = x - d->x;
+  double dy = y - d->y;
+  double distance = dx * dx + dy * dy;
+  if (d->empty || distance < d->distance) {
+    d->distance = distance;
+  }
+  d->empty = 0;
+}
+
+static void knn_distance_segment(knn_distance_t *d, double x1, double y1, double x2, double y2) {
+  double dx = x2 - x1;
+  double dy = y2 - y1;
+  double length = dx * dx + dy * dy;
+  double t = 0.0;
+
+  if (length > 0.0) {
+    t = ((d->x - x1) * dx + (d->y - y1) * dy) / length;
+    if (t < 0.0) {
+      t = 0.0;
+    } else if (t > 1.0) {
+      t = 1.0;
+    }
+  }
+
+  knn_distance_point(d, x1 + t * dx, y1 + t * dy);
+
+  if (d->in_polygon && ((y1 > d->y) != (y2 > d->y)) && d->x < x1 + (d->y - y1) * dx / dy) {
+    d->crossings++;
+  }
+}
+
+static int knn_distance_begin_geometry(const geom_consumer_t *consumer, const geom_header_t *header, errorstream_t *error) {
+  knn_distance_t *d = (knn_distance_t *)consumer;
+
+  switch (header->geom_type) {
+    case GEOM_POLYGON:
+    case GEOM_CURVEPOLYGON:
+      d->in_polygon = 1;
+      d->crossings = 0;
+      break;
+    default:
+      d->has_previous = 0;
+      break;
+  }
+
+  return SQLITE_OK;
+}
+
+static int knn_distance_end_geometry(const geom_consumer_t *consumer, const geom_header_t *header, errorstream_t *error) {
+  knn_distance_t *d = (knn_distance_t *)consumer;
+
+  switch (header->geom_type) {
+    case GEOM_POLYGON:
+    case GEOM_CURVEPOLYGON:
+      if (d->crossings % 2 != 0) {
+        d->distance = 0.0;
+      }
+      d->in_polygon = 0;
+      break;
+    default:
+      break;
+  }
+
+  return SQLITE_OK;
+}
+
+static int knn_distance_coordinates(const geom_consumer_t *consumer, const geom_header_t *header, size_t point_count, const double *coords, int skip_coords, errorstream_t *error) {
+  knn_distance_t *d = (knn_distance_t *)consumer;
+
+  for (size_t i = 0; i < point_count; i++) {
+    double x = coords[i * header->coord_size];
+    double y = coords[i * header->coord_size + 1];
+
+    if (header->geom_type == GEOM_POINT || !d->has_previous) {
+      knn_distance_point(d, x, y);
+    } else {
+      knn_distance_segment(d, d->previous_x, d->previous_y, x, y);
+    }
+
+    d->previous_x = x;
+    d->previous_y = y;
+    d->has_previous = 1;
+  }
+
+  return SQLITE_OK;
+}
+
+static void knn_distance_init(knn_distance_t *d, double x, double y) {
+  memset(d, 0, sizeof(knn_distance_t));
+  geom_consumer_init(&d->geom_consumer, NULL, NULL, knn_distance_begin_geometry, knn_distance_end_geometry, knn_distance_coordinates);
+  d->x = x;
+  d->y = y;
+  d->empty = 1;
+}
+
+static double knn_box_distance(double x, double y, const rtree_cell_t *cell) {
+  double dx = x < cell->min_x ? cell->min_x - x : (x > cell->max_x ? x - cell->max_x : 0.0);
+  double dy = y < cell->min_y ? cell->min_y - y : (y > cell->max_y ? y - cell->max_y : 0.0);
+  return dx * dx + dy * dy;
+}
+
+typedef enum {
+  /*
+   * A node of the spatial index. The distance is a lower bound for all entries in the node.
+   */
+  KNN_NODE,
+  /*
+   * A leaf entry of the spatial index. The distance is a lower bound based on its bounding box.
+   */
+  KNN_ENTRY,
+  /*
+   * A row whose exact distance has been computed.
+   */
+  KNN_ROW
+} knn_item_type_t;
+
+typedef struct {
+  double distance;
+  sqlite3_int64 id;
+  knn_item_type_t type;
+  int depth;
+} knn_item_t;
+
+typedef struct {
+  knn_item_t *items;
+  size_t count;
+  size_t capacity;
+} knn_queue_t;
+
+/*
+ * Orders items on increasing distance. Rows come before nodes and entries at the same distance so that they are
+ * returned as early as possible.
+ */
+static int knn_item_before(const knn_item_t *a, const knn_item_t *b) {
+  if (a->distance != b->distance) {
+    return a->distance < b->distance;
+  }
+  return a->type > b->type;
+}
+
+static int knn_queue_push(knn_queue_t *queue, double distance, sqlite3_int64 id, knn_item_type_t type, int depth) {
+  if (queue->count == queue->capacity) {
+    size_t capacity = queue->capacity == 0 ? 64 : queue->capacity * 2;
+    knn_item_t *items = (knn_item_t *)sqlite3_realloc64(queue->items, capacity * sizeof(knn_item_t));
+    if (items == NULL) {
+      return SQLITE_NOMEM;
+    }
+    queue->items = items;
+    queue->capacity = capacity;
+  }
+
+  knn_item_t item;
+  item.distance = distance;
+  item.id = id;
+  item.type = type;
+  item.depth = depth;
+
+  size_t i = queue->count++;
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (!knn_item_before(&item, &queue->items[parent])) {
+      break;
+    }
+    queue->items[i] = queue->items[parent];
+    i = parent;
+  }
+  queue->items[i] = item;
+
+  return SQLITE_OK;
+}
+
+static void knn_queue_pop(knn_queue_t *queue, knn_item_t *out) {
+  *out = queue->items[0];
+
+  knn_item_t last = queue->items[--queue->count];
+  size_t i = 0;
+  while (1) {
+    size_t child = 2 * i + 1;
+    if (child >= queue->count) {
+      break;
+    }
+    if (child + 1 < queue->count && knn_item_before(&queue->items[child + 1], &queue->items[child])) {
+      child++;
+    }
+    if (!knn_item_before(&queue->items[child], &last)) {
+      break;
+    }
+    queue->items[i] = queue->items[child];
+    i = child;
+  }
+  if (queue->count > 0) {
+    queue->items[i] = last;
+  }
+}
+
+static void knn_queue_destroy(knn_queue_t *queue) {
+  sqlite3_free(queue->items);
+  queue->items = NULL;
+  queue->count = 0;
+  queue->capacity = 0;
+}
+
+typedef struct {
+  sqlite3_vtab base;
+  sqlite3 *db;
+  const spatialdb_t *spatialdb;
+} knn_vtab_t;
+
+typedef struct {
+  sqlite3_vtab_cursor base;
+  rtree_reader_t reader;
+  int reader_initialized;
+  /*
+   * Returns the geometry of a single row.
+   */
+  sqlite3_stmt *geometry_stmt;
+  knn_queue_t queue;
+  double x;
+  double y;
+  /*
+   * The number of rows that can still be returned or -1 if there is no limit.
+   */
+  sqlite3_int64 remaining;
+  sqlite3_int64 id;
+  double distance;
+  int eof;
+} knn_cursor_t;
+
+static void knn_set_error(sqlite3_vtab *vtab, errorstream_t *error) {
+  sqlite3_free(vtab->zErrMsg);
+  vtab->zErrMsg = sqlite3_mprintf("%s", error_message(error));
+}
+
+static int knn_connect(sqlite3 *db, void *aux, int argc, const char *const *argv, sqlite3_vtab **vtab_out, char **err) {
+  knn_vtab_t *vtab;
+
+  int result = sqlite3_declare_vtab(db, "CREATE TABLE x(fid INTEGER, distance REAL, geometry BLOB, table_name HIDDEN, column_name HIDDEN, x HIDDEN, y HIDDEN, k HIDDEN)");
+  if (result != SQLITE_OK) {
+    return result;
+  }
+
+  vtab = (knn_vtab_t *)sqlite3_malloc(sizeof(knn_vtab_t));
+  if (vtab == NULL) {
+    return SQLITE_NOMEM;
+  }
+  memset(vtab, 0, sizeof(knn_vtab_t));
+
+  vtab->db = db;
+  vtab->spatialdb = (const spatialdb_t *)aux;
+
+  *vtab_out = &vtab->base;
+  return SQLITE_OK;
+}
+
+static int knn_disconnect(sqlite3_vtab *vtab) {
+  sqlite3_free(vtab);
+  return SQLITE_OK;
+}
+
+static int knn_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+  int constraint[KNN_ARG_COUNT];
+  int argv_index = 0;
+  int i;
+
+  for (i = 0; i < KNN_ARG_COUNT; i++) {
+    constraint[i] = -1;
+  }
+
+  for (i = 0; i < info->nConstraint; i++) {
+    const struct sqlite3_index_constraint *c = &info->aConstraint[i];
+    if (c->usable && c->op == SQLITE_INDEX_CONSTRAINT_EQ && c->iColumn >= KNN_COLUMN_TABLE_NAME) {
+      constraint[c->iColumn - KNN_COLUMN_TABLE_NAME] = i;
+    }
+  }
+
+  info->idxNum = 0;
+  for (i = 0; i < KNN_ARG_COUNT; i++) {
+    if (constraint[i] >= 0) {
+      info->aConstraintUsage[constraint[i]].argvIndex = ++argv_index;
+      info->aConstraintUsage[constraint[i]].omit = 1;
+      info->idxNum |= 1 << i;
+    }
+  }
+
+  // Rows are produced in order of increasing distance
+  if (info->nOrderBy == 1 && info->aOrderBy[0].iColumn == KNN_COLUMN_DISTANCE && !info->aOrderBy[0].desc) {
+    info->orderByConsumed = 1;
+  }
+
+  if ((info->idxNum & KNN_REQUIRED_ARGS) == KNN_REQUIRED_ARGS) {
+    info->estimatedCost = (info->idxNum & KNN_ARG_K) ? 100.0 : 1000000.0;
+  } else {
+    info->estimatedCost = 1e99;
+  }
+
+  return SQLITE_OK;
+}
+
+static int knn_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor_out) {
+  knn_cursor_t *cursor = (knn_cursor_t *)sqlite3_malloc(sizeof(knn_cursor_t));
+  if (cursor == NULL) {
+    return SQLITE_NOMEM;
+  }
+  memset(cursor, 0, sizeof(knn_cursor_t));
+  cursor->eof = 1;
+
+  *cursor_out = &cursor->base;
+  return SQLITE_OK;
+}
+
+static void knn_cursor_reset(knn_cursor_t *cursor) {
+  if (cursor->reader_initialized) {
+    rtree_reader_destroy(&cursor->reader);
+    cursor->reader_initialized = 0;
+  }
+  sqlite3_finalize(cursor->geometry_stmt);
+  cursor->geometry_stmt = NULL;
+  knn_queue_destroy(&cursor->queue);
+  cursor->eof = 1;
+}
+
+static int knn_close(sqlite3_vtab_cursor *cursor_base) {
+  knn_cursor_t *cursor = (knn_cursor_t *)cursor_base;
+  knn_cursor_reset(cursor);
+  sqlite3_free(cursor);
+  return SQLITE_OK;
+}
+
+/*
+ * Positions the geometry statement on the row with the given id. Returns SQLITE_ROW if the row has a non-empty
+ * geometry, SQLITE_DONE if it does not and an error code otherwise.
+ */
+static int knn_read_row(knn_cursor_t *cursor, sqlite3_int64 id, geom_blob_header_t *header, binstream_t *stream, errorstream_t *error) {
+  knn_vtab_t *vtab = (knn_vtab_t *)cursor->base.pVtab;
+
+  sqlite3_reset(cursor->geometry_stmt);
+  sqlite3_bind_int64(cursor->geometry_stmt, 1, id);
+
+  int result = sqlite3_step(cursor->geometry_stmt);
+  if (result == SQLITE_DONE) {
+    // The index refers to a row that no longer exists
+    return SQLITE_DONE;
+  } else if (result != SQLITE_ROW) {
+    error_append(error, "Could not read geometry of row %lld: %s", id, sqlite3_errmsg(vtab->db));
+    return result;
+  }
+
+  uint8_t *blob = (uint8_t *)sqlite3_column_blob(cursor->geometry_stmt, 0);
+  size_t blob_length = (size_t) sqlite3_column_bytes(cursor->geometry_stmt, 0);
+  if (blob == NULL) {
+    return SQLITE_DONE;
+  }
+
+  binstream_init(stream, blob, blob_length);
+  result = vtab->spatialdb->read_blob_header(stream, header, error);
+  if (result != SQLITE_OK) {
+    return result;
+  }
+
+  return header->empty ? SQLITE_DONE : SQLITE_ROW;
+}
+
+static int knn_next(sqlite3_vtab_cursor *cursor_base) {
+  knn_cursor_t *cursor = (knn_cursor_t *)cursor_base;
+  knn_vtab_t *vtab = (knn_vtab_t *)cursor_base->pVtab;
+  geom_blob_header_t header;
+  binstream_t stream;
+  knn_item_t item;
+  char error_buffer[256];
+  errorstream_t error;
+  int result = SQLITE_OK;
+
+  error_init_fixed(&error, error_buffer, 256);
+
+  if (cursor->remaining == 0) {
+    cursor->eof = 1;
+    return SQLITE_OK;
+  }
+
+  while (cursor->queue.count > 0) {
+    knn_queue_pop(&cursor->queue, &item);
+
+    if (item.type == KNN_NODE) {
+      const rtree_cell_t *cells;
+      int count;
+      result = rtree_reader_read_node(&cursor->reader, item.id, &cells, &count);
+      if (result != SQLITE_OK) {
+        error_append(&error, "Could not read spatial index node %lld: %s", item.id, sqlite3_errstr(result));
+        goto exit;
+      }
+
+      for (int i = 0; i < count && result == SQLITE_OK; i++) {
+        result = knn_queue_push(
+                   &cursor->queue, knn_box_distance(cursor->x, cursor->y, &cells[i]), cells[i].id,
+                   item.depth > 0 ? KNN_NODE : KNN_ENTRY, item.depth - 1
+                 );
+      }
+      if (result != SQLITE_OK) {
+        goto exit;
+      }
+    } else if (item.type == KNN_ENTRY) {
+      result = knn_read_row(cursor, item.id, &header, &stream, &error);
+      if (result == SQLITE_DONE) {
+        continue;
+      } else if (result != SQLITE_ROW) {
+        goto exit;
+      }
+
+      knn_distance_t distance;
+      knn_distance_init(&distance, cursor->x, cursor->y);
+      result = vtab->spatialdb->read_geometry(&stream, &distance.geom_consumer, &error);
+      if (result != SQLITE_OK) {
+        goto exit;
+      }
+
+      if (!distance.empty) {
+        result = knn_queue_push(&cursor->queue, distance.distance, item.id, KNN_ROW, 0);
+        if (result != SQLITE_OK) {
+          goto exit;
+        }
+      }
+    } else {
+      // Position the geometry statement on the row so that its geometry can be returned
+      result = knn_read_row(cursor, item.id, &header, &stream, &error);
+      if (result != SQLITE_ROW) {
+        goto exit;
+      }
+
+      cursor->id = item.id;
+      cursor->distance = sqrt(item.distance);
+      if (cursor->remaining > 0) {
+        cursor->remaining--;
+      }
+      return SQLITE_OK;
+    }
+  }
+
+  cursor->eof = 1;
+  result = SQLITE_OK;
+
+exit:
+  if (result != SQLITE_OK) {
+    if (error_count(&error) > 0) {
+      knn_set_error(cursor_base->pVtab, &error);
+    }
+  }
+  return result;
+}
+
+static int knn_filter(sqlite3_vtab_cursor *cursor_base, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
+  knn_cursor_t *cursor = (knn_cursor_t *)cursor_base;
+  knn_vtab_t *vtab = (knn_vtab_t *)cursor_base->pVtab;
+  const char *table_name;
+  const char *column_name;
+  char *index_table_name = NULL;
+  char *sql = NULL;
+  char error_buffer[256];
+  errorstream_t error;
+  int result = SQLITE_OK;
+
+  error_init_fixed(&error, error_buffer, 256);
+  knn_cursor_reset(cursor);
+
+  if ((idxNum & KNN_REQUIRED_ARGS) != KNN_REQUIRED_ARGS) {
+    error_append(&error, "gpkg_knn requires a table name, a column name and a point");
+    result = SQLITE_ERROR;
+    goto exit;
+  }
+
+  table_name = (const char *)sqlite3_value_text(argv[0]);
+  column_name = (const char *)sqlite3_value_text(argv[1]);
+  if (table_name == NULL || column_name == NULL) {
+    error_append(&error, "gpkg_knn requires a table name, a column name and a point");
+    result = SQLITE_ERROR;
+    goto exit;
+  }
+
+  if (sqlite3_value_type(argv[2]) == SQLITE_NULL || sqlite3_value_type(argv[3]) == SQLITE_NULL) {
+    goto exit;
+  }
+  cursor->x = sqlite3_value_double(argv[2]);
+  cursor->y = sqlite3_value_double(argv[3]);
+
+  cursor->remaining = -1;
+  if ((idxNum & KNN_ARG_K) && sqlite3_value_type(argv[4]) != SQLITE_NULL) {
+    cursor->remaining = sqlite3_value_int64(argv[4]);
+    if (cursor->remaining <= 0) {
+      goto exit;
+    }
+  }
+
+  index_table_name = vtab->spatialdb->spatial_index_name(table_name, column_name);
+  if (index_table_name == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  result = rtree_reader_init(&cursor->reader, vtab->db, "main", index_table_name);
+  if (result != SQLITE_OK) {
+    error_append(&error, "Could not read spatial index %s: %s", index_table_name, sqlite3_errmsg(vtab->db));
+    goto exit;
+  }
+  cursor->reader_initialized = 1;
+
+  sql = sqlite3_mprintf("SELECT \"%w\" FROM \"main\".\"%w\" WHERE rowid = ?", column_name, table_name);
+  if (sql == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  result = sqlite3_prepare_v2(vtab->db, sql, -1, &cursor->geometry_stmt, NULL);
+  if (result != SQLITE_OK) {
+    error_append(&error, "Could not read %s.%s: %s", table_name, column_name, sqlite3_errmsg(vtab->db));
+    goto exit;
+  }
+
+  result = knn_queue_push(&cursor->queue, 0.0, RTREE_ROOT_NODE, KNN_NODE, cursor->reader.depth);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  cursor->eof = 0;
+  result = knn_next(cursor_base);
+
+exit:
+  sqlite3_free(index_table_name);
+  sqlite3_free(sql);
+
+  if (result != SQLITE_OK) {
+    if (error_count(&error) > 0) {
+      knn_set_error(cursor_base->pVtab, &error);
+    }
+    knn_cursor_reset(cursor);
+  }
+
+  return result;
+}
+
+static int knn_eof(sqlite3_vtab_cursor *cursor_base) {
+  return ((knn_cursor_t *)cursor_base)->eof;
+}
+
+static int knn_column(sqlite3_vtab_cursor *cursor_base, sqlite3_context *context, int i) {
+  knn_cursor_t *cursor = (knn_cursor_t *)cursor_base;
+
+  switch (i) {
+    case KNN_COLUMN_ID:
+      sqlite3_result_int64(context, cursor->id);
+      break;
+    case KNN_COLUMN_DISTANCE:
+      sqlite3_result_double(context, cursor->distance);
+      break;
+    case KNN_COLUMN_GEOMETRY:
+      sqlite3_result_value(context, sqlite3_column_value(cursor->geometry_stmt, 0));
+      break;
+    default:
+      sqlite3_result_null(context);
+      break;
+  }
+
+  return SQLITE_OK;
+}
+
+static int knn_rowid(sqlite3_vtab_cursor *cursor_base, sqlite3_int64 *rowid) {
+  *rowid = ((knn_cursor_t *)cursor_base)->id;
+  return SQLITE_OK;
+}
+
+static sqlite3_module knn_module = {
+  0,
+  knn_connect,
+  knn_connect,
+  knn_best_index,
+  knn_disconnect,
+  knn_disconnect,
+  knn_open,
+  knn_close,
+  knn_filter,
+  knn_next,
+  knn_eof,
+  knn_column,
+  knn_rowid
+};
+
+void knn_init(sqlite3 *db, const spatialdb_t *spatialdb, errorstream_t *error) {
+  sql_create_module(db, "gpkg_knn", &knn_module, (void *)spatialdb, NULL, error);
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright 2013 Luciad (http://www.luciad.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef GPKG_KNN_H
+#define GPKG_KNN_H
+
+#include "error.h"
+#include "spatialdb.h"
+
+/**
+ * Registers the gpkg_knn nearest neighbour table valued function.
+ */
+void knn_init(sqlite3 *db, const struct spatialdb *spatialDb, errorstream_t *error);
+
+#endif
@@ -0,0 +1,791 @@
+/*
+ * Copyright 2013 Luciad (http://www.luciad.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sqlite.h"
+#include "rtree.h"
+#include "sql.h"
+#include "thread.h"
+
+#define RTREE_DIMS 2
+#define RTREE_CELL_SIZE (8 + RTREE_DIMS * 2 * 4)
+#define RTREE_MAX_LEVELS 32
+
+/*
+ * Parameters of the parallel envelope computation used by rtree_bulk_load_blobs. Batches are cut at whichever limit
+ * is reached first; a batch is only split over multiple threads if each of them gets a reasonable amount of work.
+ */
+#define RTREE_BATCH_ROWS 8192
+#define RTREE_BATCH_BYTES (8 * 1024 * 1024)
+#define RTREE_MIN_THREAD_ROWS 512
+#define RTREE_MAX_THREADS 16
+
+/*
+ * Rounding factors used by the rtree module when storing double values as 32-bit floats. Minimum values are rounded
+ * down and maximum values up so that the stored box always contains the original one.
+ */
+#define RTREE_ROUND_TOWARDS (1.0 - 1.0 / 8388608.0)
+#define RTREE_ROUND_AWAY (1.0 + 1.0 / 8388608.0)
+
+typedef struct {
+  sqlite3_int64 id;
+  float coords[RTREE_DIMS * 2];
+} rtree_entry_t;
+
+typedef struct {
+  rtree_entry_t *entries;
+  size_t count;
+} rtree_level_t;
+
+typedef struct {
+  sqlite3_stmt *update_root;
+  sqlite3_stmt *insert_node;
+  sqlite3_stmt *insert_rowid;
+  sqlite3_stmt *insert_parent;
+} rtree_writer_t;
+
+float rtree_value_down(double d) {
+  float f = (float)d;
+  if (f > d) {
+    f = (float)(d * (d < 0 ? RTREE_ROUND_AWAY : RTREE_ROUND_TOWARDS));
+  }
+  return f;
+}
+
+float rtree_value_up(double d) {
+  float f = (float)d;
+  if (f < d) {
+    f = (float)(d * (d < 0 ? RTREE_ROUND_TOWARDS : RTREE_ROUND_AWAY));
+  }
+  return f;
+}
+
+static int rtree_compare_center(const rtree_entry_t *a, const rtree_entry_t *b, int dim) {
+  float ca = a->coords[2 * dim] + a->coords[2 * dim + 1];
+  float cb = b->coords[2 * dim] + b->coords[2 * dim + 1];
+  return (ca > cb) - (ca < cb);
+}
+
+static int rtree_compare_x(const void *a, const void *b) {
+  return rtree_compare_center((const rtree_entry_t *)a, (const rtree_entry_t *)b, 0);
+}
+
+static int rtree_compare_y(const void *a, const void *b) {
+  return rtree_compare_center((const rtree_entry_t *)a, (const rtree_entry_t *)b, 1);
+}
+
+/*
+ * Sort-Tile-Recursive ordering: sort by x center, cut into vertical slices of slice_count nodes each and sort every
+ * slice by y center. Consecutive runs of capacity entries then form the nodes of the next level.
+ */
+static void rtree_str_sort(rtree_entry_t *entries, size_t count, size_t capacity) {
+  size_t node_count = (count + capacity - 1) / capacity;
+  size_t slice_count = (size_t)ceil(sqrt((double)node_count));
+  size_t slice_size = slice_count * capacity;
+
+  qsort(entries, count, sizeof(rtree_entry_t), rtree_compare_x);
+  for (size_t i = 0; i < count; i += slice_size) {
+    size_t n = count - i < slice_size ? count - i : slice_size;
+    qsort(entries + i, n, sizeof(rtree_entry_t), rtree_compare_y);
+  }
+}
+
+static int rtree_prepare(sqlite3 *db, sqlite3_stmt **stmt, const char *sql, ...) {
+  va_list args;
+  va_start(args, sql);
+  char *formatted_sql = sqlite3_vmprintf(sql, args);
+  va_end(args);
+
+  *stmt = NULL;
+  if (formatted_sql == NULL) {
+    return SQLITE_NOMEM;
+  }
+
+  int result = sqlite3_prepare_v2(db, formatted_sql, -1, stmt, NULL);
+  sqlite3_free(formatted_sql);
+  return result;
+}
+
+static int rtree_step(sqlite3_stmt *stmt) {
+  int result = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+  return result == SQLITE_DONE ? SQLITE_OK : result;
+}
+
+static int rtree_root_info(sqlite3 *db, const char *db_name, const char *rtree_name, int *node_size, int *cell_count) {
+  sqlite3_stmt *stmt = NULL;
+  int result = rtree_prepare(db, &stmt, "SELECT data FROM \"%w\".\"%w_node\" WHERE nodeno = 1", db_name, rtree_name);
+  if (result != SQLITE_OK) {
+    return result;
+  }
+
+  result = sqlite3_step(stmt);
+  if (result == SQLITE_ROW) {
+    const unsigned char *data = (const unsigned char *)sqlite3_column_blob(stmt, 0);
+    *node_size = sqlite3_column_bytes(stmt, 0);
+    if (data == NULL || *node_size < 4) {
+      result = SQLITE_CORRUPT;
+    } else {
+      *cell_count = (data[2] << 8) | data[3];
+      result = SQLITE_OK;
+    }
+  } else if (result == SQLITE_DONE) {
+    result = SQLITE_CORRUPT;
+  }
+
+  sqlite3_finalize(stmt);
+  return result;
+}
+
+static int rtree_level_reserve(rtree_level_t *level, size_t *capacity, size_t extra) {
+  if (level->count + extra <= *capacity) {
+    return SQLITE_OK;
+  }
+
+  size_t new_capacity = *capacity == 0 ? 1024 : *capacity;
+  while (new_capacity < level->count + extra) {
+    new_capacity *= 2;
+  }
+
+  rtree_entry_t *entries = (rtree_entry_t *)sqlite3_realloc64(level->entries, new_capacity * sizeof(rtree_entry_t));
+  if (entries == NULL) {
+    return SQLITE_NOMEM;
+  }
+  level->entries = entries;
+  *capacity = new_capacity;
+  return SQLITE_OK;
+}
+
+typedef struct {
+  sqlite3_int64 *ids;
+  size_t *offsets;
+  uint8_t *data;
+  size_t data_capacity;
+  rtree_entry_t *entries;
+  unsigned char *has_entry;
+  size_t count;
+} rtree_blob_batch_t;
+
+typedef struct {
+  rtree_blob_batch_t *batch;
+  size_t begin;
+  size_t end;
+  rtree_envelope_func envelope;
+  void *ctx;
+  int result;
+} rtree_envelope_task_t;
+
+static int rtree_blob_batch_init(rtree_blob_batch_t *batch) {
+  batch->ids = (sqlite3_int64 *)sqlite3_malloc64(RTREE_BATCH_ROWS * sizeof(sqlite3_int64));
+  batch->offsets = (size_t *)sqlite3_malloc64((RTREE_BATCH_ROWS + 1) * sizeof(size_t));
+  batch->entries = (rtree_entry_t *)sqlite3_malloc64(RTREE_BATCH_ROWS * sizeof(rtree_entry_t));
+  batch->has_entry = (unsigned char *)sqlite3_malloc64(RTREE_BATCH_ROWS);
+  batch->data = NULL;
+  batch->data_capacity = 0;
+  batch->count = 0;
+  if (batch->ids == NULL || batch->offsets == NULL || batch->entries == NULL || batch->has_entry == NULL) {
+    return SQLITE_NOMEM;
+  }
+  return SQLITE_OK;
+}
+
+static void rtree_blob_batch_destroy(rtree_blob_batch_t *batch) {
+  sqlite3_free(batch->ids);
+  sqlite3_free(batch->offsets);
+  sqlite3_free(batch->data);
+  sqlite3_free(batch->entries);
+  sqlite3_free(batch->has_entry);
+}
+
+/*
+ * Copies the next rows of the statement into a batch. The blobs are copied since the workers that process the batch
+ * run concurrently with the next sqlite3_step call, which invalidates the column pointers.
+ */
+static int rtree_blob_batch_read(sqlite3_stmt *stmt, rtree_blob_batch_t *batch, int *done) {
+  size_t length = 0;
+
+  batch->count = 0;
+  batch->offsets[0] = 0;
+  while (!*done && batch->count < RTREE_BATCH_ROWS && length < RTREE_BATCH_BYTES) {
+    int result = sqlite3_step(stmt);
+    if (result == SQLITE_DONE) {
+      *done = 1;
+      break;
+    } else if (result != SQLITE_ROW) {
+      return result;
+    }
+
+    if (sqlite3_column_type(stmt, 1) == SQLITE_NULL) {
+      continue;
+    }
+
+    const void *blob = sqlite3_column_blob(stmt, 1);
+    size_t blob_length = (size_t)sqlite3_column_bytes(stmt, 1);
+    if (length + blob_length > batch->data_capacity) {
+      size_t capacity = batch->data_capacity == 0 ? 65536 : batch->data_capacity * 2;
+      while (capacity < length + blob_length) {
+        capacity *= 2;
+      }
+      uint8_t *data = (uint8_t *)sqlite3_realloc64(batch->data, capacity);
+      if (data == NULL) {
+        return SQLITE_NOMEM;
+      }
+      batch->data = data;
+      batch->data_capacity = capacity;
+    }
+
+    if (blob_length > 0) {
+      memcpy(batch->data + length, blob, blob_length);
+      length += blob_length;
+    }
+    batch->ids[batch->count++] = sqlite3_column_int64(stmt, 0);
+    batch->offsets[batch->count] = length;
+  }
+
+  return SQLITE_OK;
+}
+
+static void rtree_envelope_task_run(rtree_envelope_task_t *task) {
+  rtree_blob_batch_t *batch = task->batch;
+
+  for (size_t i = task->begin; i < task->end; i++) {
+    rtree_cell_t cell;
+    int result = task->envelope(task->ctx, batch->data + batch->offsets[i], batch->offsets[i + 1] - batch->offsets[i], &cell);
+    if (result == SQLITE_OK) {
+      rtree_entry_t *entry = &batch->entries[i];
+      entry->id = batch->ids[i];
+      entry->coords[0] = rtree_value_down(cell.min_x);
+      entry->coords[1] = rtree_value_up(cell.max_x);
+      entry->coords[2] = rtree_value_down(cell.min_y);
+      entry->coords[3] = rtree_value_up(cell.max_y);
+      batch->has_entry[i] = 1;
+    } else if (result == SQLITE_DONE) {
+      batch->has_entry[i] = 0;
+    } else {
+      task->result = result;
+      return;
+    }
+  }
+}
+
+static THREAD_RESULT rtree_envelope_worker(void *arg) {
+  rtree_envelope_task_t *task = (rtree_envelope_task_t *)arg;
+  rtree_envelope_task_run(task);
+  return 0;
+}
+
+/*
+ * Reads (id, geometry) rows and computes their index entries. The connection thread copies the rows into batches;
+ * while one batch is split over worker threads that compute envelopes, the connection thread reads the next one.
+ * Blobs are handed to the envelope function unmodified so workers never touch the database connection.
+ */
+static int rtree_read_blob_entries(sqlite3 *db, const char *source_sql, rtree_envelope_func envelope, void *ctx, rtree_level_t *level) {
+  sqlite3_stmt *stmt = NULL;
+  rtree_blob_batch_t batches[2];
+  rtree_envelope_task_t tasks[RTREE_MAX_THREADS];
+  thread_t threads[RTREE_MAX_THREADS];
+  size_t capacity = 0;
+  int max_threads = 1;
+  int current = 0;
+  int done = 0;
+
+  memset(batches, 0, sizeof(batches));
+
+  int result = sqlite3_prepare_v2(db, source_sql, -1, &stmt, NULL);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  if (sqlite3_column_count(stmt) != 2) {
+    result = SQLITE_MISMATCH;
+    goto exit;
+  }
+
+  result = rtree_blob_batch_init(&batches[0]);
+  if (result == SQLITE_OK) {
+    result = rtree_blob_batch_init(&batches[1]);
+  }
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  /*
+   * Worker threads allocate memory through SQLite and call the envelope function concurrently. That is only safe if
+   * SQLite uses mutexes at runtime; a connection without a mutex indicates that it was configured not to.
+   */
+  if (sqlite3_db_mutex(db) != NULL) {
+    max_threads = thread_cpu_count();
+    if (max_threads > RTREE_MAX_THREADS) {
+      max_threads = RTREE_MAX_THREADS;
+    }
+  }
+
+  result = rtree_blob_batch_read(stmt, &batches[current], &done);
+  while (result == SQLITE_OK && batches[current].count > 0) {
+    rtree_blob_batch_t *batch = &batches[current];
+    int task_count = (int)(batch->count / RTREE_MIN_THREAD_ROWS);
+    int started = 0;
+
+    if (task_count > max_threads) {
+      task_count = max_threads;
+    } else if (task_count < 1) {
+      task_count = 1;
+    }
+
+    for (int t = 0; t < task_count; t++) {
+      tasks[t].batch = batch;
+      tasks[t].begin = batch->count * (size_t)t / (size_t)task_count;
+      tasks[t].end = batch->count * (size_t)(t + 1) / (size_t)task_count;
+      tasks[t].envelope = envelope;
+      tasks[t].ctx = ctx;
+      tasks[t].result = SQLITE_OK;
+    }
+
+    if (task_count > 1) {
+      while (started < task_count && thread_create(&threads[started], rtree_envelope_worker, &tasks[started]) == 0) {
+        started++;
+      }
+    }
+
+    result = rtree_blob_batch_read(stmt, &batches[1 - current], &done);
+
+    // Tasks for which no thread could be started are run on the connection thread
+    for (int t = started; t < task_count; t++) {
+      rtree_envelope_task_run(&tasks[t]);
+    }
+    for (int t = 0; t < started; t++) {
+      thread_join(threads[t]);
+    }
+
+    for (int t = 0; t < task_count && result == SQLITE_OK; t++) {
+      result = tasks[t].result;
+    }
+    if (result == SQLITE_OK) {
+      result = rtree_level_reserve(level, &capacity, batch->count);
+    }
+    if (result == SQLITE_OK) {
+      for (size_t i = 0; i < batch->count; i++) {
+        if (batch->has_entry[i]) {
+          level->entries[level->count++] = batch->entries[i];
+        }
+      }
+    }
+
+    current = 1 - current;
+  }
+
+exit:
+  rtree_blob_batch_destroy(&batches[0]);
+  rtree_blob_batch_destroy(&batches[1]);
+  sqlite3_finalize(stmt);
+  return result;
+}
+
+static int rtree_build_parent(rtree_level_t *child, rtree_level_t *parent, size_t capacity) {
+  rtree_str_sort(child->entries, child->count, capacity);
+
+  parent->count = (child->count + capacity - 1) / capacity;
+  parent->entries = (rtree_entry_t *)sqlite3_malloc64(parent->count * sizeof(rtree_entry_t));
+  if (parent->entries == NULL) {
+    return SQLITE_NOMEM;
+  }
+
+  for (size_t p = 0; p < parent->count; p++) {
+    rtree_entry_t *node = &parent->entries[p];
+    const rtree_entry_t *cells = child->entries + p * capacity;
+    size_t n = child->count - p * capacity < capacity ? child->count - p * capacity : capacity;
+
+    node->id = (sqlite3_int64)p;
+    memcpy(node->coords, cells[0].coords, sizeof(node->coords));
+    for (size_t c = 1; c < n; c++) {
+      for (int d = 0; d < RTREE_DIMS; d++) {
+        if (cells[c].coords[2 * d] < node->coords[2 * d]) {
+          node->coords[2 * d] = cells[c].coords[2 * d];
+        }
+        if (cells[c].coords[2 * d + 1] > node->coords[2 * d + 1]) {
+          node->coords[2 * d + 1] = cells[c].coords[2 * d + 1];
+        }
+      }
+    }
+  }
+
+  return SQLITE_OK;
+}
+
+static void rtree_write_u16(unsigned char *p, int value) {
+  p[0] = (unsigned char)((value >> 8) & 0xFF);
+  p[1] = (unsigned char)(value & 0xFF);
+}
+
+static void rtree_write_i64(unsigned char *p, sqlite3_int64 value) {
+  sqlite3_uint64 v = (sqlite3_uint64)value;
+  for (int i = 0; i < 8; i++) {
+    p[i] = (unsigned char)((v >> (56 - 8 * i)) & 0xFF);
+  }
+}
+
+static void rtree_write_float(unsigned char *p, float value) {
+  uint32_t v;
+  memcpy(&v, &value, sizeof(v));
+  p[0] = (unsigned char)((v >> 24) & 0xFF);
+  p[1] = (unsigned char)((v >> 16) & 0xFF);
+  p[2] = (unsigned char)((v >> 8) & 0xFF);
+  p[3] = (unsigned char)(v & 0xFF);
+}
+
+static void rtree_fill_node(unsigned char *node, int node_size, int depth, const rtree_entry_t *cells, size_t count, sqlite3_int64 id_offset) {
+  memset(node, 0, (size_t)node_size);
+  rtree_write_u16(node, depth);
+  rtree_write_u16(node + 2, (int)count);
+  for (size_t c = 0; c < count; c++) {
+    unsigned char *cell = node + 4 + c * RTREE_CELL_SIZE;
+    rtree_write_i64(cell, cells[c].id + id_offset);
+    for (int i = 0; i < RTREE_DIMS * 2; i++) {
+      rtree_write_float(cell + 8 + 4 * i, cells[c].coords[i]);
+    }
+  }
+}
+
+static int rtree_read_u16(const unsigned char *p) {
+  return (p[0] << 8) | p[1];
+}
+
+static sqlite3_int64 rtree_read_i64(const unsigned char *p) {
+  sqlite3_uint64 v = 0;
+  for (int i = 0; i < 8; i++) {
+    v = (v << 8) | p[i];
+  }
+  return (sqlite3_int64)v;
+}
+
+static float rtree_read_float(const unsigned char *p) {
+  uint32_t v = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+  float value;
+  memcpy(&value, &v, sizeof(value));
+  return value;
+}
+
+/*
+ * Records the parent of each cell of a node: the _rowid table for leaf nodes and the _parent table otherwise.
+ */
+static int rtree_link_cells(rtree_writer_t *writer, sqlite3_int64 nodeno, int level, const rtree_entry_t *cells, size_t count, sqlite3_int64 id_offset) {
+  sqlite3_stmt *stmt = level == 0 ? writer->insert_rowid : writer->insert_parent;
+  int result = SQLITE_OK;
+  for (size_t c = 0; c < count && result == SQLITE_OK; c++) {
+    result = sqlite3_bind_int64(stmt, 1, cells[c].id + id_offset);
+    if (result == SQLITE_OK) {
+      result = sqlite3_bind_int64(stmt, 2, nodeno);
+    }
+    if (result == SQLITE_OK) {
+      result = rtree_step(stmt);
+    }
+  }
+  return result;
+}
+
+static int rtree_write_levels(sqlite3 *db, const char *db_name, const char *rtree_name, rtree_level_t *levels, int depth, int node_size, size_t capacity) {
+  rtree_writer_t writer = {NULL, NULL, NULL, NULL};
+  sqlite3_int64 offsets[RTREE_MAX_LEVELS];
+  unsigned char *node = NULL;
+  int result;
+
+  // Node 1 is the root; the remaining nodes are numbered level by level starting below the root
+  sqlite3_int64 next_nodeno = 2;
+  offsets[0] = 0;
+  for (int level = depth; level > 0; level--) {
+    offsets[level] = next_nodeno;
+    next_nodeno += (sqlite3_int64)levels[level].count;
+  }
+
+  node = (unsigned char *)sqlite3_malloc(node_size);
+  if (node == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  result = rtree_prepare(db, &writer.update_root, "UPDATE \"%w\".\"%w_node\" SET data = ? WHERE nodeno = 1", db_name, rtree_name);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+  result = rtree_prepare(db, &writer.insert_node, "INSERT INTO \"%w\".\"%w_node\" (nodeno, data) VALUES (?, ?)", db_name, rtree_name);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+  result = rtree_prepare(db, &writer.insert_rowid, "INSERT INTO \"%w\".\"%w_rowid\" (rowid, nodeno) VALUES (?, ?)", db_name, rtree_name);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+  result = rtree_prepare(db, &writer.insert_parent, "INSERT INTO \"%w\".\"%w_parent\" (nodeno, parentnode) VALUES (?, ?)", db_name, rtree_name);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  rtree_fill_node(node, node_size, depth, levels[depth].entries, levels[depth].count, offsets[depth]);
+  result = sqlite3_bind_blob(writer.update_root, 1, node, node_size, SQLITE_STATIC);
+  if (result == SQLITE_OK) {
+    result = rtree_step(writer.update_root);
+  }
+  if (result == SQLITE_OK) {
+    result = rtree_link_cells(&writer, 1, depth, levels[depth].entries, levels[depth].count, offsets[depth]);
+  }
+
+  for (int level = depth; level > 0 && result == SQLITE_OK; level--) {
+    const rtree_level_t *children = &levels[level - 1];
+    for (size_t i = 0; i < levels[level].count && result == SQLITE_OK; i++) {
+      const rtree_entry_t *entry = &levels[level].entries[i];
+      size_t first = (size_t)entry->id * capacity;
+      size_t n = children->count - first < capacity ? children->count - first : capacity;
+      sqlite3_int64 nodeno = offsets[level] + entry->id;
+
+      rtree_fill_node(node, node_size, 0, children->entries + first, n, offsets[level - 1]);
+      result = sqlite3_bind_int64(writer.insert_node, 1, nodeno);
+      if (result == SQLITE_OK) {
+        result = sqlite3_bind_blob(writer.insert_node, 2, node, node_size, SQLITE_STATIC);
+      }
+      if (result == SQLITE_OK) {
+        result = rtree_step(writer.insert_node);
+      }
+      if (result == SQLITE_OK) {
+        result = rtree_link_cells(&writer, nodeno, level - 1, children->entries + first, n, offsets[level - 1]);
+      }
+    }
+  }
+
+exit:
+  sqlite3_finalize(writer.update_root);
+  sqlite3_finalize(writer.insert_node);
+  sqlite3_finalize(writer.insert_rowid);
+  sqlite3_finalize(writer.insert_parent);
+  sqlite3_free(node);
+  return result;
+}
+
+static int rtree_pack(sqlite3 *db, const char *db_name, const char *rtree_name, const rtree_level_t *leaves) {
+  rtree_level_t levels[RTREE_MAX_LEVELS];
+  int level_count = 0;
+  int node_size = 0;
+  int cell_count = 0;
+  size_t capacity;
+
+  memset(levels, 0, sizeof(levels));
+
+  int result = rtree_root_info(db, db_name, rtree_name, &node_size, &cell_count);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  capacity = (size_t)(node_size - 4) / RTREE_CELL_SIZE;
+  if (cell_count != 0 || capacity < 2) {
+    result = SQLITE_MISUSE;
+    goto exit;
+  }
+
+  levels[0] = *leaves;
+  level_count = 1;
+  if (levels[0].count == 0) {
+    goto exit;
+  }
+
+  while (levels[level_count - 1].count > capacity) {
+    if (level_count == RTREE_MAX_LEVELS) {
+      result = SQLITE_TOOBIG;
+      goto exit;
+    }
+    result = rtree_build_parent(&levels[level_count - 1], &levels[level_count], capacity);
+    level_count++;
+    if (result != SQLITE_OK) {
+      goto exit;
+    }
+  }
+
+  result = rtree_write_levels(db, db_name, rtree_name, levels, level_count - 1, node_size, capacity);
+
+exit:
+  // The leaf level is owned by the caller
+  for (int i = 1; i < level_count; i++) {
+    sqlite3_free(levels[i].entries);
+  }
+  return result;
+}
+
+static int rtree_insert_entries(sqlite3 *db, const char *db_name, const char *rtree_name, const rtree_level_t *leaves) {
+  sqlite3_stmt *stmt = NULL;
+  int result = rtree_prepare(db, &stmt, "INSERT OR REPLACE INTO \"%w\".\"%w\" VALUES (?, ?, ?, ?, ?)", db_name, rtree_name);
+
+  for (size_t i = 0; i < leaves->count && result == SQLITE_OK; i++) {
+    const rtree_entry_t *entry = &leaves->entries[i];
+    result = sqlite3_bind_int64(stmt, 1, entry->id);
+    for (int c = 0; c < RTREE_DIMS * 2 && result == SQLITE_OK; c++) {
+      result = sqlite3_bind_double(stmt, 2 + c, entry->coords[c]);
+    }
+    if (result == SQLITE_OK) {
+      result = rtree_step(stmt);
+    }
+  }
+
+  sqlite3_finalize(stmt);
+  return result;
+}
+
+int rtree_bulk_load_blobs(sqlite3 *db, const char *db_name, const char *rtree_name, const char *source_sql, rtree_envelope_func envelope, void *ctx) {
+  rtree_level_t leaves = {NULL, 0};
+
+  int result = rtree_read_blob_entries(db, source_sql, envelope, ctx, &leaves);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  result = sql_begin(db, "rtree_bulk_load");
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  result = rtree_pack(db, db_name, rtree_name, &leaves);
+  if (result == SQLITE_OK) {
+    result = sql_commit(db, "rtree_bulk_load");
+    goto exit;
+  }
+
+  // Undo any partially written nodes and let the rtree module insert the entries itself
+  sql_rollback(db, "rtree_bulk_load");
+  sql_commit(db, "rtree_bulk_load");
+
+  result = rtree_insert_entries(db, db_name, rtree_name, &leaves);
+
+exit:
+  sqlite3_free(leaves.entries);
+  return result;
+}
+
+int rtree_truncate(sqlite3 *db, const char *db_name, const char *rtree_name) {
+  int result = sql_begin(db, "rtree_truncate");
+  if (result != SQLITE_OK) {
+    return result;
+  }
+
+  result = sql_exec(db, "DELETE FROM \"%w\".\"%w_rowid\"", db_name, rtree_name);
+  if (result == SQLITE_OK) {
+    result = sql_exec(db, "DELETE FROM \"%w\".\"%w_parent\"", db_name, rtree_name);
+  }
+  if (result == SQLITE_OK) {
+    result = sql_exec(db, "DELETE FROM \"%w\".\"%w_node\" WHERE nodeno <> 1", db_name, rtree_name);
+  }
+  if (result == SQLITE_OK) {
+    result = sql_exec(db, "UPDATE \"%w\".\"%w_node\" SET data = zeroblob(length(data)) WHERE nodeno = 1", db_name, rtree_name);
+  }
+  if (result == SQLITE_OK) {
+    return sql_commit(db, "rtree_truncate");
+  }
+
+  sql_rollback(db, "rtree_truncate");
+  sql_commit(db, "rtree_truncate");
+
+  return sql_exec(db, "DELETE FROM \"%w\".\"%w\"", db_name, rtree_name);
+}
+
+int rtree_reader_init(rtree_reader_t *reader, sqlite3 *db, const char *db_name, const char *rtree_name) {
+  memset(reader, 0, sizeof(rtree_reader_t));
+
+  int result = rtree_prepare(db, &reader->stmt, "SELECT data FROM \"%w\".\"%w_node\" WHERE nodeno = ?", db_name, rtree_name);
+  if (result != SQLITE_OK) {
+    return result;
+  }
+
+  // The depth of the tree is stored in the first two bytes of the root node
+  sqlite3_bind_int64(reader->stmt, 1, RTREE_ROOT_NODE);
+  result = sqlite3_step(reader->stmt);
+  if (result == SQLITE_ROW) {
+    const unsigned char *data = (const unsigned char *)sqlite3_column_blob(reader->stmt, 0);
+    if (data == NULL || sqlite3_column_bytes(reader->stmt, 0) < 4) {
+      result = SQLITE_CORRUPT;
+    } else {
+      reader->depth = rtree_read_u16(data);
+      result = SQLITE_OK;
+    }
+  } else if (result == SQLITE_DONE) {
+    result = SQLITE_CORRUPT;
+  }
+  sqlite3_reset(reader->stmt);
+
+  if (result != SQLITE_OK) {
+    rtree_reader_destroy(reader);
+  }
+  return result;
+}
+
+int rtree_reader_read_node(rtree_reader_t *reader, sqlite3_int64 nodeno, const rtree_cell_t **cells, int *count) {
+  sqlite3_bind_int64(reader->stmt, 1, nodeno);
+
+  int result = sqlite3_step(reader->stmt);
+  if (result == SQLITE_DONE) {
+    result = SQLITE_CORRUPT;
+    goto exit;
+  } else if (result != SQLITE_ROW) {
+    goto exit;
+  }
+
+  const unsigned char *data = (const unsigned char *)sqlite3_column_blob(reader->stmt, 0);
+  int length = sqlite3_column_bytes(reader->stmt, 0);
+  if (data == NULL || length < 4) {
+    result = SQLITE_CORRUPT;
+    goto exit;
+  }
+
+  int cell_count = rtree_read_u16(data + 2);
+  if (4 + cell_count * RTREE_CELL_SIZE > length) {
+    result = SQLITE_CORRUPT;
+    goto exit;
+  }
+
+  if (cell_count > reader->capacity) {
+    rtree_cell_t *grown = (rtree_cell_t *)sqlite3_realloc(reader->cells, cell_count * (int)sizeof(rtree_cell_t));
+    if (grown == NULL) {
+      result = SQLITE_NOMEM;
+      goto exit;
+    }
+    reader->cells = grown;
+    reader->capacity = cell_count;
+  }
+
+  for (int c = 0; c < cell_count; c++) {
+    const unsigned char *cell = data + 4 + c * RTREE_CELL_SIZE;
+    rtree_cell_t *out = &reader->cells[c];
+    out->id = rtree_read_i64(cell);
+    out->min_x = rtree_read_float(cell + 8);
+    out->max_x = rtree_read_float(cell + 12);
+    out->min_y = rtree_read_float(cell + 16);
+    out->max_y = rtree_read_float(cell + 20);
+  }
+
+  *cells = reader->cells;
+  *count = cell_count;
+  result = SQLITE_OK;
+
+exit:
+  sqlite3_reset(reader->stmt);
+  return result;
+}
+
+void rtree_reader_destroy(rtree_reader_t *reader) {
+  sqlite3_finalize(reader->stmt);
+  reader->stmt = NULL;
+  sqlite3_free(reader->cells);
+  reader->cells = NULL;
+  reader->capacity = 0;
+}
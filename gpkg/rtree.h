@@ -0,0 +1,175 @@
+/*
+ * Copyright 2013 Luciad (http://www.luciad.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef GPKG_RTREE_H
+#define GPKG_RTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+/**
+ * \addtogroup rtree R-tree utilities
+ * @{
+ */
+
+/**
+ * The node number of the root node of an rtree.
+ */
+#define RTREE_ROOT_NODE 1
+
+/**
+ * A cell of an rtree node.
+ */
+typedef struct {
+  /**
+   * The node number of the child node for interior nodes or the row id of the index entry for leaf nodes.
+   */
+  sqlite3_int64 id;
+  /**
+   * The minimum X coordinate of the cell.
+   */
+  double min_x;
+  /**
+   * The maximum X coordinate of the cell.
+   */
+  double max_x;
+  /**
+   * The minimum Y coordinate of the cell.
+   */
+  double min_y;
+  /**
+   * The maximum Y coordinate of the cell.
+   */
+  double max_y;
+} rtree_cell_t;
+
+/**
+ * Reads the nodes of a two dimensional SQLite rtree virtual table directly from its shadow tables. This allows
+ * traversals, such as nearest neighbour searches, that cannot be expressed as a query on the rtree table.
+ */
+typedef struct {
+  /** @private */
+  sqlite3_stmt *stmt;
+  /** @private */
+  rtree_cell_t *cells;
+  /** @private */
+  int capacity;
+  /**
+   * The depth of the root node. Leaf nodes have depth 0 and the children of a node at depth d have depth d - 1.
+   */
+  int depth;
+} rtree_reader_t;
+
+/**
+ * Initializes an rtree reader.
+ *
+ * @param reader the reader to initialize
+ * @param db the SQLite database context
+ * @param db_name the name of the attached database to use. This can be 'main', 'temp' or any attached database.
+ * @param rtree_name the name of the rtree virtual table
+ * @return SQLITE_OK if the reader was initialized successfully\n
+ *         A SQLite error code otherwise
+ */
+int rtree_reader_init(rtree_reader_t *reader, sqlite3 *db, const char *db_name, const char *rtree_name);
+
+/**
+ * Reads the cells of a node. The returned cells remain valid until the next call to this function.
+ *
+ * @param reader the reader
+ * @param nodeno the number of the node to read
+ * @param[out] cells the cells of the node
+ * @param[out] count the number of cells
+ * @return SQLITE_OK if the node was read successfully\n
+ *         SQLITE_CORRUPT if the node does not exist or is malformed\n
+ *         A SQLite error code otherwise
+ */
+int rtree_reader_read_node(rtree_reader_t *reader, sqlite3_int64 nodeno, const rtree_cell_t **cells, int *count);
+
+/**
+ * Releases the resources held by an rtree reader.
+ *
+ * @param reader the reader
+ */
+void rtree_reader_destroy(rtree_reader_t *reader);
+
+/**
+ * Computes the bounding box of a geometry blob for use as an index entry. Implementations are called concurrently
+ * from multiple threads and must not use the database connection.
+ *
+ * @param ctx the context pointer that was passed to rtree_bulk_load_blobs
+ * @param blob the geometry blob
+ * @param length the length of blob in bytes
+ * @param[out] cell the cell that should receive the bounding box. The id field should not be set.
+ * @return SQLITE_OK if the bounding box was computed\n
+ *         SQLITE_DONE if the geometry has no bounding box and should not be indexed\n
+ *         A SQLite error code otherwise
+ */
+typedef int(*rtree_envelope_func)(void *ctx, const uint8_t *blob, size_t length, rtree_cell_t *cell);
+
+/**
+ * Populates an empty two dimensional SQLite rtree virtual table with the geometries returned by a query. The query
+ * must return the row id followed by the geometry blob. Rows with a NULL geometry are skipped.
+ *
+ * The bounding boxes of the geometries are computed by a pool of worker threads while the calling thread continues to
+ * read rows. The entries are then sorted using Sort-Tile-Recursive packing and written as fully packed nodes directly
+ * into the shadow tables of the rtree module. The resulting index can be queried and updated by the rtree module as
+ * usual. If the shadow tables cannot be written, for instance because the connection runs in defensive mode, or the
+ * index is not empty, the entries are inserted through the virtual table instead.
+ *
+ * @param db the SQLite database context
+ * @param db_name the name of the attached database to use. This can be 'main', 'temp' or any attached database.
+ * @param rtree_name the name of the rtree virtual table
+ * @param source_sql the query that produces the row ids and geometries
+ * @param envelope the function that computes the bounding box of a geometry
+ * @param ctx the context pointer to pass to envelope
+ * @return SQLITE_OK if the index was populated successfully\n
+ *         A SQLite error code otherwise, including any error returned by envelope
+ */
+int rtree_bulk_load_blobs(sqlite3 *db, const char *db_name, const char *rtree_name, const char *source_sql, rtree_envelope_func envelope, void *ctx);
+
+/**
+ * Removes all entries from a SQLite rtree virtual table. The shadow tables are cleared directly, which is much
+ * cheaper than deleting the entries one by one. If that is not possible the entries are deleted through the virtual
+ * table instead.
+ *
+ * @param db the SQLite database context
+ * @param db_name the name of the attached database to use. This can be 'main', 'temp' or any attached database.
+ * @param rtree_name the name of the rtree virtual table
+ * @return SQLITE_OK if the index was cleared successfully\n
+ *         A SQLite error code otherwise
+ */
+int rtree_truncate(sqlite3 *db, const char *db_name, const char *rtree_name);
+
+/**
+ * Rounds a minimum coordinate down to the 32-bit float value that the rtree module would store for it. Query bounds
+ * that are rounded the same way as the stored values never exclude an entry whose exact bounds match the query.
+ *
+ * @param d the value to round
+ * @return a float value that is not greater than d
+ */
+float rtree_value_down(double d);
+
+/**
+ * Rounds a maximum coordinate up to the 32-bit float value that the rtree module would store for it.
+ *
+ * @param d the value to round
+ * @return a float value that is not less than d
+ */
+float rtree_value_up(double d);
+
+/** @} */
+
+#endif
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 #include <stdint.h>
+#include <string.h>
 #include <sqlite3.h>
 #include <sys/types.h>
 #include <errno.h>
@@ -27,22 +28,102 @@
 #include "geomio.h"
 #include "geom_func.h"
 #include "i18n.h"
+#include "knn.h"
+#include "rtree.h"
 #include "sql.h"
 #include "sqlite.h"
 #include "spatialdb_internal.h"
 #include "wkb.h"
 #include "wkt.h"
 
+/*
+ * Envelope cache shared by the ST_Min and ST_Max functions and GPKG_Envelope of a single connection.
+ *
+ * Expressions such as the R-tree triggers typically call ST_MinX, ST_MaxX, ST_MinY and ST_MaxY on the same
+ * geometry. If the blob header does not contain an envelope each of those calls would need to decode the entire
+ * geometry. The cache remembers the envelope of the most recently decoded blob so that it is decoded only once.
+ * Entries are keyed by blob length and contents rather than by pointer, since SQLite may reuse the same buffer for the
+ * values of subsequent rows.
+ */
+typedef struct {
+  volatile long ref_count;
+  const spatialdb_t *spatialdb;
+  uint8_t *blob;
+  int length;
+  int capacity;
+  geom_envelope_t envelope;
+} envelope_cache_t;
+
+static envelope_cache_t *envelope_cache_init(const spatialdb_t *spatialdb) {
+  envelope_cache_t *cache = (envelope_cache_t *)sqlite3_malloc(sizeof(envelope_cache_t));
+
+  if (cache == NULL) {
+    return NULL;
+  }
+
+  cache->ref_count = 1;
+  cache->spatialdb = spatialdb;
+  cache->blob = NULL;
+  cache->length = -1;
+  cache->capacity = 0;
+  return cache;
+}
+
+static void envelope_cache_acquire(envelope_cache_t *cache) {
+  if (cache) {
+    atomic_inc_long(&cache->ref_count);
+  }
+}
+
+static void envelope_cache_release(envelope_cache_t *cache) {
+  if (cache) {
+    long newval = atomic_dec_long(&cache->ref_count);
+    if (newval == 0) {
+      sqlite3_free(cache->blob);
+      cache->blob = NULL;
+      sqlite3_free(cache);
+    }
+  }
+}
+
+static int envelope_cache_fill(envelope_cache_t *cache, binstream_t *stream, const uint8_t *blob, int length, geom_envelope_t *envelope, errorstream_t *error) {
+  if (cache->length == length && memcmp(cache->blob, blob, (size_t) length) == 0) {
+    *envelope = cache->envelope;
+    return SQLITE_OK;
+  }
+
+  int result = cache->spatialdb->fill_envelope(stream, envelope, error);
+  if (result != SQLITE_OK) {
+    return result;
+  }
+
+  if (length > cache->capacity) {
+    uint8_t *new_blob = (uint8_t *)sqlite3_realloc(cache->blob, length);
+    if (new_blob == NULL) {
+      /* Not being able to cache the envelope is not an error */
+      cache->length = -1;
+      return SQLITE_OK;
+    }
+    cache->blob = new_blob;
+    cache->capacity = length;
+  }
+
+  memcpy(cache->blob, blob, (size_t) length);
+  cache->length = length;
+  cache->envelope = *envelope;
+  return SQLITE_OK;
+}
+
 #define ST_MIN_MAX(name, check, field) static void ST_##name(sqlite3_context *context, int nbArgs, sqlite3_value **args) { \
-    spatialdb_t *spatialdb; \
+    envelope_cache_t *cache; \
     FUNCTION_GEOM_ARG(geomblob); \
 \
     FUNCTION_START_STATIC(context, 256); \
-    spatialdb = (spatialdb_t *)sqlite3_user_data(context); \
-    FUNCTION_GET_GEOM_ARG_UNSAFE(context, spatialdb, geomblob, 0); \
+    cache = (envelope_cache_t *)sqlite3_user_data(context); \
+    FUNCTION_GET_GEOM_ARG_UNSAFE(context, cache->spatialdb, geomblob, 0); \
  \
     if (geomblob.envelope.check == 0) { \
-        if (spatialdb->fill_envelope(&FUNCTION_GEOM_ARG_STREAM(geomblob), &geomblob.envelope, FUNCTION_ERROR) != SQLITE_OK) { \
+        if (envelope_cache_fill(cache, &FUNCTION_GEOM_ARG_STREAM(geomblob), FUNCTION_GEOM_ARG_BLOB(geomblob), (int) FUNCTION_GEOM_ARG_BLOB_LENGTH(geomblob), &geomblob.envelope, FUNCTION_ERROR) != SQLITE_OK) { \
             if ( error_count(FUNCTION_ERROR) == 0 ) error_append(FUNCTION_ERROR, "Invalid geometry blob header");\
             goto exit; \
         } \
@@ -66,6 +147,239 @@ ST_MIN_MAX(MaxZ, has_env_z, max_z)
 ST_MIN_MAX(MinM, has_env_m, min_m)
 ST_MIN_MAX(MaxM, has_env_m, max_m)
 
+/*
+ * Sets the result of a function to a polygon blob that covers the XY extent of an envelope.
+ */
+static int envelope_polygon_result(sqlite3_context *context, const spatialdb_t *spatialdb, int32_t srid, const geom_envelope_t *envelope, errorstream_t *error) {
+  geom_blob_writer_t writer;
+  int result = spatialdb->writer_init_srid(&writer, srid);
+  if (result != SQLITE_OK) {
+    return result;
+  }
+
+  double coords[] = {
+    envelope->min_x, envelope->min_y,
+    envelope->max_x, envelope->min_y,
+    envelope->max_x, envelope->max_y,
+    envelope->min_x, envelope->max_y,
+    envelope->min_x, envelope->min_y
+  };
+  geom_header_t polygon = {GEOM_POLYGON, GEOM_XY, 2};
+  geom_header_t ring = {GEOM_LINEARRING, GEOM_XY, 2};
+  geom_consumer_t *consumer = geom_blob_writer_geom_consumer(&writer);
+
+  result = consumer->begin(consumer, error);
+  if (result == SQLITE_OK) {
+    result = consumer->begin_geometry(consumer, &polygon, error);
+  }
+  if (result == SQLITE_OK) {
+    result = consumer->begin_geometry(consumer, &ring, error);
+  }
+  if (result == SQLITE_OK) {
+    result = consumer->coordinates(consumer, &ring, 5, coords, 0, error);
+  }
+  if (result == SQLITE_OK) {
+    result = consumer->end_geometry(consumer, &ring, error);
+  }
+  if (result == SQLITE_OK) {
+    result = consumer->end_geometry(consumer, &polygon, error);
+  }
+  if (result == SQLITE_OK) {
+    result = consumer->end(consumer, error);
+  }
+
+  if (result == SQLITE_OK) {
+    sqlite3_result_blob(context, geom_blob_writer_getdata(&writer), (int) geom_blob_writer_length(&writer), sqlite3_free);
+    spatialdb->writer_destroy(&writer, 0);
+  } else {
+    spatialdb->writer_destroy(&writer, 1);
+  }
+
+  return result;
+}
+
+static void GPKG_Envelope(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  envelope_cache_t *cache;
+  FUNCTION_GEOM_ARG(geomblob);
+
+  FUNCTION_START_STATIC(context, 256);
+  cache = (envelope_cache_t *)sqlite3_user_data(context);
+  FUNCTION_GET_GEOM_ARG_UNSAFE(context, cache->spatialdb, geomblob, 0);
+
+  if (!geomblob.empty && (geomblob.envelope.has_env_x == 0 || geomblob.envelope.has_env_y == 0)) {
+    FUNCTION_RESULT = envelope_cache_fill(cache, &FUNCTION_GEOM_ARG_STREAM(geomblob), FUNCTION_GEOM_ARG_BLOB(geomblob), (int) FUNCTION_GEOM_ARG_BLOB_LENGTH(geomblob), &geomblob.envelope, FUNCTION_ERROR);
+    if (FUNCTION_RESULT != SQLITE_OK) {
+      goto exit;
+    }
+  }
+
+  if (geomblob.empty || geomblob.envelope.has_env_x == 0 || geomblob.envelope.has_env_y == 0) {
+    sqlite3_result_null(context);
+    goto exit;
+  }
+
+  FUNCTION_RESULT = envelope_polygon_result(context, cache->spatialdb, geomblob.srid, &geomblob.envelope, FUNCTION_ERROR);
+
+  FUNCTION_END(context);
+
+  FUNCTION_FREE_GEOM_ARG(geomblob);
+}
+
+/*
+ * ST_Extent(geom)
+ *
+ * Aggregate that returns a polygon covering the XY envelopes of a set of geometries. Only the blob header of each
+ * geometry is read; the geometry itself is only decoded if the header does not contain an envelope. Empty geometries
+ * are ignored.
+ */
+typedef struct {
+  int count;
+  int32_t srid;
+  geom_envelope_t envelope;
+} geom_extent_t;
+
+static void ST_Extent_step(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  spatialdb_t *spatialdb;
+  geom_extent_t *extent;
+  FUNCTION_GEOM_ARG(geomblob);
+
+  FUNCTION_START_STATIC(context, 256);
+  spatialdb = (spatialdb_t *)sqlite3_user_data(context);
+  FUNCTION_GET_GEOM_ARG_UNSAFE(context, spatialdb, geomblob, 0);
+
+  if (geomblob.empty) {
+    goto exit;
+  }
+
+  if (geomblob.envelope.has_env_x == 0 || geomblob.envelope.has_env_y == 0) {
+    FUNCTION_RESULT = spatialdb->fill_envelope(&FUNCTION_GEOM_ARG_STREAM(geomblob), &geomblob.envelope, FUNCTION_ERROR);
+    if (FUNCTION_RESULT != SQLITE_OK) {
+      goto exit;
+    }
+    if (geomblob.envelope.has_env_x == 0 || geomblob.envelope.has_env_y == 0) {
+      goto exit;
+    }
+  }
+
+  extent = (geom_extent_t *)sqlite3_aggregate_context(context, sizeof(geom_extent_t));
+  if (extent == NULL) {
+    FUNCTION_RESULT = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  geom_envelope_t *envelope = &geomblob.envelope;
+  if (extent->count == 0) {
+    extent->srid = geomblob.srid;
+    extent->envelope = *envelope;
+  } else if (extent->srid != geomblob.srid) {
+    error_append(FUNCTION_ERROR, "Cannot apply ST_Extent when SRIDs differ: %d != %d", extent->srid, geomblob.srid);
+    goto exit;
+  } else {
+    extent->envelope.min_x = envelope->min_x < extent->envelope.min_x ? envelope->min_x : extent->envelope.min_x;
+    extent->envelope.min_y = envelope->min_y < extent->envelope.min_y ? envelope->min_y : extent->envelope.min_y;
+    extent->envelope.max_x = envelope->max_x > extent->envelope.max_x ? envelope->max_x : extent->envelope.max_x;
+    extent->envelope.max_y = envelope->max_y > extent->envelope.max_y ? envelope->max_y : extent->envelope.max_y;
+  }
+  extent->count++;
+
+  FUNCTION_END(context);
+
+  FUNCTION_FREE_GEOM_ARG(geomblob);
+}
+
+static void ST_Extent_final(sqlite3_context *context) {
+  spatialdb_t *spatialdb;
+  geom_extent_t *extent;
+
+  FUNCTION_START_STATIC(context, 256);
+  spatialdb = (spatialdb_t *)sqlite3_user_data(context);
+
+  extent = (geom_extent_t *)sqlite3_aggregate_context(context, 0);
+  if (extent == NULL || extent->count == 0) {
+    sqlite3_result_null(context);
+    goto exit;
+  }
+
+  FUNCTION_RESULT = envelope_polygon_result(context, spatialdb, extent->srid, &extent->envelope, FUNCTION_ERROR);
+
+  FUNCTION_END(context);
+}
+
+/*
+ * Returns the distance along a Hilbert curve of order 16 of the cell (x, y) of a 65536 x 65536 grid.
+ */
+static sqlite3_int64 hilbert_key(uint32_t x, uint32_t y) {
+  sqlite3_int64 key = 0;
+
+  for (uint32_t s = 1u << 15; s > 0; s >>= 1) {
+    uint32_t rx = (x & s) != 0;
+    uint32_t ry = (y & s) != 0;
+    key += (sqlite3_int64)s * s * ((3 * rx) ^ ry);
+
+    // Rotate the quadrant so that the curve continues in the same orientation
+    if (ry == 0) {
+      if (rx == 1) {
+        x = 0xFFFF - x;
+        y = 0xFFFF - y;
+      }
+      uint32_t t = x;
+      x = y;
+      y = t;
+    }
+  }
+
+  return key;
+}
+
+static uint32_t hilbert_cell(double value, double min, double max) {
+  if (!(max > min) || !(value > min)) {
+    return 0;
+  } else if (value >= max) {
+    return 0xFFFF;
+  } else {
+    return (uint32_t)((value - min) / (max - min) * 0xFFFF);
+  }
+}
+
+/*
+ * ST_HilbertKey(geom, min_x, min_y, max_x, max_y)
+ *
+ * Returns the position of the center of the envelope of a geometry along a Hilbert curve that covers the given extent.
+ * Sorting on this key places geometries that are close to each other next to each other.
+ */
+static void ST_HilbertKey(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  envelope_cache_t *cache;
+  FUNCTION_GEOM_ARG(geomblob);
+
+  FUNCTION_START_STATIC(context, 256);
+  cache = (envelope_cache_t *)sqlite3_user_data(context);
+  FUNCTION_GET_GEOM_ARG_UNSAFE(context, cache->spatialdb, geomblob, 0);
+
+  if (!geomblob.empty && (geomblob.envelope.has_env_x == 0 || geomblob.envelope.has_env_y == 0)) {
+    FUNCTION_RESULT = envelope_cache_fill(cache, &FUNCTION_GEOM_ARG_STREAM(geomblob), FUNCTION_GEOM_ARG_BLOB(geomblob), (int) FUNCTION_GEOM_ARG_BLOB_LENGTH(geomblob), &geomblob.envelope, FUNCTION_ERROR);
+    if (FUNCTION_RESULT != SQLITE_OK) {
+      goto exit;
+    }
+  }
+
+  if (geomblob.empty || geomblob.envelope.has_env_x == 0 || geomblob.envelope.has_env_y == 0) {
+    sqlite3_result_null(context);
+    goto exit;
+  }
+
+  double min_x = sqlite3_value_double(args[1]);
+  double min_y = sqlite3_value_double(args[2]);
+  double max_x = sqlite3_value_double(args[3]);
+  double max_y = sqlite3_value_double(args[4]);
+  double center_x = (geomblob.envelope.min_x + geomblob.envelope.max_x) / 2.0;
+  double center_y = (geomblob.envelope.min_y + geomblob.envelope.max_y) / 2.0;
+
+  sqlite3_result_int64(context, hilbert_key(hilbert_cell(center_x, min_x, max_x), hilbert_cell(center_y, min_y, max_y)));
+
+  FUNCTION_END(context);
+  FUNCTION_FREE_GEOM_ARG(geomblob);
+}
+
 static void ST_SRID(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
   spatialdb_t *spatialdb;
   FUNCTION_GEOM_ARG(geomblob);
@@ -78,18 +392,30 @@ static void ST_SRID(sqlite3_context *context, int nbArgs, sqlite3_value **args)
     sqlite3_result_int(context, geomblob.srid);
   } else {
     FUNCTION_GET_INT_ARG(geomblob.srid, 1);
-    if (binstream_seek(&FUNCTION_GEOM_ARG_STREAM(geomblob), 0) != SQLITE_OK) {
-      sqlite3_result_error(context, "Error writing geometry blob header", -1);
+
+    /*
+     * The header is rewritten in a copy of exactly the same size, which is handed over to SQLite as is. The header
+     * size does not depend on the SRID, so the geometry itself is left untouched.
+     */
+    size_t length = FUNCTION_GEOM_ARG_BLOB_LENGTH(geomblob);
+    uint8_t *data = (uint8_t *)sqlite3_malloc((int) length);
+    if (data == NULL) {
+      FUNCTION_RESULT = SQLITE_NOMEM;
       goto exit;
     }
-    if (spatialdb->write_blob_header(&FUNCTION_GEOM_ARG_STREAM(geomblob), &geomblob, FUNCTION_ERROR) != SQLITE_OK) {
+    binstream_seek(&FUNCTION_GEOM_ARG_STREAM(geomblob), 0);
+    memcpy(data, binstream_data(&FUNCTION_GEOM_ARG_STREAM(geomblob)), length);
+
+    binstream_t stream;
+    binstream_init(&stream, data, length);
+    if (spatialdb->write_blob_header(&stream, &geomblob, FUNCTION_ERROR) != SQLITE_OK) {
       if (error_count(FUNCTION_ERROR) == 0) {
         error_append(FUNCTION_ERROR, "Error writing geometry blob header");
       }
+      sqlite3_free(data);
       goto exit;
     }
-    binstream_seek(&FUNCTION_GEOM_ARG_STREAM(geomblob), 0);
-    sqlite3_result_blob(context, binstream_data(&FUNCTION_GEOM_ARG_STREAM(geomblob)), (int) binstream_available(&FUNCTION_GEOM_ARG_STREAM(geomblob)), SQLITE_TRANSIENT);
+    sqlite3_result_blob(context, data, (int) length, sqlite3_free);
   }
 
   FUNCTION_END(context);
@@ -217,29 +543,233 @@ static void ST_AsBinary(sqlite3_context *context, int nbArgs, sqlite3_value **ar
   FUNCTION_FREE_GEOM_ARG(geomblob);
 }
 
+/*
+ * ST_AsText(geom [, precision])
+ *
+ * Without a precision each coordinate is written using the shortest representation that parses back to the same
+ * value. With a precision coordinates are rounded to at most that many decimal places.
+ */
 static void ST_AsText(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
   spatialdb_t *spatialdb;
   FUNCTION_GEOM_ARG(geomblob);
+  int precision = -1;
 
   FUNCTION_START_STATIC(context, 256);
   spatialdb = (spatialdb_t *)sqlite3_user_data(context);
+
+  if (nbArgs == 2) {
+    if (sqlite3_value_type(args[1]) != SQLITE_INTEGER || sqlite3_value_int(args[1]) < 0) {
+      error_append(FUNCTION_ERROR, "Precision must be a non-negative integer");
+      goto exit;
+    }
+    precision = sqlite3_value_int(args[1]);
+  }
+
   FUNCTION_GET_GEOM_ARG_UNSAFE(context, spatialdb, geomblob, 0);
 
+  /*
+   * Each 8 byte ordinate in the blob rarely needs more than 16 characters in the text, so three times the blob
+   * length is enough to avoid growing the output buffer for almost all geometries.
+   */
   wkt_writer_t writer;
-  wkt_writer_init(&writer);
+  FUNCTION_RESULT = wkt_writer_init_precision(&writer, precision, 3 * FUNCTION_GEOM_ARG_BLOB_LENGTH(geomblob) + 64);
+  if (FUNCTION_RESULT != SQLITE_OK) {
+    goto exit;
+  }
 
   FUNCTION_RESULT = spatialdb->read_geometry(&FUNCTION_GEOM_ARG_STREAM(geomblob), wkt_writer_geom_consumer(&writer), FUNCTION_ERROR);
 
   if (FUNCTION_RESULT == SQLITE_OK) {
-    sqlite3_result_text(context, wkt_writer_getwkt(&writer), (int) wkt_writer_length(&writer), SQLITE_TRANSIENT);
+    sqlite3_result_text(context, wkt_writer_getwkt(&writer), (int) wkt_writer_length(&writer), sqlite3_free);
+    wkt_writer_destroy(&writer, 0);
+  } else {
+    wkt_writer_destroy(&writer, 1);
   }
-  wkt_writer_destroy(&writer);
 
   FUNCTION_END(context);
 
   FUNCTION_FREE_GEOM_ARG(geomblob);
 }
 
+/*
+ * ST_Collect buffers the blobs of its arguments and only writes the collection in its final function, once the type
+ * of the collection is known.
+ */
+typedef struct {
+  uint8_t *data;
+  size_t length;
+  size_t capacity;
+  int count;
+  int32_t srid;
+  geom_type_t geom_type;
+  coord_type_t coord_type;
+} geom_collect_t;
+
+static void ST_Collect_step(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  spatialdb_t *spatialdb;
+  geom_collect_t *collect;
+  FUNCTION_WKB_ARG(wkb);
+
+  FUNCTION_START_STATIC(context, 256);
+  spatialdb = (spatialdb_t *)sqlite3_user_data(context);
+  FUNCTION_GET_WKB_ARG_UNSAFE(context, spatialdb, wkb, 0);
+
+  collect = (geom_collect_t *)sqlite3_aggregate_context(context, sizeof(geom_collect_t));
+  if (collect == NULL) {
+    FUNCTION_RESULT = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  if (collect->count == 0) {
+    collect->srid = wkb_geom.srid;
+    collect->geom_type = wkb.geom_type;
+    collect->coord_type = wkb.coord_type;
+  } else if (collect->srid != wkb_geom.srid) {
+    error_append(FUNCTION_ERROR, "Cannot apply ST_Collect when SRIDs differ: %d != %d", collect->srid, wkb_geom.srid);
+    goto exit;
+  } else if (collect->coord_type != wkb.coord_type) {
+    error_append(FUNCTION_ERROR, "Cannot apply ST_Collect to geometries with different coordinate types");
+    goto exit;
+  } else if (collect->geom_type != wkb.geom_type) {
+    collect->geom_type = GEOM_GEOMETRY;
+  }
+
+  size_t blob_length = FUNCTION_GEOM_ARG_BLOB_LENGTH(wkb_geom);
+  size_t required = collect->length + sizeof(size_t) + blob_length;
+  if (required > collect->capacity) {
+    size_t capacity = collect->capacity == 0 ? 256 : collect->capacity;
+    while (capacity < required) {
+      capacity *= 2;
+    }
+    uint8_t *data = (uint8_t *)sqlite3_realloc64(collect->data, capacity);
+    if (data == NULL) {
+      FUNCTION_RESULT = SQLITE_NOMEM;
+      goto exit;
+    }
+    collect->data = data;
+    collect->capacity = capacity;
+  }
+
+  memcpy(collect->data + collect->length, &blob_length, sizeof(size_t));
+  memcpy(collect->data + collect->length + sizeof(size_t), FUNCTION_GEOM_ARG_BLOB(wkb_geom), blob_length);
+  collect->length = required;
+  collect->count++;
+
+  FUNCTION_END(context);
+
+  FUNCTION_FREE_WKB_ARG(wkb);
+}
+
+/*
+ * Passes the geometries of the collected blobs on to the collection writer without their begin and end calls.
+ */
+typedef struct {
+  geom_consumer_t geom_consumer;
+  const geom_consumer_t *target;
+} geom_collect_consumer_t;
+
+static int geom_collect_begin_geometry(const geom_consumer_t *consumer, const geom_header_t *header, errorstream_t *error) {
+  const geom_consumer_t *target = ((const geom_collect_consumer_t *)consumer)->target;
+  return target->begin_geometry(target, header, error);
+}
+
+static int geom_collect_end_geometry(const geom_consumer_t *consumer, const geom_header_t *header, errorstream_t *error) {
+  const geom_consumer_t *target = ((const geom_collect_consumer_t *)consumer)->target;
+  return target->end_geometry(target, header, error);
+}
+
+static int geom_collect_coordinates(const geom_consumer_t *consumer, const geom_header_t *header, size_t point_count, const double *coords, int skip_coords, errorstream_t *error) {
+  const geom_consumer_t *target = ((const geom_collect_consumer_t *)consumer)->target;
+  return target->coordinates(target, header, point_count, coords, skip_coords, error);
+}
+
+static void ST_Collect_final(sqlite3_context *context) {
+  spatialdb_t *spatialdb;
+  geom_collect_t *collect = NULL;
+  geom_blob_writer_t writer;
+  int writer_initialized = 0;
+
+  FUNCTION_START_STATIC(context, 256);
+  spatialdb = (spatialdb_t *)sqlite3_user_data(context);
+
+  collect = (geom_collect_t *)sqlite3_aggregate_context(context, 0);
+  if (collect == NULL || collect->count == 0) {
+    sqlite3_result_null(context);
+    goto exit;
+  }
+
+  geom_header_t header;
+  switch (collect->geom_type) {
+    case GEOM_POINT:
+      header.geom_type = GEOM_MULTIPOINT;
+      break;
+    case GEOM_LINESTRING:
+      header.geom_type = GEOM_MULTILINESTRING;
+      break;
+    case GEOM_POLYGON:
+      header.geom_type = GEOM_MULTIPOLYGON;
+      break;
+    default:
+      header.geom_type = GEOM_GEOMETRYCOLLECTION;
+      break;
+  }
+  header.coord_type = collect->coord_type;
+  header.coord_size = (uint32_t) geom_coord_dim(collect->coord_type);
+
+  spatialdb->writer_init_srid(&writer, collect->srid);
+  writer_initialized = 1;
+  geom_consumer_t *consumer = geom_blob_writer_geom_consumer(&writer);
+
+  geom_collect_consumer_t members;
+  geom_consumer_init(&members.geom_consumer, NULL, NULL, geom_collect_begin_geometry, geom_collect_end_geometry, geom_collect_coordinates);
+  members.target = consumer;
+
+  FUNCTION_RESULT = consumer->begin(consumer, FUNCTION_ERROR);
+  if (FUNCTION_RESULT == SQLITE_OK) {
+    FUNCTION_RESULT = consumer->begin_geometry(consumer, &header, FUNCTION_ERROR);
+  }
+
+  size_t offset = 0;
+  while (FUNCTION_RESULT == SQLITE_OK && offset < collect->length) {
+    size_t blob_length;
+    memcpy(&blob_length, collect->data + offset, sizeof(size_t));
+    offset += sizeof(size_t);
+
+    binstream_t stream;
+    geom_blob_header_t blob_header;
+    binstream_init(&stream, collect->data + offset, blob_length);
+    FUNCTION_RESULT = spatialdb->read_blob_header(&stream, &blob_header, FUNCTION_ERROR);
+    if (FUNCTION_RESULT == SQLITE_OK) {
+      FUNCTION_RESULT = spatialdb->read_geometry(&stream, &members.geom_consumer, FUNCTION_ERROR);
+    }
+    binstream_destroy(&stream, 0);
+    offset += blob_length;
+  }
+
+  if (FUNCTION_RESULT == SQLITE_OK) {
+    FUNCTION_RESULT = consumer->end_geometry(consumer, &header, FUNCTION_ERROR);
+  }
+  if (FUNCTION_RESULT == SQLITE_OK) {
+    FUNCTION_RESULT = consumer->end(consumer, FUNCTION_ERROR);
+  }
+
+  if (FUNCTION_RESULT == SQLITE_OK) {
+    sqlite3_result_blob(context, geom_blob_writer_getdata(&writer), (int) geom_blob_writer_length(&writer), sqlite3_free);
+    spatialdb->writer_destroy(&writer, 0);
+    writer_initialized = 0;
+  }
+
+  FUNCTION_END(context);
+
+  if (writer_initialized) {
+    spatialdb->writer_destroy(&writer, 1);
+  }
+  if (collect != NULL) {
+    sqlite3_free(collect->data);
+    collect->data = NULL;
+  }
+}
+
 static int geometry_is_assignable(geom_type_t expected, geom_type_t actual, errorstream_t* error) {
   if (!geom_is_assignable(expected, actual)) {
     const char* expectedName = NULL;
@@ -257,45 +787,71 @@ static int geometry_is_assignable(geom_type_t expected, geom_type_t actual, erro
 
 typedef int (*geometry_constructor_func)(sqlite3_context *context, void *user_data, geom_consumer_t *consumer, int nbArgs, sqlite3_value **args, errorstream_t *error);
 
-static void geometry_constructor(sqlite3_context *context, const spatialdb_t *spatialdb, geometry_constructor_func constructor, void* user_data, geom_type_t requiredType, int nbArgs, sqlite3_value **args) {
+/*
+ * Marks a constructor argument that has been seen before. SQLite only retains auxiliary data across calls for
+ * constant arguments, so a constructed geometry is only cached once this marker is found.
+ */
+static geom_blob_auxdata geom_blob_auxdata_constant = {NULL, 0};
+
+static void geometry_constructor(sqlite3_context *context, const spatialdb_t *spatialdb, geometry_constructor_func constructor, void* user_data, geom_type_t requiredType, size_t initial_size, int nbArgs, sqlite3_value **args) {
+  geom_blob_writer_t writer;
+  int writer_initialized = 0;
   FUNCTION_START_STATIC(context, 256);
 
   geom_blob_auxdata *geom = (geom_blob_auxdata *)sqlite3_get_auxdata(context, 0);
 
-  if (geom == NULL) {
-    geom_blob_writer_t writer;
-
+  if (geom == NULL || geom->data == NULL) {
     if (sqlite3_value_type(args[nbArgs - 1]) == SQLITE_INTEGER) {
-      spatialdb->writer_init_srid(&writer, sqlite3_value_int(args[nbArgs - 1]));
+      FUNCTION_RESULT = spatialdb->writer_init_srid_size(&writer, sqlite3_value_int(args[nbArgs - 1]), initial_size);
       nbArgs -= 1;
     } else {
-      spatialdb->writer_init(&writer);
+      FUNCTION_RESULT = spatialdb->writer_init_size(&writer, initial_size);
     }
+    if (FUNCTION_RESULT != SQLITE_OK) {
+      goto exit;
+    }
+    writer_initialized = 1;
 
     FUNCTION_RESULT = constructor(context, user_data, geom_blob_writer_geom_consumer(&writer), nbArgs, args, FUNCTION_ERROR);
+    if (FUNCTION_RESULT != SQLITE_OK) {
+      goto exit;
+    }
 
-    if (FUNCTION_RESULT == SQLITE_OK) {
-      if (geometry_is_assignable(requiredType, writer.geom_type, FUNCTION_ERROR) == SQLITE_OK) {
-        uint8_t *data = geom_blob_writer_getdata(&writer);
-        int length = (int) geom_blob_writer_length(&writer);
-        sqlite3_result_blob(context, data, length, SQLITE_TRANSIENT);
-        spatialdb->writer_destroy(&writer, 0);
-
-        geom = geom_blob_auxdata_malloc();
-        if (geom != NULL) {
-          geom->data = data;
-          geom->length = length;
-          sqlite3_set_auxdata(context, 0, geom, geom_blob_auxdata_free);
-        }
-      }
+    FUNCTION_RESULT = geometry_is_assignable(requiredType, writer.geom_type, FUNCTION_ERROR);
+    if (FUNCTION_RESULT != SQLITE_OK) {
+      goto exit;
+    }
+
+    uint8_t *data = geom_blob_writer_getdata(&writer);
+    int length = (int) geom_blob_writer_length(&writer);
+    spatialdb->writer_destroy(&writer, 0);
+    writer_initialized = 0;
+
+    if (geom == NULL) {
+      /* Hand the blob over to SQLite and remember that this argument has been seen */
+      sqlite3_result_blob(context, data, length, sqlite3_free);
+      sqlite3_set_auxdata(context, 0, &geom_blob_auxdata_constant, NULL);
     } else {
-      spatialdb->writer_destroy(&writer, 1);
+      /* The argument is constant; keep the blob for subsequent calls */
+      sqlite3_result_blob(context, data, length, SQLITE_TRANSIENT);
+      geom = geom_blob_auxdata_malloc();
+      if (geom != NULL) {
+        geom->data = data;
+        geom->length = length;
+        sqlite3_set_auxdata(context, 0, geom, geom_blob_auxdata_free);
+      } else {
+        sqlite3_free(data);
+      }
     }
   } else {
     sqlite3_result_blob(context, geom->data, geom->length, SQLITE_TRANSIENT);
   }
 
   FUNCTION_END(context);
+
+  if (writer_initialized) {
+    spatialdb->writer_destroy(&writer, 1);
+  }
 }
 
 static int geom_from_wkb(sqlite3_context *context, void *user_data, geom_consumer_t* consumer, int nbArgs, sqlite3_value **args, errorstream_t *error) {
@@ -313,7 +869,7 @@ static int geom_from_wkb(sqlite3_context *context, void *user_data, geom_consume
 
 static void ST_GeomFromWKB(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
   spatialdb_t *spatialdb = (spatialdb_t *)sqlite3_user_data(context);
-  geometry_constructor(context, spatialdb, geom_from_wkb, NULL, GEOM_GEOMETRY, nbArgs, args);
+  geometry_constructor(context, spatialdb, geom_from_wkb, NULL, GEOM_GEOMETRY, (size_t) sqlite3_value_bytes(args[0]) + GEOM_BLOB_MAX_OVERHEAD, nbArgs, args);
 }
 
 typedef struct {
@@ -345,36 +901,120 @@ static void fromtext_acquire(fromtext_t *fromtext) {
   if (fromtext) {
     atomic_inc_long(&fromtext->ref_count);
   }
-}
+}
+
+static void fromtext_release(fromtext_t *fromtext) {
+  if (fromtext) {
+    long newval = atomic_dec_long(&fromtext->ref_count);
+    if (newval == 0) {
+      i18n_locale_destroy(fromtext->locale);
+      fromtext->locale = NULL;
+      sqlite3_free(fromtext);
+    }
+  }
+}
+
+static int geom_from_wkt(sqlite3_context *context, void *user_data, geom_consumer_t* consumer, int nbArgs, sqlite3_value **args, errorstream_t *error) {
+  FUNCTION_TEXT_ARG(wkt);
+  FUNCTION_START_NESTED(context, error);
+
+  FUNCTION_GET_TEXT_ARG_UNSAFE(wkt, 0);
+
+  FUNCTION_RESULT = wkt_read_geometry(wkt, FUNCTION_TEXT_ARG_LENGTH(wkt), consumer, (i18n_locale_t *)user_data, FUNCTION_ERROR);
+
+  FUNCTION_END_NESTED(context);
+  FUNCTION_FREE_TEXT_ARG(wkt);
+
+  return FUNCTION_RESULT;
+}
+
+static void ST_GeomFromText(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  fromtext_t *fromtext = (fromtext_t *)sqlite3_user_data(context);
+  geometry_constructor(context, fromtext->spatialdb, geom_from_wkt, fromtext->locale, GEOM_GEOMETRY, 256, nbArgs, args);
+}
+
+typedef struct {
+  sqlite3_blob *blob;
+  int offset;
+  int length;
+} wkt_blob_input_t;
+
+static int wkt_blob_read(void *read_data, char *buffer, size_t *length, errorstream_t *error) {
+  wkt_blob_input_t *input = (wkt_blob_input_t *)read_data;
+
+  int remaining = input->length - input->offset;
+  int n = *length < (size_t)remaining ? (int)*length : remaining;
+  if (n > 0) {
+    int result = sqlite3_blob_read(input->blob, buffer, n, input->offset);
+    if (result != SQLITE_OK) {
+      error_append(error, "Could not read WKT column: %s", sqlite3_errstr(result));
+      return result;
+    }
+    input->offset += n;
+  }
+
+  *length = (size_t)n;
+  return SQLITE_OK;
+}
+
+static void GPKG_GeomFromTextColumn(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  FUNCTION_TEXT_ARG(db_name);
+  FUNCTION_TEXT_ARG(table_name);
+  FUNCTION_TEXT_ARG(column_name);
+  sqlite3_int64 rowid;
+  sqlite3_blob *blob = NULL;
+  geom_blob_writer_t writer;
+  int writer_initialized = 0;
+  FUNCTION_START(context);
+
+  fromtext_t *fromtext = (fromtext_t *)sqlite3_user_data(context);
+  if (nbArgs == 4) {
+    FUNCTION_GET_TEXT_ARG(context, db_name, 0);
+    FUNCTION_GET_TEXT_ARG(context, table_name, 1);
+    FUNCTION_GET_TEXT_ARG(context, column_name, 2);
+    rowid = sqlite3_value_int64(args[3]);
+  } else {
+    FUNCTION_SET_TEXT_ARG(db_name, "main");
+    FUNCTION_GET_TEXT_ARG(context, table_name, 0);
+    FUNCTION_GET_TEXT_ARG(context, column_name, 1);
+    rowid = sqlite3_value_int64(args[2]);
+  }
 
-static void fromtext_release(fromtext_t *fromtext) {
-  if (fromtext) {
-    long newval = atomic_dec_long(&fromtext->ref_count);
-    if (newval == 0) {
-      i18n_locale_destroy(fromtext->locale);
-      fromtext->locale = NULL;
-      sqlite3_free(fromtext);
-    }
+  FUNCTION_RESULT = sqlite3_blob_open(FUNCTION_DB_HANDLE, db_name, table_name, column_name, rowid, 0, &blob);
+  if (FUNCTION_RESULT != SQLITE_OK) {
+    error_append(FUNCTION_ERROR, "Could not open %s.%s.%s for row %lld: %s", db_name, table_name, column_name, rowid, sqlite3_errmsg(FUNCTION_DB_HANDLE));
+    goto exit;
   }
-}
-
-static int geom_from_wkt(sqlite3_context *context, void *user_data, geom_consumer_t* consumer, int nbArgs, sqlite3_value **args, errorstream_t *error) {
-  FUNCTION_TEXT_ARG(wkt);
-  FUNCTION_START_NESTED(context, error);
 
-  FUNCTION_GET_TEXT_ARG_UNSAFE(wkt, 0);
+  wkt_blob_input_t input;
+  input.blob = blob;
+  input.offset = 0;
+  input.length = sqlite3_blob_bytes(blob);
 
-  FUNCTION_RESULT = wkt_read_geometry(wkt, FUNCTION_TEXT_ARG_LENGTH(wkt), consumer, (i18n_locale_t *)user_data, FUNCTION_ERROR);
+  FUNCTION_RESULT = fromtext->spatialdb->writer_init(&writer);
+  if (FUNCTION_RESULT != SQLITE_OK) {
+    goto exit;
+  }
+  writer_initialized = 1;
 
-  FUNCTION_END_NESTED(context);
-  FUNCTION_FREE_TEXT_ARG(wkt);
+  FUNCTION_RESULT = wkt_read_geometry_stream(wkt_blob_read, &input, geom_blob_writer_geom_consumer(&writer), fromtext->locale, FUNCTION_ERROR);
+  if (FUNCTION_RESULT == SQLITE_OK) {
+    sqlite3_result_blob(context, geom_blob_writer_getdata(&writer), (int) geom_blob_writer_length(&writer), sqlite3_free);
+    fromtext->spatialdb->writer_destroy(&writer, 0);
+    writer_initialized = 0;
+  }
 
-  return FUNCTION_RESULT;
-}
+  FUNCTION_END(context);
 
-static void ST_GeomFromText(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
-  fromtext_t *fromtext = (fromtext_t *)sqlite3_user_data(context);
-  geometry_constructor(context, fromtext->spatialdb, geom_from_wkt, fromtext->locale, GEOM_GEOMETRY, nbArgs, args);
+  if (writer_initialized) {
+    fromtext->spatialdb->writer_destroy(&writer, 1);
+  }
+  if (blob != NULL) {
+    sqlite3_blob_close(blob);
+  }
+  FUNCTION_FREE_TEXT_ARG(db_name);
+  FUNCTION_FREE_TEXT_ARG(table_name);
+  FUNCTION_FREE_TEXT_ARG(column_name);
 }
 
 static int point_from_coords(sqlite3_context *context, void *user_data, geom_consumer_t *consumer, int nbArgs, sqlite3_value **args, errorstream_t *error) {
@@ -425,11 +1065,11 @@ static int point_from_coords(sqlite3_context *context, void *user_data, geom_con
 static void ST_Point(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
   fromtext_t *fromtext = (fromtext_t *)sqlite3_user_data(context);
   if (sqlite3_value_type(args[0]) == SQLITE_TEXT) {
-    geometry_constructor(context, fromtext->spatialdb, geom_from_wkt, fromtext->locale, GEOM_POINT, nbArgs, args);
+    geometry_constructor(context, fromtext->spatialdb, geom_from_wkt, fromtext->locale, GEOM_POINT, 256, nbArgs, args);
   } else if (sqlite3_value_type(args[0]) == SQLITE_BLOB) {
-    geometry_constructor(context, fromtext->spatialdb, geom_from_wkb, NULL, GEOM_POINT, nbArgs, args);
+    geometry_constructor(context, fromtext->spatialdb, geom_from_wkb, NULL, GEOM_POINT, (size_t) sqlite3_value_bytes(args[0]) + GEOM_BLOB_MAX_OVERHEAD, nbArgs, args);
   } else {
-    geometry_constructor(context, fromtext->spatialdb, point_from_coords, NULL, GEOM_POINT, nbArgs, args);
+    geometry_constructor(context, fromtext->spatialdb, point_from_coords, NULL, GEOM_POINT, GEOM_BLOB_MAX_OVERHEAD + 5 + 8 * GEOM_MAX_COORD_SIZE, nbArgs, args);
   }
 }
 
@@ -473,6 +1113,18 @@ static void GPKG_SpatialDBType(sqlite3_context *context, int nbArgs, sqlite3_val
   FUNCTION_END(context);
 }
 
+static void GPKG_StatementCacheHits(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  long hits, misses;
+  sql_stmt_cache_stats(&hits, &misses);
+  sqlite3_result_int64(context, hits);
+}
+
+static void GPKG_StatementCacheMisses(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  long hits, misses;
+  sql_stmt_cache_stats(&hits, &misses);
+  sqlite3_result_int64(context, misses);
+}
+
 static void GPKG_CheckSpatialMetaData(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
   spatialdb_t *spatialdb;
   FUNCTION_TEXT_ARG(db_name);
@@ -683,7 +1335,7 @@ static void GPKG_CreateSpatialIndex(sqlite3_context *context, int nbArgs, sqlite
 
   FUNCTION_RESULT = spatialdb->init_meta(FUNCTION_DB_HANDLE, db_name, FUNCTION_ERROR);
   if (FUNCTION_RESULT == SQLITE_OK) {
-    FUNCTION_RESULT = spatialdb->create_spatial_index(FUNCTION_DB_HANDLE, db_name, table_name, geometry_column_name, id_column_name, FUNCTION_ERROR);
+    FUNCTION_RESULT = spatialdb->create_spatial_index(FUNCTION_DB_HANDLE, spatialdb, db_name, table_name, geometry_column_name, id_column_name, FUNCTION_ERROR);
   }
 
   FUNCTION_END_TRANSACTION(__create_spatial_index);
@@ -700,6 +1352,352 @@ static void GPKG_CreateSpatialIndex(sqlite3_context *context, int nbArgs, sqlite
   FUNCTION_FREE_TEXT_ARG(id_column_name);
 }
 
+static void GPKG_SuspendSpatialIndex(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  spatialdb_t *spatialdb;
+  FUNCTION_TEXT_ARG(db_name);
+  FUNCTION_TEXT_ARG(table_name);
+  FUNCTION_TEXT_ARG(geometry_column_name);
+  FUNCTION_START(context);
+
+  spatialdb = (spatialdb_t *)sqlite3_user_data(context);
+  if (nbArgs == 3) {
+    FUNCTION_GET_TEXT_ARG(context, db_name, 0);
+    FUNCTION_GET_TEXT_ARG(context, table_name, 1);
+    FUNCTION_GET_TEXT_ARG(context, geometry_column_name, 2);
+  } else {
+    FUNCTION_SET_TEXT_ARG(db_name, "main");
+    FUNCTION_GET_TEXT_ARG(context, table_name, 0);
+    FUNCTION_GET_TEXT_ARG(context, geometry_column_name, 1);
+  }
+
+  if (spatialdb->suspend_spatial_index == NULL) {
+    error_append(FUNCTION_ERROR, "Suspending spatial indexes is not supported in %s mode", spatialdb->name);
+    goto exit;
+  }
+
+  FUNCTION_START_TRANSACTION(__suspend_spatial_index);
+  FUNCTION_RESULT = spatialdb->suspend_spatial_index(FUNCTION_DB_HANDLE, db_name, table_name, geometry_column_name, FUNCTION_ERROR);
+  FUNCTION_END_TRANSACTION(__suspend_spatial_index);
+
+  if (FUNCTION_RESULT == SQLITE_OK) {
+    sqlite3_result_null(context);
+  }
+
+  FUNCTION_END(context);
+
+  FUNCTION_FREE_TEXT_ARG(db_name);
+  FUNCTION_FREE_TEXT_ARG(table_name);
+  FUNCTION_FREE_TEXT_ARG(geometry_column_name);
+}
+
+static void GPKG_CheckSpatialIndex(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  spatialdb_t *spatialdb;
+  FUNCTION_TEXT_ARG(db_name);
+  FUNCTION_TEXT_ARG(table_name);
+  FUNCTION_TEXT_ARG(geometry_column_name);
+  FUNCTION_START(context);
+
+  spatialdb = (spatialdb_t *)sqlite3_user_data(context);
+  if (nbArgs == 3) {
+    FUNCTION_GET_TEXT_ARG(context, db_name, 0);
+    FUNCTION_GET_TEXT_ARG(context, table_name, 1);
+    FUNCTION_GET_TEXT_ARG(context, geometry_column_name, 2);
+  } else {
+    FUNCTION_SET_TEXT_ARG(db_name, "main");
+    FUNCTION_GET_TEXT_ARG(context, table_name, 0);
+    FUNCTION_GET_TEXT_ARG(context, geometry_column_name, 1);
+  }
+
+  if (spatialdb->check_spatial_index == NULL) {
+    error_append(FUNCTION_ERROR, "Checking spatial indexes is not supported in %s mode", spatialdb->name);
+    goto exit;
+  }
+
+  FUNCTION_RESULT = spatialdb->check_spatial_index(FUNCTION_DB_HANDLE, db_name, table_name, geometry_column_name, FUNCTION_ERROR);
+  if (FUNCTION_RESULT == SQLITE_OK) {
+    sqlite3_result_null(context);
+  }
+
+  FUNCTION_END(context);
+
+  FUNCTION_FREE_TEXT_ARG(db_name);
+  FUNCTION_FREE_TEXT_ARG(table_name);
+  FUNCTION_FREE_TEXT_ARG(geometry_column_name);
+}
+
+static void GPKG_ResumeSpatialIndex(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  spatialdb_t *spatialdb;
+  FUNCTION_TEXT_ARG(db_name);
+  FUNCTION_TEXT_ARG(table_name);
+  FUNCTION_TEXT_ARG(geometry_column_name);
+  FUNCTION_START(context);
+
+  spatialdb = (spatialdb_t *)sqlite3_user_data(context);
+  if (nbArgs == 3) {
+    FUNCTION_GET_TEXT_ARG(context, db_name, 0);
+    FUNCTION_GET_TEXT_ARG(context, table_name, 1);
+    FUNCTION_GET_TEXT_ARG(context, geometry_column_name, 2);
+  } else {
+    FUNCTION_SET_TEXT_ARG(db_name, "main");
+    FUNCTION_GET_TEXT_ARG(context, table_name, 0);
+    FUNCTION_GET_TEXT_ARG(context, geometry_column_name, 1);
+  }
+
+  if (spatialdb->resume_spatial_index == NULL) {
+    error_append(FUNCTION_ERROR, "Resuming spatial indexes is not supported in %s mode", spatialdb->name);
+    goto exit;
+  }
+
+  FUNCTION_START_TRANSACTION(__resume_spatial_index);
+  FUNCTION_RESULT = spatialdb->resume_spatial_index(FUNCTION_DB_HANDLE, db_name, table_name, geometry_column_name, FUNCTION_ERROR);
+  FUNCTION_END_TRANSACTION(__resume_spatial_index);
+
+  if (FUNCTION_RESULT == SQLITE_OK) {
+    sqlite3_result_null(context);
+  }
+
+  FUNCTION_END(context);
+
+  FUNCTION_FREE_TEXT_ARG(db_name);
+  FUNCTION_FREE_TEXT_ARG(table_name);
+  FUNCTION_FREE_TEXT_ARG(geometry_column_name);
+}
+
+static int cluster_read_extent(sqlite3 *db, sqlite3_stmt *stmt, void *data) {
+  double *extent = (double *)data;
+  for (int i = 0; i < 4; i++) {
+    extent[i] = sqlite3_column_double(stmt, i);
+  }
+  return SQLITE_OK;
+}
+
+static int cluster_read_int64(sqlite3 *db, sqlite3_stmt *stmt, void *data) {
+  *((sqlite3_int64 *)data) = sqlite3_column_int64(stmt, 0);
+  return SQLITE_OK;
+}
+
+/*
+ * Renumbers the rows of a table in the order of the Hilbert key of their geometry. SQLite stores the rows of a table
+ * in primary key order, so after renumbering rows that are close to each other are stored in the same pages. The
+ * primary key values are updated in two passes: first to values above all existing keys and then to 1..n, so that no
+ * intermediate value collides with an existing row. The spatial index is suspended while the keys are updated and
+ * rebuilt when it is resumed.
+ */
+static int cluster_table(sqlite3 *db, const spatialdb_t *spatialdb, const char *db_name, const char *table_name, const char *geometry_column_name, errorstream_t *error) {
+  int result = SQLITE_OK;
+  char *index_table_name = NULL;
+  char *id_column_name = NULL;
+  int exists = 0;
+  int indexed = 0;
+  double extent[4] = {0.0, 0.0, 0.0, 0.0};
+  sqlite3_int64 offset = 0;
+
+  result = sql_check_table_exists(db, db_name, table_name, &exists);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not check if table %s.%s exists: %s", db_name, table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (!exists) {
+    error_append(error, "Table %s.%s does not exist", db_name, table_name);
+    goto exit;
+  }
+
+  result = sql_check_column_exists(db, db_name, table_name, geometry_column_name, &exists);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not check if column %s.%s.%s exists: %s", db_name, table_name, geometry_column_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (!exists) {
+    error_append(error, "Column %s.%s.%s does not exist", db_name, table_name, geometry_column_name);
+    goto exit;
+  }
+
+  result = sql_integer_primary_key(db, db_name, table_name, &id_column_name);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not determine primary key of %s.%s: %s", db_name, table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (id_column_name == NULL) {
+    error_append(error, "Table %s.%s does not have an integer primary key", db_name, table_name);
+    goto exit;
+  }
+
+  index_table_name = spatialdb->spatial_index_name(table_name, geometry_column_name);
+  if (index_table_name == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  result = sql_check_table_exists(db, db_name, index_table_name, &indexed);
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not check if index table %s.%s exists: %s", db_name, index_table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (indexed) {
+    if (spatialdb->suspend_spatial_index == NULL || spatialdb->resume_spatial_index == NULL) {
+      error_append(error, "Clustering tables with a spatial index is not supported in %s mode", spatialdb->name);
+      goto exit;
+    }
+
+    result = spatialdb->suspend_spatial_index(db, db_name, table_name, geometry_column_name, error);
+    if (result != SQLITE_OK) {
+      goto exit;
+    }
+  }
+
+  result = sql_exec_stmt(
+             db, cluster_read_extent, NULL, extent,
+             "SELECT min(ST_MinX(\"%w\")), min(ST_MinY(\"%w\")), max(ST_MaxX(\"%w\")), max(ST_MaxY(\"%w\")) FROM \"%w\".\"%w\""
+             "  WHERE \"%w\" NOTNULL AND NOT ST_IsEmpty(\"%w\")",
+             geometry_column_name, geometry_column_name, geometry_column_name, geometry_column_name, db_name, table_name,
+             geometry_column_name, geometry_column_name
+           );
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not determine extent of %s.%s.%s: %s", db_name, table_name, geometry_column_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  result = sql_exec(db, "DROP TABLE IF EXISTS temp.gpkg_cluster");
+  if (result == SQLITE_OK) {
+    result = sql_exec(db, "CREATE TEMP TABLE gpkg_cluster (new INTEGER PRIMARY KEY, old INTEGER NOT NULL UNIQUE)");
+  }
+  if (result == SQLITE_OK) {
+    result = sql_exec(
+               db,
+               "INSERT INTO temp.gpkg_cluster (old) SELECT \"%w\" FROM \"%w\".\"%w\""
+               "  ORDER BY ST_HilbertKey(\"%w\", %!.17g, %!.17g, %!.17g, %!.17g), \"%w\"",
+               id_column_name, db_name, table_name,
+               geometry_column_name, extent[0], extent[1], extent[2], extent[3], id_column_name
+             );
+  }
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not sort %s.%s: %s", db_name, table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  result = sql_exec_stmt(db, cluster_read_int64, NULL, &offset, "SELECT max(ifnull(max(\"%w\"), 0), count(*)) FROM \"%w\".\"%w\"", id_column_name, db_name, table_name);
+  if (result == SQLITE_OK) {
+    result = sql_exec(
+               db,
+               "UPDATE \"%w\".\"%w\" SET \"%w\" = %lld + (SELECT new FROM temp.gpkg_cluster WHERE old = \"%w\".\"%w\")",
+               db_name, table_name, id_column_name, offset, table_name, id_column_name
+             );
+  }
+  if (result == SQLITE_OK) {
+    result = sql_exec(db, "UPDATE \"%w\".\"%w\" SET \"%w\" = \"%w\" - %lld", db_name, table_name, id_column_name, id_column_name, offset);
+  }
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not renumber rows of %s.%s: %s", db_name, table_name, sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  result = sql_exec(db, "DROP TABLE temp.gpkg_cluster");
+  if (result != SQLITE_OK) {
+    error_append(error, "Could not drop temporary table: %s", sqlite3_errmsg(db));
+    goto exit;
+  }
+
+  if (indexed) {
+    result = spatialdb->resume_spatial_index(db, db_name, table_name, geometry_column_name, error);
+  }
+
+exit:
+  sqlite3_free(index_table_name);
+  sqlite3_free(id_column_name);
+  return result;
+}
+
+/*
+ * GPKG_ClusterTable([db_name,] table_name, geometry_column_name)
+ *
+ * Renumbers the rows of a table so that they are stored in the order of the Hilbert key of their geometry. This
+ * reduces the number of pages that a spatial query needs to read. Note that this changes the primary key values of
+ * the rows.
+ */
+static void GPKG_ClusterTable(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
+  spatialdb_t *spatialdb;
+  FUNCTION_TEXT_ARG(db_name);
+  FUNCTION_TEXT_ARG(table_name);
+  FUNCTION_TEXT_ARG(geometry_column_name);
+  FUNCTION_START(context);
+
+  spatialdb = (spatialdb_t *)sqlite3_user_data(context);
+  if (nbArgs == 3) {
+    FUNCTION_GET_TEXT_ARG(context, db_name, 0);
+    FUNCTION_GET_TEXT_ARG(context, table_name, 1);
+    FUNCTION_GET_TEXT_ARG(context, geometry_column_name, 2);
+  } else {
+    FUNCTION_SET_TEXT_ARG(db_name, "main");
+    FUNCTION_GET_TEXT_ARG(context, table_name, 0);
+    FUNCTION_GET_TEXT_ARG(context, geometry_column_name, 1);
+  }
+
+  FUNCTION_START_TRANSACTION(__cluster_table);
+  FUNCTION_RESULT = cluster_table(FUNCTION_DB_HANDLE, spatialdb, db_name, table_name, geometry_column_name, FUNCTION_ERROR);
+  FUNCTION_END_TRANSACTION(__cluster_table);
+
+  if (FUNCTION_RESULT == SQLITE_OK) {
+    sqlite3_result_null(context);
+  }
+
+  FUNCTION_END(context);
+
+  FUNCTION_FREE_TEXT_ARG(db_name);
+  FUNCTION_FREE_TEXT_ARG(table_name);
+  FUNCTION_FREE_TEXT_ARG(geometry_column_name);
+}
+
+static int spatial_index_envelope(void *ctx, const uint8_t *blob, size_t length, rtree_cell_t *cell) {
+  const spatialdb_t *spatialdb = (const spatialdb_t *)ctx;
+  geom_blob_header_t header;
+  binstream_t stream;
+  errorstream_t error;
+  char message_buffer[256];
+
+  error_init_fixed(&error, message_buffer, sizeof(message_buffer));
+  binstream_init(&stream, (uint8_t *)blob, length);
+
+  int result = spatialdb->read_blob_header(&stream, &header, &error);
+  if (result == SQLITE_OK && !header.empty && (header.envelope.has_env_x == 0 || header.envelope.has_env_y == 0)) {
+    result = spatialdb->fill_envelope(&stream, &header.envelope, &error);
+  }
+  binstream_destroy(&stream, 0);
+  error_destroy(&error);
+
+  if (result != SQLITE_OK) {
+    return SQLITE_MISMATCH;
+  } else if (header.empty || header.envelope.has_env_x == 0 || header.envelope.has_env_y == 0) {
+    return SQLITE_DONE;
+  }
+
+  cell->min_x = header.envelope.min_x;
+  cell->max_x = header.envelope.max_x;
+  cell->min_y = header.envelope.min_y;
+  cell->max_y = header.envelope.max_y;
+  return SQLITE_OK;
+}
+
+int spatialdb_fill_spatial_index(sqlite3 *db, const spatialdb_t *spatialdb, const char *db_name, const char *table_name, const char *geometry_column_name, const char *id_column_name, const char *index_table_name, errorstream_t *error) {
+  char *source_sql = sqlite3_mprintf("SELECT \"%w\", \"%w\" FROM \"%w\".\"%w\"", id_column_name, geometry_column_name, db_name, table_name);
+  if (source_sql == NULL) {
+    return SQLITE_NOMEM;
+  }
+
+  int result = rtree_bulk_load_blobs(db, db_name, index_table_name, source_sql, spatial_index_envelope, (void *)spatialdb);
+  if (result == SQLITE_MISMATCH) {
+    error_append(error, "Could not populate rtree: invalid geometry blob in %s.%s.%s", db_name, table_name, geometry_column_name);
+  } else if (result != SQLITE_OK) {
+    error_append(error, "Could not populate rtree: %s", sqlite3_errmsg(db));
+  }
+
+  sqlite3_free(source_sql);
+  return result;
+}
+
 const spatialdb_t *spatialdb_detect_schema(sqlite3 *db) {
   char message_buffer[256];
   errorstream_t error;
@@ -745,6 +1743,12 @@ const spatialdb_t *spatialdb_detect_schema(sqlite3 *db) {
     sql_create_function(db, STR(pre##_##name), pre##_##func, args, flags, (void*)spatialdb, NULL, err);                \
   } while (0)
 
+#define SPATIALDB_AGGREGATE(db, pre, name, args, flags, spatialdb, err)                                                \
+  do {                                                                                                                 \
+    sql_create_aggregate(db, STR(name), pre##_##name##_step, pre##_##name##_final, args, flags, (void*)spatialdb, NULL, err); \
+    sql_create_aggregate(db, STR(pre##_##name), pre##_##name##_step, pre##_##name##_final, args, flags, (void*)spatialdb, NULL, err); \
+  } while (0)
+
 #define FROMTEXT_FUNCTION(db, pre, name, args, flags, ft, err)                                                         \
   do {                                                                                                                 \
     fromtext_acquire(fromtext);                                                                                        \
@@ -761,6 +1765,14 @@ const spatialdb_t *spatialdb_detect_schema(sqlite3 *db) {
     sql_create_function(db, STR(pre##_##name), pre##_##func, args, flags, (void*)ft, (void(*)(void*))fromtext_release, err);  \
   } while (0)
 
+#define ENVELOPE_FUNCTION(db, pre, name, args, flags, cache, err)                                                      \
+  do {                                                                                                                 \
+    envelope_cache_acquire(cache);                                                                                     \
+    sql_create_function(db, STR(name), pre##_##name, args, flags, cache, (void(*)(void*))envelope_cache_release, err); \
+    envelope_cache_acquire(cache);                                                                                     \
+    sql_create_function(db, STR(pre##_##name), pre##_##name, args, flags, cache, (void(*)(void*))envelope_cache_release, err); \
+  } while (0)
+
 SQLITE_EXTENSION_INIT1
 
 int spatialdb_init(sqlite3 *db, const char **pzErrMsg, const sqlite3_api_routines *pThunk, const spatialdb_t *spatialdb) {
@@ -826,18 +1838,32 @@ int spatialdb_init(sqlite3 *db, const char **pzErrMsg, const sqlite3_api_routine
     spatialdb = spatialdb_detect_schema(db);
   }
 
+  sql_stmt_cache_t *stmt_cache = sql_stmt_cache_init(db, &error);
+
   if (spatialdb->init != NULL) {
     spatialdb->init(db, spatialdb, &error);
   }
 
-  SPATIALDB_FUNCTION(db, ST, MinX, 1, SQL_DETERMINISTIC, spatialdb, &error);
-  SPATIALDB_FUNCTION(db, ST, MaxX, 1, SQL_DETERMINISTIC, spatialdb, &error);
-  SPATIALDB_FUNCTION(db, ST, MinY, 1, SQL_DETERMINISTIC, spatialdb, &error);
-  SPATIALDB_FUNCTION(db, ST, MaxY, 1, SQL_DETERMINISTIC, spatialdb, &error);
-  SPATIALDB_FUNCTION(db, ST, MinZ, 1, SQL_DETERMINISTIC, spatialdb, &error);
-  SPATIALDB_FUNCTION(db, ST, MaxZ, 1, SQL_DETERMINISTIC, spatialdb, &error);
-  SPATIALDB_FUNCTION(db, ST, MinM, 1, SQL_DETERMINISTIC, spatialdb, &error);
-  SPATIALDB_FUNCTION(db, ST, MaxM, 1, SQL_DETERMINISTIC, spatialdb, &error);
+  envelope_cache_t *envelope_cache = envelope_cache_init(spatialdb);
+  if (envelope_cache != NULL) {
+    ENVELOPE_FUNCTION(db, ST, MinX, 1, SQL_DETERMINISTIC, envelope_cache, &error);
+    ENVELOPE_FUNCTION(db, ST, MaxX, 1, SQL_DETERMINISTIC, envelope_cache, &error);
+    ENVELOPE_FUNCTION(db, ST, MinY, 1, SQL_DETERMINISTIC, envelope_cache, &error);
+    ENVELOPE_FUNCTION(db, ST, MaxY, 1, SQL_DETERMINISTIC, envelope_cache, &error);
+    ENVELOPE_FUNCTION(db, ST, MinZ, 1, SQL_DETERMINISTIC, envelope_cache, &error);
+    ENVELOPE_FUNCTION(db, ST, MaxZ, 1, SQL_DETERMINISTIC, envelope_cache, &error);
+    ENVELOPE_FUNCTION(db, ST, MinM, 1, SQL_DETERMINISTIC, envelope_cache, &error);
+    ENVELOPE_FUNCTION(db, ST, MaxM, 1, SQL_DETERMINISTIC, envelope_cache, &error);
+    ENVELOPE_FUNCTION(db, ST, HilbertKey, 5, SQL_DETERMINISTIC, envelope_cache, &error);
+    /* Envelope and ST_Envelope are provided by the GEOS geometry functions */
+    envelope_cache_acquire(envelope_cache);
+    sql_create_function(db, "GPKG_Envelope", GPKG_Envelope, 1, SQL_DETERMINISTIC, envelope_cache, (void(*)(void*))envelope_cache_release, &error);
+
+    envelope_cache_release(envelope_cache);
+  } else {
+    error_append(&error, "Could not create envelope cache");
+  }
+
   SPATIALDB_FUNCTION(db, ST, SRID, 1, SQL_DETERMINISTIC, spatialdb, &error);
   SPATIALDB_FUNCTION(db, ST, SRID, 2, SQL_DETERMINISTIC, spatialdb, &error);
   SPATIALDB_FUNCTION(db, ST, Is3d, 1, SQL_DETERMINISTIC, spatialdb, &error);
@@ -851,6 +1877,9 @@ int spatialdb_init(sqlite3 *db, const char **pzErrMsg, const sqlite3_api_routine
   SPATIALDB_ALIAS(db, ST, WKBToSQL, GeomFromWKB, 1, SQL_DETERMINISTIC, spatialdb, &error);
   SPATIALDB_ALIAS(db, ST, WKBToSQL, GeomFromWKB, 2, SQL_DETERMINISTIC, spatialdb, &error);
   SPATIALDB_FUNCTION(db, ST, AsText, 1, SQL_DETERMINISTIC, spatialdb, &error);
+  SPATIALDB_FUNCTION(db, ST, AsText, 2, SQL_DETERMINISTIC, spatialdb, &error);
+  SPATIALDB_AGGREGATE(db, ST, Collect, 1, 0, spatialdb, &error);
+  SPATIALDB_AGGREGATE(db, ST, Extent, 1, 0, spatialdb, &error);
 
   fromtext_t *fromtext = fromtext_init(spatialdb);
   if (fromtext != NULL) {
@@ -858,6 +1887,8 @@ int spatialdb_init(sqlite3 *db, const char **pzErrMsg, const sqlite3_api_routine
     FROMTEXT_FUNCTION(db, ST, GeomFromText, 2, SQL_DETERMINISTIC, fromtext, &error);
     FROMTEXT_ALIAS(db, ST, WKTToSQL, GeomFromText, 1, SQL_DETERMINISTIC, fromtext, &error);
     FROMTEXT_ALIAS(db, ST, WKTToSQL, GeomFromText, 2, SQL_DETERMINISTIC, fromtext, &error);
+    FROMTEXT_FUNCTION(db, GPKG, GeomFromTextColumn, 3, 0, fromtext, &error);
+    FROMTEXT_FUNCTION(db, GPKG, GeomFromTextColumn, 4, 0, fromtext, &error);
 
     FROMTEXT_FUNCTION(db, ST, Point, 1, SQL_DETERMINISTIC, fromtext, &error);
     FROMTEXT_ALIAS(db, ST, MakePoint, Point, 1, SQL_DETERMINISTIC, fromtext, &error);
@@ -889,13 +1920,26 @@ int spatialdb_init(sqlite3 *db, const char **pzErrMsg, const sqlite3_api_routine
   SPATIALDB_FUNCTION(db, GPKG, CreateTilesTable, 2, 0, spatialdb, &error);
   SPATIALDB_FUNCTION(db, GPKG, CreateSpatialIndex, 3, 0, spatialdb, &error);
   SPATIALDB_FUNCTION(db, GPKG, CreateSpatialIndex, 4, 0, spatialdb, &error);
+  SPATIALDB_FUNCTION(db, GPKG, SuspendSpatialIndex, 2, 0, spatialdb, &error);
+  SPATIALDB_FUNCTION(db, GPKG, SuspendSpatialIndex, 3, 0, spatialdb, &error);
+  SPATIALDB_FUNCTION(db, GPKG, ResumeSpatialIndex, 2, 0, spatialdb, &error);
+  SPATIALDB_FUNCTION(db, GPKG, ResumeSpatialIndex, 3, 0, spatialdb, &error);
+  SPATIALDB_FUNCTION(db, GPKG, CheckSpatialIndex, 2, 0, spatialdb, &error);
+  SPATIALDB_FUNCTION(db, GPKG, CheckSpatialIndex, 3, 0, spatialdb, &error);
+  SPATIALDB_FUNCTION(db, GPKG, ClusterTable, 2, 0, spatialdb, &error);
+  SPATIALDB_FUNCTION(db, GPKG, ClusterTable, 3, 0, spatialdb, &error);
   SPATIALDB_FUNCTION(db, GPKG, SpatialDBType, 0, 0, spatialdb, &error);
+  SPATIALDB_FUNCTION(db, GPKG, StatementCacheHits, 0, 0, spatialdb, &error);
+  SPATIALDB_FUNCTION(db, GPKG, StatementCacheMisses, 0, 0, spatialdb, &error);
 
+  knn_init(db, spatialdb, &error);
 
 #ifdef GPKG_GEOM_FUNC
   geom_func_init(db, spatialdb, &error);
 #endif
 
+  sql_stmt_cache_release(stmt_cache);
+
   int result;
   if (error_count(&error) == 0) {
     result = SQLITE_OK;
@@ -61,6 +61,15 @@ typedef struct spatialdb {
    * Initializes a spatial database specific geometry blob writer.
    */
   int(*writer_init_srid)(geom_blob_writer_t *writer, int32_t srid);
+  /*
+   * Initializes a spatial database specific geometry blob writer with the given initial buffer size. If applicable,
+   * an implementation dependent default SRID will be used.
+   */
+  int(*writer_init_size)(geom_blob_writer_t *writer, size_t initial_size);
+  /*
+   * Initializes a spatial database specific geometry blob writer with the given initial buffer size.
+   */
+  int(*writer_init_srid_size)(geom_blob_writer_t *writer, int32_t srid, size_t initial_size);
   /**
    * Destroys a geometry blob writer.
    */
@@ -74,9 +83,29 @@ typedef struct spatialdb {
    */
   int(*create_tiles_table)(sqlite3 *db, const char *db_name, const char *table_name, errorstream_t *error);
   /**
-   * Creates a spatial index on a given table column.
+   * Creates a spatial index on a given table column. The index is filled using the blob functions of spatialDb.
+   */
+  int(*create_spatial_index)(sqlite3 *db, const struct spatialdb *spatialDb, const char *db_name, const char *table_name, const char *geometry_column_name, const char *id_column_name, errorstream_t *error);
+  /**
+   * Suspends maintenance of the spatial index on a given table column. Changes to the table are logged until the index
+   * is resumed.
+   */
+  int(*suspend_spatial_index)(sqlite3 *db, const char *db_name, const char *table_name, const char *geometry_column_name, errorstream_t *error);
+  /**
+   * Brings a suspended spatial index up to date and resumes its maintenance.
+   */
+  int(*resume_spatial_index)(sqlite3 *db, const char *db_name, const char *table_name, const char *geometry_column_name, errorstream_t *error);
+  /**
+   * Checks if the spatial index on a given table column matches the geometries in the table. Each missing, extra or
+   * mismatched index entry is reported in error.
+   */
+  int(*check_spatial_index)(sqlite3 *db, const char *db_name, const char *table_name, const char *geometry_column_name, errorstream_t *error);
+  /**
+   * Returns the name of the rtree virtual table that indexes a given table column. The columns of this table are the
+   * row id followed by the minimum and maximum of each dimension (id, minx, maxx, miny, maxy). The returned string
+   * should be freed using sqlite3_free.
    */
-  int(*create_spatial_index)(sqlite3 *db, const char *db_name, const char *table_name, const char *geometry_column_name, const char *id_column_name, errorstream_t *error);
+  char *(*spatial_index_name)(const char *table_name, const char *geometry_column_name);
   /**
    * Populates a geometry envelope based on a geometry blob. The stream is expected to be positioned at the start
    * of the geometry body (i.e., immediately after the blob header). When this function returns the stream is positioned
@@ -99,7 +99,6 @@
     int free_##arg = 0
 #define FUNCTION_GET_TEXT_ARG(context, arg, ix)                                                                        \
     arg = (const char *)sqlite3_value_text(args[ix]);                                                                  \
-    FUNCTION_TEXT_ARG_LENGTH(arg) = (size_t) sqlite3_value_bytes(args[ix]);                                            \
     do {                                                                                                               \
         if (arg != NULL) {                                                                                             \
           arg = sqlite3_mprintf("%s", sqlite3_value_text(args[ix]));                                                   \
@@ -148,6 +147,8 @@
     binstream_destroy(&arg, 0)
 
 #define FUNCTION_GEOM_ARG_STREAM(arg) arg##_stream
+#define FUNCTION_GEOM_ARG_BLOB(arg) arg##_stream_blob
+#define FUNCTION_GEOM_ARG_BLOB_LENGTH(arg) arg##_stream_blob_length
 #define FUNCTION_GEOM_ARG(arg)                                                                                         \
     FUNCTION_STREAM_ARG( arg##_stream );                                                                               \
     geom_blob_header_t arg
@@ -183,4 +184,11 @@
 
 #define FUNCTION_GET_TYPE(arg, ix) arg = sqlite3_value_type(args[ix])
 
+/**
+ * Populates the empty spatial index of a geometry column. The bounding boxes of the geometries are computed on a pool
+ * of worker threads using the read_blob_header and fill_envelope functions of the spatial database schema. NULL and
+ * empty geometries are not indexed.
+ */
+int spatialdb_fill_spatial_index(sqlite3 *db, const spatialdb_t *spatialdb, const char *db_name, const char *table_name, const char *geometry_column_name, const char *id_column_name, const char *index_table_name, errorstream_t *error);
+
 #endif
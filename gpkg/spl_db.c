@@ -20,6 +20,7 @@
 #include "sqlite.h"
 #include "blobio.h"
 #include "geomio.h"
+#include "rtree.h"
 
 #define N NULL_VALUE
 #define D(v) DOUBLE_VALUE(v)
@@ -240,7 +241,8 @@ static int spl2_add_geometry_column(sqlite3 *db, const char *db_name, const char
 
   // Check if the SRID is defined
   int count = 0;
-  result = sql_exec_for_int(db, &count, "SELECT count(*) FROM spatial_ref_sys WHERE srid = %d", srs_id);
+  value_t srs_params[] = { INT_VALUE(srs_id) };
+  result = sql_exec_for_int_params(db, &count, srs_params, 1, "SELECT count(*) FROM spatial_ref_sys WHERE srid = ?");
   if (result != SQLITE_OK) {
     return result;
   }
@@ -347,6 +349,10 @@ static int spl3_writer_init(geom_blob_writer_t *writer) {
   return spb_writer_init(writer, -1);
 }
 
+static int spl3_writer_init_size(geom_blob_writer_t *writer, size_t initial_size) {
+  return spb_writer_init_size(writer, -1, initial_size);
+}
+
 static int spl3_add_geometry_column(sqlite3 *db, const char *db_name, const char *table_name, const char *column_name, const char *geom_type, int srs_id, int z, int m, errorstream_t *error) {
   int result;
 
@@ -407,7 +413,8 @@ static int spl3_add_geometry_column(sqlite3 *db, const char *db_name, const char
 
   // Check if the SRID is defined
   int count = 0;
-  result = sql_exec_for_int(db, &count, "SELECT count(*) FROM spatial_ref_sys WHERE srid = %d", srs_id);
+  value_t srs_params[] = { INT_VALUE(srs_id) };
+  result = sql_exec_for_int_params(db, &count, srs_params, 1, "SELECT count(*) FROM spatial_ref_sys WHERE srid = ?");
   if (result != SQLITE_OK) {
     return result;
   }
@@ -438,6 +445,10 @@ static int spl4_writer_init(geom_blob_writer_t *writer) {
   return spb_writer_init(writer, 0);
 }
 
+static int spl4_writer_init_size(geom_blob_writer_t *writer, size_t initial_size) {
+  return spb_writer_init_size(writer, 0, initial_size);
+}
+
 static int spl4_add_geometry_column(sqlite3 *db, const char *db_name, const char *table_name, const char *column_name, const char *geom_type, int srs_id, int z, int m, errorstream_t *error) {
   int result;
   geom_type_t geom_type_enum;
@@ -510,7 +521,8 @@ static int spl4_add_geometry_column(sqlite3 *db, const char *db_name, const char
 
   // Check if the SRID is defined
   int count = 0;
-  result = sql_exec_for_int(db, &count, "SELECT count(*) FROM spatial_ref_sys WHERE srid = %d", srs_id);
+  value_t srs_params[] = { INT_VALUE(srs_id) };
+  result = sql_exec_for_int_params(db, &count, srs_params, 1, "SELECT count(*) FROM spatial_ref_sys WHERE srid = ?");
   if (result != SQLITE_OK) {
     return result;
   }
@@ -672,12 +684,16 @@ static int read_geometry(binstream_t *stream, geom_consumer_t const *consumer, e
   return wkb_read_geometry(stream, WKB_SPATIALITE, consumer, error);
 }
 
-static int create_spatial_index(sqlite3 *db, const char *db_name, const char *table_name, const char *geometry_column_name, const char *id_column_name, errorstream_t *error) {
+static char *spatial_index_name(const char *table_name, const char *geometry_column_name) {
+  return sqlite3_mprintf("idx_%s_%s", table_name, geometry_column_name);
+}
+
+static int create_spatial_index(sqlite3 *db, const spatialdb_t *spatialdb, const char *db_name, const char *table_name, const char *geometry_column_name, const char *id_column_name, errorstream_t *error) {
   int result = SQLITE_OK;
   char *index_table_name = NULL;
   int exists = 0;
 
-  index_table_name = sqlite3_mprintf("idx_%s_%s", table_name, geometry_column_name);
+  index_table_name = spatial_index_name(table_name, geometry_column_name);
   if (index_table_name == NULL) {
     result = SQLITE_NOMEM;
     goto exit;
@@ -710,7 +726,8 @@ static int create_spatial_index(sqlite3 *db, const char *db_name, const char *ta
   }
 
   int geom_col_count = 0;
-  result = sql_exec_for_int(db, &geom_col_count, "SELECT count(*) FROM \"%w\".geometry_columns WHERE f_table_name LIKE %Q AND f_geometry_column LIKE %Q", db_name, table_name, geometry_column_name);
+  value_t geom_col_params[] = { TEXT_VALUE((char *)table_name), TEXT_VALUE((char *)geometry_column_name) };
+  result = sql_exec_for_int_params(db, &geom_col_count, geom_col_params, 2, "SELECT count(*) FROM \"%w\".geometry_columns WHERE f_table_name LIKE ? AND f_geometry_column LIKE ?", db_name);
   if (result != SQLITE_OK) {
     error_append(error, "Could not check if column %s.%s.%s exists in %s.geometry_columns: %s", db_name, table_name, geometry_column_name, db_name, sqlite3_errmsg(db));
     goto exit;
@@ -804,15 +821,8 @@ static int create_spatial_index(sqlite3 *db, const char *db_name, const char *ta
     goto exit;
   }
 
-  result = sql_exec_all(
-             db,
-             "SELECT RTreeAlign(\"%w\", \"%w\", \"%w\") FROM \"%w\".\"%w\""
-             "  WHERE \"%w\" NOTNULL AND NOT ST_IsEmpty(\"%w\")",
-             index_table_name, id_column_name, geometry_column_name, db_name, table_name,
-             geometry_column_name, geometry_column_name
-           );
+  result = spatialdb_fill_spatial_index(db, spatialdb, db_name, table_name, geometry_column_name, id_column_name, index_table_name, error);
   if (result != SQLITE_OK) {
-    error_append(error, "Could not populate rtree: %s", sqlite3_errmsg(db));
     goto exit;
   }
 
@@ -821,56 +831,108 @@ exit:
   return result;
 }
 
+typedef struct {
+  const spatialdb_t *spatialdb;
+  sql_stmt_cache_t *stmt_cache;
+} rtree_align_t;
+
+static void rtree_align_destroy(void *data) {
+  rtree_align_t *rtree_align = (rtree_align_t *)data;
+  sql_stmt_cache_release(rtree_align->stmt_cache);
+  sqlite3_free(rtree_align);
+}
+
 /*
  * (indx_table_name text, \"%w\" int, geometry blob)
+ *
+ * This function is called from the index triggers for every modified row. The delete and insert statements for the
+ * index table are taken from the connection's statement cache so they are only prepared once per index table.
+ * Coordinates are bound as doubles so the index keeps full precision.
  */
 static void spl_rtree_align(sqlite3_context *context, int nbArgs, sqlite3_value **args) {
-  const spatialdb_t *spatialdb;
+  const rtree_align_t *rtree_align = NULL;
   FUNCTION_TEXT_ARG(index_table_name);
-  FUNCTION_TEXT_ARG(row_id);
   FUNCTION_GEOM_ARG(geom);
+  char *sql = NULL;
+  sqlite3_stmt *stmt = NULL;
 
   FUNCTION_START_STATIC(context, 256);
-  spatialdb = (const spatialdb_t *)sqlite3_user_data(context);
+  rtree_align = (const rtree_align_t *)sqlite3_user_data(context);
   FUNCTION_GET_TEXT_ARG(context, index_table_name, 0);
-  FUNCTION_GET_TEXT_ARG(context, row_id, 1);
 
   int delete_row = 0;
   if (sqlite3_value_type(args[2]) == SQLITE_NULL) {
     delete_row = 1;
   } else {
-    FUNCTION_GET_GEOM_ARG_UNSAFE(context, spatialdb, geom, 2);
+    FUNCTION_GET_GEOM_ARG_UNSAFE(context, rtree_align->spatialdb, geom, 2);
     delete_row = geom.empty;
   }
 
   if (delete_row) {
-    FUNCTION_RESULT = sql_exec(
-                        sqlite3_context_db_handle(context),
-                        "DELETE FROM \"%w\" WHERE pkid = %s",
-                        index_table_name, row_id
-                      );
+    sql = sqlite3_mprintf("DELETE FROM \"%w\" WHERE pkid = ?", index_table_name);
   } else {
-    FUNCTION_RESULT = sql_exec(
-                        sqlite3_context_db_handle(context),
-                        "INSERT OR REPLACE INTO \"%w\" (pkid, xmin, ymin, xmax, ymax) VALUES (%s, %1.12f, %1.12f, %1.12f, %1.12f)",
-                        index_table_name, row_id, geom.envelope.min_x, geom.envelope.min_y, geom.envelope.max_x, geom.envelope.max_y
-                      );
+    sql = sqlite3_mprintf("INSERT OR REPLACE INTO \"%w\" (pkid, xmin, ymin, xmax, ymax) VALUES (?, ?, ?, ?, ?)", index_table_name);
+  }
+  if (sql == NULL) {
+    FUNCTION_RESULT = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  FUNCTION_RESULT = sql_stmt_cache_prepare(rtree_align->stmt_cache, sql, &stmt);
+  if (FUNCTION_RESULT == SQLITE_OK) {
+    FUNCTION_RESULT = sqlite3_bind_value(stmt, 1, args[1]);
+  }
+  if (!delete_row) {
+    if (FUNCTION_RESULT == SQLITE_OK) {
+      FUNCTION_RESULT = sqlite3_bind_double(stmt, 2, geom.envelope.min_x);
+    }
+    if (FUNCTION_RESULT == SQLITE_OK) {
+      FUNCTION_RESULT = sqlite3_bind_double(stmt, 3, geom.envelope.min_y);
+    }
+    if (FUNCTION_RESULT == SQLITE_OK) {
+      FUNCTION_RESULT = sqlite3_bind_double(stmt, 4, geom.envelope.max_x);
+    }
+    if (FUNCTION_RESULT == SQLITE_OK) {
+      FUNCTION_RESULT = sqlite3_bind_double(stmt, 5, geom.envelope.max_y);
+    }
+  }
+
+  if (FUNCTION_RESULT == SQLITE_OK) {
+    FUNCTION_RESULT = sqlite3_step(stmt);
+    if (FUNCTION_RESULT == SQLITE_DONE) {
+      FUNCTION_RESULT = SQLITE_OK;
+    }
   }
 
   if (FUNCTION_RESULT != SQLITE_OK) {
-    error_append(FUNCTION_ERROR, sqlite3_errmsg(sqlite3_context_db_handle(context)));
+    error_append(FUNCTION_ERROR, sqlite3_errmsg(FUNCTION_DB_HANDLE));
   }
 
   FUNCTION_END(context);
+  if (stmt != NULL) {
+    sql_stmt_cache_done(rtree_align->stmt_cache, stmt);
+  }
+  sqlite3_free(sql);
   FUNCTION_FREE_TEXT_ARG(index_table_name);
-  FUNCTION_FREE_TEXT_ARG(row_id);
   FUNCTION_FREE_GEOM_ARG(geom);
 }
 
 static void spatialite_init(sqlite3 *db, const spatialdb_t *spatialDb, errorstream_t *error) {
   sql_create_function(db, "GeometryConstraints", spl_geometry_constraints, 3, SQL_DETERMINISTIC, (void *)spatialDb, NULL, error);
   sql_create_function(db, "GeometryConstraints", spl_geometry_constraints, 4, SQL_DETERMINISTIC, (void *)spatialDb, NULL, error);
-  sql_create_function(db, "RTreeAlign", spl_rtree_align, 3, 0, (void *)spatialDb, NULL, error);
+
+  rtree_align_t *rtree_align = (rtree_align_t *)sqlite3_malloc(sizeof(rtree_align_t));
+  if (rtree_align == NULL) {
+    error_append(error, "Could not create RTreeAlign function context");
+    return;
+  }
+  rtree_align->spatialdb = spatialDb;
+  rtree_align->stmt_cache = sql_stmt_cache_init(db, error);
+  if (rtree_align->stmt_cache == NULL) {
+    sqlite3_free(rtree_align);
+    return;
+  }
+  sql_create_function(db, "RTreeAlign", spl_rtree_align, 3, 0, rtree_align, rtree_align_destroy, error);
 }
 
 static const spatialdb_t SPATIALITE2 = {
@@ -882,10 +944,16 @@ static const spatialdb_t SPATIALITE2 = {
   read_blob_header,
   spl3_writer_init,
   spb_writer_init,
+  spl3_writer_init_size,
+  spb_writer_init_size,
   spb_writer_destroy,
   spl2_add_geometry_column,
   NULL,
   create_spatial_index,
+  NULL,
+  NULL,
+  NULL,
+  spatial_index_name,
   fill_envelope,
   read_geometry_header,
   read_geometry
@@ -900,10 +968,16 @@ static const spatialdb_t SPATIALITE3 = {
   read_blob_header,
   spl3_writer_init,
   spb_writer_init,
+  spl3_writer_init_size,
+  spb_writer_init_size,
   spb_writer_destroy,
   spl3_add_geometry_column,
   NULL,
   create_spatial_index,
+  NULL,
+  NULL,
+  NULL,
+  spatial_index_name,
   fill_envelope,
   read_geometry_header,
   read_geometry
@@ -918,10 +992,16 @@ static const spatialdb_t SPATIALITE4 = {
   read_blob_header,
   spl4_writer_init,
   spb_writer_init,
+  spl4_writer_init_size,
+  spb_writer_init_size,
   spb_writer_destroy,
   spl4_add_geometry_column,
   NULL,
   create_spatial_index,
+  NULL,
+  NULL,
+  NULL,
+  spatial_index_name,
   fill_envelope,
   read_geometry_header,
   read_geometry
@@ -34,11 +34,13 @@
 #define CHECK_ENV(spb, error) CHECK_ENV_COMP(spb, x, error) CHECK_ENV_COMP(spb, y, error) CHECK_ENV_COMP(spb, z, error) CHECK_ENV_COMP(spb, m, error)
 
 int spb_read_header(binstream_t *stream, geom_blob_header_t *spb, errorstream_t *error) {
-  uint8_t start;
-  if (binstream_read_u8(stream, &start) != SQLITE_OK) {
+  /* START and ENDIAN bytes */
+  uint8_t head[2];
+  if (binstream_nread_u8(stream, head, 2) != SQLITE_OK) {
     return SQLITE_IOERR;
   }
 
+  uint8_t start = head[0];
   if (start != 0x00) {
     if (error) {
       error_append(error, "Incorrect SPB START value [expected: 00, actual:%x]", start);
@@ -46,11 +48,7 @@ int spb_read_header(binstream_t *stream, geom_blob_header_t *spb, errorstream_t
     return SQLITE_IOERR;
   }
 
-  uint8_t endian;
-  if (binstream_read_u8(stream, &endian)) {
-    return SQLITE_IOERR;
-  }
-
+  uint8_t endian = head[1];
   if (endian != SPB_BIG_ENDIAN && endian != SPB_LITTLE_ENDIAN) {
     if (error) {
       error_append(error, "Incorrect SPB ENDIAN value [expected: 00 or 01, actual:%x]", endian);
@@ -63,22 +61,20 @@ int spb_read_header(binstream_t *stream, geom_blob_header_t *spb, errorstream_t
     return SQLITE_IOERR;
   }
 
+  /* The MBR is stored as [minx, miny, maxx, maxy] */
+  double mbr[4];
+  if (binstream_nread_double(stream, mbr, 4) != SQLITE_OK) {
+    return SQLITE_IOERR;
+  }
+
   spb->envelope.has_env_x = 1;
   spb->envelope.has_env_y = 1;
   spb->envelope.has_env_z = 0;
   spb->envelope.has_env_m = 0;
-  if (binstream_read_double(stream, &spb->envelope.min_x)) {
-    return SQLITE_IOERR;
-  }
-  if (binstream_read_double(stream, &spb->envelope.min_y)) {
-    return SQLITE_IOERR;
-  }
-  if (binstream_read_double(stream, &spb->envelope.max_x)) {
-    return SQLITE_IOERR;
-  }
-  if (binstream_read_double(stream, &spb->envelope.max_y)) {
-    return SQLITE_IOERR;
-  }
+  spb->envelope.min_x = mbr[0];
+  spb->envelope.min_y = mbr[1];
+  spb->envelope.max_x = mbr[2];
+  spb->envelope.max_y = mbr[3];
 
   spb->empty = fp_isnan(spb->envelope.min_x) && fp_isnan(spb->envelope.max_x) && fp_isnan(spb->envelope.min_y) && fp_isnan(spb->envelope.max_y);
 
@@ -218,6 +214,10 @@ exit:
 }
 
 int spb_writer_init(geom_blob_writer_t *writer, int32_t srid) {
+  return spb_writer_init_size(writer, srid, 256);
+}
+
+int spb_writer_init_size(geom_blob_writer_t *writer, int32_t srid, size_t initial_size) {
   geom_consumer_init(&writer->geom_consumer, NULL, spb_end, spb_begin_geometry, spb_end_geometry, spb_coordinates);
   geom_envelope_init(&writer->header.envelope);
   writer->geom_type = GEOM_GEOMETRY;
@@ -225,7 +225,7 @@ int spb_writer_init(geom_blob_writer_t *writer, int32_t srid) {
   writer->header.envelope.has_env_y = 1;
   writer->header.srid = srid;
   writer->header.empty = 1;
-  return wkb_writer_init(&writer->wkb_writer, WKB_SPATIALITE);
+  return wkb_writer_init_size(&writer->wkb_writer, WKB_SPATIALITE, initial_size);
 }
 
 void spb_writer_destroy(geom_blob_writer_t *writer, int free_data) {
@@ -35,6 +35,15 @@
  */
 int spb_writer_init(geom_blob_writer_t *writer, int32_t srid);
 
+/**
+ * Initializes a Spatialite Binary writer with the given initial buffer size. See wkb_writer_init_size().
+ * @param writer the writer to initialize
+ * @param srid the SRID that should be used
+ * @param initial_size the initial size of the output buffer in bytes
+ * @return SQLITE_OK on success, an error code otherwise
+ */
+int spb_writer_init_size(geom_blob_writer_t *writer, int32_t srid, size_t initial_size);
+
 /**
  * Destroys a Spatialite Binary writer.
  * @param writer the writer to destroy
@@ -13,10 +13,13 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <float.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include "sqlite.h"
 #include "sql.h"
+#include "atomic_ops.h"
 
 #define SQL_NOT_NULL_MASK SQL_NOT_NULL
 #define SQL_AUTOINCREMENT_MASK SQL_AUTOINCREMENT
@@ -44,6 +47,333 @@ static int sql_stmt_init(sqlite3_stmt **stmt, sqlite3 *db, char *sql, ...) {
   return res;
 }
 
+#define SQL_STMT_CACHE_SIZE 16
+
+typedef struct {
+  char *sql;
+  sqlite3_stmt *stmt;
+  int in_use;
+  unsigned long last_used;
+} sql_stmt_cache_entry_t;
+
+struct sql_stmt_cache {
+  sqlite3 *db;
+  int ref_count;
+  /*
+   * Statements are only kept while the close hook table is connected. SQLite disconnects it before checking for
+   * unfinalized statements when the connection is closed.
+   */
+  int hook_connected;
+  unsigned long tick;
+  sql_stmt_cache_entry_t entries[SQL_STMT_CACHE_SIZE];
+  struct sql_stmt_cache *next;
+};
+
+/*
+ * All statement caches in the process, keyed by connection. The list is only consulted when a helper function needs
+ * the cache of a connection and is protected by the static master mutex. The caches themselves are only accessed
+ * while holding their connection's mutex.
+ */
+static sql_stmt_cache_t *sql_stmt_caches = NULL;
+
+static volatile long sql_stmt_cache_hits = 0;
+static volatile long sql_stmt_cache_misses = 0;
+
+#define SQL_STMT_CACHE_HOOK "gpkg_statement_cache"
+
+static sql_stmt_cache_t *sql_stmt_cache_get(sqlite3 *db) {
+  sqlite3_mutex *master = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+  sqlite3_mutex_enter(master);
+  sql_stmt_cache_t *cache = sql_stmt_caches;
+  while (cache != NULL && cache->db != db) {
+    cache = cache->next;
+  }
+  sqlite3_mutex_leave(master);
+  return cache;
+}
+
+static void sql_stmt_cache_clear(sql_stmt_cache_t *cache) {
+  for (int i = 0; i < SQL_STMT_CACHE_SIZE; i++) {
+    sql_stmt_cache_entry_t *e = &cache->entries[i];
+    if (!e->in_use) {
+      sqlite3_finalize(e->stmt);
+      sqlite3_free(e->sql);
+      e->stmt = NULL;
+      e->sql = NULL;
+    }
+  }
+}
+
+typedef struct {
+  sqlite3_vtab base;
+  sql_stmt_cache_t *cache;
+} sql_stmt_cache_vtab_t;
+
+typedef struct {
+  sqlite3_vtab_cursor base;
+  int index;
+} sql_stmt_cache_cursor_t;
+
+static int sql_stmt_cache_hook_connect(sqlite3 *db, void *aux, int argc, const char *const *argv, sqlite3_vtab **vtab_out, char **err) {
+  sql_stmt_cache_vtab_t *vtab;
+
+  int result = sqlite3_declare_vtab(db, "CREATE TABLE x(sql TEXT)");
+  if (result != SQLITE_OK) {
+    return result;
+  }
+
+  vtab = (sql_stmt_cache_vtab_t *)sqlite3_malloc(sizeof(sql_stmt_cache_vtab_t));
+  if (vtab == NULL) {
+    return SQLITE_NOMEM;
+  }
+  memset(vtab, 0, sizeof(sql_stmt_cache_vtab_t));
+
+  vtab->cache = (sql_stmt_cache_t *)aux;
+  vtab->cache->hook_connected = 1;
+
+  *vtab_out = &vtab->base;
+  return SQLITE_OK;
+}
+
+static int sql_stmt_cache_hook_disconnect(sqlite3_vtab *vtab_base) {
+  sql_stmt_cache_vtab_t *vtab = (sql_stmt_cache_vtab_t *)vtab_base;
+  vtab->cache->hook_connected = 0;
+  sql_stmt_cache_clear(vtab->cache);
+  sqlite3_free(vtab);
+  return SQLITE_OK;
+}
+
+static int sql_stmt_cache_hook_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+  info->estimatedCost = SQL_STMT_CACHE_SIZE;
+  return SQLITE_OK;
+}
+
+static int sql_stmt_cache_hook_next(sqlite3_vtab_cursor *cursor_base) {
+  sql_stmt_cache_cursor_t *cursor = (sql_stmt_cache_cursor_t *)cursor_base;
+  sql_stmt_cache_t *cache = ((sql_stmt_cache_vtab_t *)cursor_base->pVtab)->cache;
+  do {
+    cursor->index++;
+  } while (cursor->index < SQL_STMT_CACHE_SIZE && cache->entries[cursor->index].sql == NULL);
+  return SQLITE_OK;
+}
+
+static int sql_stmt_cache_hook_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor_out) {
+  sql_stmt_cache_cursor_t *cursor = (sql_stmt_cache_cursor_t *)sqlite3_malloc(sizeof(sql_stmt_cache_cursor_t));
+  if (cursor == NULL) {
+    return SQLITE_NOMEM;
+  }
+  memset(cursor, 0, sizeof(sql_stmt_cache_cursor_t));
+  cursor->index = SQL_STMT_CACHE_SIZE;
+
+  *cursor_out = &cursor->base;
+  return SQLITE_OK;
+}
+
+static int sql_stmt_cache_hook_close(sqlite3_vtab_cursor *cursor) {
+  sqlite3_free(cursor);
+  return SQLITE_OK;
+}
+
+static int sql_stmt_cache_hook_filter(sqlite3_vtab_cursor *cursor_base, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
+  sql_stmt_cache_cursor_t *cursor = (sql_stmt_cache_cursor_t *)cursor_base;
+  cursor->index = -1;
+  return sql_stmt_cache_hook_next(cursor_base);
+}
+
+static int sql_stmt_cache_hook_eof(sqlite3_vtab_cursor *cursor_base) {
+  return ((sql_stmt_cache_cursor_t *)cursor_base)->index >= SQL_STMT_CACHE_SIZE;
+}
+
+static int sql_stmt_cache_hook_column(sqlite3_vtab_cursor *cursor_base, sqlite3_context *context, int column) {
+  sql_stmt_cache_cursor_t *cursor = (sql_stmt_cache_cursor_t *)cursor_base;
+  sql_stmt_cache_t *cache = ((sql_stmt_cache_vtab_t *)cursor_base->pVtab)->cache;
+  sqlite3_result_text(context, cache->entries[cursor->index].sql, -1, SQLITE_TRANSIENT);
+  return SQLITE_OK;
+}
+
+static int sql_stmt_cache_hook_rowid(sqlite3_vtab_cursor *cursor_base, sqlite3_int64 *rowid) {
+  *rowid = ((sql_stmt_cache_cursor_t *)cursor_base)->index;
+  return SQLITE_OK;
+}
+
+/*
+ * Eponymous-only virtual table that lists the cached statements of the connection. Its real purpose is the
+ * disconnect callback: SQLite disconnects all virtual tables before it checks for unfinalized statements when a
+ * connection is closed, so this is where the cached statements are finalized.
+ */
+static sqlite3_module sql_stmt_cache_hook_module = {
+  0,
+  NULL,
+  sql_stmt_cache_hook_connect,
+  sql_stmt_cache_hook_best_index,
+  sql_stmt_cache_hook_disconnect,
+  NULL,
+  sql_stmt_cache_hook_open,
+  sql_stmt_cache_hook_close,
+  sql_stmt_cache_hook_filter,
+  sql_stmt_cache_hook_next,
+  sql_stmt_cache_hook_eof,
+  sql_stmt_cache_hook_column,
+  sql_stmt_cache_hook_rowid
+};
+
+/*
+ * Connects the close hook table if it is not connected yet. Returns 1 if statements may be kept in the cache.
+ */
+static int sql_stmt_cache_hook(sql_stmt_cache_t *cache) {
+  if (!cache->hook_connected) {
+    sqlite3_stmt *stmt = NULL;
+    sqlite3_prepare_v2(cache->db, "SELECT * FROM " SQL_STMT_CACHE_HOOK, -1, &stmt, NULL);
+    sqlite3_finalize(stmt);
+  }
+  return cache->hook_connected;
+}
+
+sql_stmt_cache_t *sql_stmt_cache_init(sqlite3 *db, errorstream_t *error) {
+  sql_stmt_cache_t *cache = sql_stmt_cache_get(db);
+  if (cache != NULL) {
+    sql_stmt_cache_acquire(cache);
+    return cache;
+  }
+
+  cache = (sql_stmt_cache_t *)sqlite3_malloc(sizeof(sql_stmt_cache_t));
+  if (cache == NULL) {
+    error_append(error, "Could not create statement cache");
+    return NULL;
+  }
+  memset(cache, 0, sizeof(sql_stmt_cache_t));
+  cache->db = db;
+  /* One reference for the caller, one for the close hook module */
+  cache->ref_count = 2;
+
+  sqlite3_mutex *master = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+  sqlite3_mutex_enter(master);
+  cache->next = sql_stmt_caches;
+  sql_stmt_caches = cache;
+  sqlite3_mutex_leave(master);
+
+  /* The module destructor is called, releasing its reference, even if registration fails. */
+  sql_create_module(db, SQL_STMT_CACHE_HOOK, &sql_stmt_cache_hook_module, cache, (void(*)(void*))sql_stmt_cache_release, error);
+
+  return cache;
+}
+
+void sql_stmt_cache_acquire(sql_stmt_cache_t *cache) {
+  cache->ref_count++;
+}
+
+void sql_stmt_cache_release(sql_stmt_cache_t *cache) {
+  if (cache == NULL || --cache->ref_count > 0) {
+    return;
+  }
+
+  sqlite3_mutex *master = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+  sqlite3_mutex_enter(master);
+  sql_stmt_cache_t **link = &sql_stmt_caches;
+  while (*link != cache) {
+    link = &(*link)->next;
+  }
+  *link = cache->next;
+  sqlite3_mutex_leave(master);
+
+  for (int i = 0; i < SQL_STMT_CACHE_SIZE; i++) {
+    sqlite3_finalize(cache->entries[i].stmt);
+    sqlite3_free(cache->entries[i].sql);
+  }
+  sqlite3_free(cache);
+}
+
+void sql_stmt_cache_stats(long *hits, long *misses) {
+  *hits = sql_stmt_cache_hits;
+  *misses = sql_stmt_cache_misses;
+}
+
+/*
+ * Prepares a statement for the given SQL text. If the connection has a statement cache the statement is looked up
+ * in or added to it and *entry is set to the cache slot that holds it. Slots that are in use by an enclosing
+ * statement are never handed out or evicted.
+ */
+static int sql_stmt_cache_lookup(sql_stmt_cache_t *cache, sqlite3 *db, const char *sql, sqlite3_stmt **stmt, sql_stmt_cache_entry_t **entry) {
+  *stmt = NULL;
+  *entry = NULL;
+
+  if (cache == NULL) {
+    return sqlite3_prepare_v2(db, sql, -1, stmt, NULL);
+  }
+
+  sql_stmt_cache_entry_t *victim = NULL;
+  for (int i = 0; i < SQL_STMT_CACHE_SIZE; i++) {
+    sql_stmt_cache_entry_t *e = &cache->entries[i];
+    if (e->in_use) {
+      continue;
+    }
+    if (e->sql != NULL && strcmp(e->sql, sql) == 0) {
+      atomic_inc_long(&sql_stmt_cache_hits);
+      e->in_use = 1;
+      e->last_used = ++cache->tick;
+      *stmt = e->stmt;
+      *entry = e;
+      return SQLITE_OK;
+    }
+    if (victim == NULL || (victim->sql != NULL && (e->sql == NULL || e->last_used < victim->last_used))) {
+      victim = e;
+    }
+  }
+
+  atomic_inc_long(&sql_stmt_cache_misses);
+  int result = sqlite3_prepare_v2(db, sql, -1, stmt, NULL);
+  if (result != SQLITE_OK || victim == NULL || !sql_stmt_cache_hook(cache)) {
+    return result;
+  }
+
+  size_t length = strlen(sql) + 1;
+  char *key = (char *)sqlite3_malloc((int)length);
+  if (key == NULL) {
+    return SQLITE_OK;
+  }
+  memcpy(key, sql, length);
+
+  sqlite3_finalize(victim->stmt);
+  sqlite3_free(victim->sql);
+  victim->sql = key;
+  victim->stmt = *stmt;
+  victim->in_use = 1;
+  victim->last_used = ++cache->tick;
+  *entry = victim;
+  return SQLITE_OK;
+}
+
+static void sql_stmt_cache_unlock(sql_stmt_cache_t *cache, sqlite3_stmt *stmt, sql_stmt_cache_entry_t *entry) {
+  if (entry != NULL && cache->hook_connected) {
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    entry->in_use = 0;
+  } else if (entry != NULL) {
+    /* The hook was disconnected while the statement was running; do not keep it */
+    sqlite3_finalize(stmt);
+    sqlite3_free(entry->sql);
+    memset(entry, 0, sizeof(sql_stmt_cache_entry_t));
+  } else if (stmt != NULL) {
+    sqlite3_finalize(stmt);
+  }
+}
+
+int sql_stmt_cache_prepare(sql_stmt_cache_t *cache, const char *sql, sqlite3_stmt **stmt) {
+  sql_stmt_cache_entry_t *entry;
+  return sql_stmt_cache_lookup(cache, cache->db, sql, stmt, &entry);
+}
+
+void sql_stmt_cache_done(sql_stmt_cache_t *cache, sqlite3_stmt *stmt) {
+  sql_stmt_cache_entry_t *entry = NULL;
+  for (int i = 0; i < SQL_STMT_CACHE_SIZE; i++) {
+    if (cache->entries[i].in_use && cache->entries[i].stmt == stmt) {
+      entry = &cache->entries[i];
+      break;
+    }
+  }
+  sql_stmt_cache_unlock(cache, stmt, entry);
+}
+
 static int sql_stmt_bind(sqlite3_stmt *stmt, const value_t *values, const int nValues) {
   int result = sqlite3_reset(stmt);
   if (result != SQLITE_OK) {
@@ -81,14 +411,30 @@ static void sql_stmt_destroy(sqlite3_stmt *stmt) {
   }
 }
 
-static int sql_stmt_exec(sqlite3 *db, sql_callback row, sql_callback nodata, void *data, char *sql, va_list args) {
+static int sql_stmt_exec(sqlite3 *db, sql_callback row, sql_callback nodata, void *data, const value_t *params, int nParams, char *sql, va_list args) {
   sqlite3_stmt *stmt = NULL;
-  int result = sql_stmt_vinit(&stmt, db, sql, args);
+  sql_stmt_cache_t *cache = sql_stmt_cache_get(db);
+  sql_stmt_cache_entry_t *entry = NULL;
+  char *formatted_sql = sqlite3_vmprintf(sql, args);
+
+  if (formatted_sql == NULL) {
+    return SQLITE_NOMEM;
+  }
 
+  int result = sql_stmt_cache_lookup(cache, db, formatted_sql, &stmt, &entry);
+  sqlite3_free(formatted_sql);
   if (result != SQLITE_OK) {
     return result;
   }
 
+  if (nParams > 0) {
+    result = sql_stmt_bind(stmt, params, nParams);
+    if (result != SQLITE_OK) {
+      sql_stmt_cache_unlock(cache, stmt, entry);
+      return result;
+    }
+  }
+
   int stmt_res = sqlite3_step(stmt);
   if (stmt_res == SQLITE_DONE) {
     if (nodata != NULL) {
@@ -120,7 +466,7 @@ static int sql_stmt_exec(sqlite3 *db, sql_callback row, sql_callback nodata, voi
     result = stmt_res;
   }
 
-  sql_stmt_destroy(stmt);
+  sql_stmt_cache_unlock(cache, stmt, entry);
   return result;
 }
 
@@ -153,7 +499,7 @@ static int nodata_string(sqlite3 *db, sqlite3_stmt *stmt, void *out) {
 int sql_exec_for_string(sqlite3 *db, char **out, char *sql, ...) {
   va_list args;
   va_start(args, sql);
-  int result = sql_stmt_exec(db, row_string, nodata_string, out, sql, args);
+  int result = sql_stmt_exec(db, row_string, nodata_string, out, NULL, 0, sql, args);
   va_end(args);
   return result;
 }
@@ -176,7 +522,7 @@ static int nodata_int(sqlite3 *db, sqlite3_stmt *stmt, void *data) {
 int sql_exec_for_int(sqlite3 *db, int *out, char *sql, ...) {
   va_list args;
   va_start(args, sql);
-  int result = sql_stmt_exec(db, row_int, nodata_int, out, sql, args);
+  int result = sql_stmt_exec(db, row_int, nodata_int, out, NULL, 0, sql, args);
   va_end(args);
   return result;
 }
@@ -196,10 +542,18 @@ static int nodata_double(sqlite3 *db, sqlite3_stmt *stmt, void *data) {
   return SQLITE_ABORT;
 }
 
+int sql_exec_for_int_params(sqlite3 *db, int *out, const value_t *params, int nParams, char *sql, ...) {
+  va_list args;
+  va_start(args, sql);
+  int result = sql_stmt_exec(db, row_int, nodata_int, out, params, nParams, sql, args);
+  va_end(args);
+  return result;
+}
+
 int sql_exec_for_double(sqlite3 *db, double *out, char *sql, ...) {
   va_list args;
   va_start(args, sql);
-  int result = sql_stmt_exec(db, row_double, nodata_double, out, sql, args);
+  int result = sql_stmt_exec(db, row_double, nodata_double, out, NULL, 0, sql, args);
   va_end(args);
   return result;
 }
@@ -211,7 +565,7 @@ static int abort_after_first_row(sqlite3 *db, sqlite3_stmt *stmt, void *data) {
 int sql_exec(sqlite3 *db, char *sql, ...) {
   va_list args;
   va_start(args, sql);
-  int result = sql_stmt_exec(db, abort_after_first_row, NULL, NULL, sql, args);
+  int result = sql_stmt_exec(db, abort_after_first_row, NULL, NULL, NULL, 0, sql, args);
   va_end(args);
   return result;
 }
@@ -219,7 +573,7 @@ int sql_exec(sqlite3 *db, char *sql, ...) {
 int sql_exec_all(sqlite3 *db, char *sql, ...) {
   va_list args;
   va_start(args, sql);
-  int result = sql_stmt_exec(db, NULL, NULL, NULL, sql, args);
+  int result = sql_stmt_exec(db, NULL, NULL, NULL, NULL, 0, sql, args);
   va_end(args);
   return result;
 }
@@ -227,7 +581,7 @@ int sql_exec_all(sqlite3 *db, char *sql, ...) {
 int sql_exec_stmt(sqlite3 *db, sql_callback row, sql_callback nodata, void *data, char *sql, ...) {
   va_list args;
   va_start(args, sql);
-  int result = sql_stmt_exec(db, row, nodata, data, sql, args);
+  int result = sql_stmt_exec(db, row, nodata, data, NULL, 0, sql, args);
   va_end(args);
   return result;
 }
@@ -272,16 +626,49 @@ int sql_check_column_exists(sqlite3 *db, const char *db_name, const char *table_
     return SQLITE_ERROR;
   }
 
-  int result = sql_exec_stmt(
-                 db, sql_check_column_exists_row, NULL, &c,
-                 "PRAGMA \"%w\".table_info(\"%w\")", db_name, table_name
-               );
+  int result = sql_exec_stmt(db, sql_check_column_exists_row, NULL, &c, "PRAGMA \"%w\".table_info(\"%w\")", db_name, table_name);
 
   *exists = c.found;
 
   return result;
 }
 
+typedef struct {
+  int pk_count;
+  char *name;
+} integer_pk_t;
+
+static int sql_integer_primary_key_row(sqlite3 *db, sqlite3_stmt *stmt, void *data) {
+  integer_pk_t *pk = (integer_pk_t *)data;
+  if (sqlite3_column_int(stmt, 5) == 0) {
+    return SQLITE_OK;
+  }
+
+  pk->pk_count++;
+  const char *type = (const char *)sqlite3_column_text(stmt, 2);
+  if (pk->name == NULL && type != NULL && sqlite3_strnicmp(type, "INTEGER", 8) == 0) {
+    pk->name = sqlite3_mprintf("%s", sqlite3_column_text(stmt, 1));
+    if (pk->name == NULL) {
+      return SQLITE_NOMEM;
+    }
+  }
+  return SQLITE_OK;
+}
+
+int sql_integer_primary_key(sqlite3 *db, const char *db_name, const char *table_name, char **column_name) {
+  integer_pk_t pk = {0, NULL};
+
+  int result = sql_exec_stmt(db, sql_integer_primary_key_row, NULL, &pk, "PRAGMA \"%w\".table_info(\"%w\")", db_name, table_name);
+
+  if (result != SQLITE_OK || pk.pk_count != 1) {
+    sqlite3_free(pk.name);
+    pk.name = NULL;
+  }
+  *column_name = pk.name;
+
+  return result;
+}
+
 static int sql_count_columns(const table_info_t *table_info) {
   int nColumns = 0;
   const column_info_t *column = table_info->columns;
@@ -969,7 +1356,104 @@ int sql_check_integrity(sqlite3 *db, const char *db_name, errorstream_t *error)
   return result;
 }
 
-int sql_create_function(sqlite3 *db, const char *name, void (*function)(sqlite3_context *, int, sqlite3_value **), int args, int flags, void *user_data, void (*destroy)(void *), errorstream_t *error) {
+/*
+ * The rtree module stores coordinates as 32-bit floats, rounded outwards. A stored coordinate matches the expected
+ * value if it lies within two float ulps of it.
+ */
+static int sql_rtree_coord_matches(double stored, double expected) {
+  return fabs(stored - expected) <= fabs(expected) * (2 * FLT_EPSILON) + FLT_MIN;
+}
+
+#define SQL_CHECK_RTREE_MAX_REPORTS 10
+
+int sql_check_rtree(sqlite3 *db, const char *db_name, const char *rtree_name, const char *source_sql, errorstream_t *error) {
+  sqlite3_stmt *index_stmt = NULL;
+  sqlite3_stmt *source_stmt = NULL;
+  int index_row;
+  int source_row;
+  int missing = 0;
+  int extra = 0;
+  int mismatched = 0;
+
+  // Scanning the rowid shadow table yields the entries in id order; CROSS JOIN keeps it as the outer loop so the rtree
+  // is only used for rowid lookups and no sort is needed
+  int result = sql_stmt_init(
+                 &index_stmt, db,
+                 "SELECT r.* FROM \"%w\".\"%w_rowid\" AS s CROSS JOIN \"%w\".\"%w\" AS r WHERE r.rowid = s.rowid ORDER BY s.rowid",
+                 db_name, rtree_name, db_name, rtree_name
+               );
+  if (result == SQLITE_OK) {
+    result = sqlite3_prepare_v2(db, source_sql, -1, &source_stmt, NULL);
+  }
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  if (sqlite3_column_count(index_stmt) != 5 || sqlite3_column_count(source_stmt) != 5) {
+    result = SQLITE_MISMATCH;
+    goto exit;
+  }
+
+  index_row = sqlite3_step(index_stmt);
+  source_row = sqlite3_step(source_stmt);
+  while (index_row == SQLITE_ROW || source_row == SQLITE_ROW) {
+    sqlite3_int64 index_id = index_row == SQLITE_ROW ? sqlite3_column_int64(index_stmt, 0) : 0;
+    sqlite3_int64 source_id = source_row == SQLITE_ROW ? sqlite3_column_int64(source_stmt, 0) : 0;
+
+    if (source_row != SQLITE_ROW || (index_row == SQLITE_ROW && index_id < source_id)) {
+      if (missing + extra + mismatched < SQL_CHECK_RTREE_MAX_REPORTS) {
+        error_append(error, "%s: entry %lld does not correspond to a non-empty geometry", rtree_name, index_id);
+      }
+      extra++;
+      index_row = sqlite3_step(index_stmt);
+    } else if (index_row != SQLITE_ROW || source_id < index_id) {
+      if (missing + extra + mismatched < SQL_CHECK_RTREE_MAX_REPORTS) {
+        error_append(error, "%s: entry %lld is missing", rtree_name, source_id);
+      }
+      missing++;
+      source_row = sqlite3_step(source_stmt);
+    } else {
+      int matches = 1;
+      for (int i = 1; i < 5; i++) {
+        matches &= sql_rtree_coord_matches(sqlite3_column_double(index_stmt, i), sqlite3_column_double(source_stmt, i));
+      }
+      if (!matches) {
+        if (missing + extra + mismatched < SQL_CHECK_RTREE_MAX_REPORTS) {
+          error_append(
+            error, "%s: entry %lld has envelope [%g %g, %g %g], expected [%g %g, %g %g]", rtree_name, index_id,
+            sqlite3_column_double(index_stmt, 1), sqlite3_column_double(index_stmt, 3),
+            sqlite3_column_double(index_stmt, 2), sqlite3_column_double(index_stmt, 4),
+            sqlite3_column_double(source_stmt, 1), sqlite3_column_double(source_stmt, 3),
+            sqlite3_column_double(source_stmt, 2), sqlite3_column_double(source_stmt, 4)
+          );
+        }
+        mismatched++;
+      }
+      index_row = sqlite3_step(index_stmt);
+      source_row = sqlite3_step(source_stmt);
+    }
+  }
+
+  if (index_row != SQLITE_DONE) {
+    result = index_row;
+  } else if (source_row != SQLITE_DONE) {
+    result = source_row;
+  }
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  if (missing + extra + mismatched > SQL_CHECK_RTREE_MAX_REPORTS) {
+    error_append(error, "%s: %d missing, %d extra and %d mismatched entries", rtree_name, missing, extra, mismatched);
+  }
+
+exit:
+  sqlite3_finalize(index_stmt);
+  sqlite3_finalize(source_stmt);
+  return result;
+}
+
+static int sql_function_flags(int flags) {
   int function_flags = SQLITE_UTF8;
 
 #if SQLITE_VERSION_NUMBER >= 3008003
@@ -978,8 +1462,12 @@ int sql_create_function(sqlite3 *db, const char *name, void (*function)(sqlite3_
   }
 #endif
 
+  return function_flags;
+}
+
+int sql_create_function(sqlite3 *db, const char *name, void (*function)(sqlite3_context *, int, sqlite3_value **), int args, int flags, void *user_data, void (*destroy)(void *), errorstream_t *error) {
   int result = sqlite3_create_function_v2(
-                 db, name, args, function_flags, user_data, function, NULL, NULL, destroy
+                 db, name, args, sql_function_flags(flags), user_data, function, NULL, NULL, destroy
                );
   if (result != SQLITE_OK) {
     error_append(error, "Error registering function %s/%d: %s", name, args, sqlite3_errmsg(db));
@@ -987,3 +1475,23 @@ int sql_create_function(sqlite3 *db, const char *name, void (*function)(sqlite3_
 
   return result;
 }
+
+int sql_create_aggregate(sqlite3 *db, const char *name, void (*step)(sqlite3_context *, int, sqlite3_value **), void (*final)(sqlite3_context *), int args, int flags, void *user_data, void (*destroy)(void *), errorstream_t *error) {
+  int result = sqlite3_create_function_v2(
+                 db, name, args, sql_function_flags(flags), user_data, NULL, step, final, destroy
+               );
+  if (result != SQLITE_OK) {
+    error_append(error, "Error registering aggregate %s/%d: %s", name, args, sqlite3_errmsg(db));
+  }
+
+  return result;
+}
+
+int sql_create_module(sqlite3 *db, const char *name, const sqlite3_module *module, void *user_data, void (*destroy)(void *), errorstream_t *error) {
+  int result = sqlite3_create_module_v2(db, name, module, user_data, destroy);
+  if (result != SQLITE_OK) {
+    error_append(error, "Error registering module %s: %s", name, sqlite3_errmsg(db));
+  }
+
+  return result;
+}
@@ -288,6 +288,20 @@ int sql_exec_for_string(sqlite3 *db, char **out, char *sql, ...);
  */
 int sql_exec_for_int(sqlite3 *db, int *out, char *sql, ...);
 
+/**
+ * Executes a SQL statement that is expected to return a single integer value. The SQL statement can be a printf style
+ * format pattern and may contain '?' parameters that are bound to the given values. Prefer this over formatting
+ * values into the SQL text so that the statement text stays the same and can be reused by the statement cache.
+ * @param db the SQLite database context
+ * @param[out] out on success, out will be set to the returned integer value
+ * @param params the values to bind to the statement parameters
+ * @param nParams the number of elements in params
+ * @param sql the SQL statement to execute
+ * @return SQLITE_OK if the SQL statement was executed successfully\n
+ *         A SQLite error code otherwise
+ */
+int sql_exec_for_int_params(sqlite3 *db, int *out, const value_t *params, int nParams, char *sql, ...);
+
 /**
  * Executes a SQL statement that is expected to return a single double value. The SQL statement can be a printf style
  * format pattern.
@@ -322,6 +336,18 @@ int sql_check_table_exists(sqlite3 *db, const char *db_name, const char *table_n
  */
 int sql_check_column_exists(sqlite3 *db, const char *db_name, const char *table_name, const char *column_name, int *exists);
 
+/**
+ * Looks up the INTEGER PRIMARY KEY column of a table, i.e. the column that aliases the rowid.
+ * @param db the SQLite database context
+ * @param db_name the name of the attached database to use. This can be 'main', 'temp' or any attached database.
+ * @param table_name the name of the table to check.
+ * @param[out] column_name on success, column_name will be set to the name of the column or to NULL if the table has no
+ *                         INTEGER PRIMARY KEY. The returned string should be freed using sqlite3_free.
+ * @return SQLITE_OK if the table was checked successfully\n
+ *         A SQLite error code otherwise
+ */
+int sql_integer_primary_key(sqlite3 *db, const char *db_name, const char *table_name, char **column_name);
+
 #define SQL_MUST_EXIST (1 << 1)
 #define SQL_CHECK_DEFAULT_VALUES (1 << 2)
 #define SQL_CHECK_DEFAULT_DATA (1 << 3)
@@ -345,6 +371,23 @@ int sql_check_table(sqlite3 *db, const char *db_name, const table_info_t *table_
 
 int sql_check_integrity(sqlite3 *db, const char *db_name, errorstream_t *error);
 
+/**
+ * Checks if the entries of a two dimensional rtree match the entries that are produced by a query. The query must
+ * return the row id followed by the minimum and maximum of each dimension, in the column order of the rtree table,
+ * ordered by row id. Both sides are merged in a single pass, so the check runs in bounded memory if the query can
+ * be answered without sorting. Coordinates are compared with a tolerance that allows for the 32-bit float rounding
+ * done by the rtree module.
+ * @param db the SQLite database context
+ * @param db_name the name of the attached database to use. This can be 'main', 'temp' or any attached database.
+ * @param rtree_name the name of the rtree virtual table
+ * @param source_sql the query that produces the expected entries
+ * @param[out] error on successful exit, error will contain descriptive messages for the first missing, extra or
+ *                   mismatched entries, followed by a summary if there are more
+ * @return SQLITE_OK if the rtree was checked successfully\n
+ *         A SQLite error code otherwise
+ */
+int sql_check_rtree(sqlite3 *db, const char *db_name, const char *rtree_name, const char *source_sql, errorstream_t *error);
+
 /**
  * Initializes a table based on the given table specification. If the table already exists, then this function is
  * equivalent to slq_check_table(). Otherwise a new table will be created based on the specification.
@@ -361,12 +404,73 @@ int sql_init_table(sqlite3 *db, const char *db_name, const table_info_t *table_i
 
 int sql_init_stmt(sqlite3_stmt **stmt, sqlite3 *db, char *sql);
 
+/**
+ * A per connection cache of prepared statements.
+ */
+typedef struct sql_stmt_cache sql_stmt_cache_t;
+
+/**
+ * Returns the prepared statement cache of the given connection, creating it if the connection does not have one yet.
+ * Once a connection has a cache, the sql_exec family of functions reuses prepared statements keyed by their formatted
+ * SQL text instead of preparing them on every call. Least recently used statements are evicted once the cache is full.
+ * The cached statements are finalized when the connection is closed. The cache registers an eponymous virtual table
+ * named gpkg_statement_cache for this purpose, which lists the SQL text of the cached statements.
+ *
+ * The caller receives a reference to the cache that must be released using sql_stmt_cache_release().
+ * @param db the SQLite database context
+ * @param[out] error the error stream to append to in case of errors
+ * @return the statement cache or NULL if it could not be created
+ */
+sql_stmt_cache_t *sql_stmt_cache_init(sqlite3 *db, errorstream_t *error);
+
+/**
+ * Acquires an additional reference to a statement cache.
+ * @param cache the statement cache
+ */
+void sql_stmt_cache_acquire(sql_stmt_cache_t *cache);
+
+/**
+ * Releases a reference to a statement cache. The cache is destroyed once all references have been released.
+ * @param cache the statement cache
+ */
+void sql_stmt_cache_release(sql_stmt_cache_t *cache);
+
+/**
+ * Prepares a statement using a statement cache. If a statement with the same SQL text is available in the cache it is
+ * reused. The statement must be handed back using sql_stmt_cache_done() and must not be finalized by the caller.
+ * @param cache the statement cache
+ * @param sql the SQL text of the statement
+ * @param[out] stmt the prepared statement
+ * @return SQLITE_OK if the statement was prepared successfully\n
+ *         A SQLite error code otherwise
+ */
+int sql_stmt_cache_prepare(sql_stmt_cache_t *cache, const char *sql, sqlite3_stmt **stmt);
+
+/**
+ * Hands back a statement that was obtained using sql_stmt_cache_prepare(). The statement is reset and its bindings
+ * are cleared.
+ * @param cache the statement cache
+ * @param stmt the statement
+ */
+void sql_stmt_cache_done(sql_stmt_cache_t *cache, sqlite3_stmt *stmt);
+
+/**
+ * Retrieves the process wide prepared statement cache counters.
+ * @param[out] hits the number of statements that were reused from a cache
+ * @param[out] misses the number of statements that had to be prepared because they were not in a cache
+ */
+void sql_stmt_cache_stats(long *hits, long *misses);
+
 typedef void(sql_function)(sqlite3_context *, int, sqlite3_value **);
 
 #define SQL_DETERMINISTIC 1
 
 int sql_create_function(sqlite3 *db, const char *name, sql_function *function, int args, int flags, void *user_data, void (*destroy)(void *), errorstream_t *error);
 
+int sql_create_aggregate(sqlite3 *db, const char *name, sql_function *step, void (*final)(sqlite3_context *), int args, int flags, void *user_data, void (*destroy)(void *), errorstream_t *error);
+
+int sql_create_module(sqlite3 *db, const char *name, const sqlite3_module *module, void *user_data, void (*destroy)(void *), errorstream_t *error);
+
 /** @} */
 
 #endif
@@ -87,54 +87,71 @@ int strbuf_append(strbuf_t *buffer, const char *msg, ...) {
   return result;
 }
 
-int strbuf_vappend(strbuf_t *buffer, const char *msg, va_list args) {
-  int result = SQLITE_OK;
-  char *formatted = sqlite3_vmprintf(msg, args);
+static int strbuf_grow(strbuf_t *buffer, size_t needed_capacity) {
+  size_t new_capacity = buffer->capacity * 3 / 2;
+  if (needed_capacity > new_capacity) {
+    new_capacity = needed_capacity;
+  }
 
-  if (formatted == NULL) {
-    result = SQLITE_NOMEM;
-    goto exit;
+  char *data = (char *)sqlite3_realloc(buffer->buffer, (int)new_capacity);
+  if (data == NULL) {
+    return SQLITE_NOMEM;
   }
 
-  size_t formatted_len = strlen(formatted);
-  size_t needed_capacity = buffer->length + formatted_len + 1;
-  if (needed_capacity > buffer->capacity) {
-    if (buffer->growable) {
-      size_t new_capacity = buffer->capacity * 3 / 2;
-      if (needed_capacity > new_capacity) {
-        new_capacity = needed_capacity;
-      }
+  memset(data + buffer->capacity, 0, new_capacity - buffer->capacity);
 
-      char *data = (char *)sqlite3_realloc(buffer->buffer, (int)new_capacity);
-      if (data == NULL) {
-        result = SQLITE_NOMEM;
-        goto exit;
-      }
+  buffer->buffer = data;
+  buffer->capacity = new_capacity;
+  return SQLITE_OK;
+}
 
-      memset(data + buffer->capacity, 0, new_capacity - buffer->capacity);
+static int strbuf_append_internal(strbuf_t *buffer, const char *chars, size_t length) {
+  int result = SQLITE_OK;
 
-      buffer->buffer = data;
-      buffer->capacity = new_capacity;
+  size_t needed_capacity = buffer->length + length + 1;
+  if (needed_capacity > buffer->capacity) {
+    if (buffer->growable) {
+      result = strbuf_grow(buffer, needed_capacity);
+      if (result != SQLITE_OK) {
+        return result;
+      }
     } else {
       result = SQLITE_NOMEM;
       size_t available = (buffer->capacity - buffer->length);
       if (available > 0) {
-        formatted_len = available - 1;
+        length = available - 1;
       } else {
-        formatted_len = 0;
+        length = 0;
       }
     }
   }
 
-  if (formatted_len > 0) {
-    memmove(buffer->buffer + buffer->length, formatted, formatted_len);
-    buffer->length += formatted_len;
+  if (length > 0) {
+    memmove(buffer->buffer + buffer->length, chars, length);
+    buffer->length += length;
     buffer->buffer[buffer->length] = 0;
   }
 
+  return result;
+}
+
+int strbuf_vappend(strbuf_t *buffer, const char *msg, va_list args) {
+  int result = SQLITE_OK;
+  char *formatted = sqlite3_vmprintf(msg, args);
+
+  if (formatted == NULL) {
+    result = SQLITE_NOMEM;
+    goto exit;
+  }
+
+  result = strbuf_append_internal(buffer, formatted, strlen(formatted));
+
 exit:
   sqlite3_free(formatted);
 
   return result;
 }
 
+int strbuf_append_chars(strbuf_t *buffer, const char *chars, size_t length) {
+  return strbuf_append_internal(buffer, chars, length);
+}
@@ -115,6 +115,17 @@ int strbuf_append(strbuf_t *buffer, const char *fmt, ...);
  */
 int strbuf_vappend(strbuf_t *buffer, const char *fmt, va_list args);
 
+/**
+ * Appends a sequence of characters to this string buffer without any formatting.
+ *
+ * @param buffer a string buffer
+ * @param chars the characters to append
+ * @param length the number of characters to append
+ *
+ * @return SQLITE_OK on success, an error code otherwise
+ */
+int strbuf_append_chars(strbuf_t *buffer, const char *chars, size_t length);
+
 /** @} */
 
 #endif
@@ -0,0 +1,94 @@
+#ifndef GPKG_THREAD_H
+#define GPKG_THREAD_H
+
+#if defined(_WIN32) || defined(WIN32) || defined(__MINGW32__)
+
+#include <Windows.h>
+#include <process.h>
+
+typedef HANDLE thread_t;
+
+#define THREAD_RESULT unsigned __stdcall
+
+static inline int thread_create(thread_t *thread, unsigned (__stdcall *func)(void *), void *arg) {
+  *thread = (HANDLE)_beginthreadex(NULL, 0, func, arg, 0, NULL);
+  return *thread == NULL ? -1 : 0;
+}
+
+static inline void thread_join(thread_t thread) {
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+static inline int thread_cpu_count() {
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (int)info.dwNumberOfProcessors;
+}
+
+/*
+ * The callback of a thread exit key is called with the value the exiting thread has set for the key, if it is not
+ * NULL. Depending on the platform, deleting a key may also call the callback for the values that are still set.
+ */
+typedef DWORD thread_exit_key_t;
+
+#define THREAD_EXIT_CALLBACK void WINAPI
+
+static inline int thread_exit_key_create(thread_exit_key_t *key, void (WINAPI *callback)(void *)) {
+  *key = FlsAlloc(callback);
+  return *key == FLS_OUT_OF_INDEXES ? -1 : 0;
+}
+
+static inline void thread_exit_key_set(thread_exit_key_t key, void *value) {
+  FlsSetValue(key, value);
+}
+
+static inline void thread_exit_key_delete(thread_exit_key_t key) {
+  FlsFree(key);
+}
+
+#else
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_t thread_t;
+
+#define THREAD_RESULT void *
+
+static inline int thread_create(thread_t *thread, void *(*func)(void *), void *arg) {
+  return pthread_create(thread, NULL, func, arg) == 0 ? 0 : -1;
+}
+
+static inline void thread_join(thread_t thread) {
+  pthread_join(thread, NULL);
+}
+
+static inline int thread_cpu_count() {
+#if defined(_SC_NPROCESSORS_ONLN)
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int)count : 1;
+#else
+  return 1;
+#endif
+}
+
+typedef pthread_key_t thread_exit_key_t;
+
+#define THREAD_EXIT_CALLBACK void
+
+static inline int thread_exit_key_create(thread_exit_key_t *key, void (*callback)(void *)) {
+  return pthread_key_create(key, callback) == 0 ? 0 : -1;
+}
+
+static inline void thread_exit_key_set(thread_exit_key_t key, void *value) {
+  pthread_setspecific(key, value);
+}
+
+static inline void thread_exit_key_delete(thread_exit_key_t key) {
+  pthread_key_delete(key);
+}
+
+#endif
+
+#endif
@@ -222,15 +222,16 @@ static int read_point(binstream_t *stream, wkb_dialect dialect, const geom_consu
   int result;
   uint32_t coord_size = header->coord_size;
   double coord[GEOM_MAX_COORD_SIZE];
+  result = binstream_nread_double(stream, coord, coord_size);
+  if (result != SQLITE_OK) {
+    if (error) {
+      error_append(error, "Error reading point coordinates");
+    }
+    return result;
+  }
+
   int allnan = 1;
   for (uint32_t i = 0; i < coord_size; i++) {
-    result = binstream_read_double(stream, &coord[i]);
-    if (result != SQLITE_OK) {
-      if (error) {
-        error_append(error, "Error reading point coordinates");
-      }
-      return result;
-    }
     allnan &= fp_isnan(coord[i]);
   }
 
@@ -241,32 +242,63 @@ static int read_point(binstream_t *stream, wkb_dialect dialect, const geom_consu
   return consumer->coordinates(consumer, header, 1, coord, 0, error);
 }
 
-#define COORD_BATCH_SIZE 10
+#define COORD_BATCH_SIZE 64
 
 static int read_points(binstream_t *stream, wkb_dialect dialect, const geom_consumer_t *consumer, const geom_header_t *header, uint32_t point_count, errorstream_t *error) {
   int result;
+  uint32_t coord_size = header->coord_size;
+
+  // Check the point count before computing the number of coordinates so that the multiplication cannot wrap
+  if (point_count > binstream_available(stream) / (coord_size * sizeof(double))) {
+    if (error) {
+      error_append(error, "Error reading point coordinates");
+    }
+    return SQLITE_IOERR;
+  }
+
+  /*
+   * If the byte order of the data matches the host and the data is suitably aligned, the entire point sequence is
+   * passed to the consumer in a single call with a pointer straight into the blob. Otherwise the coordinates are
+   * copied (and byte swapped if needed) in batches. Due to the byte order markers in WKB the copy is the common case.
+   */
+  const double *span = NULL;
+  result = binstream_map_ndouble(stream, &span, (size_t) point_count * coord_size);
+  if (result != SQLITE_OK) {
+    if (error) {
+      error_append(error, "Error reading point coordinates");
+    }
+    return result;
+  }
+
+  if (span != NULL) {
+    if (point_count == 0) {
+      return SQLITE_OK;
+    }
+    return consumer->coordinates(consumer, header, point_count, span, 0, error);
+  }
+
   double coord[GEOM_MAX_COORD_SIZE * COORD_BATCH_SIZE];
-  int max_coords_to_read = COORD_BATCH_SIZE;
+  uint32_t max_points_to_read = COORD_BATCH_SIZE;
 
+  /*
+   * Circular strings are split into batches of whole arcs: an odd number of points, the first of which repeats the
+   * last point of the previous batch.
+   */
   if (header->geom_type == GEOM_CIRCULARSTRING) {
-    max_coords_to_read = COORD_BATCH_SIZE - ((COORD_BATCH_SIZE - 3) % 2);
+    max_points_to_read = COORD_BATCH_SIZE - 1 + (COORD_BATCH_SIZE % 2);
   }
 
   uint32_t remaining = point_count;
   uint32_t offset = 0;
-  uint32_t points_read = 0;
   uint32_t extra_coords = 0;
   while (remaining > 0) {
-    uint32_t points_to_read = (remaining > max_coords_to_read ? max_coords_to_read : remaining);
-    uint32_t coords_to_read = points_to_read * header->coord_size;
-    for (uint32_t i = 0; i < coords_to_read; i++) {
-      result = binstream_read_double(stream, &coord[i + offset]);
-      if (result != SQLITE_OK) {
-        if (error) {
-          error_append(error, "Error reading point coordinates");
-        }
-        return result;
+    uint32_t points_to_read = (remaining > max_points_to_read ? max_points_to_read : remaining);
+    result = binstream_nread_double(stream, &coord[offset], points_to_read * coord_size);
+    if (result != SQLITE_OK) {
+      if (error) {
+        error_append(error, "Error reading point coordinates");
       }
+      return result;
     }
 
     result = consumer->coordinates(consumer, header, points_to_read + extra_coords, coord, offset, error);
@@ -275,10 +307,13 @@ static int read_points(binstream_t *stream, wkb_dialect dialect, const geom_cons
     }
 
     if (header->geom_type == GEOM_CIRCULARSTRING) {
-      for (uint32_t i = 0; i < header->coord_size; i++) {
-        coord[i] = coord[((points_to_read - 1) * header->coord_size) + i];
+      for (uint32_t i = 0; i < coord_size; i++) {
+        coord[i] = coord[((points_to_read + extra_coords - 1) * coord_size) + i];
+      }
+      if (extra_coords == 0) {
+        max_points_to_read--;
       }
-      offset = header->coord_size;
+      offset = coord_size;
       extra_coords = 1;
     }
 
@@ -827,8 +862,12 @@ static int wkb_end(const geom_consumer_t *consumer, errorstream_t *error) {
 }
 
 int wkb_writer_init(wkb_writer_t *writer, wkb_dialect dialect) {
+  return wkb_writer_init_size(writer, dialect, 256);
+}
+
+int wkb_writer_init_size(wkb_writer_t *writer, wkb_dialect dialect, size_t initial_size) {
   geom_consumer_init(&writer->geom_consumer, NULL, wkb_end, wkb_begin_geometry, wkb_end_geometry, wkb_coordinates);
-  int res = binstream_init_growable(&writer->stream, 256);
+  int res = binstream_init_growable(&writer->stream, initial_size);
   if (res != SQLITE_OK) {
     return res;
   }
@@ -56,6 +56,15 @@ typedef struct {
  */
 int wkb_writer_init(wkb_writer_t *writer, wkb_dialect dialect);
 
+/**
+ * Initializes a Well-Known Binary writer with the given initial buffer size. If the size of the output is known in
+ * advance, passing it here ensures the output buffer is allocated only once.
+ * @param writer the writer to initialize
+ * @param initial_size the initial size of the output buffer in bytes
+ * @return SQLITE_OK on success, an error code otherwise
+ */
+int wkb_writer_init_size(wkb_writer_t *writer, wkb_dialect dialect, size_t size);
+
 /**
  * Destroys a Well-Known Binary writer.
  * @param writer the writer to destroy
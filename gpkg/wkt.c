@@ -13,8 +13,11 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include "fp.h"
 #include "sqlite.h"
 #include "wkt.h"
 
@@ -111,19 +114,119 @@ exit:
   return result;
 }
 
-#define WKT_COORD "%.10g"
-#define WKT_COORD_2 WKT_COORD " " WKT_COORD
-#define WKT_COORD_3 WKT_COORD_2 " " WKT_COORD
-#define WKT_COORD_4 WKT_COORD_3 " " WKT_COORD
+/*
+ * Coordinates are formatted directly into a local buffer and appended once per point, rather than through
+ * strbuf_append, which allocates a formatted copy for each call.
+ */
+#define WKT_MAX_PRECISION 17
+#define WKT_FIXED_LIMIT 1e17
+#define WKT_ORDINATE_BUFFER_SIZE 40
+#define WKT_POINT_BUFFER_SIZE (2 + GEOM_MAX_COORD_SIZE * (WKT_ORDINATE_BUFFER_SIZE + 1))
+
+static const double wkt_powers_of_ten[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17
+};
+
+/*
+ * Bits used for the fixed point fraction when the scaled value is too large to round in a double. Such values are at
+ * least 2^52 / 10^WKT_MAX_PRECISION, so the lowest bit of their fraction is no smaller than 2^-57 and ten times the
+ * fraction still fits in 64 bits.
+ */
+#define WKT_FRACTION_BITS 57
+
+static int wkt_format_ordinate(const wkt_writer_t *writer, double value, char *buffer) {
+  if (writer->precision < 0 || !(value > -WKT_FIXED_LIMIT && value < WKT_FIXED_LIMIT)) {
+    return fp_format_double(value, buffer);
+  }
+
+  /*
+   * The value is rounded half away from zero based on its exact binary value, and written as an integral part and at
+   * most precision fraction digits without trailing zeros. A value that rounds to zero is written as 0, without sign.
+   */
+  int precision = writer->precision;
+  double magnitude = fabs(value);
+  double power = wkt_powers_of_ten[precision];
+  double scaled = magnitude * power;
+  uint64_t integral;
+  char fraction[WKT_MAX_PRECISION];
+
+  if (scaled < 4503599627370496.0) {
+    /*
+     * Halves are representable at this magnitude, so rounding the product to a double never moves it across .5. Only
+     * when the rounded product ends in exactly .5 the rounding error of the multiplication decides which way to round.
+     */
+    double rounded = floor(scaled);
+    double rest = scaled - rounded;
+    if (rest > 0.5 || (rest == 0.5 && fma(magnitude, power, -scaled) >= 0)) {
+      rounded += 1;
+    }
+    uint64_t digits = (uint64_t) rounded;
+    for (int i = precision - 1; i >= 0; i--) {
+      fraction[i] = (char)('0' + digits % 10);
+      digits /= 10;
+    }
+    integral = digits;
+  } else {
+    /* Expand the fraction digit by digit in fixed point, which is exact */
+    double whole = floor(magnitude);
+    uint64_t mask = ((uint64_t) 1 << WKT_FRACTION_BITS) - 1;
+    uint64_t bits = (uint64_t) ldexp(magnitude - whole, WKT_FRACTION_BITS);
+    integral = (uint64_t) whole;
+    for (int i = 0; i < precision; i++) {
+      bits *= 10;
+      fraction[i] = (char)('0' + (bits >> WKT_FRACTION_BITS));
+      bits &= mask;
+    }
+    if (bits >= ((uint64_t) 1 << (WKT_FRACTION_BITS - 1))) {
+      int i = precision - 1;
+      while (i >= 0 && fraction[i] == '9') {
+        fraction[i--] = '0';
+      }
+      if (i >= 0) {
+        fraction[i]++;
+      } else {
+        integral++;
+      }
+    }
+  }
+
+  int fraction_length = precision;
+  while (fraction_length > 0 && fraction[fraction_length - 1] == '0') {
+    fraction_length--;
+  }
+
+  int length = 0;
+  if (value < 0 && (integral > 0 || fraction_length > 0)) {
+    buffer[length++] = '-';
+  }
+
+  char tmp[20];
+  int count = 0;
+  do {
+    tmp[count++] = (char)('0' + integral % 10);
+    integral /= 10;
+  } while (integral > 0);
+  while (count > 0) {
+    buffer[length++] = tmp[--count];
+  }
+
+  if (fraction_length > 0) {
+    buffer[length++] = '.';
+    memcpy(buffer + length, fraction, (size_t) fraction_length);
+    length += fraction_length;
+  }
+  return length;
+}
 
 static int wkt_coordinates(const geom_consumer_t *consumer, const geom_header_t *header, size_t point_count, const double *coords, int skip_coords, errorstream_t *error) {
   int result = SQLITE_OK;
+  char point[WKT_POINT_BUFFER_SIZE];
 
   wkt_writer_t *writer = (wkt_writer_t *) consumer;
 
   int first = writer->children[writer->offset] == 0;
   if (first) {
-    result = strbuf_append(&writer->strbuf, "(");
+    result = strbuf_append_chars(&writer->strbuf, "(", 1);
   }
   writer->children[writer->offset]++;
 
@@ -133,54 +236,25 @@ static int wkt_coordinates(const geom_consumer_t *consumer, const geom_header_t
 
   int offset = skip_coords;
   point_count = (offset == 0) ? point_count : (point_count - (offset / header->coord_size));
-  if (header->coord_size == 2) {
-    for (size_t i = 0; i < point_count; i++) {
-      double x = coords[offset++];
-      double y = coords[offset++];
-
-      if (first) {
-        result = strbuf_append(&writer->strbuf, WKT_COORD_2, x, y);
-        first = 0;
-      } else {
-        result = strbuf_append(&writer->strbuf, ", "WKT_COORD_2, x, y);
-      }
-
-      if (result != SQLITE_OK) {
-        goto exit;
-      }
+  for (size_t i = 0; i < point_count; i++) {
+    int length = 0;
+    if (first) {
+      first = 0;
+    } else {
+      point[length++] = ',';
+      point[length++] = ' ';
     }
-  } else if (header->coord_size == 3) {
-    for (size_t i = 0; i < point_count; i++) {
-      double x = coords[offset++];
-      double y = coords[offset++];
-      double zm = coords[offset++];
-      if (first) {
-        result = strbuf_append(&writer->strbuf, WKT_COORD_3, x, y, zm);
-        first = 0;
-      } else {
-        result = strbuf_append(&writer->strbuf, ", "WKT_COORD_3, x, y, zm);
-      }
 
-      if (result != SQLITE_OK) {
-        goto exit;
+    for (uint32_t j = 0; j < header->coord_size; j++) {
+      if (j > 0) {
+        point[length++] = ' ';
       }
+      length += wkt_format_ordinate(writer, coords[offset++], point + length);
     }
-  } else if (header->coord_size == 4) {
-    for (size_t i = 0; i < point_count; i++) {
-      double x = coords[offset++];
-      double y = coords[offset++];
-      double z = coords[offset++];
-      double m = coords[offset++];
-      if (first) {
-        result = strbuf_append(&writer->strbuf, WKT_COORD_4, x, y, z, m);
-        first = 0;
-      } else {
-        result = strbuf_append(&writer->strbuf, ", "WKT_COORD_4, x, y, z, m);
-      }
 
-      if (result != SQLITE_OK) {
-        goto exit;
-      }
+    result = strbuf_append_chars(&writer->strbuf, point, (size_t) length);
+    if (result != SQLITE_OK) {
+      goto exit;
     }
   }
 
@@ -204,12 +278,18 @@ static int wkt_end_geometry(const geom_consumer_t *consumer, const geom_header_t
 }
 
 int wkt_writer_init(wkt_writer_t *writer) {
+  return wkt_writer_init_precision(writer, -1, 256);
+}
+
+int wkt_writer_init_precision(wkt_writer_t *writer, int precision, size_t initial_size) {
   geom_consumer_init(&writer->geom_consumer, NULL, NULL, wkt_begin_geometry, wkt_end_geometry, wkt_coordinates);
-  int res = strbuf_init(&writer->strbuf, 256);
+  int res = strbuf_init(&writer->strbuf, initial_size);
   if (res != SQLITE_OK) {
     return res;
   }
 
+  writer->precision = precision > WKT_MAX_PRECISION ? WKT_MAX_PRECISION : precision;
+
   memset(writer->type, 0, GEOM_MAX_DEPTH);
   memset(writer->children, 0, GEOM_MAX_DEPTH);
   writer->offset = -1;
@@ -221,8 +301,10 @@ geom_consumer_t *wkt_writer_geom_consumer(wkt_writer_t *writer) {
   return &writer->geom_consumer;
 }
 
-void wkt_writer_destroy(wkt_writer_t *writer) {
-  strbuf_destroy(&writer->strbuf);
+void wkt_writer_destroy(wkt_writer_t *writer, int free_data) {
+  if (free_data) {
+    strbuf_destroy(&writer->strbuf);
+  }
 }
 
 char *wkt_writer_getwkt(wkt_writer_t *writer) {
@@ -267,6 +349,16 @@ typedef struct {
   wkt_token token;
   double token_value;
   i18n_locale_t *locale;
+
+  /* Incremental input; read is NULL when the entire text is in memory */
+  wkt_read_func read;
+  void *read_data;
+  errorstream_t *read_error;
+  int read_result;
+  char *buffer;
+  size_t capacity;
+  size_t offset;
+  int eof;
 } wkt_tokenizer_t;
 
 typedef int(*read_body_function)(wkt_tokenizer_t *, const geom_header_t *, geom_consumer_t const *, errorstream_t *);
@@ -278,9 +370,82 @@ static void wkt_tokenizer_init(wkt_tokenizer_t *tok, const char *data, size_t le
   tok->token_position = 0;
   tok->end = data + length;
   tok->locale = locale;
+  tok->read = NULL;
+  tok->read_data = NULL;
+  tok->read_error = NULL;
+  tok->read_result = SQLITE_OK;
+  tok->buffer = NULL;
+  tok->capacity = 0;
+  tok->offset = 0;
+  tok->eof = 1;
+}
+
+/*
+ * The tokenizer keeps at least this many characters of input ahead of the current position in its buffer, unless the
+ * end of the input has been reached. A single token can therefore never span more than one fill of the buffer.
+ */
+#define WKT_TOKENIZER_LOOKAHEAD 256
+#define WKT_TOKENIZER_BUFFER_SIZE 65536
+
+static int wkt_tokenizer_init_stream(wkt_tokenizer_t *tok, wkt_read_func read, void *read_data, i18n_locale_t *locale, errorstream_t *error) {
+  char *buffer = (char *)sqlite3_malloc(WKT_TOKENIZER_BUFFER_SIZE + 1);
+  if (buffer == NULL) {
+    return SQLITE_NOMEM;
+  }
+  buffer[0] = '\0';
+
+  wkt_tokenizer_init(tok, buffer, 0, locale);
+  tok->read = read;
+  tok->read_data = read_data;
+  tok->read_error = error;
+  tok->buffer = buffer;
+  tok->capacity = WKT_TOKENIZER_BUFFER_SIZE;
+  tok->eof = 0;
+  return SQLITE_OK;
+}
+
+static void wkt_tokenizer_destroy(wkt_tokenizer_t *tok) {
+  sqlite3_free(tok->buffer);
+  tok->buffer = NULL;
+}
+
+/*
+ * Moves the unread part of the buffer to the front and reads input until the buffer is full or the input is
+ * exhausted. The buffer is kept null terminated so that i18n_strtod never reads past the available input.
+ */
+static int wkt_tokenizer_fill(wkt_tokenizer_t *tok) {
+  size_t remaining = (size_t)(tok->end - tok->position);
+  tok->offset += (size_t)(tok->position - tok->start);
+  memmove(tok->buffer, tok->position, remaining);
+
+  while (remaining < tok->capacity) {
+    size_t length = tok->capacity - remaining;
+    int result = tok->read(tok->read_data, tok->buffer + remaining, &length, tok->read_error);
+    if (result != SQLITE_OK) {
+      tok->read_result = result;
+      tok->eof = 1;
+      break;
+    }
+    if (length == 0) {
+      tok->eof = 1;
+      break;
+    }
+    remaining += length;
+  }
+
+  tok->buffer[remaining] = '\0';
+  tok->start = tok->buffer;
+  tok->position = tok->buffer;
+  tok->end = tok->buffer + remaining;
+  return tok->read_result;
 }
 
 static void wkt_tokenizer_error(wkt_tokenizer_t *tok, errorstream_t *error, const char *msg) {
+  if (tok->read_result != SQLITE_OK) {
+    /* The input could not be read; the read function has already reported why */
+    return;
+  }
+
   if (tok-> token_length > 0) {
     error_append(error, "%s at column %d: %.*s", msg, tok->token_position, tok->token_length, tok->token_start);
   } else {
@@ -289,20 +454,31 @@ static void wkt_tokenizer_error(wkt_tokenizer_t *tok, errorstream_t *error, cons
 }
 
 static void wkt_tokenizer_next(wkt_tokenizer_t *tok) {
-  const char *start = tok->position;
-  const char *end = tok->end;
-  while (start < end) {
-    char c = *start;
-    while (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+  const char *start;
+  const char *end;
+  for (;;) {
+    start = tok->position;
+    end = tok->end;
+    while (start < end && (*start == ' ' || *start == '\t' || *start == '\r' || *start == '\n')) {
       start++;
-      if (start == end) {
-        goto eof;
-      }
-      c = *start;
     }
+    tok->position = start;
+
+    if (tok->eof || (size_t)(end - start) >= WKT_TOKENIZER_LOOKAHEAD) {
+      break;
+    }
+
+    if (wkt_tokenizer_fill(tok) != SQLITE_OK) {
+      tok->token_length = 0;
+      goto error;
+    }
+  }
+
+  if (start < end) {
+    char c = *start;
 
     tok->token_start = start;
-    tok->token_position = (start - tok->start);
+    tok->token_position = (int)(tok->offset + (size_t)(start - tok->start));
     if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z')) {
       const char *tok_end = start;
       do {
@@ -349,9 +525,14 @@ static void wkt_tokenizer_next(wkt_tokenizer_t *tok) {
 
       return;
     } else if (('0' <= c && c <= '9') || c == '-' || c == '+') {
-      char *tok_end = NULL;
-      tok->token_value = i18n_strtod(start, &tok_end, tok->locale);
-      if (tok_end == NULL) {
+      const char *tok_end = NULL;
+      if (!fp_parse_double(start, end, &tok_end, &tok->token_value)) {
+        char *strtod_end = NULL;
+        tok->token_value = i18n_strtod(start, &strtod_end, tok->locale);
+        tok_end = strtod_end;
+      }
+      if (tok_end == NULL || (tok_end == end && !tok->eof)) {
+        /* A number that does not fit in the lookahead of the buffer */
         tok->token_length = 0;
         goto error;
       } else {
@@ -380,7 +561,7 @@ static void wkt_tokenizer_next(wkt_tokenizer_t *tok) {
       goto error;
     }
   }
-eof:
+
   tok->position = tok->end;
   tok->token = WKT_EOF;
   tok->token_length = 0;
@@ -1150,3 +1331,34 @@ int wkt_read_geometry(char const *data, size_t length, geom_consumer_t const *co
 exit:
   return result;
 }
+
+int wkt_read_geometry_stream(wkt_read_func read, void *read_data, geom_consumer_t const *consumer, i18n_locale_t *locale, errorstream_t *error) {
+  int result = SQLITE_OK;
+  wkt_tokenizer_t tok;
+
+  result = wkt_tokenizer_init_stream(&tok, read, read_data, locale, error);
+  if (result != SQLITE_OK) {
+    return result;
+  }
+
+  result = consumer->begin(consumer, error);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  wkt_tokenizer_next(&tok);
+
+  result = wkt_read_geometry_tagged_text(&tok, NULL, consumer, error);
+  if (result != SQLITE_OK) {
+    goto exit;
+  }
+
+  result = consumer->end(consumer, error);
+
+exit:
+  if (tok.read_result != SQLITE_OK) {
+    result = tok.read_result;
+  }
+  wkt_tokenizer_destroy(&tok);
+  return result;
+}
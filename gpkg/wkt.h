@@ -44,6 +44,8 @@ typedef struct {
   /** @private */
   int offset;
   /** @private */
+  int precision;
+  /** @private */
   i18n_locale_t *locale;
 } wkt_writer_t;
 
@@ -54,11 +56,23 @@ typedef struct {
  */
 int wkt_writer_init(wkt_writer_t *writer);
 
+/**
+ * Initializes a Well-Known Text writer that writes coordinates with a fixed number of decimal places.
+ * @param writer the writer to initialize
+ * @param precision the maximum number of decimal places, trailing zeros are omitted. A negative value writes each
+ *                  coordinate using the shortest representation that parses back to the same value.
+ * @param initial_size the initial size of the output buffer in bytes
+ * @return SQLITE_OK on success, an error code otherwise
+ */
+int wkt_writer_init_precision(wkt_writer_t *writer, int precision, size_t initial_size);
+
 /**
  * Destroys a Well-Known Text writer.
  * @param writer the writer to destroy
+ * @param free_data if non-zero the text buffer is freed; otherwise ownership of the buffer returned by
+ *                  wkt_writer_getwkt() passes to the caller, who must release it with sqlite3_free()
  */
-void wkt_writer_destroy(wkt_writer_t *writer);
+void wkt_writer_destroy(wkt_writer_t *writer, int free_data);
 
 /**
  * Returns a Well-Known Text writer as a geometry consumer. This function should be used
@@ -93,6 +107,31 @@ size_t wkt_writer_length(wkt_writer_t *writer);
  */
 int wkt_read_geometry(char const *data, size_t length, geom_consumer_t const *consumer, i18n_locale_t *locale, errorstream_t *error);
 
+/**
+ * Reads the next chunk of Well-Known Text input.
+ *
+ * @param read_data the read_data pointer that was passed to wkt_read_geometry_stream()
+ * @param buffer the buffer to copy the input to
+ * @param[in,out] length the size of buffer on input; the number of characters that were copied on output. A length
+ *                       of 0 indicates the end of the input.
+ * @param[out] error the error buffer to write to in case of I/O errors
+ * @return SQLITE_OK on success, an error code otherwise
+ */
+typedef int (*wkt_read_func)(void *read_data, char *buffer, size_t *length, errorstream_t *error);
+
+/**
+ * Parses a Well-Known Text geometry that is read incrementally using the given read function. Only a fixed size
+ * window of the text is kept in memory, so this function can be used to parse geometries without materializing the
+ * complete text first.
+ *
+ * @param read the function that provides the input
+ * @param read_data the user data that is passed to read
+ * @param consumer the geometry consumer that will receive the parsed geometry
+ * @param[out] error the error buffer to write to in case of I/O errors
+ * @return SQLITE_OK on success, an error code otherwise
+ */
+int wkt_read_geometry_stream(wkt_read_func read, void *read_data, geom_consumer_t const *consumer, i18n_locale_t *locale, errorstream_t *error);
+
 /** @} */
 
 #endif
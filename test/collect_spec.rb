@@ -0,0 +1,67 @@
+# Copyright 2013 Luciad (http://www.luciad.com)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require_relative 'gpkg'
+
+describe 'ST_Collect' do
+  before(:each) do
+    @db.execute('CREATE TABLE test (id INTEGER PRIMARY KEY, geom BLOB)')
+  end
+
+  def insert(*wkts)
+    wkts.each do |wkt|
+      @db.execute("INSERT INTO test (geom) VALUES (GeomFromText('#{wkt}'))")
+    end
+  end
+
+  it 'should return NULL when there are no geometries' do
+    expect('SELECT ST_Collect(geom) FROM test').to have_result nil
+    @db.execute('INSERT INTO test (geom) VALUES (NULL)')
+    expect('SELECT ST_Collect(geom) FROM test').to have_result nil
+  end
+
+  it 'should raise an error on invalid input' do
+    @db.execute("INSERT INTO test (geom) VALUES (x'FFFFFFFFFF')")
+    expect('SELECT ST_Collect(geom) FROM test').to raise_sql_error
+  end
+
+  it 'should return a multi geometry when all geometries have the same type' do
+    insert 'Point(1 2)', 'Point(3 4)'
+    expect('SELECT ST_AsText(ST_Collect(geom)) FROM test').to have_result 'MultiPoint ((1 2), (3 4))'
+    @db.execute('DELETE FROM test')
+    insert 'LineString(0 0, 1 1)', 'LineString(2 2, 3 3)'
+    expect('SELECT ST_AsText(ST_Collect(geom)) FROM test').to have_result 'MultiLineString ((0 0, 1 1), (2 2, 3 3))'
+    @db.execute('DELETE FROM test')
+    insert 'Polygon((0 0, 1 0, 1 1, 0 0))', 'Polygon((2 2, 3 2, 3 3, 2 2))'
+    expect('SELECT ST_AsText(ST_Collect(geom)) FROM test').to have_result 'MultiPolygon (((0 0, 1 0, 1 1, 0 0)), ((2 2, 3 2, 3 3, 2 2)))'
+  end
+
+  it 'should return a geometry collection for mixed geometry types' do
+    insert 'Point(1 2)', 'LineString(3 4, 5 6)', 'MultiPoint((7 8))'
+    expect('SELECT ST_AsText(ST_Collect(geom)) FROM test').to have_result 'GeometryCollection (Point (1 2), LineString (3 4, 5 6), MultiPoint ((7 8)))'
+  end
+
+  it 'should preserve the coordinate type, SRID and envelope' do
+    insert 'Point Z(1 2 3)', 'Point Z(4 5 6)'
+    expect('SELECT ST_AsText(ST_Collect(geom)) FROM test').to have_result 'MultiPoint Z ((1 2 3), (4 5 6))'
+    expect("SELECT ST_SRID(ST_Collect(GeomFromText('Point(1 2)', 4326)))").to have_result 4326
+    expect('SELECT ST_MinX(ST_Collect(geom)) || ST_MaxY(ST_Collect(geom)) FROM test').to have_result '1.05.0'
+  end
+
+  it 'should raise an error when SRIDs or coordinate types differ' do
+    expect("SELECT ST_Collect(GeomFromText(printf('Point(%d 2)', id), id)) FROM (SELECT 1 AS id UNION ALL SELECT 2)").to raise_sql_error
+    insert 'Point(1 2)', 'Point Z(4 5 6)'
+    expect('SELECT ST_Collect(geom) FROM test').to raise_sql_error
+  end
+end
@@ -395,6 +395,11 @@ if ENV['GPKG_GEOM_FUNC']
       expect("SELECT AsText(ST_Boundary(GeomFromText('LineString (0 100, 0 10, 80 10)')))").to have_result 'MultiPoint ((0 100), (80 10))'
       expect("SELECT AsText(ST_Boundary(GeomFromText('Polygon((0 0, 2 0, 2 2, 1 1, 0 2, 0 0))')))").to have_result 'LineString (0 0, 2 0, 2 2, 1 1, 0 2, 0 0)'
     end
+
+    it 'should preserve all coordinates and Z values' do
+      expect("SELECT AsText(ST_Boundary(GeomFromText('Polygon((0 0, 1 0, 2 0, 3 0, 4 0, 5 0, 6 0, 7 0, 8 0, 9 0, 10 0, 11 0, 11 1, 0 1, 0 0))')))").to have_result 'LineString (0 0, 1 0, 2 0, 3 0, 4 0, 5 0, 6 0, 7 0, 8 0, 9 0, 10 0, 11 0, 11 1, 0 1, 0 0)'
+      expect("SELECT AsText(ST_Boundary(GeomFromText('Polygon Z((0 0 1, 2 0 2, 2 2 3, 0 0 1))')))").to have_result 'LineString Z (0 0 1, 2 0 2, 2 2 3, 0 0 1)'
+    end
   end
 
   describe 'ST_ConvexHull' do
@@ -509,4 +514,143 @@ if ENV['GPKG_GEOM_FUNC']
       expect("SELECT AsText(ST_Union(GeomFromText('Polygon((0 0, 2 0, 2 2, 0 2, 0 0))'), GeomFromText('Polygon((1 0, 3 0, 3 2, 1 2, 1 0))')))").to have_result 'Polygon ((1 0, 0 0, 0 2, 1 2, 2 2, 3 2, 3 0, 2 0, 1 0))'
     end
   end
+
+  describe 'ST_Union aggregate' do
+    before(:each) do
+      @db.execute('CREATE TABLE test (id INTEGER PRIMARY KEY, geom BLOB)')
+      @db.execute(
+          "WITH RECURSIVE c(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM c WHERE i < 10) " \
+          "INSERT INTO test SELECT i, GeomFromText(printf('Polygon((0 0, %d 0, %d %d, 0 %d, 0 0))', i, i, i, i)) FROM c"
+      )
+    end
+
+    it 'should return NULL when there are no geometries' do
+      expect('SELECT ST_Union(geom) FROM test WHERE id > 10').to have_result nil
+      expect('SELECT ST_Union(NULL) FROM test').to have_result nil
+    end
+
+    it 'should raise an error on invalid input' do
+      expect("SELECT ST_Union(x'FFFFFFFFFF') FROM test").to raise_sql_error
+    end
+
+    it 'should raise an error when SRIDs differ' do
+      expect("SELECT ST_Union(GeomFromText(printf('Point(%d 0)', id), id)) FROM test").to raise_sql_error
+    end
+
+    it 'should dissolve all geometries' do
+      expect('SELECT ST_Area(ST_Union(geom)) FROM test').to have_result 100.0
+      expect('SELECT ST_Area(ST_Union(geom)) FROM test WHERE id < 4').to have_result 9.0
+    end
+
+    it 'should keep disjoint geometries apart' do
+      expect("SELECT ST_NumGeometries(ST_Union(GeomFromText(printf('Point(%d 0)', id)))) FROM test").to have_result 10
+    end
+  end
+
+  describe 'Geometry cache' do
+    before(:each) do
+      @db.execute('CREATE TABLE test (id INTEGER PRIMARY KEY, geom BLOB)')
+      @db.execute(
+          "WITH RECURSIVE c(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM c WHERE i < 10) " \
+          "INSERT INTO test SELECT i, GeomFromText(printf('Polygon((0 0, %d 0, %d %d, 0 %d, 0 0))', i, i, i, i)) FROM c"
+      )
+    end
+
+    it 'should decode each row once when several functions are applied to it' do
+      expect('CREATE TEMP TABLE stats AS SELECT GPKG_GeometryCacheHits() AS hits, GPKG_GeometryCacheMisses() AS misses').to have_result nil
+      expect('SELECT sum(ST_Area(geom) + 2 * ST_Area(geom) + 3 * ST_Area(geom)) FROM test').to have_result 2310.0
+      expect('SELECT GPKG_GeometryCacheMisses() - misses FROM stats').to have_result 10
+      expect('SELECT GPKG_GeometryCacheHits() - hits FROM stats').to have_result 20
+    end
+
+    it 'should not confuse rows with different geometries' do
+      expect('SELECT group_concat(ST_Area(geom)) FROM test').to have_result '1.0,4.0,9.0,16.0,25.0,36.0,49.0,64.0,81.0,100.0'
+      expect('SELECT group_concat(ST_Area(geom)) FROM test').to have_result '1.0,4.0,9.0,16.0,25.0,36.0,49.0,64.0,81.0,100.0'
+    end
+  end
+
+  describe 'Prepared geometry cache' do
+    before(:each) do
+      @db.execute('CREATE TABLE test (id INTEGER PRIMARY KEY, geom BLOB)')
+      @db.execute(
+          "WITH RECURSIVE c(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM c WHERE i < 10) " \
+          "INSERT INTO test SELECT i, GeomFromText(printf('Polygon((0 0, %d 0, %d %d, 0 %d, 0 0))', i, i, i, i)) FROM c"
+      )
+    end
+
+    it 'should reuse prepared geometries across statements' do
+      expect('CREATE TEMP TABLE stats AS SELECT GPKG_PreparedGeometryCacheHits() AS hits, GPKG_PreparedGeometryCacheMisses() AS misses').to have_result nil
+      query = "SELECT sum(ST_Intersects(GeomFromText('Polygon((0.25 0.25, 7.75 0.25, 7.75 7.75, 0.25 7.75, 0.25 0.25))'), geom)) FROM test"
+      # Only geometries that miss twice are cached
+      @db.execute(query)
+      @db.execute(query)
+      expect(query).to have_result 10
+      expect('SELECT GPKG_PreparedGeometryCacheMisses() - misses FROM stats').to have_result 2
+      expect('SELECT GPKG_PreparedGeometryCacheHits() - hits FROM stats').to have_result 1
+    end
+  end
+
+  describe 'GEOS handles' do
+    it 'should give each thread that uses a connection its own handle' do
+      area = "SELECT ST_Area(GeomFromText('Polygon((0 0, 1 0, 1 1, 0 1, 0 0))'))"
+      expect(area).to have_result 1.0
+      expect('SELECT GPKG_GEOSHandleCount()').to have_result 1
+
+      started = Queue.new
+      finish = Queue.new
+      threads = Array.new(3) do
+        Thread.new do
+          @db.execute(area)
+          started << true
+          finish.pop
+        end
+      end
+      3.times { started.pop }
+      expect('SELECT GPKG_GEOSHandleCount()').to have_result 4
+      3.times { finish << true }
+      threads.each(&:join)
+
+      # Threads that start after others have exited take over their handles
+      10.times do
+        Array.new(3) { Thread.new { @db.execute(area) } }.each(&:join)
+      end
+      expect('SELECT GPKG_GEOSHandleCount() < 10').to have_result 1
+    end
+  end
+
+  describe 'Envelope checks' do
+    it 'should decide predicates from the blob envelopes without decoding the geometries' do
+      expect('CREATE TEMP TABLE stats AS SELECT GPKG_GeometryCacheMisses() AS misses').to have_result nil
+      expect("SELECT ST_Intersects(GeomFromText('Polygon((0 0, 2 0, 2 2, 0 2, 0 0))'), GeomFromText('Polygon((5 5, 6 5, 6 6, 5 6, 5 5))'))").to have_result 0
+      expect("SELECT ST_Disjoint(GeomFromText('Polygon((0 0, 2 0, 2 2, 0 2, 0 0))'), GeomFromText('Polygon((5 5, 6 5, 6 6, 5 6, 5 5))'))").to have_result 1
+      expect("SELECT ST_Contains(GeomFromText('Polygon((0 0, 2 0, 2 2, 0 2, 0 0))'), GeomFromText('Polygon((1 1, 3 1, 3 3, 1 3, 1 1))'))").to have_result 0
+      expect("SELECT ST_Within(GeomFromText('Polygon((0 0, 2 0, 2 2, 0 2, 0 0))'), GeomFromText('Polygon((1 1, 3 1, 3 3, 1 3, 1 1))'))").to have_result 0
+      expect('SELECT GPKG_GeometryCacheMisses() - misses FROM stats').to have_result 0
+    end
+
+    it 'should still compare geometries with different SRIDs' do
+      expect("SELECT ST_Intersects(GeomFromText('Point(0 0)', 4326), GeomFromText('Point(5 5)', 3857))").to raise_sql_error
+    end
+  end
+end
+
+describe 'ST_HilbertKey' do
+  it 'should return NULL when passed NULL' do
+    expect('SELECT ST_HilbertKey(NULL, 0, 0, 1, 1)').to have_result nil
+  end
+
+  it 'should return NULL for empty geometries' do
+    expect("SELECT ST_HilbertKey(GeomFromText('Point EMPTY'), 0, 0, 1, 1)").to have_result nil
+  end
+
+  it 'should visit the quadrants of the extent in Hilbert order' do
+    expect(
+        "SELECT group_concat(n) FROM (SELECT n FROM (SELECT 1 AS n, 'Point(1.5 0.5)' AS p UNION ALL SELECT 2, 'Point(0.5 1.5)' " \
+        "UNION ALL SELECT 3, 'Point(1.5 1.5)' UNION ALL SELECT 4, 'Point(0.5 0.5)') ORDER BY ST_HilbertKey(GeomFromText(p), 0, 0, 2, 2))"
+    ).to have_result '4,2,3,1'
+  end
+
+  it 'should use the center of the envelope' do
+    expect("SELECT ST_HilbertKey(GeomFromText('LineString(0 0, 0 2)'), 0, 0, 2, 2) = ST_HilbertKey(GeomFromText('Point(0 1)'), 0, 0, 2, 2)").to have_result 1
+  end
 end
\ No newline at end of file
@@ -0,0 +1,60 @@
+# Copyright 2013 Luciad (http://www.luciad.com)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require_relative 'gpkg'
+
+describe 'gpkg_knn' do
+  before(:each) do
+    @db.execute('SELECT InitSpatialMetadata()')
+    @db.execute('CREATE TABLE test (id INTEGER PRIMARY KEY)')
+    @db.execute("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)")
+    # A 40 x 25 grid of points at (i % 40, i / 40)
+    @db.execute(
+        "WITH RECURSIVE c(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM c WHERE i < 999) " \
+        "INSERT INTO test (id, geom) SELECT i + 1, GeomFromText(printf('Point(%d %d)', i % 40, i / 40)) FROM c"
+    )
+    @db.execute("SELECT CreateSpatialIndex('test', 'geom', 'id')")
+  end
+
+  it 'should return the nearest rows in order of increasing distance' do
+    expect("SELECT group_concat(fid) FROM gpkg_knn('test', 'geom', 10.2, 5.1, 3)").to have_result '211,212,251'
+    expect("SELECT round(distance, 6) FROM gpkg_knn('test', 'geom', 10.2, 5.1, 1)").to have_result Math.sqrt(0.05).round(6)
+  end
+
+  it 'should return the geometry of each row' do
+    expect("SELECT AsText(geometry) FROM gpkg_knn('test', 'geom', 10.2, 5.1, 1)").to have_result 'Point (10 5)'
+  end
+
+  it 'should return all rows without a limit' do
+    expect("SELECT count(*) FROM gpkg_knn('test', 'geom', 10.2, 5.1)").to have_result 1000
+    expect("SELECT count(*) FROM gpkg_knn('test', 'geom', 10.2, 5.1, 0)").to have_result 0
+    expect("SELECT count(*) FROM gpkg_knn('test', 'geom', NULL, 5.1, 3)").to have_result 0
+  end
+
+  it 'should use the exact distance to the geometry' do
+    @db.execute('CREATE TABLE shapes (id INTEGER PRIMARY KEY)')
+    @db.execute("SELECT AddGeometryColumn('shapes', 'geom', 'polygon', 0, 0, 0)")
+    @db.execute("INSERT INTO shapes (id, geom) VALUES (1, GeomFromText('Polygon((0 0, 10 0, 10 10, 0 10, 0 0), (4 4, 6 4, 6 6, 4 6, 4 4))'))")
+    @db.execute("INSERT INTO shapes (id, geom) VALUES (2, GeomFromText('Polygon((20 0, 30 10, 20 10, 20 0))'))")
+    @db.execute("SELECT CreateSpatialIndex('shapes', 'geom', 'id')")
+    expect("SELECT distance FROM gpkg_knn('shapes', 'geom', 2, 2, 1)").to have_result 0.0
+    expect("SELECT distance FROM gpkg_knn('shapes', 'geom', 5, 5, 1)").to have_result 1.0
+    # Inside the bounding box of the triangle
+    expect("SELECT round(distance, 6) FROM gpkg_knn('shapes', 'geom', 26, 2, 1)").to have_result Math.sqrt(8.0).round(6)
+  end
+
+  it 'should raise an error if the column has no spatial index' do
+    expect("SELECT count(*) FROM gpkg_knn('test', 'other', 1, 1, 1)").to raise_sql_error
+  end
+end
@@ -188,6 +188,10 @@ describe 'ST_MinM' do
   it 'should return NULL if M is undefined' do
     expect("SELECT ST_MinM(GeomFromText('Point Z (1 5 4)'))").to have_result nil
   end
+
+  it 'should return the minimum M coordinate of a line string' do
+    expect("SELECT ST_MinM(GeomFromText('LineString ZM (1 2 3 4, 5 6 7 -8, 9 10 11 12, 13 14 15 16, 17 18 19 20)'))").to have_result -8.0
+  end
 end
 
 describe 'ST_MaxM' do
@@ -238,4 +242,70 @@ describe 'ST_MaxZ' do
   it 'should return NULL if Z is undefined' do
     expect("SELECT ST_MaxZ(GeomFromText('Point M (1 5 4)'))").to have_result nil
   end
-end
\ No newline at end of file
+
+  it 'should return the maximum Z coordinate of a line string' do
+    expect("SELECT ST_MaxZ(GeomFromText('LineString Z (1 2 3, 4 5 6, 7 8 90, 10 11 12, 13 14 15, 16 17 18, 19 20 21)'))").to have_result 90.0
+  end
+end
+
+describe 'GPKG_Envelope' do
+  it 'should return NULL when passed NULL' do
+    expect('SELECT GPKG_Envelope(NULL)').to have_result nil
+  end
+
+  it 'should return NULL for empty geometries' do
+    expect("SELECT GPKG_Envelope(GeomFromText('Point EMPTY'))").to have_result nil
+  end
+
+  it 'should return the envelope as a polygon' do
+    expect("SELECT AsText(GPKG_Envelope(GeomFromText('LineString(1 2, 5 -3)')))").to have_result 'Polygon ((1 -3, 5 -3, 5 2, 1 2, 1 -3))'
+  end
+
+  it 'should preserve the SRID' do
+    expect("SELECT ST_SRID(GPKG_Envelope(GeomFromText('Point(1 2)', 4326)))").to have_result 4326
+  end
+end
+
+describe 'ST_Extent' do
+  before(:each) do
+    @db.execute('CREATE TABLE test (id INTEGER PRIMARY KEY, geom BLOB)')
+  end
+
+  it 'should return NULL when there are no geometries' do
+    expect('SELECT ST_Extent(geom) FROM test').to have_result nil
+    @db.execute("INSERT INTO test (geom) VALUES (NULL), (GeomFromText('Point EMPTY'))")
+    expect('SELECT ST_Extent(geom) FROM test').to have_result nil
+  end
+
+  it 'should raise an error on invalid input' do
+    @db.execute("INSERT INTO test (geom) VALUES (x'FFFFFFFFFF')")
+    expect('SELECT ST_Extent(geom) FROM test').to raise_sql_error
+  end
+
+  it 'should return the envelope of all geometries as a polygon' do
+    @db.execute("INSERT INTO test (geom) VALUES (GeomFromText('Point(-1 7)')), (GeomFromText('LineString(1 2, 5 -3)')), (NULL), (GeomFromText('Polygon EMPTY'))")
+    expect('SELECT AsText(ST_Extent(geom)) FROM test').to have_result 'Polygon ((-1 -3, 5 -3, 5 7, -1 7, -1 -3))'
+    expect('SELECT ST_MaxX(Extent(geom)) FROM test').to have_result 5.0
+  end
+
+  it 'should compute an extent per group' do
+    @db.execute("INSERT INTO test (id, geom) SELECT value, GeomFromText(printf('Point(%d %d)', value, value * 2)) FROM (WITH RECURSIVE c(value) AS (SELECT 1 UNION ALL SELECT value + 1 FROM c WHERE value < 10) SELECT value FROM c)")
+    expect("SELECT group_concat(x, ' ') FROM (SELECT ST_MinX(ST_Extent(geom)) || '-' || ST_MaxY(ST_Extent(geom)) AS x FROM test GROUP BY id % 2 ORDER BY id % 2)").to have_result '2.0-20.0 1.0-18.0'
+  end
+
+  it 'should preserve the SRID' do
+    @db.execute("INSERT INTO test (geom) VALUES (GeomFromText('Point(1 2)', 4326)), (GeomFromText('Point(3 4)', 4326))")
+    expect('SELECT ST_SRID(ST_Extent(geom)) FROM test').to have_result 4326
+  end
+
+  it 'should raise an error when SRIDs differ' do
+    @db.execute("INSERT INTO test (geom) VALUES (GeomFromText('Point(1 2)', 4326)), (GeomFromText('Point(3 4)', 3857))")
+    expect('SELECT ST_Extent(geom) FROM test').to raise_sql_error
+  end
+end
+
+describe 'Envelope cache' do
+  it 'should not return stale values for subsequent rows' do
+    expect("SELECT group_concat(ST_MinX(g) || ' ' || ST_MaxY(g), ', ') FROM (SELECT GeomFromText('Point(1 2)') AS g UNION ALL SELECT GeomFromText('Point(3 4)'))").to have_result '1.0 2.0, 3.0 4.0'
+  end
+end
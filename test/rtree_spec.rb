@@ -87,5 +87,229 @@ describe 'CreateSpatialIndex' do
     expect("SELECT count(*) FROM #{index_prefix}_test_geom").to have_result 3
   end
 
+  it 'should bulk load a multi level spatial index that can still be updated' do
+    index_min_x = mode == :gpkg ? 'minx' : 'xmin'
+    index_max_x = mode == :gpkg ? 'maxx' : 'xmax'
+    expect('SELECT InitSpatialMetadata()').to have_result nil
+    expect('CREATE TABLE test (id int)').to have_result nil
+    expect("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)").to have_result nil
+    expect("WITH RECURSIVE c(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM c WHERE i < 5000) INSERT INTO test SELECT i, GeomFromText('POINT(' || i || ' ' || (i % 7) || ')') FROM c").to have_result nil
+
+    expect("SELECT CreateSpatialIndex('test', 'geom', 'id')").to have_result nil
+    expect("SELECT count(*) FROM #{index_prefix}_test_geom").to have_result 5000
+    expect("SELECT count(*) FROM #{index_prefix}_test_geom WHERE #{index_min_x} >= 100.5 AND #{index_max_x} <= 200.5").to have_result 100
+
+    expect('DELETE FROM test WHERE id % 2 = 0').to have_result nil
+    expect("INSERT INTO test VALUES (5001, GeomFromText('POINT(150.25 1)'))").to have_result nil
+    expect("SELECT count(*) FROM #{index_prefix}_test_geom").to have_result 2501
+    expect("SELECT count(*) FROM #{index_prefix}_test_geom WHERE #{index_min_x} >= 100.5 AND #{index_max_x} <= 200.5").to have_result 51
+  end
+
+  it 'should skip NULL geometries when computing envelopes in batches' do
+    index_min_y = mode == :gpkg ? 'miny' : 'ymin'
+    expect('SELECT InitSpatialMetadata()').to have_result nil
+    expect('CREATE TABLE test (id int)').to have_result nil
+    expect("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)").to have_result nil
+    expect("WITH RECURSIVE c(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM c WHERE i < 20000) INSERT INTO test SELECT i, CASE WHEN i % 3 = 0 THEN NULL ELSE GeomFromText('POINT(' || (i % 100) || ' ' || i || ')') END FROM c").to have_result nil
+
+    expect("SELECT CreateSpatialIndex('test', 'geom', 'id')").to have_result nil
+    expect("SELECT count(*) FROM #{index_prefix}_test_geom").to have_result 13334
+    expect("SELECT count(*) FROM #{index_prefix}_test_geom WHERE #{index_min_y} > 19999.5").to have_result 1
+  end
+
+  if mode != :gpkg
+    it 'should reuse the index statements for every row updated by the triggers' do
+      expect('SELECT InitSpatialMetadata()').to have_result nil
+      expect('CREATE TABLE test (id int)').to have_result nil
+      expect("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)").to have_result nil
+      expect("SELECT CreateSpatialIndex('test', 'geom', 'id')").to have_result nil
+
+      expect("INSERT INTO test VALUES (1, GeomFromText('POINT(1 1)'))").to have_result nil
+      expect("UPDATE test SET geom = NULL WHERE id = 1").to have_result nil
+      expect('CREATE TEMP TABLE stats AS SELECT GPKG_StatementCacheMisses() AS misses').to have_result nil
+
+      expect("WITH RECURSIVE c(i) AS (SELECT 2 UNION ALL SELECT i + 1 FROM c WHERE i < 6) INSERT INTO test SELECT i, GeomFromText('POINT(' || i || '.125 2)') FROM c").to have_result nil
+      expect("UPDATE test SET geom = NULL WHERE id > 3").to have_result nil
+      expect('SELECT GPKG_StatementCacheMisses() = misses FROM stats').to have_result 1
+
+      expect("SELECT count(*) FROM idx_test_geom").to have_result 2
+      expect("SELECT xmin FROM idx_test_geom WHERE pkid = 3").to have_result 3.125
+    end
+  end
+
+  if mode == :gpkg
+    it 'should raise an error on invalid geometry blobs' do
+      expect('SELECT InitSpatialMetadata()').to have_result nil
+      expect('CREATE TABLE test (id int)').to have_result nil
+      expect("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)").to have_result nil
+      expect("INSERT INTO test VALUES (1, x'0102')").to have_result nil
+      expect("SELECT CreateSpatialIndex('test', 'geom', 'id')").to raise_sql_error
+      expect("SELECT count(*) FROM sqlite_master WHERE name = 'rtree_test_geom'").to have_result 0
+    end
+  end
+
+end
+
+
+describe 'SuspendSpatialIndex' do
+  if mode == :gpkg
+    it 'should log changes and apply them on resume' do
+      expect('SELECT InitSpatialMetadata()').to have_result nil
+      expect('CREATE TABLE test (id integer primary key)').to have_result nil
+      expect("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)").to have_result nil
+      expect("WITH RECURSIVE c(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM c WHERE i < 100) INSERT INTO test SELECT i, GeomFromText('POINT(' || i || ' 1)') FROM c").to have_result nil
+      expect("SELECT CreateSpatialIndex('test', 'geom', 'id')").to have_result nil
+
+      expect("SELECT SuspendSpatialIndex('test', 'geom')").to have_result nil
+      expect("INSERT INTO test VALUES (101, GeomFromText('POINT(5 5)'))").to have_result nil
+      expect("UPDATE test SET geom = GeomFromText('POINT(7 7)') WHERE id = 1").to have_result nil
+      expect('DELETE FROM test WHERE id = 2').to have_result nil
+      expect('SELECT count(*) FROM rtree_test_geom').to have_result 100
+      expect('SELECT count(*) FROM rtree_test_geom_log').to have_result 3
+
+      expect("SELECT ResumeSpatialIndex('test', 'geom')").to have_result nil
+      expect('SELECT count(*) FROM rtree_test_geom').to have_result 100
+      expect("SELECT count(*) FROM sqlite_master WHERE name = 'rtree_test_geom_log'").to have_result 0
+
+      # The regular index triggers are active again
+      expect('DELETE FROM test WHERE id = 3').to have_result nil
+      expect('SELECT count(*) FROM rtree_test_geom').to have_result 99
+      expect('SELECT minx FROM rtree_test_geom WHERE id = 1').to have_result 7.0
+      expect('SELECT minx FROM rtree_test_geom WHERE id = 101').to have_result 5.0
+    end
+
+    it 'should rebuild the index on resume after many changes' do
+      expect('SELECT InitSpatialMetadata()').to have_result nil
+      expect('CREATE TABLE test (id integer primary key)').to have_result nil
+      expect("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)").to have_result nil
+      expect("SELECT CreateSpatialIndex('test', 'geom', 'id')").to have_result nil
+
+      expect("SELECT SuspendSpatialIndex('test', 'geom')").to have_result nil
+      expect("WITH RECURSIVE c(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM c WHERE i < 1000) INSERT INTO test SELECT i, GeomFromText('POINT(' || i || ' 1)') FROM c").to have_result nil
+      expect('SELECT count(*) FROM rtree_test_geom').to have_result 0
+
+      expect("SELECT ResumeSpatialIndex('test', 'geom')").to have_result nil
+      expect('SELECT count(*) FROM rtree_test_geom').to have_result 1000
+      expect('SELECT count(*) FROM rtree_test_geom WHERE minx >= 100.5 AND maxx <= 200.5').to have_result 100
+    end
+
+    it 'should require an integer primary key' do
+      expect('SELECT InitSpatialMetadata()').to have_result nil
+      expect('CREATE TABLE test (id int)').to have_result nil
+      expect("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)").to have_result nil
+      expect("SELECT CreateSpatialIndex('test', 'geom', 'id')").to have_result nil
+      expect("SELECT SuspendSpatialIndex('test', 'geom')").to raise_sql_error
+    end
+  else
+    it 'should not be supported' do
+      expect('SELECT InitSpatialMetadata()').to have_result nil
+      expect('CREATE TABLE test (id integer primary key)').to have_result nil
+      expect("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)").to have_result nil
+      expect("SELECT CreateSpatialIndex('test', 'geom', 'id')").to have_result nil
+      expect("SELECT SuspendSpatialIndex('test', 'geom')").to raise_sql_error
+    end
+  end
 end
 
+describe 'CheckSpatialIndex' do
+  if mode == :gpkg
+    before(:each) do
+      @db.execute('SELECT InitSpatialMetadata()')
+      @db.execute('CREATE TABLE test (id integer primary key)')
+      @db.execute("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)")
+      @db.execute("WITH RECURSIVE c(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM c WHERE i < 1000) INSERT INTO test SELECT i, GeomFromText('POINT(' || (i / 3.0) || ' ' || (i * 1.1) || ')') FROM c")
+      @db.execute("SELECT CreateSpatialIndex('test', 'geom', 'id')")
+    end
+
+    it 'should return NULL for a consistent index' do
+      expect("SELECT CheckSpatialIndex('test', 'geom')").to have_result nil
+      expect("UPDATE test SET geom = NULL WHERE id = 5").to have_result nil
+      expect("SELECT CheckSpatialIndex('main', 'test', 'geom')").to have_result nil
+    end
+
+    it 'should report missing, extra and mismatched entries' do
+      expect('DROP TRIGGER rtree_test_geom_insert').to have_result nil
+      expect('DROP TRIGGER rtree_test_geom_delete').to have_result nil
+
+      expect("INSERT INTO test VALUES (2000, GeomFromText('POINT(1 1)'))").to have_result nil
+      expect("SELECT CheckSpatialIndex('test', 'geom')").to raise_sql_error
+      expect('DELETE FROM test WHERE id = 2000').to have_result nil
+      expect("SELECT CheckSpatialIndex('test', 'geom')").to have_result nil
+
+      expect('DELETE FROM test WHERE id = 5').to have_result nil
+      expect("SELECT CheckSpatialIndex('test', 'geom')").to raise_sql_error
+      expect('DELETE FROM rtree_test_geom WHERE id = 5').to have_result nil
+      expect("SELECT CheckSpatialIndex('test', 'geom')").to have_result nil
+
+      expect('UPDATE rtree_test_geom SET minx = minx - 1 WHERE id = 7').to have_result nil
+      expect("SELECT CheckSpatialIndex('test', 'geom')").to raise_sql_error
+    end
+
+    it 'should raise an error if the index does not exist or is suspended' do
+      expect("SELECT CheckSpatialIndex('test', 'other')").to raise_sql_error
+      expect("SELECT SuspendSpatialIndex('test', 'geom')").to have_result nil
+      expect("SELECT CheckSpatialIndex('test', 'geom')").to raise_sql_error
+    end
+  else
+    it 'should not be supported' do
+      expect('SELECT InitSpatialMetadata()').to have_result nil
+      expect('CREATE TABLE test (id integer primary key)').to have_result nil
+      expect("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)").to have_result nil
+      expect("SELECT CreateSpatialIndex('test', 'geom', 'id')").to have_result nil
+      expect("SELECT CheckSpatialIndex('test', 'geom')").to raise_sql_error
+    end
+  end
+end
+
+describe 'ClusterTable' do
+  index_prefix = mode == :gpkg ? 'rtree' : 'idx'
+
+  it 'should renumber the rows in Hilbert order' do
+    expect('SELECT InitSpatialMetadata()').to have_result nil
+    expect('CREATE TABLE test (id integer primary key, name text)').to have_result nil
+    expect("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)").to have_result nil
+    expect("INSERT INTO test VALUES (10, 'a', GeomFromText('POINT(1 0)'))").to have_result nil
+    expect("INSERT INTO test VALUES (20, 'b', GeomFromText('POINT(0 1)'))").to have_result nil
+    expect("INSERT INTO test VALUES (30, 'c', GeomFromText('POINT(1 1)'))").to have_result nil
+    expect("INSERT INTO test VALUES (40, 'd', GeomFromText('POINT(0 0)'))").to have_result nil
+
+    expect("SELECT ClusterTable('test', 'geom')").to have_result nil
+    expect("SELECT group_concat(id || name) FROM (SELECT id, name FROM test ORDER BY id)").to have_result '1d,2b,3c,4a'
+  end
+
+  it 'should not renumber the rows when the geometry column does not exist' do
+    expect('SELECT InitSpatialMetadata()').to have_result nil
+    expect('CREATE TABLE test (id integer primary key, name text)').to have_result nil
+    expect("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)").to have_result nil
+    expect("INSERT INTO test VALUES (10, 'a', GeomFromText('POINT(1 0)'))").to have_result nil
+
+    expect("SELECT ClusterTable('test', 'shape')").to raise_sql_error
+    expect("SELECT group_concat(id || name) FROM test").to have_result '10a'
+  end
+
+  if mode == :gpkg
+    it 'should rebuild the spatial index' do
+      expect('SELECT InitSpatialMetadata()').to have_result nil
+      expect('CREATE TABLE test (id integer primary key)').to have_result nil
+      expect("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)").to have_result nil
+      expect("WITH RECURSIVE c(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM c WHERE i < 1000) INSERT INTO test SELECT i * 2, GeomFromText('POINT(' || (i % 37) || ' ' || (i % 23) || ')') FROM c").to have_result nil
+      expect("SELECT CreateSpatialIndex('test', 'geom', 'id')").to have_result nil
+
+      expect("SELECT ClusterTable('test', 'geom')").to have_result nil
+      expect("SELECT min(id) || ' ' || max(id) FROM test").to have_result '1 1000'
+      expect("SELECT count(*) FROM #{index_prefix}_test_geom r JOIN test t ON t.id = r.id WHERE r.minx = ST_MinX(t.geom) AND r.miny = ST_MinY(t.geom)").to have_result 1000
+
+      # The regular index triggers are active again
+      expect('DELETE FROM test WHERE id = 1').to have_result nil
+      expect("SELECT count(*) FROM #{index_prefix}_test_geom").to have_result 999
+    end
+  else
+    it 'should not be supported for tables with a spatial index' do
+      expect('SELECT InitSpatialMetadata()').to have_result nil
+      expect('CREATE TABLE test (id integer primary key)').to have_result nil
+      expect("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)").to have_result nil
+      expect("SELECT CreateSpatialIndex('test', 'geom', 'id')").to have_result nil
+      expect("SELECT ClusterTable('test', 'geom')").to raise_sql_error
+    end
+  end
+end
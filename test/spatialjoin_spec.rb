@@ -0,0 +1,74 @@
+# Copyright 2013 Luciad (http://www.luciad.com)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require_relative 'gpkg'
+
+if ENV['GPKG_GEOM_FUNC']
+  describe 'gpkg_spatial_join' do
+    before(:each) do
+      @db.execute('SELECT InitSpatialMetadata()')
+      @db.execute('CREATE TABLE squares (id INTEGER PRIMARY KEY)')
+      @db.execute("SELECT AddGeometryColumn('squares', 'geom', 'polygon', 0, 0, 0)")
+      # A 20 x 20 grid of 2 x 2 squares with their lower left corner at (i % 20, i / 20)
+      @db.execute(
+          "WITH RECURSIVE c(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM c WHERE i < 399) " \
+          "INSERT INTO squares (id, geom) SELECT i + 1, GeomFromText(printf('Polygon((%d %d, %d %d, %d %d, %d %d, %d %d))', " \
+          "i % 20, i / 20, i % 20 + 2, i / 20, i % 20 + 2, i / 20 + 2, i % 20, i / 20 + 2, i % 20, i / 20)) FROM c"
+      )
+      @db.execute("SELECT CreateSpatialIndex('squares', 'geom', 'id')")
+      @db.execute('CREATE TABLE points (id INTEGER PRIMARY KEY)')
+      @db.execute("SELECT AddGeometryColumn('points', 'geom', 'point', 0, 0, 0)")
+      # A 10 x 10 grid of points at the centers of the odd unit cells
+      @db.execute(
+          "WITH RECURSIVE c(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM c WHERE i < 99) " \
+          "INSERT INTO points (id, geom) SELECT i + 1, GeomFromText(printf('Point(%f %f)', (i % 10) * 2 + 0.5, (i / 10) * 2 + 0.5)) FROM c"
+      )
+      @db.execute("SELECT CreateSpatialIndex('points', 'geom', 'id')")
+    end
+
+    it 'should return the pairs that satisfy the predicate' do
+      expect("SELECT count(*) FROM gpkg_spatial_join('points', 'geom', 'squares', 'geom')").to have_result 4 * 100 - 2 * 10 - 2 * 10 + 1
+      expect("SELECT group_concat(fid_b) FROM (SELECT fid_b FROM gpkg_spatial_join('points', 'geom', 'squares', 'geom') WHERE fid_a = 1 ORDER BY fid_b)").to have_result '1'
+    end
+
+    it 'should number the result rows' do
+      expect("SELECT min(rowid) || ' ' || max(rowid) || ' ' || count(DISTINCT rowid) FROM gpkg_spatial_join('points', 'geom', 'squares', 'geom')").to have_result '1 361 361'
+    end
+
+    it 'should evaluate the predicate with the first column as first argument' do
+      expect("SELECT count(*) FROM gpkg_spatial_join('points', 'geom', 'squares', 'geom', 'within')").to have_result 361
+      expect("SELECT count(*) FROM gpkg_spatial_join('squares', 'geom', 'points', 'geom', 'contains')").to have_result 361
+      expect("SELECT count(*) FROM gpkg_spatial_join('squares', 'geom', 'points', 'geom', 'within')").to have_result 0
+    end
+
+    it 'should match the unindexed join' do
+      expect("SELECT count(*) FROM gpkg_spatial_join('squares', 'geom', 'squares', 'geom')").to have_result @db.get_first_value(
+          "SELECT count(*) FROM squares a, squares b WHERE ST_Intersects(a.geom, b.geom)"
+      )
+    end
+
+    it 'should only compare envelopes for the envelope predicate' do
+      # Squares overlap the squares that are at most two cells away in both directions, including those they only touch
+      expect("SELECT count(*) FROM gpkg_spatial_join('squares', 'geom', 'squares', 'geom', 'envelope')").to have_result((5 * 20 - 6) * (5 * 20 - 6))
+    end
+
+    it 'should raise an error on unsupported predicates' do
+      expect("SELECT count(*) FROM gpkg_spatial_join('points', 'geom', 'squares', 'geom', 'disjoint')").to raise_sql_error
+    end
+
+    it 'should raise an error if a column has no spatial index' do
+      expect("SELECT count(*) FROM gpkg_spatial_join('points', 'geom', 'squares', 'other')").to raise_sql_error
+    end
+  end
+end
@@ -0,0 +1,73 @@
+# Copyright 2013 Luciad (http://www.luciad.com)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require_relative 'gpkg'
+
+if ENV['GPKG_GEOM_FUNC']
+  describe 'gpkg_spatial_query' do
+    before(:each) do
+      @db.execute('SELECT InitSpatialMetadata()')
+      @db.execute('CREATE TABLE test (id INTEGER PRIMARY KEY)')
+      @db.execute("SELECT AddGeometryColumn('test', 'geom', 'polygon', 0, 0, 0)")
+      # A 10 x 10 grid of 2 x 2 squares with their lower left corner at (i % 10, i / 10)
+      @db.execute(
+          "WITH RECURSIVE c(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM c WHERE i < 99) " \
+          "INSERT INTO test (id, geom) SELECT i + 1, GeomFromText(printf('Polygon((%d %d, %d %d, %d %d, %d %d, %d %d))', " \
+          "i % 10, i / 10, i % 10 + 2, i / 10, i % 10 + 2, i / 10 + 2, i % 10, i / 10 + 2, i % 10, i / 10)) FROM c"
+      )
+      @db.execute("SELECT CreateSpatialIndex('test', 'geom', 'id')")
+    end
+
+    it 'should return the rows that intersect the query geometry' do
+      expect("SELECT count(*) FROM gpkg_spatial_query('test', 'geom', GeomFromText('Point(4.5 4.5)'))").to have_result 4
+      expect("SELECT group_concat(fid) FROM gpkg_spatial_query('test', 'geom', GeomFromText('Point(0.5 0.5)'), 'intersects')").to have_result '1'
+    end
+
+    it 'should accept well-known text' do
+      expect("SELECT count(*) FROM gpkg_spatial_query('test', 'geom', 'Point(4.5 4.5)')").to have_result 4
+    end
+
+    it 'should return the geometry of each row' do
+      expect("SELECT AsText(geometry) FROM gpkg_spatial_query('test', 'geom', 'Point(0.5 0.5)')").to have_result 'Polygon ((0 0, 2 0, 2 2, 0 2, 0 0))'
+    end
+
+    it 'should evaluate the predicate with the column geometry as first argument' do
+      expect("SELECT count(*) FROM gpkg_spatial_query('test', 'geom', 'Polygon((0 0, 4 0, 4 4, 0 4, 0 0))', 'within')").to have_result 9
+      expect("SELECT count(*) FROM gpkg_spatial_query('test', 'geom', 'Point(4.5 4.5)', 'contains')").to have_result 4
+      expect("SELECT count(*) FROM gpkg_spatial_query('test', 'geom', 'Polygon((0 0, 4 0, 4 4, 0 4, 0 0))', 'contains')").to have_result 0
+    end
+
+    it 'should match the unindexed query' do
+      expect("SELECT count(*) FROM gpkg_spatial_query('test', 'geom', 'LineString(0.5 0.5, 6.5 3.5)')").to have_result @db.get_first_value(
+          "SELECT count(*) FROM test WHERE ST_Intersects(geom, GeomFromText('LineString(0.5 0.5, 6.5 3.5)'))"
+      )
+    end
+
+    it 'should return no rows for NULL' do
+      expect("SELECT count(*) FROM gpkg_spatial_query('test', 'geom', NULL)").to have_result 0
+    end
+
+    it 'should raise an error on unsupported predicates' do
+      expect("SELECT count(*) FROM gpkg_spatial_query('test', 'geom', 'Point(1 1)', 'disjoint')").to raise_sql_error
+    end
+
+    it 'should raise an error if the column has no spatial index' do
+      expect("SELECT count(*) FROM gpkg_spatial_query('test', 'other', 'Point(1 1)')").to raise_sql_error
+    end
+
+    it 'should raise an error when SRIDs differ' do
+      expect("SELECT count(*) FROM gpkg_spatial_query('test', 'geom', GeomFromText('Point(1 1)', 4326))").to raise_sql_error
+    end
+  end
+end
@@ -148,34 +148,37 @@ module SQLite3
       end
 
       all_rows = []
-      while (res = sqlite3_step(stmt)) == SQLite3::ROW
-        cols = sqlite3_column_count(stmt)
-        row = Array.new(cols) do |i|
-          type = sqlite3_column_type(stmt, i)
-          case type
-            when SQLite3::INTEGER
-              sqlite3_column_int64(stmt, i)
-            when SQLite3::FLOAT
-              sqlite3_column_double(stmt, i)
-            when SQLite3::TEXT
-              sqlite3_column_text(stmt, i).force_encoding(UTF8)
-            when SQLite3::BLOB
-              ptr = sqlite3_column_blob(stmt, i)
-              length = sqlite3_column_bytes(stmt, i)
-              ptr.get_bytes(0, length)
-            else
-              nil
+      begin
+        while (res = sqlite3_step(stmt)) == SQLite3::ROW
+          cols = sqlite3_column_count(stmt)
+          row = Array.new(cols) do |i|
+            type = sqlite3_column_type(stmt, i)
+            case type
+              when SQLite3::INTEGER
+                sqlite3_column_int64(stmt, i)
+              when SQLite3::FLOAT
+                sqlite3_column_double(stmt, i)
+              when SQLite3::TEXT
+                sqlite3_column_text(stmt, i).force_encoding(UTF8)
+              when SQLite3::BLOB
+                ptr = sqlite3_column_blob(stmt, i)
+                length = sqlite3_column_bytes(stmt, i)
+                ptr.get_bytes(0, length)
+              else
+                nil
+            end
+          end
+          if block_given?
+            yield row
+          else
+            all_rows << row
           end
         end
-        if block_given?
-          yield row
-        else
-          all_rows << row
-        end
+      ensure
+        # Also finalize when the block returns early
+        sqlite3_finalize(stmt)
       end
 
-      sqlite3_finalize(stmt)
-
       if res != SQLite3::DONE
         raise SQLite3Error.new(sqlite3_errmsg(@db).strip)
       end
@@ -41,4 +41,11 @@ describe 'ST_SRID' do
 
       expect("SELECT ST_SRID(ST_SRID(GeomFromText('Point(1 0)', 20), 10))").to have_result 10
   end
+
+  it 'should not modify the stored geometry when called with two parameters' do
+    @db.execute("CREATE TABLE test (geom BLOB)")
+    @db.execute("INSERT INTO test VALUES (GeomFromText('Point(1 0)', 20))")
+    expect('SELECT ST_SRID(ST_SRID(geom, 10)) FROM test').to have_result 10
+    expect('SELECT ST_SRID(geom) FROM test').to have_result 20
+  end
 end
\ No newline at end of file
@@ -0,0 +1,47 @@
+# Copyright 2013 Luciad (http://www.luciad.com)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+require_relative 'gpkg'
+
+describe 'Statement cache' do
+  it 'should reuse statements within a metadata function call' do
+    expect('SELECT InitSpatialMetadata()').to have_result nil
+    expect('CREATE TABLE test (id int)').to have_result nil
+    expect('CREATE TEMP TABLE stats AS SELECT GPKG_StatementCacheHits() AS hits, GPKG_StatementCacheMisses() AS misses').to have_result nil
+    expect("SELECT AddGeometryColumn('test', 'geom', 'point', 0, 0, 0)").to have_result nil
+    expect('SELECT GPKG_StatementCacheHits() > hits FROM stats').to have_result 1
+    expect('SELECT GPKG_StatementCacheMisses() > misses FROM stats').to have_result 1
+  end
+
+  it 'should reuse statements across metadata function calls' do
+    expect('SELECT InitSpatialMetadata()').to have_result nil
+    expect('SELECT CheckSpatialMetaData()').to have_result nil
+    expect('CREATE TEMP TABLE stats AS SELECT GPKG_StatementCacheHits() AS hits, GPKG_StatementCacheMisses() AS misses').to have_result nil
+    expect('SELECT CheckSpatialMetaData()').to have_result nil
+    expect('SELECT GPKG_StatementCacheHits() > hits FROM stats').to have_result 1
+    expect('SELECT GPKG_StatementCacheMisses() = misses FROM stats').to have_result 1
+  end
+
+  it 'should list the cached statements' do
+    expect('SELECT InitSpatialMetadata()').to have_result nil
+    expect("SELECT count(*) > 0 FROM gpkg_statement_cache WHERE sql LIKE 'PRAGMA %.table_info(%)'").to have_result 1
+  end
+
+  it 'should not keep statements after a failed metadata function call' do
+    expect('SELECT InitSpatialMetadata()').to have_result nil
+    expect('CREATE TABLE test (id int)').to have_result nil
+    expect("SELECT AddGeometryColumn('test', 'geom', 'point', 12345, 0, 0)").to raise_sql_error
+    expect('DROP TABLE test').to have_result nil
+  end
+end
@@ -156,6 +156,44 @@ describe 'AsText' do
   it  'should format XYZM curvepolygon correctly' do
     expect(query(AS_TEXT, 'curvepolygon ZM(CompoundCurve ZM((0 0 1 3, 2 2 2 5, 4 3 2 6), circularstring ZM(1 2 3 5, 3 4 3 8, 5 6 7 9)))')).to have_result 'CurvePolygon ZM (CompoundCurve ZM ((0 0 1 3, 2 2 2 5, 4 3 2 6), CircularString ZM (1 2 3 5, 3 4 3 8, 5 6 7 9)))'
   end
+
+  it 'should format coordinates using the shortest representation that round trips' do
+    expect(query(AS_TEXT, 'Point(0.1 123456789012.5)')).to have_result 'Point (0.1 123456789012.5)'
+    expect(query(AS_TEXT, 'Point(0.3333333333333333 -2.0000000000000004)')).to have_result 'Point (0.3333333333333333 -2.0000000000000004)'
+    expect(query(AS_TEXT, 'Point(1e-7 1e20)')).to have_result 'Point (1e-07 1e+20)'
+    expect(query(AS_TEXT, 'Point(0.0001 -0)')).to have_result 'Point (0.0001 0)'
+    expect(query(AS_TEXT, 'Point(1.7976931348623157e308 5e-324)')).to have_result 'Point (1.7976931348623157e+308 5e-324)'
+  end
+
+  it 'should switch to exponential notation at the same exponents as %.17g' do
+    expect(query(AS_TEXT, 'Point(1e16 1e17)')).to have_result 'Point (10000000000000000 1e+17)'
+    expect(query(AS_TEXT, 'Point(12345678901234567 123456789012345678)')).to have_result 'Point (12345678901234568 1.2345678901234568e+17)'
+    expect(query(AS_TEXT, 'Point(0.0001 0.00001)')).to have_result 'Point (0.0001 1e-05)'
+  end
+
+  it 'should format negative zero and infinities like %.10g did' do
+    expect("SELECT AsText(GeomFromWKB(x'01010000000000000000000080000000000000f07f'))").to have_result 'Point (0 Inf)'
+    expect("SELECT AsText(GeomFromWKB(x'0101000000000000000000f0ff0000000000000080'))").to have_result 'Point (-Inf 0)'
+    expect("SELECT AsText(GeomFromWKB(x'0101000000000000000000f0ff0000000000000080'), 2)").to have_result 'Point (-Inf 0)'
+  end
+
+  it 'should round coordinates to the requested precision' do
+    expect("SELECT AsText(GeomFromText('LineString(1.23456789 -9.87654321, 1.5 -0.0000001)'), 6)").to have_result 'LineString (1.234568 -9.876543, 1.5 0)'
+    expect("SELECT ST_AsText(GeomFromText('Point Z(1.23456789 2 3.99)'), 0)").to have_result 'Point Z (1 2 4)'
+    expect("SELECT AsText(GeomFromText('Point(1e20 0.5)'), 2)").to have_result 'Point (1e+20 0.5)'
+  end
+
+  it 'should round halves away from zero at any magnitude' do
+    expect("SELECT AsText(GeomFromText('Point(0.125 -2.5)'), 2)").to have_result 'Point (0.13 -2.5)'
+    expect("SELECT AsText(GeomFromText('Point(0.125 -2.5)'), 0)").to have_result 'Point (0 -3)'
+    expect("SELECT AsText(GeomFromText('Point(1000000000000000.125 -1000000000000000.375)'), 2)").to have_result 'Point (1000000000000000.13 -1000000000000000.38)'
+    expect("SELECT AsText(GeomFromText('Point(0.1 -0.5)'), 17)").to have_result 'Point (0.10000000000000001 -0.5)'
+  end
+
+  it 'should raise an error on an invalid precision' do
+    expect("SELECT AsText(GeomFromText('Point(1 2)'), -1)").to raise_sql_error
+    expect("SELECT AsText(GeomFromText('Point(1 2)'), 'abc')").to raise_sql_error
+  end
 end
 
 describe 'AsBinary' do
@@ -288,6 +326,7 @@ end
 
 describe 'GeomFromText' do
   AS_GEOM = 'SELECT lower(hex(GeomFromText(?, -1)))'
+  MIN_X = 'SELECT ST_MinX(GeomFromText(?))'
 
   it 'should parse XY points correctly' do
     expect(query(AS_GEOM, 'Point(1 2)')).
@@ -439,6 +478,55 @@ describe 'GeomFromText' do
                    '0001ffffffff000000000000f87f000000000000f87f000000000000f87f000000000000f87f7c0600000000000000fe'
            )
   end
+
+  it 'should parse decimal numbers' do
+    expect(query(MIN_X, 'Point(0.1 0)')).to have_result 0.1
+    expect(query(MIN_X, 'Point(-123.456789 0)')).to have_result -123.456789
+    expect(query(MIN_X, 'Point(+1.5e2 0)')).to have_result 150.0
+    expect(query(MIN_X, 'Point(25E-3 0)')).to have_result 0.025
+    expect(query(MIN_X, 'Point(000.000 0)')).to have_result 0.0
+  end
+
+  it 'should parse numbers that need more than double precision to round correctly' do
+    expect(query(MIN_X, 'Point(0.12345678901234567890123 0)')).to have_result 0.12345678901234568
+    expect(query(MIN_X, 'Point(9007199254740993 0)')).to have_result 9007199254740992.0
+    expect(query(MIN_X, 'Point(1.7976931348623157e308 0)')).to have_result 1.7976931348623157e308
+    expect(query(MIN_X, 'Point(4.9e-324 0)')).to have_result 5.0e-324
+  end
+
+  it 'should raise an error on malformed numbers' do
+    expect(query(MIN_X, 'Point(1e 0)')).to raise_sql_error
+    expect(query(MIN_X, 'Point(1.5.5 0)')).to raise_sql_error
+    expect(query(MIN_X, 'Point(- 0)')).to raise_sql_error
+  end
+end
+
+describe 'GeomFromTextColumn' do
+  before(:each) do
+    @db.execute('CREATE TABLE wkt (id INTEGER PRIMARY KEY, geom TEXT)')
+  end
+
+  it 'should parse WKT stored in a column' do
+    @db.execute("INSERT INTO wkt VALUES (1, 'LineString(1 2, 3 4)')")
+    expect("SELECT AsText(GeomFromTextColumn('wkt', 'geom', 1))").to have_result 'LineString (1 2, 3 4)'
+    expect("SELECT AsText(GPKG_GeomFromTextColumn('main', 'wkt', 'geom', 1))").to have_result 'LineString (1 2, 3 4)'
+  end
+
+  it 'should parse WKT that spans multiple reads' do
+    coords = (0...20000).map { |i| "#{i}.25    #{-i}.5" }
+    @db.execute('INSERT INTO wkt VALUES (1, ?)', "LineString(#{coords.join(',   ')})")
+    expect("SELECT hex(GeomFromTextColumn('wkt', 'geom', 1)) = hex(GeomFromText(geom)) FROM wkt").to have_result 1
+    expect("SELECT ST_MaxX(GeomFromTextColumn('wkt', 'geom', 1))").to have_result 19999.25
+  end
+
+  it 'should raise an error on malformed WKT' do
+    @db.execute("INSERT INTO wkt VALUES (1, 'LineString(1 2, 3')")
+    expect("SELECT GeomFromTextColumn('wkt', 'geom', 1)").to raise_sql_error
+  end
+
+  it 'should raise an error on missing rows' do
+    expect("SELECT GeomFromTextColumn('wkt', 'geom', 1)").to raise_sql_error
+  end
 end
 
 describe 'GeomFromWKB' do
@@ -569,4 +657,22 @@ describe 'GeomFromWKB' do
                    '0001ffffffff000000000000f87f000000000000f87f000000000000f87f000000000000f87f7c0600000000000000fe'
            )
   end
-end
\ No newline at end of file
+
+  it 'should read line strings that span several coordinate batches' do
+    points = (0...150).map { |i| "#{i} #{i + 1}" }.join(', ')
+    expect(query(AS_TEXT, "LineString(#{points})")).to have_result "LineString (#{points})"
+  end
+
+  it 'should read circular strings that span several coordinate batches' do
+    points = (0...151).map { |i| "#{i} #{i + 1}" }.join(', ')
+    expect(query(AS_TEXT, "CircularString(#{points})")).to have_result "CircularString (#{points})"
+  end
+
+  it 'should reject point counts that exceed the blob' do
+    expect("SELECT AsText(GeomFromWKB(x'01ba0b0000010000400000000000000000000000000000f03f00000000000000400000000000000840'))").to raise_sql_error
+  end
+
+  it 'should parse big endian line strings correctly' do
+    expect("SELECT AsText(GeomFromWKB(x'0000000002000000033ff000000000000040000000000000004008000000000000401000000000000040140000000000004018000000000000'))").to have_result 'LineString (1 2, 3 4, 5 6)'
+  end
+end